@@ -10,6 +10,7 @@
 
 - (void)onChatRoomUpdate:(MEGAChatSdk *)api chat:(MEGAChatRoom *)chat;
 - (void)onMessageLoaded:(MEGAChatSdk *)api message:(MEGAChatMessage *)message;
+- (void)onMessagesLoaded:(MEGAChatSdk *)api messages:(NSArray<MEGAChatMessage *> *)messages;
 - (void)onMessageReceived:(MEGAChatSdk *)api message:(MEGAChatMessage *)message;
 - (void)onMessageUpdate:(MEGAChatSdk *)api message:(MEGAChatMessage *)message;
 - (void)onHistoryReloaded:(MEGAChatSdk *)api chat:(MEGAChatRoom *)chat;
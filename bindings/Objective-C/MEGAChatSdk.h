@@ -254,6 +254,9 @@ typedef NS_ENUM (NSInteger, MEGAChatConnection) {
 - (MEGAChatSource)loadMessagesForChat:(uint64_t)chatId count:(NSInteger)count;
 - (BOOL)isFullHistoryLoadedForChat:(uint64_t)chatId;
 
+- (void)enableBatchedMessageLoading:(BOOL)enable;
+- (BOOL)isBatchedMessageLoadingEnabled;
+
 - (MEGAChatMessage *)messageForChat:(uint64_t)chatId messageId:(uint64_t)messageId;
 - (MEGAChatMessage *)messageFromNodeHistoryForChat:(uint64_t)chatId messageId:(uint64_t)messageId;
 - (MEGAChatMessage *)sendMessageToChat:(uint64_t)chatId message:(NSString *)message;
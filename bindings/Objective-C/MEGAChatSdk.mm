@@ -807,6 +807,14 @@ static DelegateMEGAChatLoggerListener *externalLogger = NULL;
     return self.megaChatApi->isFullHistoryLoaded(chatId);
 }
 
+- (void)enableBatchedMessageLoading:(BOOL)enable {
+    self.megaChatApi->enableBatchedMessageLoading(enable);
+}
+
+- (BOOL)isBatchedMessageLoadingEnabled {
+    return self.megaChatApi->isBatchedMessageLoadingEnabled();
+}
+
 - (MEGAChatMessage *)messageForChat:(uint64_t)chatId messageId:(uint64_t)messageId {
     return self.megaChatApi->getMessage(chatId, messageId) ? [[MEGAChatMessage alloc] initWithMegaChatMessage:self.megaChatApi->getMessage(chatId, messageId) cMemoryOwn:YES] : nil;
 }
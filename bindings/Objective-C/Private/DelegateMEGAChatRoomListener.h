@@ -11,6 +11,7 @@ public:
     
     void onChatRoomUpdate(megachat::MegaChatApi *api, megachat::MegaChatRoom *chat);
     void onMessageLoaded(megachat::MegaChatApi *api, megachat::MegaChatMessage *message);
+    void onMessagesLoaded(megachat::MegaChatApi *api, megachat::MegaChatMessageList *messages);
     void onMessageReceived(megachat::MegaChatApi *api, megachat::MegaChatMessage *message);
     void onMessageUpdate(megachat::MegaChatApi *api, megachat::MegaChatMessage *message);
     void onHistoryReloaded(megachat::MegaChatApi *api, megachat::MegaChatRoom *chat);
@@ -37,6 +37,34 @@ void DelegateMEGAChatRoomListener::onMessageLoaded(megachat::MegaChatApi *api, m
     }
 }
 
+void DelegateMEGAChatRoomListener::onMessagesLoaded(megachat::MegaChatApi *api, megachat::MegaChatMessageList *messages) {
+    if (listener != nil && [listener respondsToSelector:@selector(onMessagesLoaded:messages:)]) {
+        NSMutableArray<MEGAChatMessage *> *tempMessages = [NSMutableArray arrayWithCapacity:messages->size()];
+        for (unsigned int i = 0; i < messages->size(); i++) {
+            [tempMessages addObject:[[MEGAChatMessage alloc] initWithMegaChatMessage:messages->get(i)->copy() cMemoryOwn:YES]];
+        }
+        MEGAChatSdk *tempMegaChatSDK = this->megaChatSDK;
+        id<MEGAChatRoomDelegate> tempListener = this->listener;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [tempListener onMessagesLoaded:tempMegaChatSDK messages:tempMessages];
+        });
+    } else if (listener != nil && [listener respondsToSelector:@selector(onMessageLoaded:message:)]) {
+        // delegates without onMessagesLoaded get the page one message at a time, as without batching
+        NSMutableArray<MEGAChatMessage *> *tempMessages = [NSMutableArray arrayWithCapacity:messages->size()];
+        for (unsigned int i = 0; i < messages->size(); i++) {
+            [tempMessages addObject:[[MEGAChatMessage alloc] initWithMegaChatMessage:messages->get(i)->copy() cMemoryOwn:YES]];
+        }
+        MEGAChatSdk *tempMegaChatSDK = this->megaChatSDK;
+        id<MEGAChatRoomDelegate> tempListener = this->listener;
+        dispatch_async(dispatch_get_main_queue(), ^{
+            for (MEGAChatMessage *message in tempMessages) {
+                [tempListener onMessageLoaded:tempMegaChatSDK message:message];
+            }
+            [tempListener onMessageLoaded:tempMegaChatSDK message:nil];
+        });
+    }
+}
+
 void DelegateMEGAChatRoomListener::onMessageReceived(megachat::MegaChatApi *api, megachat::MegaChatMessage *message) {
     if (listener != nil && [listener respondsToSelector:@selector(onMessageReceived:message:)]) {
         MegaChatMessage *tempMessage = message->copy();
@@ -15,6 +15,8 @@
  */
 package nz.mega.sdk;
 
+import java.util.ArrayList;
+
 class DelegateMegaChatRoomListener extends MegaChatRoomListener {
 
     MegaChatApiJava megaChatApi;
@@ -75,6 +77,23 @@ class DelegateMegaChatRoomListener extends MegaChatRoomListener {
         }
     }
 
+    @Override
+    public void onMessagesLoaded(MegaChatApi api, MegaChatMessageList msgs){
+        if (listener != null) {
+            final ArrayList<MegaChatMessage> megaChatMessages = new ArrayList<MegaChatMessage>((int) msgs.size());
+            for (int i = 0; i < msgs.size(); i++) {
+                megaChatMessages.add(msgs.get(i).copy());
+            }
+            megaChatApi.runCallback(new Runnable() {
+                public void run() {
+                    if (listener != null) {
+                        listener.onMessagesLoaded(megaChatApi, megaChatMessages);
+                    }
+                }
+            });
+        }
+    }
+
     @Override
     public void onMessageReceived(MegaChatApi api, MegaChatMessage msg){
         if (listener != null) {
@@ -2044,6 +2044,30 @@ public class MegaChatApiJava {
         return megaChatApi.isFullHistoryLoaded(chatid);
     }
 
+    /**
+     * Enables or disables the batched delivery of loaded messages
+     *
+     * When enabled, each page of messages loaded by MegaChatApiJava::loadMessages is
+     * delivered to the listener in a single callback in the UI thread, instead of
+     * posting one callback per message. The page is received by
+     * MegaChatRoomListenerInterface::onMessagesLoaded, instead of one
+     * MegaChatRoomListenerInterface::onMessageLoaded per message followed by a null message.
+     *
+     * @param enable True to enable batched delivery, false to disable it
+     */
+    public void enableBatchedMessageLoading(boolean enable) {
+        megaChatApi.enableBatchedMessageLoading(enable);
+    }
+
+    /**
+     * Returns whether the batched delivery of loaded messages is enabled
+     *
+     * @return True if batched delivery is enabled
+     */
+    public boolean isBatchedMessageLoadingEnabled() {
+        return megaChatApi.isBatchedMessageLoadingEnabled();
+    }
+
     /**
      * Returns the MegaChatMessage specified from the chat room.
      *
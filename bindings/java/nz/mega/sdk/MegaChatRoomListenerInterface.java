@@ -15,10 +15,24 @@
  */
 package nz.mega.sdk;
 
+import java.util.ArrayList;
 
 public interface MegaChatRoomListenerInterface {
     public void onChatRoomUpdate(MegaChatApiJava api, MegaChatRoom chat);
     public void onMessageLoaded(MegaChatApiJava api, MegaChatMessage msg);
+
+    /**
+     * Called instead of onMessageLoaded when batched message loading is enabled.
+     * By default, it calls onMessageLoaded for each message, followed by a call with
+     * a null message, so existing listeners keep working without changes.
+     */
+    default void onMessagesLoaded(MegaChatApiJava api, ArrayList<MegaChatMessage> msgs) {
+        for (MegaChatMessage msg : msgs) {
+            onMessageLoaded(api, msg);
+        }
+        onMessageLoaded(api, null);
+    }
+
     public void onMessageReceived(MegaChatApiJava api, MegaChatMessage msg);
     public void onMessageUpdate(MegaChatApiJava api, MegaChatMessage msg);
     public void onHistoryReloaded(MegaChatApiJava api, MegaChatRoom chat);
@@ -100,6 +100,7 @@ HEADERS  += asyncTest-framework.h \
             url.h \
             base64url.h \
             chatdDb.h \
+            chatdTrace.h \
             IGui.h \
             megachatapi_impl.h \
             sdkApi.h \
@@ -125,8 +126,13 @@ HEADERS  += asyncTest-framework.h \
             base/services.h \
             base/timers.hpp \
             base/trackDelete.h \
+            base/flatHashMap.h \
+            base/lruCache.h \
+            base/workScheduler.h \
             net/libwebsocketsIO.h \
             net/websocketsIO.h \
+            rtcModule/audioLevel.h \
+            rtcModule/frameConverter.h \
             rtcModule/IDeviceListImpl.h \
             rtcModule/IRtcCrypto.h \
             rtcModule/IRtcStats.h \
@@ -136,6 +142,7 @@ HEADERS  += asyncTest-framework.h \
             rtcModule/messages.h \
             rtcModule/rtcmPrivate.h \
             rtcModule/rtcStats.h \
+            rtcModule/sampleSeries.h \
             rtcModule/streamPlayer.h \
             rtcModule/webrtc.h \
             rtcModule/webrtcAdapter.h \
@@ -8,6 +8,8 @@
 
 #include <vector>
 #include <string>
+#include <chrono>
+#include <stdio.h>
 
 namespace test
 {
@@ -384,6 +386,23 @@ inline Test& Test::disable()
     return *this;
 }
 
+/** Micro-benchmark to run along the tests: calls \c func(count), which is expected
+ * to do \c count iterations, and prints the time it took.
+ * @return The elapsed time, in microseconds */
+template <class F>
+long long benchmark(const char* name, int count, F&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func(count);
+    long long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    if (!elapsed)
+        elapsed = 1;
+    printf("    %s: %d iterations in %lld us (%.0f/s)\n", name, count,
+        elapsed, count * 1000000.0 / elapsed);
+    return elapsed;
+}
+
 } //end namespace
 
 #define TEST_DO_TOKENPASTE(a, b) a##b
@@ -0,0 +1,152 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include <flatHashMap.h>
+#include <map>
+#include <random>
+
+TESTS_INIT();
+using namespace karere;
+
+std::vector<uint64_t> randomIds(size_t count)
+{
+    std::mt19937_64 rng(12345);
+    std::vector<uint64_t> ids(count);
+    for (auto& id: ids)
+        id = rng();
+    return ids;
+}
+
+//Same sequence of operations that chatd::Chat does on mIdToIndexMap when
+//loading history: duplicate check, then insert at the next index
+template <class M>
+size_t loadHistory(M& map, const std::vector<uint64_t>& ids)
+{
+    int32_t idx = 0;
+    size_t dups = 0;
+    for (auto id: ids)
+    {
+        if (map.find(id) != map.end())
+        {
+            dups++;
+            continue;
+        }
+        map[id] = idx++;
+    }
+    return dups;
+}
+
+//Same lookups that chatd::Chat does for a burst of SEEN/RECEIVED commands
+template <class M>
+int64_t seenStorm(M& map, const std::vector<uint64_t>& ids, int count)
+{
+    int64_t sum = 0;
+    for (int i = 0; i < count; i++)
+    {
+        auto it = map.find(ids[(static_cast<size_t>(i) * 7919) % ids.size()]);
+        if (it != map.end())
+            sum += it->second;
+    }
+    return sum;
+}
+
+int main()
+{
+
+TestGroup("FlatHashMap")
+{
+    syncTest("Basic insert, find and erase")
+    {
+        FlatHashMap<uint64_t, int32_t> map;
+        check(map.find(1) == map.end());
+        check(map.emplace(1, 10).second);
+        check(!map.emplace(1, 20).second);
+        check(map.find(1)->second == 10);
+        map[0] = 5; //zero is a valid key
+        check(map.size() == 2 && map[0] == 5);
+        check(map.erase(1) == 1);
+        check(map.erase(1) == 0);
+        check(map.find(1) == map.end());
+        check(map.size() == 1);
+        map.clear();
+        check(map.empty() && map.find(0) == map.end());
+    });
+    syncTest("Matches std::map under random inserts and erases")
+    {
+        FlatHashMap<uint64_t, int32_t> map;
+        std::map<uint64_t, int32_t> ref;
+        std::mt19937 rng(42);
+        for (int i = 0; i < 200000; i++)
+        {
+            //small key range so that there are many collisions and erases
+            uint64_t key = (rng() % 5000) << 12;
+            if (rng() % 3)
+            {
+                map[key] = i;
+                ref[key] = i;
+            }
+            else
+            {
+                check(map.erase(key) == ref.erase(key));
+            }
+        }
+        check(map.size() == ref.size());
+        for (auto& item: ref)
+        {
+            auto it = map.find(item.first);
+            check(it != map.end() && it->second == item.second);
+        }
+        size_t count = 0;
+        for (auto it = map.begin(); it != map.end(); ++it)
+        {
+            check(ref.find(it->first) != ref.end());
+            count++;
+        }
+        check(count == ref.size());
+    });
+});
+
+TestGroup("Performance")
+{
+    syncTest("Load of a 100k-message history")
+    {
+        auto ids = randomIds(100000);
+        size_t dups = 0;
+        test::benchmark("std::map", 100000, [&](int)
+        {
+            std::map<uint64_t, int32_t> map;
+            dups += loadHistory(map, ids);
+            dups += loadHistory(map, ids);
+        });
+        test::benchmark("FlatHashMap", 100000, [&](int)
+        {
+            FlatHashMap<uint64_t, int32_t> map;
+            dups += loadHistory(map, ids);
+            dups += loadHistory(map, ids);
+        });
+        check(dups == 2 * ids.size());
+    });
+    syncTest("SEEN storm over a 100k-message history")
+    {
+        auto ids = randomIds(100000);
+        std::map<uint64_t, int32_t> treeMap;
+        FlatHashMap<uint64_t, int32_t> flatMap;
+        loadHistory(treeMap, ids);
+        loadHistory(flatMap, ids);
+        int64_t treeSum = 0;
+        int64_t flatSum = 0;
+        test::benchmark("std::map", 2000000, [&](int count)
+        {
+            treeSum = seenStorm(treeMap, ids, count);
+        });
+        test::benchmark("FlatHashMap", 2000000, [&](int count)
+        {
+            flatSum = seenStorm(flatMap, ids, count);
+        });
+        check(treeSum == flatSum);
+    });
+});
+
+return test::gNumFailed;
+}
@@ -0,0 +1,190 @@
+#ifndef FLATHASHMAP_H
+#define FLATHASHMAP_H
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <utility>
+#include <vector>
+
+namespace karere
+{
+/** @brief Open-addressing hash map for 64-bit integer keys (handles, ids).
+ *
+ * Entries live in a single contiguous array and collisions are resolved with
+ * linear probing, so a lookup usually touches one or two adjacent cache lines
+ * instead of walking a tree of separately allocated nodes. Erasing uses
+ * backward-shift deletion, so no tombstones accumulate.
+ *
+ * The interface is the subset of std::map used for id-to-index lookups:
+ * find(), end(), emplace(), operator[], erase(), clear(), size(). Iteration
+ * order is unspecified, and any insertion or erase invalidates iterators.
+ * \c K must be convertible to uint64_t, and both \c K and \c V should be cheap
+ * to copy.
+ */
+template <class K, class V>
+class FlatHashMap
+{
+public:
+    struct Entry
+    {
+        K first;
+        V second;
+    protected:
+        bool mUsed = false;
+        friend class FlatHashMap;
+    };
+
+    class iterator
+    {
+    protected:
+        Entry* mPos;
+        Entry* mEnd;
+        void skipUnused() { while (mPos != mEnd && !mPos->mUsed) mPos++; }
+        iterator(Entry* pos, Entry* end): mPos(pos), mEnd(end) {}
+        friend class FlatHashMap;
+    public:
+        Entry& operator*() const { return *mPos; }
+        Entry* operator->() const { return mPos; }
+        iterator& operator++() { mPos++; skipUnused(); return *this; }
+        bool operator==(const iterator& other) const { return mPos == other.mPos; }
+        bool operator!=(const iterator& other) const { return mPos != other.mPos; }
+    };
+
+    FlatHashMap() {}
+    size_t size() const { return mCount; }
+    bool empty() const { return mCount == 0; }
+    iterator begin()
+    {
+        iterator it(mEntries.data(), endPtr());
+        it.skipUnused();
+        return it;
+    }
+    iterator end() { return iterator(endPtr(), endPtr()); }
+
+    iterator find(const K& key)
+    {
+        if (!mCount)
+            return end();
+
+        for (size_t pos = slotOf(key);; pos = (pos + 1) & mMask)
+        {
+            Entry& entry = mEntries[pos];
+            if (!entry.mUsed)
+                return end();
+            if (entry.first == key)
+                return iterator(&entry, endPtr());
+        }
+    }
+
+    /** @brief Inserts \c key with \c value if the key is not present. Returns
+     * an iterator to the entry for \c key and whether it was inserted, as
+     * std::map::emplace() does */
+    std::pair<iterator, bool> emplace(const K& key, const V& value)
+    {
+        reserve(mCount + 1);
+        Entry& entry = mEntries[probe(key)];
+        if (entry.mUsed)
+            return std::make_pair(iterator(&entry, endPtr()), false);
+
+        entry.first = key;
+        entry.second = value;
+        entry.mUsed = true;
+        mCount++;
+        return std::make_pair(iterator(&entry, endPtr()), true);
+    }
+
+    V& operator[](const K& key)
+    {
+        return emplace(key, V()).first->second;
+    }
+
+    size_t erase(const K& key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            return 0;
+
+        erase(it);
+        return 1;
+    }
+
+    void erase(iterator it)
+    {
+        assert(it.mPos != endPtr() && it.mPos->mUsed);
+        size_t hole = it.mPos - mEntries.data();
+        // shift back the following entries of the probe sequence, so that
+        // lookups never stop early at the freed slot
+        for (size_t pos = (hole + 1) & mMask; mEntries[pos].mUsed; pos = (pos + 1) & mMask)
+        {
+            size_t home = slotOf(mEntries[pos].first);
+            if (((pos - home) & mMask) >= ((pos - hole) & mMask))
+            {
+                mEntries[hole] = mEntries[pos];
+                hole = pos;
+            }
+        }
+        mEntries[hole].mUsed = false;
+        mCount--;
+    }
+
+    void clear()
+    {
+        mEntries.clear();
+        mMask = 0;
+        mCount = 0;
+    }
+
+    /** @brief Makes room for \c count entries without rehashing */
+    void reserve(size_t count)
+    {
+        // keep load factor at or below 7/8
+        if (count * 8 <= mEntries.size() * 7)
+            return;
+
+        size_t capacity = mEntries.empty() ? static_cast<size_t>(kMinCapacity) : mEntries.size();
+        while (count * 8 > capacity * 7)
+            capacity *= 2;
+        rehash(capacity);
+    }
+
+protected:
+    enum { kMinCapacity = 16 };
+    std::vector<Entry> mEntries;
+    size_t mMask = 0;
+    size_t mCount = 0;
+
+    Entry* endPtr() { return mEntries.data() + mEntries.size(); }
+
+    // The finalizer of splitmix64. Message ids are random, but other handles
+    // may have patterns in their low bits
+    static uint64_t hash(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+    size_t slotOf(const K& key) const { return static_cast<size_t>(hash(static_cast<uint64_t>(key))) & mMask; }
+
+    // Returns the slot holding \c key, or the empty slot where it should be inserted
+    size_t probe(const K& key) const
+    {
+        size_t pos = slotOf(key);
+        while (mEntries[pos].mUsed && !(mEntries[pos].first == key))
+            pos = (pos + 1) & mMask;
+        return pos;
+    }
+
+    void rehash(size_t capacity)
+    {
+        std::vector<Entry> old(capacity);
+        old.swap(mEntries);
+        mMask = capacity - 1;
+        for (auto& entry: old)
+        {
+            if (entry.mUsed)
+                mEntries[probe(entry.first)] = entry;
+        }
+    }
+};
+}
+#endif
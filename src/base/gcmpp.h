@@ -6,11 +6,32 @@
 #include "karereCommon.h"
 #include "gcm.h"
 #include "logger.h"
+#include "workScheduler.h"
 #include <memory>
 #include <assert.h>
 
 namespace karere
 {
+/** @brief While in scope, the messages posted by marshallCall() that the current thread
+ * processes are freed without calling their function. It allows to release the messages
+ * posted to a context that doesn't exist anymore
+ */
+class DiscardScope
+{
+public:
+    DiscardScope(): mPrev(discarding()) { discarding() = true; }
+    ~DiscardScope() { discarding() = mPrev; }
+    static bool isActive() { return discarding(); }
+
+protected:
+    bool mPrev;
+    static bool& discarding()
+    {
+        static thread_local bool discard = false;
+        return discard;
+    }
+};
+
 /** This function uses the plain C Gui Call Marshaller mechanism (see gcm.h) to
  * marshal a C++11 lambda function call on the main (GUI) thread. Also it could
  * be used with a std::function or any other object with operator()). It provides
@@ -48,6 +69,10 @@ static inline void marshallCall(F&& func, void *appCtx)
     {
         AutoDel pMsg(static_cast<Msg*>(ptr));
         assert(pMsg->magic == 0x3e9a3591);
+        if (DiscardScope::isActive())
+        {
+            return;
+        }
         if (!gCatchException)
         {
             pMsg->mFunc();
@@ -67,5 +92,16 @@ static inline void marshallCall(F&& func, void *appCtx)
     megaPostMessageToGui(static_cast<void*>(msg), appCtx);
 }
 
+/** Same as above, but the call is scheduled with the specified class and key,
+ * instead of the ones of the current thread (see karere::WorkScheduler). Message
+ * loops that don't schedule the calls by class simply process them in order
+ */
+template <class F>
+static inline void marshallCall(F&& func, void *appCtx, WorkClass cls, uint64_t key = 0)
+{
+    WorkScope scope(cls, key);
+    marshallCall(std::forward<F>(func), appCtx);
+}
+
 }
 #endif
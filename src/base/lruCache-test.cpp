@@ -0,0 +1,61 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include <lruCache.h>
+#include <string>
+
+TESTS_INIT();
+using namespace karere;
+
+int main()
+{
+
+TestGroup("LruCache")
+{
+    syncTest("Find, put and erase")
+    {
+        LruCache<std::string, int> cache(4);
+        check(cache.empty() && cache.capacity() == 4);
+        check(!cache.find("a"));
+        cache.put("a", 1);
+        cache.put("b", 2);
+        check(cache.find("a") && *cache.find("a") == 1);
+        cache.put("a", 3); //replaces
+        check(cache.size() == 2 && *cache.find("a") == 3);
+        check(cache.erase("a"));
+        check(!cache.erase("a"));
+        check(!cache.find("a") && cache.size() == 1);
+        cache.clear();
+        check(cache.empty() && !cache.find("b"));
+    });
+    syncTest("Evicts the least recently used entry")
+    {
+        LruCache<int, int> cache(3);
+        cache.put(1, 10);
+        cache.put(2, 20);
+        cache.put(3, 30);
+        check(cache.find(1)); //1 is now the most recently used
+        cache.put(4, 40); //evicts 2
+        check(cache.size() == 3);
+        check(!cache.find(2));
+        check(cache.find(1) && cache.find(3) && cache.find(4));
+        cache.put(3, 31); //3 is now the most recently used
+        cache.put(5, 50); //evicts 1
+        check(!cache.find(1) && *cache.find(3) == 31);
+    });
+    syncTest("Stays bounded under a long stream of keys")
+    {
+        LruCache<int, int> cache(100);
+        for (int i = 0; i < 100000; i++)
+        {
+            cache.put(i, i);
+            check(cache.size() <= 100);
+        }
+        check(cache.size() == 100);
+        check(cache.find(99999) && !cache.find(99899));
+    });
+});
+
+return test::gNumFailed;
+}
@@ -0,0 +1,84 @@
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+#include <stddef.h>
+#include <assert.h>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace karere
+{
+/** @brief Fixed-capacity map that evicts the least recently used entry.
+ *
+ * Entries are kept in a list ordered by last use, and indexed by a hash map,
+ * so lookups, insertions and evictions are O(1). Both find() and put() mark
+ * the entry as the most recently used one.
+ */
+template <class K, class V, class Hash = std::hash<K>>
+class LruCache
+{
+public:
+    typedef std::pair<K, V> Entry;
+
+    explicit LruCache(size_t capacity): mCapacity(capacity) { assert(capacity); }
+    size_t size() const { return mEntries.size(); }
+    size_t capacity() const { return mCapacity; }
+    bool empty() const { return mEntries.empty(); }
+
+    /** @brief Returns a pointer to the value for \c key, or nullptr if it is not
+     * in the cache. The pointer is valid until the entry is evicted or erased */
+    V* find(const K& key)
+    {
+        auto it = mIndex.find(key);
+        if (it == mIndex.end())
+            return nullptr;
+
+        mEntries.splice(mEntries.begin(), mEntries, it->second);
+        return &it->second->second;
+    }
+
+    /** @brief Inserts or replaces the value for \c key, evicting the least
+     * recently used entry if the cache is full */
+    void put(const K& key, V value)
+    {
+        auto it = mIndex.find(key);
+        if (it != mIndex.end())
+        {
+            it->second->second = std::move(value);
+            mEntries.splice(mEntries.begin(), mEntries, it->second);
+            return;
+        }
+
+        if (mEntries.size() >= mCapacity)
+        {
+            mIndex.erase(mEntries.back().first);
+            mEntries.pop_back();
+        }
+        mEntries.emplace_front(key, std::move(value));
+        mIndex.emplace(key, mEntries.begin());
+    }
+
+    bool erase(const K& key)
+    {
+        auto it = mIndex.find(key);
+        if (it == mIndex.end())
+            return false;
+
+        mEntries.erase(it->second);
+        mIndex.erase(it);
+        return true;
+    }
+
+    void clear()
+    {
+        mIndex.clear();
+        mEntries.clear();
+    }
+
+protected:
+    size_t mCapacity;
+    std::list<Entry> mEntries;  // most recently used first
+    std::unordered_map<K, typename std::list<Entry>::iterator, Hash> mIndex;
+};
+}
+#endif
@@ -630,5 +630,60 @@ TestGroup("Unhandled promise fail")
     });
 });
 
+TestGroup("Performance")
+{
+    syncTest("Chained then() throughput, resolved after chaining")
+    {
+        int sum = 0;
+        test::benchmark("pending chain of 4", 100000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                Promise<int> pms;
+                pms.then([](int a) { return a+1; })
+                .then([](int a) { return Promise<int>(a+1); })
+                .fail([](const Error&) { return 0; })
+                .then([&sum](int a) { sum += a; });
+                pms.resolve(1);
+            }
+        });
+        check(sum == 300000);
+    });
+    syncTest("Chained then() throughput, already resolved")
+    {
+        int sum = 0;
+        test::benchmark("resolved chain of 3", 100000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                Promise<int> pms(1);
+                pms.then([](int a) { return a+1; })
+                .then([&sum](int a) { sum += a; });
+            }
+        });
+        check(sum == 200000);
+    });
+    syncTest("when() throughput, msgDecrypt-like pattern")
+    {
+        int numDone = 0;
+        test::benchmark("when(2)+then", 100000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                Promise<std::string> symPms;
+                Promise<int> edPms;
+                when(symPms, edPms)
+                .then([&numDone]()
+                {
+                    numDone++;
+                });
+                symPms.resolve("key");
+                edPms.resolve(1);
+            }
+        });
+        check(numDone == 100000);
+    });
+});
+
 return test::gNumFailed;
 }
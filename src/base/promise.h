@@ -7,6 +7,7 @@
 #include <string>
 #include <utility>
 #include <memory>
+#include <new>
 #include <assert.h>
 
 /** @brief The name of the unhandled promise error handler. This handler is
@@ -38,6 +39,107 @@ enum ResolvedState
     #define PROMISE_LOG_REF(fmtString,...)
 #endif
 
+/** @brief Max number of free blocks that a thread keeps cached per size class.
+ * Define PROMISE_NO_POOL to allocate promise shared state and callbacks
+ * directly with the global operator new, i.e. to disable the freelist pools.
+ * Useful when hunting memory errors with ASAN/valgrind.
+ */
+#ifndef PROMISE_POOL_MAX_FREE
+    #define PROMISE_POOL_MAX_FREE 1024
+#endif
+
+/** @brief Per-thread freelist of fixed-size memory blocks.
+ * Promise shared state and callback wrappers are small, short-lived and have
+ * only a few distinct sizes, so instead of going to malloc for each of them
+ * we recycle released blocks of the same size class. Each block is a separate
+ * heap allocation, so a block may be freed by a thread different from the one
+ * that allocated it. A thread keeps at most PROMISE_POOL_MAX_FREE free blocks
+ * per size class, the rest are returned to the heap.
+ */
+template <size_t BlockSize>
+class FreeListPool
+{
+protected:
+    struct Node { Node* next; };
+    static_assert(BlockSize >= sizeof(Node), "Block size too small");
+    Node* mFree = nullptr;
+    size_t mFreeCount = 0;
+    ~FreeListPool()
+    {
+        while (mFree)
+        {
+            Node* next = mFree->next;
+            ::operator delete(mFree);
+            mFree = next;
+        }
+    }
+    static FreeListPool& instance()
+    {
+        static thread_local FreeListPool pool;
+        return pool;
+    }
+public:
+    static void* alloc()
+    {
+        auto& pool = instance();
+        Node* node = pool.mFree;
+        if (!node)
+            return ::operator new(BlockSize);
+        pool.mFree = node->next;
+        pool.mFreeCount--;
+        return node;
+    }
+    static void release(void* ptr)
+    {
+        if (!ptr)
+            return;
+        auto& pool = instance();
+        if (pool.mFreeCount >= PROMISE_POOL_MAX_FREE)
+        {
+            ::operator delete(ptr);
+            return;
+        }
+        Node* node = static_cast<Node*>(ptr);
+        node->next = pool.mFree;
+        pool.mFree = node;
+        pool.mFreeCount++;
+    }
+};
+
+/** @brief Mixin that routes the class' operator new/delete to the freelist pool
+ * of the corresponding size class (sizes are rounded up to 16 bytes). Objects
+ * larger than 256 bytes use the global heap. Works for polymorphic hierarchies
+ * as long as the base has a virtual destructor - operator delete is then
+ * resolved in the context of the most derived class.
+ */
+template <class T>
+struct Pooled
+{
+    //T is incomplete at the point Pooled<T> is instantiated, so its size
+    //can only be queried inside the member functions
+    template <class U=T>
+    static constexpr size_t sizeClass() { return (sizeof(U) + 15) & ~size_t(15); }
+    static void* operator new(size_t size)
+    {
+#ifndef PROMISE_NO_POOL
+        if (size == sizeof(T) && sizeClass() <= 256)
+            return FreeListPool<sizeClass()>::alloc();
+#endif
+        return ::operator new(size);
+    }
+    static void operator delete(void* ptr, size_t size)
+    {
+#ifndef PROMISE_NO_POOL
+        if (size == sizeof(T) && sizeClass() <= 256)
+        {
+            FreeListPool<sizeClass()>::release(ptr);
+            return;
+        }
+#endif
+        ::operator delete(ptr);
+    }
+};
+
 //===
 struct _Void{};
 typedef _Void Void;
@@ -142,11 +244,18 @@ public:
     virtual ~PromiseBase(){}
 };
 
+/** The first kInlineCount callbacks are stored inline - the vast majority of
+ * promises have one then() and/or one fail() attached, so we normally don't
+ * need a heap-allocated vector at all.
+ */
 template <class C>
 class CallbackList
 {
 protected:
-    std::vector<C*> items;
+    enum { kInlineCount = 2 };
+    C* mInline[kInlineCount];
+    int mCount = 0;
+    std::vector<C*> mOverflow;
 public:
     CallbackList(){}
 /**
@@ -158,45 +267,64 @@ public:
     template<class SP>
     inline void push(SP& cb)
     {
-        items.push_back(cb.release());
+        pushPtr(cb.get());
+        cb.release();
     }
 
     inline C*& operator[](int idx)
     {
-        assert((idx >= 0) && (idx < (int)items.size()));
-        return items[idx];
+        assert((idx >= 0) && (idx < mCount));
+        return (idx < kInlineCount) ? mInline[idx] : mOverflow[idx-kInlineCount];
     }
-    inline const C*& operator[](int idx) const
+    inline C* const& operator[](int idx) const
     {
-        assert((idx >= 0) && (idx < items.size()));
-        return items[idx];
+        assert((idx >= 0) && (idx < mCount));
+        return (idx < kInlineCount) ? mInline[idx] : mOverflow[idx-kInlineCount];
     }
     inline C*& first()
     {
-        assert(!items.empty());
-        return items[0];
+        assert(mCount > 0);
+        return mInline[0];
     }
     inline int count() const
     {
-        return items.size();
+        return mCount;
     }
     inline void addListMoveItems(CallbackList& other)
     {
-        items.insert(items.end(), other.items.begin(), other.items.end());
-        other.items.clear();
+        for (int i = 0; i < other.mCount; i++)
+        {
+            pushPtr(other[i]);
+        }
+        other.mOverflow.clear();
+        other.mCount = 0;
     }
     void clear()
     {
         static_assert(std::is_base_of<IVirtDtor, C>::value, "Callback type must be inherited from IVirtDtor");
-        for (auto it = items.begin(); it != items.end(); it++)
+        for (int i = 0; i < mCount; i++)
         {
-            delete ((IVirtDtor*)*it); //static_cast wont work here because there is no info that ICallback inherits from IVirtDtor
+            delete ((IVirtDtor*)(*this)[i]); //static_cast wont work here because there is no info that ICallback inherits from IVirtDtor
         }
-        items.clear();
+        mOverflow.clear();
+        mCount = 0;
     }
     ~CallbackList()
     {
-        assert(items.empty());
+        assert(mCount == 0);
+    }
+protected:
+    inline void pushPtr(C* cb)
+    {
+        if (mCount < kInlineCount)
+        {
+            mInline[mCount] = cb;
+        }
+        else
+        {
+            mOverflow.push_back(cb); //may throw, the item is not added then
+        }
+        mCount++;
     }
 };
 
@@ -225,7 +353,7 @@ protected:
     };
 
     template <class P, class CB, class TP=int>
-    struct Callback: public ICallbackWithPromise<P, TP>
+    struct Callback: public ICallbackWithPromise<P, TP>, public Pooled<Callback<P, CB, TP> >
     {
     protected:
         CB mCb;
@@ -261,9 +389,9 @@ protected:
         return new Callback<typename MaskVoid<P>::type, CB, TP>(std::forward<CB>(cb), next);
     }
 //===
-    struct SharedObj
+    struct SharedObj: public Pooled<SharedObj>
     {
-        struct CbLists
+        struct CbLists: public Pooled<CbLists>
         {
             CallbackList<ISuccessCb> mSuccessCbs;
             CallbackList<IFailCb> mFailCbs;
@@ -29,17 +29,27 @@
 namespace karere
 {
 
+struct TimerMsg;
+void addTimer(void *ctx, TimerMsg *timer);
+void removeTimer(void *ctx, TimerMsg *timer);
+
 struct TimerMsg: public megaMessage
 {
     timerevent* timerEvent = nullptr;
     bool canceled = false;
     megaHandle handle;
-    TimerMsg(megaMessageFunc aFunc)
+    void *appCtx;
+    void (*destroy)(TimerMsg *timer);  // deletes the object with its actual type
+    TimerMsg(megaMessageFunc aFunc, void *ctx, void (*aDestroy)(TimerMsg *))
         :megaMessage(aFunc),
-          handle(services_hstore_add_handle(MEGA_HTYPE_TIMER, this))
-    {}
+          handle(services_hstore_add_handle(MEGA_HTYPE_TIMER, this)),
+          appCtx(ctx), destroy(aDestroy)
+    {
+        addTimer(appCtx, this);
+    }
    ~TimerMsg()
     {
+        removeTimer(appCtx, this);
         services_hstore_remove_handle(MEGA_HTYPE_TIMER, handle);
         if (timerEvent)
         {            
@@ -53,6 +63,19 @@ struct TimerMsg: public megaMessage
 
 void init_uv_timer(void *ctx, uv_timer_t *timer);
 
+/** @brief Stops and frees the timers of an app context that is being deleted, including
+ * the ones that were never cancelled. Must be called from the thread of its loop. The
+ * timers are freed once they are closed, in the next iteration of the loop, so the messages
+ * they already posted to the context must be discarded before it (see DiscardScope)
+ */
+void closeTimers(void *ctx);
+
+/** @brief Sets the libuv loop that runs the timers of an app context which doesn't belong
+ * to a MegaChatApi instance, as the ones of the tools that drive a karere::Client directly.
+ * A null \c loop removes it
+ */
+void setTimersLoop(void *ctx, uv_loop_t *loop);
+
 extern std::recursive_mutex timerMutex;
 
 template <int persist, class CB>
@@ -61,9 +84,8 @@ inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
     struct Msg: public TimerMsg
     {
         CB cb;
-        void *appCtx;
-        Msg(CB&& aCb, megaMessageFunc cFunc)
-        :TimerMsg(cFunc), cb(aCb)
+        Msg(CB&& aCb, megaMessageFunc cFunc, void *ctx)
+        :TimerMsg(cFunc, ctx, [](TimerMsg *timer) { delete static_cast<Msg*>(timer); }), cb(aCb)
         {}
         unsigned time;
         int loop;
@@ -72,7 +94,7 @@ inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
         ? (megaMessageFunc) [](void* arg)
           {
               Msg* msg = static_cast<Msg*>(arg);
-              if (msg->canceled)
+              if (msg->canceled || DiscardScope::isActive())
                   return;
               msg->cb();
           }
@@ -80,7 +102,8 @@ inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
           {
               timerMutex.lock();
               Msg* msg = static_cast<Msg*>(arg);
-              if (msg->canceled)
+              // a discarded message is still owned by its uv timer, which is freed by closeTimers()
+              if (msg->canceled || DiscardScope::isActive())
               {
                   timerMutex.unlock();
                   return;
@@ -96,10 +119,9 @@ inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
           };
 
     timerMutex.lock();
-    Msg* pMsg = new Msg(std::forward<CB>(callback), cfunc);
+    Msg* pMsg = new Msg(std::forward<CB>(callback), cfunc, ctx);
     timerMutex.unlock();
 
-    pMsg->appCtx = ctx;
     pMsg->time = time;
     pMsg->loop = persist;  
     marshallCall([pMsg, ctx]()
@@ -112,7 +134,7 @@ inline megaHandle setTimer(CB&& callback, unsigned time, void *ctx)
                        {
                            megaPostMessageToGui(handle->data, ((Msg*)handle->data)->appCtx);
                        }, pMsg->time, pMsg->loop ? pMsg->time : 0);
-    }, ctx);    
+    }, ctx, kWorkForeground);
     return pMsg->handle;
 }
 /** Cancels a previously set timeout with setTimeout()
@@ -135,7 +157,8 @@ static inline bool cancelTimeout(megaHandle handle, void *ctx)
 //we have to make sure that we delete the timer only after all possibly queued
 //timer messages in the app's message queue are processed. For this purpose,
 //we first stop the timer, and only then post a call to delete the timer.
-//That call should be processed after all timer messages
+//That call should be processed after all timer messages, which are posted by libuv
+//without a class, so these calls must have the highest one to keep them in order
     timer->canceled = true; //disable timer callback being called by possibly queued messages, and message freeing in one-shot timer handler
     timerMutex.unlock();    
     marshallCall([timer, ctx]()
@@ -145,8 +168,8 @@ static inline bool cancelTimeout(megaHandle handle, void *ctx)
         marshallCall([timer, ctx]()
         {
             delete timer;
-        }, ctx);
-    }, ctx);
+        }, ctx, kWorkForeground);
+    }, ctx, kWorkForeground);
     return true;
 }
 /** @brief Cancels a previously set timer with setInterval.
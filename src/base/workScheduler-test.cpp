@@ -0,0 +1,127 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include <workScheduler.h>
+#include <thread>
+#include <vector>
+
+TESTS_INIT();
+using namespace karere;
+
+static void* item(intptr_t n) { return reinterpret_cast<void*>(n); }
+
+int main()
+{
+
+TestGroup("WorkScheduler")
+{
+    syncTest("Processes by priority, and in order within a class")
+    {
+        WorkScheduler scheduler;
+        scheduler.push(item(1), kWorkMaintenance, 0);
+        scheduler.push(item(2), kWorkBackground, 0);
+        scheduler.push(item(3), kWorkForeground, 0);
+        scheduler.push(item(4), kWorkCall, 0);
+        scheduler.push(item(5), kWorkForeground, 0);
+        check(scheduler.size() == 5);
+
+        std::vector<intptr_t> order;
+        check(scheduler.drain(0, [&order](void* it) { order.push_back(reinterpret_cast<intptr_t>(it)); }));
+        check((order == std::vector<intptr_t>{3, 5, 4, 2, 1}));
+        check(scheduler.empty());
+        check(scheduler.stats(kWorkForeground).count == 2 && scheduler.stats(kWorkMaintenance).count == 1);
+    });
+    syncTest("Items with the same key are processed in order")
+    {
+        WorkScheduler scheduler;
+        scheduler.push(item(1), kWorkBackground, 100);
+        scheduler.push(item(2), kWorkBackground, 200);
+        scheduler.push(item(3), kWorkForeground, 0);
+        scheduler.push(item(4), kWorkForeground, 100); //promotes 1
+        scheduler.push(item(5), kWorkMaintenance, 100); //queued along with 1 and 4
+        check(scheduler.stats(kWorkForeground).pending == 4);
+
+        std::vector<intptr_t> order;
+        scheduler.drain(0, [&order](void* it) { order.push_back(reinterpret_cast<intptr_t>(it)); });
+        check((order == std::vector<intptr_t>{1, 3, 4, 5, 2}));
+    });
+    syncTest("Posted work inherits the key, but not the class")
+    {
+        WorkScheduler scheduler(0); //the oldest item always goes first
+        scheduler.push(item(1), kWorkMaintenance, 100);
+        scheduler.push(item(2), kWorkMaintenance, 100);
+        scheduler.push(item(3), kWorkForeground, 0);
+        std::vector<intptr_t> order;
+        bool inherited = false;
+        scheduler.drain(0, [&scheduler, &order, &inherited](void* it)
+        {
+            intptr_t n = reinterpret_cast<intptr_t>(it);
+            order.push_back(n);
+            if (n == 1)
+            {
+                inherited = (WorkScope::currentClass() == kWorkForeground && WorkScope::currentKey() == 100);
+                scheduler.push(item(4)); //promotes 2, and goes after it
+            }
+        });
+        check(inherited);
+        check((order == std::vector<intptr_t>{1, 2, 3, 4}));
+        check(scheduler.stats(kWorkMaintenance).count == 1 && scheduler.stats(kWorkForeground).count == 3);
+        check(WorkScope::currentClass() == kWorkForeground && !WorkScope::currentKey());
+    });
+    syncTest("Work keyed with kWorkKeyAll goes after all the previous work")
+    {
+        WorkScheduler scheduler;
+        scheduler.push(item(1), kWorkMaintenance, 100);
+        scheduler.push(item(2), kWorkBackground, 0);
+        scheduler.push(item(3), kWorkForeground, 0);
+        scheduler.push(item(4), kWorkForeground, kWorkKeyAll);
+        scheduler.push(item(5), kWorkBackground, 200);
+        scheduler.push(item(6), kWorkMaintenance, 100); //queued along with 1
+        scheduler.push(item(7), kWorkForeground, 0);
+        check(scheduler.stats(kWorkForeground).pending == 6);
+
+        std::vector<intptr_t> order;
+        scheduler.drain(0, [&order](void* it) { order.push_back(reinterpret_cast<intptr_t>(it)); });
+        check((order == std::vector<intptr_t>{1, 2, 3, 4, 6, 7, 5}));
+    });
+    syncTest("Items of lower classes go first once they have waited for a second")
+    {
+        WorkScheduler scheduler;
+        std::vector<intptr_t> order;
+        auto process = [&order](void* it) { order.push_back(reinterpret_cast<intptr_t>(it)); };
+
+        scheduler.push(item(1), kWorkBackground, 0);
+        scheduler.push(item(2), kWorkForeground, 0);
+        scheduler.drain(0, process);
+        check((order == std::vector<intptr_t>{2, 1}));
+
+        order.clear();
+        scheduler.push(item(3), kWorkMaintenance, 0);
+        scheduler.push(item(4), kWorkBackground, 0);
+        std::this_thread::sleep_for(std::chrono::milliseconds(WorkScheduler::kDefaultMaxWaitMs + 50));
+        scheduler.push(item(5), kWorkForeground, 0);
+        scheduler.push(item(6), kWorkForeground, 0);
+        scheduler.drain(0, process);
+        check((order == std::vector<intptr_t>{3, 4, 5, 6}));
+        check(scheduler.stats(kWorkMaintenance).maxWaitUs >= WorkScheduler::kDefaultMaxWaitMs * 1000);
+        check(scheduler.stats(kWorkForeground).maxWaitUs < WorkScheduler::kDefaultMaxWaitMs * 1000);
+    });
+    syncTest("Draining stops at the end of the time slice")
+    {
+        WorkScheduler scheduler;
+        scheduler.push(item(1), kWorkForeground, 0);
+        scheduler.push(item(2), kWorkForeground, 0);
+        int count = 0;
+        check(!scheduler.drain(1, [&count](void*)
+        {
+            count++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }));
+        check(count == 1 && scheduler.size() == 1);
+        check(scheduler.statsToJson().find("\"fg\":{\"n\":1,") == 1);
+    });
+});
+
+return test::gNumFailed;
+}
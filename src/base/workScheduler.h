@@ -0,0 +1,295 @@
+#ifndef WORKSCHEDULER_H
+#define WORKSCHEDULER_H
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace karere
+{
+/** @brief Key of the work that depends on all the work posted before it */
+static const uint64_t kWorkKeyAll = UINT64_MAX;
+
+/** @brief Classes of the work posted to the event loop, in order of priority */
+enum WorkClass: uint8_t
+{
+    kWorkForeground = 0,    // chats opened by the app, and any work that is not classified
+    kWorkCall,              // calls
+    kWorkBackground,        // chats not opened by the app
+    kWorkMaintenance,       // retention history, deletion of the client...
+    kWorkNumClasses
+};
+
+/** @brief Sets the class of the work posted by the current thread, while in scope.
+ *
+ * The key identifies a sequence of work that must be processed in order (i.e. the
+ * chatid), or is zero if there is no such requirement. \c kWorkKeyAll marks work that
+ * must be processed after everything posted before it (i.e. it affects all the chats).
+ * The scheduler sets the key of every item while it is processed, so the work it posts
+ * keeps the order of the sequence, but the class is always reset to foreground: only
+ * the work posted with an explicit class is delayed. Threads that never set a scope
+ * post foreground work.
+ */
+class WorkScope
+{
+public:
+    WorkScope(WorkClass cls, uint64_t key = 0): mPrev(current())
+    {
+        current().cls = cls;
+        current().key = key;
+    }
+    ~WorkScope() { current() = mPrev; }
+    static WorkClass currentClass() { return current().cls; }
+    static uint64_t currentKey() { return current().key; }
+
+protected:
+    struct Context
+    {
+        WorkClass cls;
+        uint64_t key;
+    };
+    Context mPrev;
+    static Context& current()
+    {
+        static thread_local Context ctx = { kWorkForeground, 0 };
+        return ctx;
+    }
+};
+
+/** @brief Cooperative scheduler of the work posted to the event loop.
+ *
+ * Items are queued by class and processed in order of priority, a time slice at a
+ * time, so that a burst of background work can't delay the foreground for long.
+ * Within a class, items are processed in the order they were posted. To prevent
+ * starvation, the oldest item of all goes first once it has waited for \c maxWaitMs.
+ * Hence an item is never processed before an older one of the same or higher class.
+ *
+ * All the pending items with the same key are kept in the same class, so they are
+ * processed in order: posting an item of a higher class promotes the pending ones,
+ * and posting one of a lower class queues it along with them. Posting an item with
+ * \c kWorkKeyAll promotes all the pending items of lower classes, so it's processed
+ * after all of them. Items without key are not ordered with respect to the keyed ones
+ * of lower classes, so any work that depends on a keyed sequence must use its key.
+ *
+ * Items can be posted from any thread, but must be processed by a single one.
+ */
+class WorkScheduler
+{
+public:
+    enum { kDefaultMaxWaitMs = 1000 };
+
+    struct Stats
+    {
+        uint64_t count = 0;         // items processed
+        uint64_t totalWaitUs = 0;   // time spent in the queue by the processed items
+        uint64_t maxWaitUs = 0;
+        size_t pending = 0;         // items in the queue
+    };
+
+    explicit WorkScheduler(unsigned maxWaitMs = kDefaultMaxWaitMs): mMaxWait(maxWaitMs) {}
+
+    /** @brief Queues an item with the class and key of the current thread */
+    void push(void* item) { push(item, WorkScope::currentClass(), WorkScope::currentKey()); }
+
+    void push(void* item, WorkClass cls, uint64_t key)
+    {
+        assert(cls < kWorkNumClasses);
+        std::lock_guard<std::mutex> lock(mMutex);
+        WorkClass queue = cls;
+        if (key == kWorkKeyAll)
+        {
+            for (int from = cls + 1; from < kWorkNumClasses; from++)
+            {
+                moveItems(static_cast<WorkClass>(from), cls, [](const Item&) { return true; });
+            }
+            for (auto& state: mKeys)
+            {
+                state.second.cls = std::min(state.second.cls, cls);
+            }
+            key = 0;
+        }
+        else if (key)
+        {
+            auto it = mKeys.find(key);
+            if (it == mKeys.end())
+            {
+                mKeys.emplace(key, KeyState{cls, 1});
+            }
+            else
+            {
+                KeyState& state = it->second;
+                if (state.cls > cls)
+                {
+                    moveItems(state.cls, cls, [key](const Item& item) { return item.key == key; });
+                    state.cls = cls;
+                }
+                queue = state.cls;
+                state.pending++;
+            }
+        }
+        mQueues[queue].push_back(Item{item, key, ++mSeq, Clock::now()});
+    }
+
+    /** @brief Processes the queued items, calling \c process(item) for each one, until
+     * there are no more or \c sliceMs have elapsed. A zero slice drains all of them,
+     * including the ones posted meanwhile.
+     * @return True if the queues are empty */
+    template <class F>
+    bool drain(unsigned sliceMs, F&& process)
+    {
+        auto start = Clock::now();
+        Item item;
+        while (pop(item))
+        {
+            {
+                WorkScope scope(kWorkForeground, item.key);
+                process(item.item);
+            }
+            if (sliceMs && Clock::now() - start >= std::chrono::milliseconds(sliceMs))
+            {
+                return empty();
+            }
+        }
+        return true;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        size_t count = 0;
+        for (const auto& queue: mQueues)
+        {
+            count += queue.size();
+        }
+        return count;
+    }
+
+    bool empty() const { return !size(); }
+
+    Stats stats(WorkClass cls) const
+    {
+        assert(cls < kWorkNumClasses);
+        std::lock_guard<std::mutex> lock(mMutex);
+        Stats stats = mStats[cls];
+        stats.pending = mQueues[cls].size();
+        return stats;
+    }
+
+    /** @brief Returns the queue latency per class, as a JSON object like
+     * {"fg":{"n":10,"avg":150,"max":900,"q":0},"call":{...},"bg":{...},"mnt":{...}}
+     * where the times are in microseconds */
+    std::string statsToJson() const
+    {
+        static const char* names[kWorkNumClasses] = { "fg", "call", "bg", "mnt" };
+        std::string json = "{";
+        for (int i = 0; i < kWorkNumClasses; i++)
+        {
+            Stats st = stats(static_cast<WorkClass>(i));
+            if (i)
+            {
+                json += ",";
+            }
+            json.append("\"").append(names[i]).append("\":{\"n\":").append(std::to_string(st.count))
+                .append(",\"avg\":").append(std::to_string(st.count ? st.totalWaitUs / st.count : 0))
+                .append(",\"max\":").append(std::to_string(st.maxWaitUs))
+                .append(",\"q\":").append(std::to_string(st.pending)).append("}");
+        }
+        json += "}";
+        return json;
+    }
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+    struct Item
+    {
+        void* item;
+        uint64_t key;
+        uint64_t seq;
+        Clock::time_point ts;
+    };
+    struct KeyState
+    {
+        WorkClass cls;
+        size_t pending;
+    };
+
+    mutable std::mutex mMutex;
+    std::deque<Item> mQueues[kWorkNumClasses];
+    std::unordered_map<uint64_t, KeyState> mKeys;
+    Stats mStats[kWorkNumClasses];
+    uint64_t mSeq = 0;
+    std::chrono::milliseconds mMaxWait;
+
+    bool pop(Item& item)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        int first = -1;
+        int oldest = -1;
+        for (int i = 0; i < kWorkNumClasses; i++)
+        {
+            if (mQueues[i].empty())
+            {
+                continue;
+            }
+            if (first < 0)
+            {
+                first = i;
+            }
+            if (oldest < 0 || mQueues[i].front().seq < mQueues[oldest].front().seq)
+            {
+                oldest = i;
+            }
+        }
+        if (first < 0)
+        {
+            return false;
+        }
+
+        auto now = Clock::now();
+        int queue = (now - mQueues[oldest].front().ts >= mMaxWait) ? oldest : first;
+        item = mQueues[queue].front();
+        mQueues[queue].pop_front();
+
+        if (item.key)
+        {
+            auto it = mKeys.find(item.key);
+            assert(it != mKeys.end() && it->second.pending);
+            if (!--it->second.pending)
+            {
+                mKeys.erase(it);
+            }
+        }
+
+        Stats& stats = mStats[queue];
+        uint64_t waitUs = std::chrono::duration_cast<std::chrono::microseconds>(now - item.ts).count();
+        stats.count++;
+        stats.totalWaitUs += waitUs;
+        stats.maxWaitUs = std::max(stats.maxWaitUs, waitUs);
+        return true;
+    }
+
+    // moves the selected items to a queue of higher priority, keeping the order of both queues
+    template <class P>
+    void moveItems(WorkClass from, WorkClass to, P&& selected)
+    {
+        std::deque<Item> kept;
+        std::deque<Item> moved;
+        for (const Item& item: mQueues[from])
+        {
+            (selected(item) ? moved : kept).push_back(item);
+        }
+        mQueues[from].swap(kept);
+
+        std::deque<Item> merged;
+        std::merge(mQueues[to].begin(), mQueues[to].end(), moved.begin(), moved.end(), std::back_inserter(merged),
+                   [](const Item& a, const Item& b) { return a.seq < b.seq; });
+        mQueues[to].swap(merged);
+    }
+};
+}
+#endif
@@ -0,0 +1,184 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include <buffer.h>
+#include <set>
+#include <arpa/inet.h>
+#include <strongvelope/tlvstore.h>
+
+TESTS_INIT();
+
+//Builds a buffer the same way chatd::MsgCommand does for NEWMSG:
+//opcode.1 chatid.8 userid.8 msgid.8 ts.4 updated.2 keyid.4 msglen.4 msg.msglen
+template <class B>
+void buildMsgCommand(B& cmd, const std::string& msg)
+{
+    cmd.template write<uint8_t>(0, 7);
+    cmd.template write<uint64_t>(1, 0x1122334455667788);
+    cmd.template write<uint64_t>(9, 0x8877665544332211);
+    cmd.template write<uint64_t>(17, 0xaabbccddeeff0011);
+    cmd.template write<uint32_t>(25, 1234567);
+    cmd.template write<uint16_t>(29, 0);
+    cmd.template write<uint32_t>(31, 0xfffffffe);
+    cmd.template write<uint32_t>(35, (uint32_t)msg.size());
+    cmd.append(msg);
+}
+
+//Builds a buffer the same way chatd::KeyCommand does for NEWKEY, with one key
+//blob per participant:
+//opcode.1 chatid.8 keyid.4 keyblobslen.4 {userid.8 keylen.2 key.keylen}*
+template <class B>
+void buildKeyCommand(B& cmd, int numUsers)
+{
+    char key[16] = {0};
+    cmd.template append<uint8_t>(30).template append<uint64_t>(0x1122334455667788)
+       .template append<uint32_t>(0xfffffffe).template append<uint32_t>(0);
+    for (int i = 0; i < numUsers; i++)
+    {
+        cmd.template append<uint64_t>(i).template append<uint16_t>(sizeof(key));
+        cmd.append(key, sizeof(key));
+    }
+}
+
+int main()
+{
+
+TestGroup("SmallBuffer")
+{
+    syncTest("Data stays inline while it fits")
+    {
+        SmallBuffer<32> buf;
+        const char* inlineStart = buf.buf();
+        buf.append("0123456789012345678901234567890"); //31 bytes
+        check(buf.buf() == inlineStart);
+        check(buf.dataSize() == 31);
+        buf.append<uint8_t>(1);
+        check(buf.buf() == inlineStart);
+        buf.append<uint8_t>(2); //spills to heap
+        check(buf.buf() != inlineStart);
+        check(buf.dataSize() == 33);
+        check(memcmp(buf.buf(), "0123456789", 10) == 0);
+        check(buf.read<uint8_t>(31) == 1 && buf.read<uint8_t>(32) == 2);
+    });
+    syncTest("Move of inline data copies it and empties the source")
+    {
+        SmallBuffer<32> src;
+        src.append("test");
+        SmallBuffer<32> dest(std::move(src));
+        check(!src.buf() && !src.bufSize() && !src.dataSize());
+        check(dest.dataEquals("test", 4));
+        Buffer plain(std::move(dest));
+        check(!dest.buf() && !dest.dataSize());
+        check(plain.dataEquals("test", 4));
+        plain.append("more");
+        check(plain.dataEquals("testmore", 8));
+    });
+    syncTest("Move of heap data transfers the block")
+    {
+        SmallBuffer<8> src;
+        src.append("longer than eight");
+        const char* heap = src.buf();
+        SmallBuffer<8> dest(std::move(src));
+        check(dest.buf() == heap);
+        check(!src.buf());
+    });
+    syncTest("Buffer grows geometrically on append")
+    {
+        Buffer buf(0);
+        size_t numReallocs = 0;
+        size_t lastSize = 0;
+        for (int i = 0; i < 100000; i++)
+        {
+            buf.append<uint8_t>(i & 0xff);
+            if (buf.bufSize() != lastSize)
+            {
+                numReallocs++;
+                lastSize = buf.bufSize();
+            }
+        }
+        check(buf.dataSize() == 100000);
+        check(numReallocs < 40);
+    });
+    syncTest("reserve() is relative to data size")
+    {
+        Buffer buf(16);
+        buf.append("0123456789");
+        buf.reserve(100);
+        check(buf.bufSize() == 110);
+        buf.reserve(50);
+        check(buf.bufSize() == 110);
+    });
+});
+
+TestGroup("Performance")
+{
+    syncTest("NEWMSG command building")
+    {
+        std::string text(60, 'x');
+        std::string longText(2000, 'x');
+        size_t total = 0;
+        test::benchmark("Buffer, 60-byte message", 1000000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                Buffer cmd(64);
+                buildMsgCommand(cmd, text);
+                total += cmd.dataSize();
+            }
+        });
+        test::benchmark("SmallBuffer<128>, 60-byte message", 1000000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                SmallBuffer<128> cmd(64);
+                buildMsgCommand(cmd, text);
+                total += cmd.dataSize();
+            }
+        });
+        test::benchmark("SmallBuffer<128>, 2000-byte message", 1000000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                SmallBuffer<128> cmd(64);
+                buildMsgCommand(cmd, longText);
+                total += cmd.dataSize();
+            }
+        });
+        check(total == (size_t)1000000 * (99 + 99 + 2039));
+    });
+    syncTest("NEWKEY command building for a 100-member group")
+    {
+        size_t total = 0;
+        test::benchmark("SmallBuffer<128>, 100 keys", 100000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                SmallBuffer<128> cmd(128);
+                buildKeyCommand(cmd, 100);
+                total += cmd.dataSize();
+            }
+        });
+        check(total == 100000 * (17 + 100 * 26));
+    });
+    syncTest("TLV record building")
+    {
+        size_t total = 0;
+        char nonce[12] = {0};
+        char signature[64] = {0};
+        test::benchmark("TlvWriter nonce+signature", 1000000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                strongvelope::TlvWriter tlv;
+                tlv.addRecord(1, StaticBuffer(signature, sizeof(signature)));
+                tlv.addRecord(2, StaticBuffer(nonce, sizeof(nonce)));
+                total += tlv.dataSize();
+            }
+        });
+        check(total == 1000000 * (67 + 15));
+    });
+});
+
+return test::gNumFailed;
+}
@@ -165,6 +165,9 @@ class Buffer: public StaticBuffer
 {
 protected:
     size_t mBufSize;
+    /** Storage provided by a derived class (see SmallBuffer) that is used
+     * instead of a heap block while the data fits in it. Never freed by us */
+    char* mInlineBuf = nullptr;
     enum {kMinBufSize = 64};
     void zero()
     {
@@ -172,6 +175,95 @@ protected:
         mBufSize = 0;
         mDataSize = 0;
     }
+    bool isInline() const { return mBuf && (mBuf == mInlineBuf); }
+    /** Used by derived classes that provide inline storage. If \c size fits in
+     * \c inlineSize, no heap block is allocated */
+    Buffer(char* inlineBuf, size_t inlineSize, size_t size, size_t dataSize)
+    : mInlineBuf(inlineBuf)
+    {
+        assert(dataSize <= size);
+        if (size <= inlineSize)
+        {
+            mBuf = inlineBuf;
+            mBufSize = inlineSize;
+            mDataSize = dataSize;
+        }
+        else
+        {
+            mBuf = (char*)malloc(size);
+            if (!mBuf)
+            {
+                zero();
+                throw std::runtime_error("Out of memory allocating block of size "+ std::to_string(size));
+            }
+            mBufSize = size;
+            mDataSize = dataSize;
+        }
+    }
+    /** Takes the content of \c other. If \c other uses its inline storage,
+     * the data is copied into our own inline block (if it fits) or into a new
+     * heap block. Otherwise, the heap block is transferred. */
+    void moveFrom(Buffer& other)
+    {
+        assert(!mBuf || isInline());
+        if (other.isInline())
+        {
+            if (!mInlineBuf || (other.mDataSize > mBufSize))
+            {
+                size_t size = (other.mDataSize > kMinBufSize) ? other.mDataSize : (size_t)kMinBufSize;
+                mBuf = (char*)malloc(size);
+                if (!mBuf)
+                {
+                    zero();
+                    throw std::runtime_error("Buffer::moveFrom: Out of memory allocating block of size "+ std::to_string(size));
+                }
+                mBufSize = size;
+            }
+            memcpy(mBuf, other.mBuf, other.mDataSize);
+            mDataSize = other.mDataSize;
+        }
+        else
+        {
+            mBuf = other.mBuf;
+            mBufSize = other.mBufSize;
+            mDataSize = other.mDataSize;
+        }
+        other.zero();
+    }
+    /** Ensures the buffer can hold at least \c reqdSize bytes. If \c exact is
+     * false, the capacity grows geometrically (by 1.5x), so that a sequence of
+     * appends needs a logarithmic number of reallocations */
+    void ensureBufSize(size_t reqdSize, bool exact)
+    {
+        if (reqdSize <= mBufSize)
+            return;
+        size_t newsize = reqdSize;
+        if (!exact)
+        {
+            size_t grown = mBufSize + (mBufSize >> 1);
+            if (grown > newsize)
+                newsize = grown;
+            if (newsize < kMinBufSize)
+                newsize = kMinBufSize;
+        }
+        if (!mBuf || isInline())
+        {
+            char* newbuf = (char*)::malloc(newsize);
+            if (!newbuf)
+                throw std::runtime_error("Buffer: Out of memory allocating block of size "+std::to_string(newsize));
+            if (mBuf)
+                memcpy(newbuf, mBuf, mDataSize);
+            mBuf = newbuf;
+        }
+        else
+        {
+            char* newbuf = (char*)::realloc(mBuf, newsize);
+            if (!newbuf)
+                throw std::runtime_error("Buffer: error reallocating block of size "+std::to_string(newsize));
+            mBuf = newbuf;
+        }
+        mBufSize = newsize;
+    }
 public:
     char* buf() { return mBuf;}
     const char* buf() const { return mBuf;}
@@ -220,7 +312,10 @@ public:
         }
     }
     Buffer(Buffer&& other)
-        :StaticBuffer(other.mBuf, other.mDataSize), mBufSize(other.mBufSize) { other.zero(); }
+    {
+        zero();
+        moveFrom(other);
+    }
 
     template <bool withNull>
     Buffer(const std::string& src)
@@ -240,7 +335,8 @@ public:
                 mDataSize = datalen;
                 return;
             }
-            ::free(mBuf);
+            if (!isInline())
+                ::free(mBuf);
         }
         mBufSize = (kMinBufSize > datalen) ? (size_t) kMinBufSize : datalen;
         mBuf = (char*)malloc(mBufSize);
@@ -255,28 +351,11 @@ public:
     template <bool withNull>
     void assign(const std::string& src) { assign(src.c_str(), withNull?(src.size()+1):src.size()); }
     void copyFrom(const StaticBuffer& src) { assign(src.buf(), src.dataSize()); }
+    /** Makes sure there is room for at least \c size more bytes after the
+     * current data, allocating exactly the required amount if needed */
     void reserve(size_t size)
     {
-        if (!mBuf)
-        {
-            mBuf = (char*)::malloc(size);
-            mBufSize = size;
-            assert(mDataSize == 0);
-        }
-        else
-        {
-            size_t newsize = mDataSize+size;
-            if (newsize <= mBufSize)
-                return;
-            char* save = mBuf;
-            mBuf = (char*)::realloc(mBuf, newsize);
-            if (!mBuf)
-            {
-                mBuf = save;
-                throw std::runtime_error("Buffer::reserve: Out of memory");
-            }
-            mBufSize = newsize;
-        }
+        ensureBufSize(mDataSize+size, true);
     }
     void setDataSize(size_t size)
     {
@@ -287,13 +366,9 @@ public:
     char* writePtr(size_t offset, size_t dataLen)
     {
         auto reqdSize = offset+dataLen;
-        if (reqdSize > mBufSize)
-        {
-            reserve(reqdSize);
-            mDataSize = reqdSize;
-        }
-        else if (reqdSize > mDataSize)
+        if (reqdSize > mDataSize)
         {
+            ensureBufSize(reqdSize, false);
             mDataSize = reqdSize;
         }
         return mBuf+offset;
@@ -308,27 +383,12 @@ public:
         if (!data)
             return *this;
         auto reqdSize = offset+datalen;
-        if (reqdSize <= mDataSize)
+        if (reqdSize > mDataSize)
         {
-            ::memcpy(mBuf+offset, data, datalen);
-            return *this;
-        }
-        else
-        {
-            if (reqdSize > mBufSize)
-            {
-                auto save = mBuf;
-                mBuf = (char*)::realloc(mBuf, reqdSize);
-                if (!mBuf)
-                {
-                    mBuf = save;
-                    throw std::runtime_error("Buffer::write: error reallocating block of size "+std::to_string(reqdSize));
-                }
-                mBufSize = reqdSize;
-            }
-            memcpy(mBuf+offset, data, datalen);
+            ensureBufSize(reqdSize, false);
             mDataSize = reqdSize;
         }
+        ::memcpy(mBuf+offset, data, datalen);
         return *this;
     }
     Buffer& write(size_t offset, const StaticBuffer& from) { return write(offset, from.buf(), from.dataSize()); }
@@ -356,15 +416,39 @@ public:
     {
         if (!mBuf)
             return;
-        ::free(mBuf);
+        if (!isInline())
+            ::free(mBuf);
         mBuf = nullptr;
         mBufSize = mDataSize = 0;
     }
 
     ~Buffer()
     {
-        if (mBuf)
+        if (mBuf && !isInline())
             ::free(mBuf);
     }
 };
+
+/** @brief A Buffer with \c N bytes of inline storage. As long as the data fits
+ * in that storage, no heap allocation is done. Meant for short-lived buffers
+ * that are built by appending, like protocol commands.
+ */
+template <size_t N>
+class SmallBuffer: public Buffer
+{
+protected:
+    //Buffer's constructor runs before this member is constructed, but it
+    //only takes its address, and a char array needs no initialization
+    char mInlineData[N];
+public:
+    enum { kInlineSize = N };
+    SmallBuffer(size_t size=N, size_t dataSize=0)
+    : Buffer(mInlineData, N, size, dataSize) {}
+    SmallBuffer(const char* data, size_t datalen)
+    : Buffer(mInlineData, N, datalen, 0) { append(data, datalen); }
+    SmallBuffer(SmallBuffer&& other)
+    : Buffer(mInlineData, N, 0, 0) { moveFrom(other); }
+    SmallBuffer(Buffer&& other)
+    : Buffer(mInlineData, N, 0, 0) { moveFrom(other); }
+};
 #endif
@@ -32,6 +32,7 @@
 #include <autoHandle.h>
 #include <asyncTools.h>
 #include <codecvt> //for nonWhitespaceStr()
+#include <limits>
 #include <locale>
 #include "strongvelope/strongvelope.h"
 #include "base64url.h"
@@ -54,7 +55,7 @@ namespace karere
 {
 
 template <class T, class F>
-void callAfterInit(T* self, F&& func, void* ctx);
+void callAfterInit(T* self, F&& func, void* ctx, uint64_t key);
 
 std::string encodeFirstName(const std::string& first);
 
@@ -354,6 +355,17 @@ bool Client::openDb(const std::string& sid)
                     KR_LOG_WARNING("Database version has been updated to %s", gDbSchemaVersionSuffix);
                 }
             }
+            else if (cachedVersionSuffix == "10" && (strcmp(gDbSchemaVersionSuffix, "11") == 0))
+            {
+                KR_LOG_WARNING("Updating schema of MEGAchat cache...");
+
+                // Add TLS sessions to dns_cache table
+                db.query("ALTER TABLE `dns_cache` ADD sess blob");
+                db.query("update vars set value = ? where name = 'schema_version'", currentVersion);
+                db.commit();
+                ok = true;
+                KR_LOG_WARNING("Database version has been updated to %s", gDbSchemaVersionSuffix);
+            }
         }
     }
 
@@ -378,259 +390,510 @@ void Client::createDbSchema()
     db.commit();
 }
 
-int Client::importMessages(const char *externalDbPath)
+promise::Promise<int> Client::importMessages(const char *externalDbPath, MessageImporter::ProgressCb&& onProgress)
+{
+    if (mMessageImporter)
+    {
+        return ::promise::Error("importMessages: another import is in progress", kErrorAccess);
+    }
+
+    std::unique_ptr<MessageImporter> importer(new MessageImporter(*this, std::move(onProgress)));
+    if (importer->open(externalDbPath) < 0)
+    {
+        return ::promise::Error("importMessages: the external DB can't be imported", kErrorArgs);
+    }
+
+    mMessageImporter = std::move(importer);
+    auto pms = mMessageImporter->mPromise;
+    auto wptr = weakHandle();
+    marshallCall([wptr, this]()
+    {
+        if (wptr.deleted())
+        {
+            return;
+        }
+
+        importMessagesBatch();
+    }, appCtx, kWorkForeground, kWorkKeyAll);
+    return pms;
+}
+
+void Client::importMessagesBatch()
 {
-    SqliteDb dbExternal;
-    if (!dbExternal.open(externalDbPath, false))
+    if (!mMessageImporter)  // aborted by terminate()
+    {
+        return;
+    }
+
+    bool pending = false;
+    std::string errMsg;
+    try
+    {
+        if (db.isOpen())
+        {
+            pending = mMessageImporter->importBatch();
+        }
+        else
+        {
+            errMsg = "importMessages: the app's DB has been closed";
+        }
+    }
+    catch (std::exception& e)
+    {
+        errMsg = std::string("importMessages: ") + e.what();
+    }
+
+    if (pending && errMsg.empty())
+    {
+        // let other events be processed before the next batch
+        auto wptr = weakHandle();
+        marshallCall([wptr, this]()
+        {
+            if (wptr.deleted())
+            {
+                return;
+            }
+
+            importMessagesBatch();
+        }, appCtx, kWorkForeground, kWorkKeyAll);
+        return;
+    }
+
+    auto pms = mMessageImporter->mPromise;
+    int countAdded = mMessageImporter->countAdded();
+    int countUpdated = mMessageImporter->countUpdated();
+    mMessageImporter.reset();
+
+    if (!errMsg.empty())
+    {
+        KR_LOG_ERROR("%s", errMsg.c_str());
+        pms.reject(errMsg, kErrorArgs, kErrorTypeGeneric);
+        return;
+    }
+
+    int total = countAdded + countUpdated;
+    KR_LOG_DEBUG("Imported messages: %d (added: %d, updated: %d)", total, countAdded, countUpdated);
+    pms.resolve(total);
+}
+
+MessageImporter::MessageImporter(Client& client, ProgressCb&& onProgress)
+    : mClient(client), mOnProgress(std::move(onProgress))
+{
+}
+
+MessageImporter::~MessageImporter()
+{
+    if (mCommitModeChanged && mClient.db.isOpen())
+    {
+        // commit the transaction of importing msgs and restore previous mode
+        mClient.setCommitMode(mOldCommitMode);
+    }
+
+    // statements must be finalized before closing the DB
+    mStmtLastSeen.reset();
+    mStmtIdxOfMsgid.reset();
+    mStmtTruncate.reset();
+    mStmtOldest.reset();
+    mStmtMsgs.reset();
+    mStmtKey.reset();
+    mStmtUpdatedMsgs.reset();
+    mStmtAppUpdated.reset();
+    mDbExternal.close();
+}
+
+int MessageImporter::open(const char *externalDbPath)
+{
+    if (!mDbExternal.open(externalDbPath, true))
     {
         KR_LOG_ERROR("importMessages: failed to open external DB (%s)", externalDbPath);
         return -1;
     }
     // check external DB uses the same DB schema than the app
-    SqliteStmt stmtVersion(dbExternal, "select value from vars where name = 'schema_version'");
-    if (!stmtVersion.step())
     {
-        dbExternal.close();
-        KR_LOG_ERROR("importMessages: failed to get external DB version");
-        return -2;
+        SqliteStmt stmtVersion(mDbExternal, "select value from vars where name = 'schema_version'");
+        if (!stmtVersion.step())
+        {
+            KR_LOG_ERROR("importMessages: failed to get external DB version");
+            return -2;
+        }
+        // check external DB uses the same DB version than the app
+        std::string currentVersion(gDbSchemaHash);
+        currentVersion.append("_").append(gDbSchemaVersionSuffix);    // <hash>_<suffix>
+        std::string cachedVersion(stmtVersion.stringCol(0));
+        if (cachedVersion != currentVersion)
+        {
+            KR_LOG_ERROR("importMessages: external DB version is too old");
+            return -3;
+        }
+        // check external DB is for the same user than the app's DB
+        SqliteStmt stmtMyHandle(mDbExternal, "select value from vars where name = 'my_handle'");
+        if (!stmtMyHandle.step() || stmtMyHandle.uint64Col(0) != mClient.myHandle())
+        {
+            KR_LOG_ERROR("importMessages: external DB of a different user");
+            return -4;
+        }
     }
-    // check external DB uses the same DB version than the app
-    std::string currentVersion(gDbSchemaHash);
-    currentVersion.append("_").append(gDbSchemaVersionSuffix);    // <hash>_<suffix>
-    std::string cachedVersion(stmtVersion.stringCol(0));
-    if (cachedVersion != currentVersion)
+
+    // prepare the statements once, they are reused for every chat and batch
+    mStmtLastSeen.reset(new SqliteStmt(mDbExternal, "select last_seen from chats where chatid = ?1"));
+    mStmtIdxOfMsgid.reset(new SqliteStmt(mDbExternal, "select idx from history where chatid = ?1 and msgid = ?2"));
+    mStmtTruncate.reset(new SqliteStmt(mDbExternal, "select msgid, idx, type from history where chatid = ?1 and idx > ?2"));
+    mStmtOldest.reset(new SqliteStmt(mDbExternal, "select min(idx), msgid, idx from history where chatid = ?1"));
+    mStmtMsgs.reset(new SqliteStmt(mDbExternal, "select userid, ts, type, data, idx, keyid, backrefid, updated, is_encrypted, msgid from history"
+                                   " where chatid = ?1 and idx >= ?2 order by idx limit ?3"));
+    mStmtKey.reset(new SqliteStmt(mDbExternal, "select key from sendkeys where chatid = ?1 and userid = ?2 and keyid = ?3"));
+    mStmtUpdatedMsgs.reset(new SqliteStmt(mDbExternal, "select userid, ts, type, data, msgid, keyid, updated, backrefid, is_encrypted, idx from history"
+                                          " where chatid = ?1 and ts > ?2 and updated > 0 and idx >= ?3 and idx < ?4 order by idx limit ?5"));
+    mStmtAppUpdated.reset(new SqliteStmt(mClient.db, "select updated from history where chatid = ?1 and msgid = ?2"));
+
+    // a previous import may have been interrupted in the middle of a chat
+    SqliteStmt stmtCheckpoint(mClient.db, "select name, value from vars where name in ('import_chatid', 'import_editable_ts')");
+    while (stmtCheckpoint.step())
     {
-        dbExternal.close();
-        KR_LOG_ERROR("importMessages: external DB version is too old");
-        return -3;
+        if (stmtCheckpoint.stringCol(0) == "import_chatid")
+        {
+            mCheckpointChatid = stmtCheckpoint.uint64Col(1);
+        }
+        else
+        {
+            mCheckpointEditableTs = stmtCheckpoint.uintCol(1);
+        }
     }
-    // check external DB is for the same user than the app's DB
-    SqliteStmt stmtMyHandle(dbExternal, "select value from vars where name = 'my_handle'");
-    if (!stmtMyHandle.step() || stmtMyHandle.uint64Col(0) != myHandle())
+    if (mCheckpointChatid.isValid())
     {
-        dbExternal.close();
-        KR_LOG_ERROR("importMessages: external DB of a different user");
-        return -4;
+        KR_LOG_DEBUG("importMessages: resuming import of chatid: %s", mCheckpointChatid.toString().c_str());
     }
 
     // avoid to write each imported message to disk individually
-    bool oldCommitMode = commitEach();
-    setCommitMode(false);
-
-    // for every chat, check messages to be added and/or updated
-    int countAdded = 0;
-    int countUpdated = 0;
-    for (auto& it : *chats)
-    {
-        // find the newest message in the app
-        karere::ChatRoom *chatroom = it.second;
-        chatd::Chat &chat = chatroom->chat();
-        karere::Id chatid = chatroom->chatid();
-
-        // get id of last message seen from external db
-        Id lastSeenId;
-        SqliteStmt stmtLastSeen(dbExternal, "select last_seen from chats where chatid=?");
-        stmtLastSeen << chatid;
-        if (stmtLastSeen.step())
-        {
-            lastSeenId = stmtLastSeen.uint64Col(0);
-            chat.seenImport(lastSeenId);
-        }
-        else    // no SEEN pointer for this chat on external cache (or chat not found)
+    mOldCommitMode = mClient.commitEach();
+    mClient.setCommitMode(false);
+    mCommitModeChanged = true;
+
+    for (auto& it : *mClient.chats)
+    {
+        mChatids.push_back(it.first);
+    }
+    return 0;
+}
+
+bool MessageImporter::importBatch()
+{
+    int remaining = kBatchSize;
+    karere::Id chatid;
+    while (remaining > 0 && mChatPos < mChatids.size())
+    {
+        chatid = mChatids[mChatPos];
+        auto it = mClient.chats->find(chatid);
+        if (it == mClient.chats->end())
         {
-            KR_LOG_WARNING("importMessages: SEEN not imported becaus chatid not found in external db (chatid: %s)",
-                         chatid.toString().c_str());
+            // chatroom removed while importing
+            nextChat();
+            continue;
         }
 
-        chatd::Idx newestAppIdx = CHATD_IDX_INVALID;
-        karere::Id newestAppMsgid(Id::inval());
-        chatd::Message *newestAppMsg = nullptr;
-        chatd::Idx firstIdxToImport = CHATD_IDX_INVALID;    // may not match the idx from app (even for same msgid)
-        karere::Id firstMsgidToImport(Id::inval());
-        uint32_t editableMsgsTs = 0;
-
-        std::string query;
-        if (!chat.empty())
-        {
-            newestAppIdx = chat.highnum();
-            newestAppMsg = &chat.at(newestAppIdx);
-            newestAppMsgid = firstMsgidToImport = newestAppMsg->id();
-
-            // find the newest message known by the app in the external DB
-            query = "select idx from history where chatid = ?1 and msgid = ?2";
-            SqliteStmt stmt1(dbExternal, query.c_str());
-            stmt1 << chatid << firstMsgidToImport;
-            if (stmt1.step())
+        chatd::Chat &chat = it->second->chat();
+        switch (mStep)
+        {
+        case kStepStartChat:
+            if (startChat(chat))
             {
-                firstIdxToImport = stmt1.intCol(0);
-
-                // ts of oldest message in app that could have been updated/deleted
-                editableMsgsTs = newestAppMsg->ts - CHATD_MAX_EDIT_AGE;
+                mStep = kStepNewMessages;
             }
-            else    // not found
+            else
             {
-                // check if a truncate in external DB has cleared this message (idx greater than newest app msg)
-                query = "select msgid, idx, type from history where chatid = ?1 and idx > ?2";
-                SqliteStmt stmt2(dbExternal, query.c_str());
-                stmt2 << chatid << newestAppIdx;
-                if (stmt2.step())
-                {
-                    assert(stmt2.intCol(2) == chatd::Message::kMsgTruncate);
-                    firstMsgidToImport = stmt2.uint64Col(0);
-                    firstIdxToImport = stmt2.intCol(1);
-
-                    KR_LOG_DEBUG("importMessages: truncate detected in chatid: %s msgid: %s idx: %d",
-                                 chatid.toString().c_str(), firstMsgidToImport.toString().c_str(), firstIdxToImport);
-                }
-                else
-                {
-                    // (it means app is ahead of external DB for this chat, so nothing to import)
-                    KR_LOG_DEBUG("importMessages: no messages to import for chatid: %s", chatid.toString().c_str());
-                    continue;
-                }
+                nextChat();
             }
-        }
-        else    // chat history is empty in the app
+            break;
+
+        case kStepNewMessages:
         {
-            // find the oldest message in external DB: first msgid to import
-            query = "select min(idx), msgid, idx from history where chatid = ?1";
-            SqliteStmt stmt(dbExternal, query.c_str());
-            stmt << chatid;
-            if (stmt.step())
+            int count = importNewMessages(chat, remaining);
+            remaining -= count;
+            if (remaining > 0)  // no more new messages
             {
-                firstMsgidToImport = stmt.uint64Col(1);
-                firstIdxToImport = stmt.intCol(2);
+                mStep = kStepUpdatedMessages;
+                mNextIdx = std::numeric_limits<chatd::Idx>::min();
             }
-            else
+            break;
+        }
+
+        case kStepUpdatedMessages:
+        {
+            int count = importUpdatedMessages(chat, remaining);
+            remaining -= count;
+            if (remaining > 0)
             {
-                // chatroom has no history in external DB either
-                continue;
+                nextChat();
             }
+            break;
+        }
         }
+    }
 
-        // for every newer message in external DB, add them to the app's history
-        // (also consider the newest app message to update history in case of truncate)
-        query = "select userid, ts, type, data, idx, keyid, backrefid, updated, is_encrypted, msgid from history"
-                            " where chatid = ?1 and idx >= ?2";
-        SqliteStmt stmtMsg(dbExternal, query.c_str());
-        stmtMsg << chatroom->chatid() << firstIdxToImport;
-        while (stmtMsg.step())
-        {
-            // restore Message from external DB
-            std::unique_ptr<chatd::Message> msg;
-            karere::Id userid(stmtMsg.uint64Col(0));
-            karere::Id msgid(stmtMsg.uint64Col(9));
-            uint32_t ts = stmtMsg.uintCol(1);
-            unsigned char type = (unsigned char)stmtMsg.intCol(2);
-            uint16_t updated = (uint16_t)stmtMsg.intCol(7);
-            chatd::KeyId keyid = stmtMsg.uintCol(5);
-            Buffer buf;
-            stmtMsg.blobCol(3, buf);
-            msg.reset(new chatd::Message(msgid, userid, ts, updated, std::move(buf), false, keyid, type));
-            msg->backRefId = stmtMsg.uint64Col(6);
-            msg->setEncrypted((uint8_t)stmtMsg.intCol(8));
-
-            bool isUpdate = false;
-            if (msgid == newestAppMsgid)
-            {
-                // first message, if not updated or truncated, msg can be skipped
-                isUpdate = (newestAppMsg->type != msg->type && msg->type == chatd::Message::kMsgTruncate)      // become a truncate
-                        || (msg->type == chatd::Message::kMsgTruncate && msg->ts > newestAppMsg->ts)    // truncate a truncate
-                        || (msg->updated > newestAppMsg->updated);  // edited/deleted
+    // make the imported messages durable, so an interrupted import can resume
+    mClient.db.commit();
 
-                if (!isUpdate)
-                {
-                    KR_LOG_DEBUG("importMessages: newest message not changed. Skipping... (chatid: %s msgid: %s)",
-                                 chatid.toString().c_str(), msgid.toString().c_str());
-                    continue;
-                }
-            }
+    bool pending = mChatPos < mChatids.size();
+    if (!pending)
+    {
+        mClient.db.query("delete from vars where name in ('import_chatid', 'import_editable_ts')");
+    }
+
+    if (mOnProgress)
+    {
+        mOnProgress(mCountAdded + mCountUpdated, chatid);
+    }
+    return pending;
+}
+
+bool MessageImporter::startChat(chatd::Chat &chat)
+{
+    karere::Id chatid = chat.chatId();
+
+    // get id of last message seen from external db
+    SqliteStmt& stmtLastSeen = *mStmtLastSeen;
+    stmtLastSeen.reset().clearBind();
+    stmtLastSeen << chatid;
+    if (stmtLastSeen.step())
+    {
+        chat.seenImport(stmtLastSeen.uint64Col(0));
+    }
+    else    // no SEEN pointer for this chat on external cache (or chat not found)
+    {
+        KR_LOG_WARNING("importMessages: SEEN not imported becaus chatid not found in external db (chatid: %s)",
+                     chatid.toString().c_str());
+    }
+    stmtLastSeen.reset();
 
-            if (keyid != CHATD_KEYID_INVALID)   // keyid is invalid for mngt msgs and public chats
+    mNewestAppMsgid = Id::inval();
+    mFirstIdxToImport = CHATD_IDX_INVALID;
+    mEditableMsgsTs = 0;
+    if (!chat.empty())
+    {
+        chatd::Idx newestAppIdx = chat.highnum();
+        chatd::Message &newestAppMsg = chat.at(newestAppIdx);
+        mNewestAppMsgid = newestAppMsg.id();
+        mNewestAppMsgType = newestAppMsg.type;
+        mNewestAppMsgTs = newestAppMsg.ts;
+        mNewestAppMsgUpdated = newestAppMsg.updated;
+
+        // find the newest message known by the app in the external DB
+        SqliteStmt& stmtIdx = *mStmtIdxOfMsgid;
+        stmtIdx.reset().clearBind();
+        stmtIdx << chatid << mNewestAppMsgid;
+        if (stmtIdx.step())
+        {
+            mFirstIdxToImport = stmtIdx.intCol(0);
+
+            // ts of oldest message in app that could have been updated/deleted
+            mEditableMsgsTs = newestAppMsg.ts - CHATD_MAX_EDIT_AGE;
+        }
+        else    // not found
+        {
+            // check if a truncate in external DB has cleared this message (idx greater than newest app msg)
+            SqliteStmt& stmtTruncate = *mStmtTruncate;
+            stmtTruncate.reset().clearBind();
+            stmtTruncate << chatid << newestAppIdx;
+            if (stmtTruncate.step())
             {
-                // restore the SendKey of the message from external DB
-                std::string queryKey = "select key from sendkeys "
-                        " where chatid = ?1 and userid = ?2 and keyid = ?3";
-                SqliteStmt stmtKey(dbExternal, queryKey.c_str());
-                stmtKey << chatroom->chatid() << userid << keyid;
-                if (!stmtKey.step())
-                {
-                    KR_LOG_ERROR("importMessages: key not found. chatid: %s msgid: %s keyid %d",
-                                 chatid.toString().c_str(), msgid.toString().c_str(), keyid);
-                    continue;
-                }
-                Buffer key;
-                stmtKey.blobCol(0, key);
+                assert(stmtTruncate.intCol(2) == chatd::Message::kMsgTruncate);
+                mFirstIdxToImport = stmtTruncate.intCol(1);
 
-                // import the corresponding key and the message itself
-                chat.keyImport(keyid, userid, key.buf(), (uint16_t)key.dataSize());
+                KR_LOG_DEBUG("importMessages: truncate detected in chatid: %s msgid: %s idx: %d",
+                             chatid.toString().c_str(), ID_CSTR(stmtTruncate.uint64Col(0)), mFirstIdxToImport);
             }
+            stmtTruncate.reset();
+        }
+        stmtIdx.reset();
 
-            chat.msgImport(move(msg), isUpdate);
-            (isUpdate) ? countUpdated++ : countAdded++;
+        if (mFirstIdxToImport == CHATD_IDX_INVALID)
+        {
+            // (it means app is ahead of external DB for this chat, so nothing to import)
+            KR_LOG_DEBUG("importMessages: no messages to import for chatid: %s", chatid.toString().c_str());
+            return false;
+        }
+    }
+    else    // chat history is empty in the app
+    {
+        // find the oldest message in external DB: first msgid to import
+        SqliteStmt& stmtOldest = *mStmtOldest;
+        stmtOldest.reset().clearBind();
+        stmtOldest << chatid;
+        if (stmtOldest.step() && sqlite3_column_type(stmtOldest, 0) != SQLITE_NULL)
+        {
+            mFirstIdxToImport = stmtOldest.intCol(2);
+        }
+        stmtOldest.reset();
 
-            KR_LOG_DEBUG("importMessages: message added (chatid: %s msgid: %s)", chatid.toString().c_str(), msgid.toString().c_str());
+        if (mFirstIdxToImport == CHATD_IDX_INVALID)
+        {
+            // chatroom has no history in external DB either
+            return false;
         }
+    }
 
-        // finally, check if any older message has been updated
-        if (editableMsgsTs) // 0 --> chat was empty or truncated
+    if (chatid == mCheckpointChatid)
+    {
+        // the newest message in the app may be one imported by the interrupted
+        // import, so keep the window for edits that was computed back then
+        mEditableMsgsTs = mCheckpointEditableTs;
+    }
+    else
+    {
+        saveCheckpoint(chatid, mEditableMsgsTs);
+    }
+
+    mNextIdx = mFirstIdxToImport;
+    return true;
+}
+
+int MessageImporter::importNewMessages(chatd::Chat &chat, int maxCount)
+{
+    // for every newer message in external DB, add them to the app's history
+    // (also consider the newest app message to update history in case of truncate)
+    karere::Id chatid = chat.chatId();
+    SqliteStmt& stmtMsg = *mStmtMsgs;
+    stmtMsg.reset().clearBind();
+    stmtMsg << chatid << mNextIdx << maxCount;
+    int count = 0;
+    while (stmtMsg.step())
+    {
+        count++;
+        mNextIdx = stmtMsg.intCol(4) + 1;
+
+        // restore Message from external DB
+        std::unique_ptr<chatd::Message> msg;
+        karere::Id userid(stmtMsg.uint64Col(0));
+        karere::Id msgid(stmtMsg.uint64Col(9));
+        uint32_t ts = stmtMsg.uintCol(1);
+        unsigned char type = (unsigned char)stmtMsg.intCol(2);
+        uint16_t updated = (uint16_t)stmtMsg.intCol(7);
+        chatd::KeyId keyid = stmtMsg.uintCol(5);
+        Buffer buf;
+        stmtMsg.blobCol(3, buf);
+        msg.reset(new chatd::Message(msgid, userid, ts, updated, std::move(buf), false, keyid, type));
+        msg->backRefId = stmtMsg.uint64Col(6);
+        msg->setEncrypted((uint8_t)stmtMsg.intCol(8));
+
+        bool isUpdate = false;
+        if (msgid == mNewestAppMsgid)
         {
-            query = "select userid, ts, type, data, msgid, keyid, updated, backrefid, is_encrypted from history"
-                                " where chatid = ?1 and ts > ?2 and updated > 0 and idx < ?3";
+            // first message, if not updated or truncated, msg can be skipped
+            isUpdate = (mNewestAppMsgType != msg->type && msg->type == chatd::Message::kMsgTruncate)      // become a truncate
+                    || (msg->type == chatd::Message::kMsgTruncate && msg->ts > mNewestAppMsgTs)    // truncate a truncate
+                    || (msg->updated > mNewestAppMsgUpdated);  // edited/deleted
 
-            SqliteStmt stmtMsgUpdated(dbExternal, query);
-            stmtMsgUpdated << chatroom->chatid() << editableMsgsTs << firstIdxToImport;
-            while (stmtMsgUpdated.step())
+            if (!isUpdate)
             {
-                karere::Id msgid(stmtMsgUpdated.uint64Col(4));
-                uint16_t updated = (uint16_t)stmtMsgUpdated.intCol(6);
-
-                // check if the edit in the external DB is newer than in app DB
-                query = "select updated from history where chatid = ?1 and msgid = ?2";
-                SqliteStmt stmtMsgAppUpdated(db, query);
-                stmtMsgAppUpdated << chatroom->chatid() << msgid;
-                if (!stmtMsgAppUpdated.step())
-                {
-                    KR_LOG_ERROR("importMessages: message not found in app's db (chatid: %s msgid: %s)",
-                                 chatid.toString().c_str(), msgid.toString().c_str());
-                    continue;
-                }
-                uint16_t updatedApp = (uint16_t)stmtMsgAppUpdated.intCol(0);
-                if (updated <= updatedApp)
-                {
-                    KR_LOG_DEBUG("importMessages: edited message in external db is older. Skipping... (chatid: %s msgid: %s)",
-                                 chatid.toString().c_str(), msgid.toString().c_str());
-                    continue;
-                }
+                KR_LOG_DEBUG("importMessages: newest message not changed. Skipping... (chatid: %s msgid: %s)",
+                             chatid.toString().c_str(), msgid.toString().c_str());
+                continue;
+            }
+        }
 
-                // restore Message from external DB
-                std::unique_ptr<chatd::Message> msg;
-                karere::Id userid(stmtMsgUpdated.uint64Col(0));
-                uint32_t ts = stmtMsgUpdated.uintCol(1);
-                unsigned char type = (unsigned char)stmtMsgUpdated.intCol(2);
-                Buffer buf;
-                stmtMsgUpdated.blobCol(3, buf);
-                chatd::KeyId keyid = stmtMsgUpdated.uintCol(5);
-                msg.reset(new chatd::Message(msgid, userid, ts, updated, std::move(buf), false, keyid, type));
-                msg->backRefId = stmtMsgUpdated.uint64Col(7);
-                msg->setEncrypted((uint8_t)stmtMsgUpdated.intCol(8));
-
-                chat.msgImport(move(msg), true);
-                countUpdated++;
-
-                KR_LOG_DEBUG("importMessages: message updated (chatid: %s msgid: %s)", chatid.toString().c_str(), msgid.toString().c_str());
+        if (keyid != CHATD_KEYID_INVALID)   // keyid is invalid for mngt msgs and public chats
+        {
+            // restore the SendKey of the message from external DB
+            SqliteStmt& stmtKey = *mStmtKey;
+            stmtKey.reset().clearBind();
+            stmtKey << chatid << userid << keyid;
+            if (!stmtKey.step())
+            {
+                KR_LOG_ERROR("importMessages: key not found. chatid: %s msgid: %s keyid %d",
+                             chatid.toString().c_str(), msgid.toString().c_str(), keyid);
+                stmtKey.reset();
+                continue;
             }
+            Buffer key;
+            stmtKey.blobCol(0, key);
+            stmtKey.reset();
+
+            // import the corresponding key and the message itself
+            chat.keyImport(keyid, userid, key.buf(), (uint16_t)key.dataSize());
         }
+
+        chat.msgImport(move(msg), isUpdate);
+        (isUpdate) ? mCountUpdated++ : mCountAdded++;
+
+        KR_LOG_DEBUG("importMessages: message added (chatid: %s msgid: %s)", chatid.toString().c_str(), msgid.toString().c_str());
     }
+    stmtMsg.reset();
+    return count;
+}
 
-    dbExternal.close();
+int MessageImporter::importUpdatedMessages(chatd::Chat &chat, int maxCount)
+{
+    // finally, check if any older message has been updated
+    if (!mEditableMsgsTs) // 0 --> chat was empty or truncated
+    {
+        return 0;
+    }
 
-    // commit the transaction of importing msgs and restore previous mode
-    setCommitMode(oldCommitMode);
+    karere::Id chatid = chat.chatId();
+    SqliteStmt& stmtMsgUpdated = *mStmtUpdatedMsgs;
+    stmtMsgUpdated.reset().clearBind();
+    stmtMsgUpdated << chatid << mEditableMsgsTs << mNextIdx << mFirstIdxToImport << maxCount;
+    int count = 0;
+    while (stmtMsgUpdated.step())
+    {
+        count++;
+        mNextIdx = stmtMsgUpdated.intCol(9) + 1;
+        karere::Id msgid(stmtMsgUpdated.uint64Col(4));
+        uint16_t updated = (uint16_t)stmtMsgUpdated.intCol(6);
 
-    int total = countAdded + countUpdated;
-    KR_LOG_DEBUG("Imported messages: %d (added: %d, updated: %d)", total, countAdded, countUpdated);
-    return total;
+        // check if the edit in the external DB is newer than in app DB
+        SqliteStmt& stmtMsgAppUpdated = *mStmtAppUpdated;
+        stmtMsgAppUpdated.reset().clearBind();
+        stmtMsgAppUpdated << chatid << msgid;
+        if (!stmtMsgAppUpdated.step())
+        {
+            KR_LOG_ERROR("importMessages: message not found in app's db (chatid: %s msgid: %s)",
+                         chatid.toString().c_str(), msgid.toString().c_str());
+            stmtMsgAppUpdated.reset();
+            continue;
+        }
+        uint16_t updatedApp = (uint16_t)stmtMsgAppUpdated.intCol(0);
+        stmtMsgAppUpdated.reset();
+        if (updated <= updatedApp)
+        {
+            KR_LOG_DEBUG("importMessages: edited message in external db is older. Skipping... (chatid: %s msgid: %s)",
+                         chatid.toString().c_str(), msgid.toString().c_str());
+            continue;
+        }
+
+        // restore Message from external DB
+        std::unique_ptr<chatd::Message> msg;
+        karere::Id userid(stmtMsgUpdated.uint64Col(0));
+        uint32_t ts = stmtMsgUpdated.uintCol(1);
+        unsigned char type = (unsigned char)stmtMsgUpdated.intCol(2);
+        Buffer buf;
+        stmtMsgUpdated.blobCol(3, buf);
+        chatd::KeyId keyid = stmtMsgUpdated.uintCol(5);
+        msg.reset(new chatd::Message(msgid, userid, ts, updated, std::move(buf), false, keyid, type));
+        msg->backRefId = stmtMsgUpdated.uint64Col(7);
+        msg->setEncrypted((uint8_t)stmtMsgUpdated.intCol(8));
+
+        chat.msgImport(move(msg), true);
+        mCountUpdated++;
+
+        KR_LOG_DEBUG("importMessages: message updated (chatid: %s msgid: %s)", chatid.toString().c_str(), msgid.toString().c_str());
+    }
+    stmtMsgUpdated.reset();
+    return count;
+}
+
+void MessageImporter::saveCheckpoint(karere::Id chatid, uint32_t editableMsgsTs)
+{
+    mClient.db.query("insert or replace into vars(name,value) values('import_chatid', ?)", chatid);
+    mClient.db.query("insert or replace into vars(name,value) values('import_editable_ts', ?)", editableMsgsTs);
+    mCheckpointChatid = chatid;
+    mCheckpointEditableTs = editableMsgsTs;
+}
+
+void MessageImporter::nextChat()
+{
+    mChatPos++;
+    mStep = kStepStartChat;
 }
 
 void Client::heartbeat()
@@ -907,6 +1170,17 @@ promise::Promise<void> Client::pushReceived(Id chatid)
         if (wptr.deleted())
             return promise::Error("Up to date with API, but instance was removed");
 
+        // the chat of the push is needed now, even if it wasn't joined due to the lazy-join
+        // policy. A push without chatid doesn't tell which one, so the others stay deferred
+        if (chatid.isValid())
+        {
+            ChatRoomList::const_iterator it = chats->find(chatid);
+            if (it != chats->end())
+            {
+                it->second->chat().requestJoin();
+            }
+        }
+
         // if already sent SYNCs or we are not logged in right now...
         if (mSyncTimer)
         {
@@ -952,7 +1226,7 @@ promise::Promise<void> Client::pushReceived(Id chatid)
             for (auto& item: *chats)
             {
                 ChatRoom *chat = item.second;
-                if (!chat->chat().isDisabled())
+                if (!chat->chat().isDisabled() && !chat->chat().isJoinDeferred())
                 {
                     mSyncCount++;
                     chat->sendSync();
@@ -993,6 +1267,7 @@ promise::Promise<void> Client::initWithNewSession(const char* sid, const std::st
 
     mSid = sid;
     createDb();
+    initTlsSessionStore();
 
 // We have a complete snapshot of the SDK contact and chat list state.
 // Commit it with the accompanying scsn
@@ -1092,7 +1367,7 @@ void Client::onEvent(::mega::MegaApi* /*api*/, ::mega::MegaEvent* event)
                 commit(scsn);
             }
 
-        }, appCtx);
+        }, appCtx, kWorkForeground, kWorkKeyAll);
         break;
     }
 
@@ -1135,8 +1410,19 @@ void Client::initWithDbSession(const char* sid)
 
         loadOwnKeysFromDb();
         mDnsCache.loadFromDb();
+        initTlsSessionStore();
         mContactList->loadFromDb();
         mChatdClient.reset(new chatd::Client(this));
+
+        // resolve the shards in the background while the chats (and their keys) are loaded
+        std::set<int> shards;
+        SqliteStmt stmtShards(db, "select distinct shard from chats where mode != ?");
+        stmtShards << (int)strongvelope::CHAT_MODE_PREVIEW;
+        while (stmtShards.step())
+        {
+            shards.insert(stmtShards.intCol(0));
+        }
+        mChatdClient->prefetchShards(shards);
         chats->loadFromDb();
 
         // Get aliases from cache
@@ -1281,7 +1567,7 @@ void Client::onRequestFinish(::mega::MegaApi* /*apiObj*/, ::mega::MegaRequest *r
                 {
                     setInitState(kInitErrSidInvalid);
                 }
-            }, appCtx);
+            }, appCtx, kWorkForeground, kWorkKeyAll);
             return;
         }
         break;
@@ -1356,7 +1642,7 @@ void Client::onRequestFinish(::mega::MegaApi* /*apiObj*/, ::mega::MegaRequest *r
                 assert(state == kInitHasOnlineSession);
                 api.sdk.resumeActionPackets();
             }
-        }, appCtx);
+        }, appCtx, kWorkForeground, kWorkKeyAll);
         break;
     }
 
@@ -1388,7 +1674,7 @@ void Client::onRequestFinish(::mega::MegaApi* /*apiObj*/, ::mega::MegaRequest *r
                 return;
 
             mUserAttrCache->onUserAttrChange(mMyHandle, changeType);
-        }, appCtx);
+        }, appCtx, kWorkForeground, kWorkKeyAll);
         break;
     }
 
@@ -1618,6 +1904,7 @@ void Client::sendStats()
         return;
     }
 
+    mInitStats.setTlsHandshakes(websocketIO->tlsResumedHandshakes(), websocketIO->tlsFullHandshakes());
     std::string stats = mInitStats.onCompleted(api.sdk.getNumNodes(), chats->size(), mContactList->size());
     KR_LOG_DEBUG("Init stats: %s", stats.c_str());
     api.callIgnoreResult(&::mega::MegaApi::sendEvent, 99008, jsonUnescape(stats).c_str());
@@ -1867,6 +2154,17 @@ void Client::terminate(bool deleteDb)
         mPresencedClient.disconnect();
     }
 
+    // abort the import in progress, if any (a new import will resume it)
+    if (mMessageImporter)
+    {
+        auto pms = mMessageImporter->mPromise;
+        mMessageImporter.reset();
+        pms.reject("importMessages: client terminated", kErrorAccess, kErrorTypeGeneric);
+    }
+
+    // TLS sessions are kept in memory only, until a new client persists them again
+    websocketIO->setTlsSessionStore(nullptr);
+
     // close or delete MEGAchat's DB file
     try
     {
@@ -1920,7 +2218,7 @@ void Client::onUsersUpdate(mega::MegaApi* /*api*/, mega::MegaUserList *aUsers)
         }
 
         mContactList->syncWithApi(*users);
-    }, appCtx);
+    }, appCtx, kWorkForeground, kWorkKeyAll);
 }
 
 promise::Promise<karere::Id>
@@ -2085,7 +2383,7 @@ void ChatRoom::onLastMessageTsUpdated(uint32_t ts)
         auto display = roomGui();
         if (display)
             display->onLastTsUpdated(ts);
-    }, parent.mKarereClient.appCtx);
+    }, parent.mKarereClient.appCtx, chatid().val);
 }
 
 ApiPromise ChatRoom::requestGrantAccess(mega::MegaNode *node, mega::MegaHandle userHandle)
@@ -2121,7 +2419,7 @@ void ChatRoom::createChatdChat(const karere::SetOfIds& initialUsers, bool isPubl
 }
 
 template <class T, typename F>
-void callAfterInit(T* self, F&& func, void *ctx)
+void callAfterInit(T* self, F&& func, void *ctx, uint64_t key)
 {
     if (self->isInitializing())
     {
@@ -2130,7 +2428,7 @@ void callAfterInit(T* self, F&& func, void *ctx)
         {
             if (!wptr.deleted())
                 func();
-        }, ctx);
+        }, ctx, kWorkForeground, key);
     }
     else
     {
@@ -2375,8 +2673,8 @@ GroupChatRoom::GroupChatRoom(ChatRoomList& parent, const uint64_t& chatid,
     auto db = parent.mKarereClient.db;
     db.query(
         "insert or replace into chats(chatid, shard, peer, peer_priv, "
-        "own_priv, ts_created, mode, unified_key) values(?,?,-1,0,?,?,2,?)",
-        mChatid, mShardNo, mOwnPriv, mCreationTs, unifiedKeyBuf);
+        "own_priv, ts_created, mode, unified_key) values(?,?,-1,0,?,?,?,?)",
+        mChatid, mShardNo, mOwnPriv, mCreationTs, (int)strongvelope::CHAT_MODE_PREVIEW, unifiedKeyBuf);
 
     initWithChatd(true, unifiedKey, 0, publicHandle); // strongvelope only needs the public handle in preview mode (to fetch user attributes via `mcuga`)
     mChat->setPublicHandle(publicHandle);   // chatd always need to know the public handle in preview mode (to send HANDLEJOIN)
@@ -2759,7 +3057,7 @@ void GroupChatRoom::deleteSelf()
             return;
         }
         delete this;
-    }, parent.mKarereClient.appCtx);
+    }, parent.mKarereClient.appCtx, kWorkForeground, chatid().val);
 }
 
 ChatRoomList::ChatRoomList(Client& aClient)
@@ -2924,7 +3222,7 @@ void ChatRoomList::removeRoomPreview(Id chatid)
         groupchat->notifyPreviewClosed();
         erase(it);
         delete groupchat;
-    },mKarereClient.appCtx);
+    }, mKarereClient.appCtx, kWorkForeground, chatid.val);
 }
 
 void GroupChatRoom::notifyPreviewClosed()
@@ -2964,7 +3262,7 @@ void Client::onChatsUpdate(::mega::MegaApi*, ::mega::MegaTextChatList* rooms)
         }
 
         chats->onChatsUpdate(*copy);
-    }, appCtx);
+    }, appCtx, kWorkForeground, kWorkKeyAll);
 }
 
 void ChatRoomList::onChatsUpdate(::mega::MegaTextChatList& rooms)
@@ -3307,6 +3605,18 @@ void ChatRoom::setAppChatHandler(IApp::IChatHandler* handler)
 //return to the event loop
     mChat->setListener(mAppChatHandler);
     mAppChatHandler->init(*mChat, dummyIntf);
+    mChat->setForeground(true);
+
+    // in case it was deferred by the lazy-join policy. The app may open the chat from its
+    // own thread, so the connection is started from the karere thread
+    auto wptr = weakHandle();
+    marshallCall([wptr, this]()
+    {
+        if (wptr.deleted())
+            return;
+
+        mChat->requestJoin();
+    }, parent.mKarereClient.appCtx, kWorkForeground, chatid().val);
 }
 
 void ChatRoom::removeAppChatHandler()
@@ -3315,6 +3625,7 @@ void ChatRoom::removeAppChatHandler()
         return;
     mAppChatHandler = nullptr;
     mChat->setListener(this);
+    mChat->setForeground(false);
 }
 
 bool ChatRoom::hasChatHandler() const
@@ -3405,7 +3716,7 @@ void ChatRoom::onLastTextMessageUpdated(const chatd::LastTextMsg& msg)
             auto display = roomGui();
             if (display)
                 display->onLastMessageUpdated(msg);
-        }, parent.mKarereClient.appCtx);
+        }, parent.mKarereClient.appCtx, kWorkForeground, chatid().val);
     }
     else
     {
@@ -3531,6 +3842,11 @@ void ChatRoom::onArchivedChanged(bool archived)
     // since the archived rooms don't count for the chats with unread messages,
     // we need to notifiy the apps about the changes on unread messages.
     onUnreadChanged();
+
+    if (!archived)
+    {
+        mChat->requestJoin();   // in case it was deferred by the lazy-join policy
+    }
 }
 
 void PeerChatRoom::updateTitle(const std::string& title)
@@ -3549,7 +3865,7 @@ void ChatRoom::notifyTitleChanged()
 
         if (mAppChatHandler)
             mAppChatHandler->onTitleChanged(mTitleString);
-    }, parent.mKarereClient.appCtx);
+    }, parent.mKarereClient.appCtx, chatid().val);
 }
 
 void ChatRoom::notifyChatModeChanged()
@@ -3562,7 +3878,7 @@ void ChatRoom::notifyChatModeChanged()
 
         if (mAppChatHandler)
             mAppChatHandler->onChatModeChanged(this->publicChat());
-    }, parent.mKarereClient.appCtx);
+    }, parent.mKarereClient.appCtx, chatid().val);
 }
 
 void GroupChatRoom::enablePreview(uint64_t ph)
@@ -3946,14 +4262,88 @@ promise::Promise<void> GroupChatRoom::Member::nameResolved() const
 
 void Client::connectToChatd()
 {
+    long int numDeferred = 0;
     for (auto& item: *chats)
     {
         auto& chat = *item.second;
         if (!chat.chat().isDisabled())
         {
+            if (isJoinDeferrable(chat))
+            {
+                chat.chat().deferJoin();
+            }
+
+            if (chat.chat().isJoinDeferred())
+            {
+                numDeferred++;
+                continue;
+            }
+
             chat.connect();
         }
     }
+
+    if (numDeferred)
+    {
+        KR_LOG_DEBUG("Lazy join: %ld of %zu chats will be joined on demand", numDeferred, chats->size());
+    }
+    mInitStats.setNumDeferredChats(numDeferred);
+}
+
+bool Client::isJoinDeferrable(ChatRoom& room) const
+{
+    if (room.previewMode() || room.hasChatHandler())
+    {
+        return false;
+    }
+
+    if (mLazyJoinArchived && room.isArchived())
+    {
+        return true;
+    }
+
+    if (mLazyJoinIdleDays)
+    {
+        // the newest message loaded from the db, or the creation of the chat if none
+        chatd::Chat& chat = room.chat();
+        uint32_t lastTs = chat.empty() ? chat.lastMessageTs() : chat.at(chat.highnum()).ts;
+        return (time(NULL) - lastTs) > static_cast<time_t>(mLazyJoinIdleDays) * 86400;
+    }
+
+    return false;
+}
+
+void Client::setLazyJoin(bool archived, unsigned idleDays)
+{
+    mLazyJoinArchived = archived;
+    mLazyJoinIdleDays = idleDays;
+}
+
+void Client::setMaxResidentMsgs(uint32_t count)
+{
+    mMaxResidentMsgs = count;
+    if (mChatdClient)
+    {
+        mChatdClient->setMaxResidentMsgs(count);
+    }
+}
+
+void Client::setTlsSessionPersistence(bool enable)
+{
+    mPersistTlsSessions = enable;
+    if (db.isOpen())
+    {
+        initTlsSessionStore();
+    }
+}
+
+void Client::initTlsSessionStore()
+{
+    if (!mPersistTlsSessions)
+    {
+        mDnsCache.clearTlsSessions();
+    }
+    websocketIO->setTlsSessionStore(mPersistTlsSessions ? &mDnsCache : nullptr);
 }
 
 ContactList::ContactList(Client& aClient)
@@ -4231,7 +4621,7 @@ void Contact::notifyTitleChanged()
         //1on1 chatrooms don't have a binary layout for the title
         if (mChatRoom)
             mChatRoom->updateTitle(mTitleString);
-    }, mClist.client.appCtx);
+    }, mClist.client.appCtx, mChatRoom ? mChatRoom->chatid().val : 0);
 }
 
 Contact::~Contact()
@@ -4583,6 +4973,52 @@ void InitStats::incrementRetries(uint8_t stage, uint8_t shard)
     mStageShardStats[stage][shard].mRetries++;
 }
 
+void InitStats::setConnectIpFamily(uint8_t shard, bool ipv6, bool raced)
+{
+    if (mCompleted)
+    {
+        return;
+    }
+
+    InitStats::ShardStats &shardStats = mStageShardStats[kStatsConnect][shard];
+    shardStats.mIpFamily = ipv6 ? 6 : 4;
+    if (raced)
+    {
+        shardStats.mRaces++;
+    }
+}
+
+void InitStats::setLoginBytesRecv(uint8_t shard, size_t bytes)
+{
+    if (mCompleted)
+    {
+        return;
+    }
+
+    mStageShardStats[kStatsLoginChatd][shard].mBytesRecv = bytes;
+}
+
+void InitStats::setNumDeferredChats(long int numChats)
+{
+    if (mCompleted)
+    {
+        return;
+    }
+
+    mNumDeferredChats = numChats;
+}
+
+void InitStats::setTlsHandshakes(unsigned int resumed, unsigned int full)
+{
+    if (mCompleted)
+    {
+        return;
+    }
+
+    mTlsResumedHandshakes = resumed;
+    mTlsFullHandshakes = full;
+}
+
 void InitStats::handleShardStats(chatd::Connection::State oldState, chatd::Connection::State newState, uint8_t shard)
 {
     if (mCompleted)
@@ -4775,6 +5211,23 @@ std::string InitStats::toJson()
                 // Add stage retries
                 jsonValue.SetInt(shardStats.mRetries);
                 jSonShard.AddMember(rapidjson::Value("ret"), jsonValue, jSonDocument.GetAllocator());
+
+                // Add IP family and races (only recorded for connections)
+                if (shardStats.mIpFamily)
+                {
+                    jsonValue.SetInt(shardStats.mIpFamily);
+                    jSonShard.AddMember(rapidjson::Value("ipf"), jsonValue, jSonDocument.GetAllocator());
+
+                    jsonValue.SetInt(shardStats.mRaces);
+                    jSonShard.AddMember(rapidjson::Value("race"), jsonValue, jSonDocument.GetAllocator());
+                }
+
+                // Add bytes received (only recorded for logins)
+                if (shardStats.mBytesRecv)
+                {
+                    jsonValue.SetUint64(shardStats.mBytesRecv);
+                    jSonShard.AddMember(rapidjson::Value("rcv"), jsonValue, jSonDocument.GetAllocator());
+                }
                 shardArray.PushBack(jSonShard, jSonDocument.GetAllocator());
             }
         }
@@ -4803,6 +5256,16 @@ std::string InitStats::toJson()
     jsonValue.SetInt64(mNumChats);
     jSonObject.AddMember(rapidjson::Value("nch"), jsonValue, jSonDocument.GetAllocator());
 
+    // Add number of chats not joined at connection
+    jsonValue.SetInt64(mNumDeferredChats);
+    jSonObject.AddMember(rapidjson::Value("ndc"), jsonValue, jSonDocument.GetAllocator());
+
+    // Add number of resumed and full TLS handshakes
+    jsonValue.SetUint(mTlsResumedHandshakes);
+    jSonObject.AddMember(rapidjson::Value("tlsr"), jsonValue, jSonDocument.GetAllocator());
+    jsonValue.SetUint(mTlsFullHandshakes);
+    jSonObject.AddMember(rapidjson::Value("tlsf"), jsonValue, jSonDocument.GetAllocator());
+
     // Add number of contacts
     jsonValue.SetInt64(mInitState);
     jSonObject.AddMember(rapidjson::Value("sid"), jsonValue, jSonDocument.GetAllocator());
@@ -53,6 +53,7 @@ namespace rh { class IRetryController; }
 KARERE_IMPEXP const std::string& createAppDir(const char* dirname=".karere", const char* envVarName="KRDIR");
 
 class TextModule;
+class Client;
 class ChatRoom;
 class GroupChatRoom;
 class Contact;
@@ -656,8 +657,9 @@ class InitStats
          * - Version 1: Initial version
          * - Version 2: Fix errors and discard atypical values
          * - Version 3: Implement DNS, Chatd and Presenced Ip/Url cache
+         * - Version 4: Add deferred chats and resumed/full TLS handshakes
          */
-        const uint32_t INITSTATSVERSION = 3;
+        const uint32_t INITSTATSVERSION = 4;
 
         /** @brief Init states in init stats */
         enum
@@ -715,6 +717,19 @@ class InitStats
         /** @brief Increments the number of retries for a shard */
         void incrementRetries(uint8_t stage, uint8_t shard);
 
+        /** @brief Records the IP family (4 or 6) used to connect to a shard, and whether
+         * both families had to be raced to get the connection established */
+        void setConnectIpFamily(uint8_t shard, bool ipv6, bool raced);
+
+        /** @brief Records the bytes received from a shard until all its chats were logged in */
+        void setLoginBytesRecv(uint8_t shard, size_t bytes);
+
+        /** @brief Set the number of chats whose join was deferred by the lazy-join policy */
+        void setNumDeferredChats(long int numChats);
+
+        /** @brief Set the number of TLS handshakes that resumed a previous session, and the full ones */
+        void setTlsHandshakes(unsigned int resumed, unsigned int full);
+
         /** @brief This function handle the shard stats according to connections states transitions, getting
          *  the start or end ts for a shard in a stage or increments the number of retries in case of error in the stage
          *
@@ -737,6 +752,15 @@ private:
 
         /** @brief Number of retries */
         unsigned int mRetries = 0;
+
+        /** @brief IP family of the established connection (0 if not recorded) */
+        uint8_t mIpFamily = 0;
+
+        /** @brief Number of connections where both IP families were raced */
+        unsigned int mRaces = 0;
+
+        /** @brief Bytes received until all the chats were logged in (only recorded for logins) */
+        size_t mBytesRecv = 0;
     };
 
     typedef std::map<uint8_t, mega::dstime> StageMap;   // maps stage to elapsed time (first it stores tsStart)
@@ -759,6 +783,15 @@ private:
     /** @brief Number of contacts in the account */
     long int mNumContacts = 0;
 
+    /** @brief Number of chats not joined at connection, due to the lazy-join policy */
+    long int mNumDeferredChats = 0;
+
+    /** @brief Number of TLS handshakes that resumed a previous session */
+    unsigned int mTlsResumedHandshakes = 0;
+
+    /** @brief Number of full TLS handshakes */
+    unsigned int mTlsFullHandshakes = 0;
+
     /** @brief Flag that indicates whether the stats have already been sent */
     bool mCompleted = false;
 
@@ -782,6 +815,96 @@ private:
 
 };
 
+/** @brief Imports the history of an external DB (i.e. the cache of the iOS
+ * Notification Service Extension) into the app's DB.
+ *
+ * Messages are imported in batches of \c kBatchSize, one batch per iteration of
+ * the event loop, so the app remains responsive during large imports. Every batch
+ * re-queries the external DB from the last imported idx with the same prepared
+ * statements, so no read transaction is held on the external DB between batches.
+ *
+ * The app's DB is committed after every batch. Since the import of a chat starts
+ * after the newest message the app has, an interrupted import resumes where it
+ * stopped. The only state that can't be recomputed, the time window for edits of
+ * the chat being imported, is saved as a checkpoint in the \c vars table.
+ */
+class MessageImporter
+{
+public:
+    enum { kBatchSize = 256 };
+
+    /** @brief Called after every batch, with the number of messages added/updated so far
+     * and the chat being imported */
+    typedef std::function<void(int count, karere::Id chatid)> ProgressCb;
+
+    MessageImporter(Client& client, ProgressCb&& onProgress);
+    ~MessageImporter();
+
+    /** @brief Opens and validates the external DB
+     * @return 0 on success, -1 if the DB can't be opened, -2 if its version is unknown,
+     * -3 if it uses a different schema, -4 if it belongs to a different user
+     */
+    int open(const char *externalDbPath);
+
+    /** @brief Imports up to \c kBatchSize messages
+     * @return false when there is nothing left to import
+     */
+    bool importBatch();
+
+    int countAdded() const { return mCountAdded; }
+    int countUpdated() const { return mCountUpdated; }
+
+    /** @brief Resolved with the number of messages added/updated */
+    promise::Promise<int> mPromise;
+
+protected:
+    enum Step
+    {
+        kStepStartChat,         // find out what needs to be imported in the next chat
+        kStepNewMessages,       // import messages newer than the newest one in the app
+        kStepUpdatedMessages    // update older messages that have been edited/deleted
+    };
+
+    Client& mClient;
+    ProgressCb mOnProgress;
+    bool mOldCommitMode = true;
+    bool mCommitModeChanged = false;
+    SqliteDb mDbExternal;
+    std::unique_ptr<SqliteStmt> mStmtLastSeen;
+    std::unique_ptr<SqliteStmt> mStmtIdxOfMsgid;
+    std::unique_ptr<SqliteStmt> mStmtTruncate;
+    std::unique_ptr<SqliteStmt> mStmtOldest;
+    std::unique_ptr<SqliteStmt> mStmtMsgs;
+    std::unique_ptr<SqliteStmt> mStmtKey;
+    std::unique_ptr<SqliteStmt> mStmtUpdatedMsgs;
+    std::unique_ptr<SqliteStmt> mStmtAppUpdated;
+
+    std::vector<karere::Id> mChatids;   // chats to import, in order
+    size_t mChatPos = 0;
+    Step mStep = kStepStartChat;
+    int mCountAdded = 0;
+    int mCountUpdated = 0;
+
+    // checkpoint of the chat being imported, from a previous import that was interrupted
+    karere::Id mCheckpointChatid;
+    uint32_t mCheckpointEditableTs = 0;
+
+    // state of the chat being imported (the app's buffer may change between batches)
+    karere::Id mNewestAppMsgid;
+    unsigned char mNewestAppMsgType = 0;
+    uint32_t mNewestAppMsgTs = 0;
+    uint16_t mNewestAppMsgUpdated = 0;
+    chatd::Idx mFirstIdxToImport = CHATD_IDX_INVALID;
+    chatd::Idx mNextIdx = CHATD_IDX_INVALID;
+    uint32_t mEditableMsgsTs = 0;
+
+    bool startChat(chatd::Chat& chat);
+    int importNewMessages(chatd::Chat& chat, int maxCount);
+    int importUpdatedMessages(chatd::Chat& chat, int maxCount);
+    void saveCheckpoint(karere::Id chatid, uint32_t editableMsgsTs);
+    void nextChat();
+};
+
 /** @brief The karere Client object. Create an instance to use Karere.
  *
  *  A sequence of how the client has to be initialized:
@@ -939,10 +1062,22 @@ protected:
     megaHandle mHeartbeatTimer = 0;
     InitStats mInitStats;
 
+    // import of messages from an external DB in progress, if any
+    std::unique_ptr<MessageImporter> mMessageImporter;
+    void importMessagesBatch();
+
     // Maps uhBin to user alias encoded in B64
     AliasesMap mAliasesMap;
     bool mIsInBackground = false;
 
+    // lazy-join policy (see setLazyJoin())
+    bool mLazyJoinArchived = false;
+    unsigned mLazyJoinIdleDays = 0;
+    // TLS sessions are persisted in the db (see setTlsSessionPersistence())
+    bool mPersistTlsSessions = false;
+    // max messages in RAM per chat (see setMaxResidentMsgs())
+    uint32_t mMaxResidentMsgs = 0;
+
 public:
 
     /**
@@ -1121,10 +1256,18 @@ public:
 
     /**
      * @brief Import messages from external DB
+     *
+     * The import runs in batches, see \c MessageImporter. If a previous import was
+     * interrupted, it's resumed.
+     *
      * @param externalDbPath Path of the DB to open
-     * @return Number of messages added/updated. If error, -1.
+     * @param onProgress Called after every batch with the number of messages
+     * added/updated so far and the chat being imported
+     * @return A promise resolved with the number of messages added/updated. It fails
+     * with kErrorArgs if the external DB can't be imported, and with kErrorAccess if
+     * there is another import in progress.
      */
-    int importMessages(const char *externalDbPath);
+    promise::Promise<int> importMessages(const char *externalDbPath, MessageImporter::ProgressCb&& onProgress = nullptr);
 
     /** @brief There is a call active in the chatroom*/
     bool isCallActive(karere::Id chatid = karere::Id::inval()) const;
@@ -1147,6 +1290,27 @@ public:
     uint64_t initMyIdentity();
 
     bool isInBackground() const;
+
+    /**
+     * @brief Sets the lazy-join policy. The chats matching it are not joined at connection
+     * (nor at reconnections), but only once they are needed: when opened, when a push is
+     * received for them or when they are unarchived. Applies from the next connection.
+     *
+     * @param archived Defer the join of archived chats
+     * @param idleDays Defer the join of chats without messages for more than this number
+     * of days, or zero to join them regardless of their activity
+     */
+    void setLazyJoin(bool archived, unsigned idleDays);
+
+    /** @brief Sets whether TLS sessions are stored in the DNS cache of the db, so they
+     * can be resumed after a restart. Disabling it removes the ones already stored */
+    void setTlsSessionPersistence(bool enable);
+
+    /** @brief Limits the number of messages kept in RAM by each chat (see
+     * chatd::Client::setMaxResidentMsgs). Zero disables the limit */
+    void setMaxResidentMsgs(uint32_t count);
+    uint32_t maxResidentMsgs() const { return mMaxResidentMsgs; }
+
     void updateAliases(Buffer *data);
 
     /** @brief Returns a string that contains the user alias in UTF-8 if exists, otherwise returns an empty string*/
@@ -1164,6 +1328,8 @@ protected:
     void createDb();
     void wipeDb(const std::string& sid);
     void createDbSchema();
+    // sets (or unsets) the db as the store of TLS sessions, according to mPersistTlsSessions
+    void initTlsSessionStore();
 
     // initialization of own handle/email/identity/keys/contacts...
     karere::Id getMyHandleFromDb();
@@ -1179,6 +1345,7 @@ protected:
 
     // connection-related methods
     void connectToChatd();
+    bool isJoinDeferrable(ChatRoom& room) const;
     promise::Promise<void> connectToPresenced(Presence pres);
     promise::Promise<int> initializeContactList();
 
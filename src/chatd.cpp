@@ -119,6 +119,7 @@ Client::Client(karere::Client *aKarereClient) :
     mApi(&aKarereClient->api),
     mKarereClient(aKarereClient)
 {
+    mMaxResidentMsgs = mKarereClient->maxResidentMsgs();
     if (!mKarereClient->anonymousMode())
     {
         mRichPrevAttrCbHandle = mKarereClient->userAttrCache().getAttr(mMyHandle, ::mega::MegaApi::USER_ATTR_RICH_PREVIEWS, this,
@@ -416,21 +417,124 @@ void Client::setRetentionTimer()
 
         mRetentionTimer = 0; // it's important to reset here
 
-        // Get the min check period
-        time_t minTs = 0;
+        // Every chat is checked by a separate call of the maintenance class, so the cleanup
+        // doesn't delay the rest of work. The last one gets the min check period of all them
+        struct RetentionCheck
+        {
+            time_t minTs = 0;
+            size_t pending = 0;
+        };
+        auto check = std::make_shared<RetentionCheck>();
+        check->pending = mChatForChatId.size();
+        if (!check->pending)
+        {
+            updateRetentionCheckTs(0, true);
+            return;
+        }
+
         for (auto& chat: mChatForChatId)
         {
-            // Call with false, to avoid infinite loop by calling setRetentionTimer
-            time_t nextRetentionTs = chat.second->handleRetentionTime(false);
-            if (nextRetentionTs && (nextRetentionTs < minTs || !minTs))
+            Id chatid = chat.first;
+            marshallCall([this, wptr, check, chatid]()
             {
-                minTs = nextRetentionTs;
-            }
+                if (wptr.deleted())
+                    return;
+
+                auto it = mChatForChatId.find(chatid);
+                if (it != mChatForChatId.end())
+                {
+                    // Call with false, to avoid infinite loop by calling setRetentionTimer
+                    time_t nextRetentionTs = it->second->handleRetentionTime(false);
+                    if (nextRetentionTs && (nextRetentionTs < check->minTs || !check->minTs))
+                    {
+                        check->minTs = nextRetentionTs;
+                    }
+                }
+
+                if (!--check->pending)
+                {
+                    // if a timer has been set meanwhile, keep it unless this check is sooner
+                    updateRetentionCheckTs(check->minTs, !mRetentionTimer);
+                }
+            }, mKarereClient->appCtx, kWorkMaintenance, chatid.val);
         }
-        updateRetentionCheckTs(minTs, true);
     }, retentionPeriod * 1000 , mKarereClient->appCtx);
 }
 
+void Client::setMaxResidentMsgs(uint32_t count)
+{
+    mMaxResidentMsgs = count;
+    for (auto& it: mChatForChatId)
+    {
+        it.second->scheduleEviction();
+    }
+}
+
+uint32_t Client::maxResidentMsgs() const
+{
+    return mMaxResidentMsgs;
+}
+
+bool Client::startTrace(const std::string& path, size_t maxBytes)
+{
+    std::unique_ptr<TraceWriter> trace(new TraceWriter);
+    if (!trace->open(path, chatdVersion, maxBytes))
+    {
+        CHATD_LOG_ERROR("startTrace: can't create the trace file %s", path.c_str());
+        return false;
+    }
+
+    CHATD_LOG_WARNING("Capturing chatd traffic to %s", path.c_str());
+    mTrace = std::move(trace);
+    return true;
+}
+
+void Client::stopTrace()
+{
+    if (mTrace)
+    {
+        CHATD_LOG_WARNING("Chatd traffic capture stopped, %zu bytes written", mTrace->bytesWritten());
+        mTrace.reset();
+    }
+}
+
+bool Client::isTracing() const
+{
+    return mTrace && mTrace->isOpen();
+}
+
+bool Client::replayFrame(int shardNo, const StaticBuffer& frame)
+{
+    auto it = mConnections.find(shardNo);
+    if (it == mConnections.end())
+    {
+        return false;
+    }
+
+    it->second->execCommand(frame);
+    return true;
+}
+
+size_t Client::residentMsgCount() const
+{
+    size_t count = 0;
+    for (auto& it: mChatForChatId)
+    {
+        count += it.second->size();
+    }
+    return count;
+}
+
+uint64_t Client::evictedMsgCount() const
+{
+    uint64_t count = 0;
+    for (auto& it: mChatForChatId)
+    {
+        count += it.second->evictedMsgCount();
+    }
+    return count;
+}
+
 uint8_t Client::richLinkState() const
 {
     return mRichLinkState;
@@ -443,7 +547,7 @@ bool Client::areAllChatsLoggedIn(int shard)
     for (map<Id, shared_ptr<Chat>>::iterator it = mChatForChatId.begin(); it != mChatForChatId.end(); it++)
     {
         Chat* chat = it->second.get();
-        if (!chat->isLoggedIn() && !chat->isDisabled()
+        if (!chat->isLoggedIn() && !chat->isDisabled() && !chat->isJoinDeferred()
                 && (shard == -1 || chat->connection().shardNo() == shard))
         {
             allConnected = false;
@@ -466,8 +570,29 @@ bool Client::areAllChatsLoggedIn(int shard)
     return allConnected;
 }
 
+void Client::prefetchShards(const std::set<int>& shards)
+{
+    for (int shardNo: shards)
+    {
+        if (mConnections.find(shardNo) != mConnections.end())
+        {
+            continue;
+        }
+
+        Connection* conn = new Connection(*this, shardNo);
+        mConnections.emplace(std::piecewise_construct,
+            std::forward_as_tuple(shardNo), std::forward_as_tuple(conn));
+        conn->prefetchDns();
+    }
+}
+
 void Chat::connect()
 {
+    if (isJoinDeferred())
+    {
+        return;
+    }
+
     if ((mConnection.state() == Connection::kStateNew))
     {
         // attempt a connection ONLY if this is a new shard.
@@ -527,6 +652,8 @@ Connection::Connection(Client& chatdClient, int shardNo)
 
 void Connection::wsConnectCb()
 {
+    mTargetIp = wsConnectedIp();    // the IP that won the race, if both families were tried
+    mChatdClient.mKarereClient->initStats().setConnectIpFamily(shardNo(), mTargetIp.find(':') != string::npos, wsRaced());
     setState(kStateConnected);
 }
 
@@ -592,7 +719,6 @@ void Connection::onSocketClose(int errcode, int errtype, const std::string& reas
 
     assert(oldState != kStateDisconnected);
 
-    usingipv6 = !usingipv6;
     mTargetIp.clear();
 
     if (oldState == kStateConnected)
@@ -844,16 +970,42 @@ Promise<void> Connection::reconnect()
             string ipv4, ipv6;
             bool cachedIPs = mDnsCache.getIp(mShardNo, ipv4, ipv6);
 
+            // the IPs have just been resolved by prefetchDns(), so they are used without resolving
+            // the hostname again. Next attempts, if any, resolve it as usual
+            bool prefetchedIPs = mDnsPrefetched && cachedIPs;
+            mDnsPrefetched = false;
+
             setState(kStateResolving);
-            CHATDS_LOG_DEBUG("Resolving hostname %s...", host.c_str());
+            CHATDS_LOG_DEBUG(prefetchedIPs ? "Using the prefetched IPs of %s" : "Resolving hostname %s...", host.c_str());
 
             for (auto& chatid: mChatIds)
             {
                 auto& chat = mChatdClient.chats(chatid);
-                if (!chat.isDisabled())
+                if (!chat.isDisabled() && !chat.isJoinDeferred())
                     chat.setOnlineState(kChatStateConnecting);
             }
 
+            auto onConnected = [wptr, this]()
+            {
+                if (wptr.deleted())
+                    return;
+
+                assert(isOnline());
+                sendCommand(Command(OP_CLIENTID)+mChatdClient.mKarereClient->myIdentity());
+                mTsLastRecv = time(NULL);   // data has been received right now, since connection is established
+                mHeartbeatEnabled = true;
+                sendKeepalive();
+                mLoginStartTs = karere::timestampMs();
+                mLoginBytesRecv = 0;
+                rejoinExistingChats();
+            };
+
+            if (prefetchedIPs)
+            {
+                doConnect();
+                return mConnectPromise.then(onConnected);
+            }
+
             //GET start ts for QueryDns
             mChatdClient.mKarereClient->initStats().shardStart(InitStats::kStatsQueryDns, shardNo());
 
@@ -968,19 +1120,7 @@ Promise<void> Connection::reconnect()
                 doConnect();
             }
 
-            return mConnectPromise
-            .then([wptr, this]()
-            {
-                if (wptr.deleted())
-                    return;
-
-                assert(isOnline());
-                sendCommand(Command(OP_CLIENTID)+mChatdClient.mKarereClient->myIdentity());
-                mTsLastRecv = time(NULL);   // data has been received right now, since connection is established
-                mHeartbeatEnabled = true;
-                sendKeepalive();
-                rejoinExistingChats();
-            });
+            return mConnectPromise.then(onConnected);
         }, wptr, mChatdClient.mKarereClient->appCtx, nullptr, 0, 0, KARERE_RECONNECT_DELAY_MAX, KARERE_RECONNECT_DELAY_INITIAL));
 
         return static_cast<Promise<void>&>(mRetryCtrl->start());
@@ -1012,49 +1152,28 @@ void Connection::doConnect()
     string ipv4, ipv6;
     bool cachedIPs = mDnsCache.getIp(mShardNo, ipv4, ipv6);
     assert(cachedIPs);
-    mTargetIp = (usingipv6 && ipv6.size()) ? ipv6 : ipv4;
+
+    // race both IP families, starting with the one that connected last time
+    bool ipv6First = ipv6.size() && (ipv4.empty() || mDnsCache.preferIpv6(mShardNo));
+    mTargetIp = ipv6First ? ipv6 : ipv4;
+    string fallbackIp = ipv6First ? ipv4 : ipv6;
 
     const karere::Url &url = mDnsCache.getUrl(mShardNo);
     assert (url.isValid());
 
     setState(kStateConnecting);
-    CHATDS_LOG_DEBUG("Connecting to chatd using the IP: %s", mTargetIp.c_str());
+    CHATDS_LOG_DEBUG("Connecting to chatd using the IP: %s (fallback IP: %s)", mTargetIp.c_str(), fallbackIp.c_str());
 
-    bool rt = wsConnect(mChatdClient.mKarereClient->websocketIO, mTargetIp.c_str(),
+    bool rt = wsConnect(mChatdClient.mKarereClient->websocketIO, mTargetIp.c_str(), fallbackIp.c_str(),
               url.host.c_str(),
               url.port,
               url.path.c_str(),
               url.isSecure);
 
-    if (!rt)    // immediate failure --> try the other IP family (if available)
+    if (!rt)    // immediate failure of all the IPs
     {
-        CHATDS_LOG_DEBUG("Connection to chatd failed using the IP: %s", mTargetIp.c_str());
-
-        string oldTargetIp = mTargetIp;
-        mTargetIp.clear();
-        if (oldTargetIp == ipv6 && ipv4.size())
-        {
-            mTargetIp = ipv4;
-        }
-        else if (oldTargetIp == ipv4 && ipv6.size())
-        {
-            mTargetIp = ipv6;
-        }
-
-        if (mTargetIp.size())
-        {
-            CHATDS_LOG_DEBUG("Retrying using the IP: %s", mTargetIp.c_str());
-            if (wsConnect(mChatdClient.mKarereClient->websocketIO, mTargetIp.c_str(),
-                                      url.host.c_str(),
-                                      url.port,
-                                      url.path.c_str(),
-                                      url.isSecure))
-            {
-                return;
-            }
-            CHATDS_LOG_DEBUG("Connection to chatd failed using the IP: %s", mTargetIp.c_str());
-        }
-        else
+        CHATDS_LOG_DEBUG("Connection to chatd failed using the IP: %s", wsConnectedIp().c_str());
+        if (fallbackIp.empty())
         {
             // do not close the socket, which forces a new retry attempt and turns the DNS response obsolete
             // Instead, let the DNS request to complete, in order to refresh IPs
@@ -1246,6 +1365,11 @@ bool Connection::sendBuf(Buffer&& buf)
         });
     }
 
+    if (mChatdClient.mTrace)
+    {
+        mChatdClient.mTrace->write(kTraceOut, mShardNo, buf.buf(), buf.dataSize());
+    }
+
     bool rc = wsSendMessage(buf.buf(), buf.dataSize());
     buf.free();
 
@@ -1551,7 +1675,7 @@ bool Connection::rejoinExistingChats()
         try
         {
             Chat& chat = mChatdClient.chats(chatid);
-            if (!chat.isDisabled())
+            if (!chat.isDisabled() && !chat.isJoinDeferred())
                 chat.login();
         }
         catch(std::exception& e)
@@ -1563,6 +1687,62 @@ bool Connection::rejoinExistingChats()
     return true;
 }
 
+// resolve the hostname before the connection is started (while the chats are being loaded),
+// so it can use fresh IPs straight away instead of waiting for DNS or connecting to stale ones
+void Connection::prefetchDns()
+{
+    if (!mDnsCache.isValidUrl(mShardNo))
+    {
+        return; // the URL is fetched at connection, once the session with API is ready
+    }
+
+    // not recorded in the init stats: kStatsQueryDns is the time the connection waits for DNS
+    const std::string &host = mDnsCache.getUrl(mShardNo).host;
+    CHATDS_LOG_DEBUG("Prefetching DNS of %s...", host.c_str());
+
+    auto wptr = weakHandle();
+    wsResolveDNS(mChatdClient.mKarereClient->websocketIO, host.c_str(),
+                 [wptr, this](int statusDNS, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6)
+    {
+        if (wptr.deleted() || mChatdClient.mKarereClient->isTerminated())
+        {
+            return;
+        }
+
+        if (mState != kStateNew)
+        {
+            CHATDS_LOG_DEBUG("DNS prefetch completed but ignored: the connection has already started");
+            return;
+        }
+
+        if (statusDNS < 0 || (ipsv4.empty() && ipsv6.empty()))
+        {
+            CHATDS_LOG_WARNING("DNS prefetch failed (%d). It will be resolved again at connection", statusDNS);
+            return;
+        }
+
+        if (mDnsCache.setIp(mShardNo, ipsv4, ipsv6))
+        {
+            CHATDS_LOG_DEBUG("DNS prefetch updated the cached IPs");
+        }
+        mDnsPrefetched = true;
+    });
+}
+
+// called when all the chats of the shard that are not deferred are logged in
+void Connection::onAllChatsLoggedIn()
+{
+    if (!mLoginStartTs)
+    {
+        return; // already reported, i.e. a deferred chat has been joined afterwards
+    }
+
+    CHATDS_LOG_DEBUG("Logged in to all chats in %lld ms, %zu bytes received",
+                     static_cast<long long>(karere::timestampMs() - mLoginStartTs), mLoginBytesRecv);
+    mChatdClient.mKarereClient->initStats().setLoginBytesRecv(shardNo(), mLoginBytesRecv);
+    mLoginStartTs = 0;
+}
+
 // send JOIN
 void Chat::join()
 {
@@ -1763,7 +1943,7 @@ HistSource Chat::getHistoryFromDbOrServer(unsigned count)
 
                 CHATID_LOG_DEBUG("Fetching history (%u messages) from server...", count);
                 requestHistoryFromServer(-count);
-            }, mChatdClient.mKarereClient->appCtx);
+            }, mChatdClient.mKarereClient->appCtx, workClass(), mChatId.val);
         }
         mServerOldHistCbEnabled = true;
         return kHistSourceServer;
@@ -1805,7 +1985,7 @@ void Chat::requestNodeHistoryFromServer(Id oldestMsgid, uint32_t count)
         assert(mAttachNodesReceived == 0);
         mAttachmentHistDoneReceived = false;
         sendCommand(Command(OP_NODEHIST) + mChatId + oldestMsgid + -count);
-    }, mChatdClient.mKarereClient->appCtx);
+    }, mChatdClient.mKarereClient->appCtx, workClass(), mChatId.val);
 }
 
 Message *Chat::oldest() const
@@ -1843,7 +2023,8 @@ Chat::Chat(Connection& conn, Id chatid, Listener* listener,
     ICrypto* crypto, bool isGroup)
     : mChatdClient(conn.mChatdClient), mConnection(conn), mChatId(chatid),
       mListener(listener), mUsers(initialUsers), mCrypto(crypto),
-      mLastMsgTs(chatCreationTs), mIsGroup(isGroup)
+      mLastMsgTs(chatCreationTs), mIsGroup(isGroup),
+      mDecryptedReactions(kDecryptedReactionsCacheSize)
 {
     assert(mChatId);
     assert(mListener);
@@ -1937,6 +2118,26 @@ void Chat::disable(bool state)
     }
 }
 
+void Chat::deferJoin()
+{
+    mJoinOnDemand = true;
+}
+
+void Chat::requestJoin()
+{
+    if (mJoinRequested)
+        return;
+
+    bool wasDeferred = isJoinDeferred();
+    mJoinRequested = true;
+    if (wasDeferred && !mIsDisabled
+            && mChatdClient.mKarereClient->connState() != karere::Client::kDisconnected)
+    {
+        CHATID_LOG_DEBUG("Joining chat on demand");
+        connect();
+    }
+}
+
 Idx Chat::getHistoryFromDb(unsigned count)
 {
     assert(mHasMoreHistoryInDb); //we are within the db range
@@ -1950,7 +2151,7 @@ Idx Chat::getHistoryFromDb(unsigned count)
         for (auto& reaction : reactions)
         {
             // Add reaction to confirmed reactions queue in message
-            msg->addReaction(reaction.first, reaction.second);
+            msg->addReaction(mReactionTable.intern(reaction.first), reaction.second);
         }
 
         msgIncoming(false, msg, true); //increments mLastHistFetch/DecryptCount, may reset mHasMoreHistoryInDb if this msgid == mLastKnownMsgid
@@ -1998,6 +2199,14 @@ Idx Chat::getHistoryFromDb(unsigned count)
 void Connection::wsHandleMsgCb(char *data, size_t len)
 {
     mTsLastRecv = time(NULL);
+    if (mLoginStartTs)
+    {
+        mLoginBytesRecv += len;
+    }
+    if (mChatdClient.mTrace)
+    {
+        mChatdClient.mTrace->write(kTraceIn, mShardNo, data, len);
+    }
     execCommand(StaticBuffer(data, len));
 }
 
@@ -2013,6 +2222,8 @@ void Connection::wsSendMsgCb(const char *, size_t)
 void Connection::execCommand(const StaticBuffer& buf)
 {
     size_t pos = 0;
+    // history messages (OLDMSG) received in the same packet share their allocations
+    MessageArena histArena;
 //IMPORTANT: Increment pos before calling the command handler, because the handler may throw, in which
 //case the next iteration will not advance and will execute the same command again, resulting in
 //infinite loop
@@ -2084,7 +2295,8 @@ void Connection::execCommand(const StaticBuffer& buf)
                     ID_CSTR(chatid), Command::opcodeToStr(opcode), ID_CSTR(msgid),
                     ID_CSTR(userid), keyid, ts, updated);
 
-                std::unique_ptr<Message> msg(new Message(msgid, userid, ts, updated, msgdata, msglen, false, keyid));
+                std::unique_ptr<Message> msg(Message::create((opcode == OP_OLDMSG) ? &histArena : nullptr,
+                    msgid, userid, ts, updated, msgdata, msglen, keyid));
                 msg->setEncrypted(Message::kEncryptedPending);
                 Chat& chat = mChatdClient.chats(chatid);
                 if (opcode == OP_MSGUPD)
@@ -2825,7 +3037,7 @@ void Chat::onReactionReject(const karere::Id &msgId)
             mPendingReactions.erase(auxit);
             if (message)
             {
-                CALL_LISTENER(onReactionUpdate, msgId, reaction.mReactionString.c_str(), message->getReactionCount(reaction.mReactionString));
+                CALL_LISTENER(onReactionUpdate, msgId, reaction.mReactionString.c_str(), message->getReactionCount(reactionId(reaction.mReactionString)));
             }
         }
     }
@@ -2861,7 +3073,7 @@ void Chat::flushChatPendingReactions()
         else
         {
             const Message &message = at(index);
-            CALL_LISTENER(onReactionUpdate, message.mId, reaction.mReactionString.c_str(), message.getReactionCount(reaction.mReactionString));
+            CALL_LISTENER(onReactionUpdate, message.mId, reaction.mReactionString.c_str(), message.getReactionCount(reactionId(reaction.mReactionString)));
         }
         CALL_DB(cleanPendingReactions, reaction.mMsgId);
     }
@@ -2936,6 +3148,33 @@ bool Chat::haveAllHistoryNotified() const
     return (mNextHistFetchIdx < lownum() || empty());
 }
 
+Message *Chat::loadEvictedMsg(Id msgid, Idx& idx)
+{
+    if (!mEvictedMsgCount || empty())
+        return nullptr;
+
+    idx = mDbInterface->getIdxOfMsgidFromHistory(msgid);
+    if (idx == CHATD_IDX_INVALID || idx >= lownum())
+        return nullptr;
+
+    std::vector<Message*> messages;
+    mDbInterface->fetchDbHistory(idx, 1, messages);
+    if (messages.empty())
+        return nullptr;
+
+    Message *msg = messages[0];
+    assert(msg->id() == msgid);
+
+    // reactions are not part of the history table, load them as getHistoryFromDb() does
+    std::vector<std::pair<std::string, karere::Id>> reactions;
+    mDbInterface->getReactions(msgid, reactions);
+    for (auto& reaction : reactions)
+    {
+        msg->addReaction(mReactionTable.intern(reaction.first), reaction.second);
+    }
+    return msg;
+}
+
 Message *Chat::getMessageFromNodeHistory(Id msgid) const
 {
     return mAttachmentNodes->getMessage(msgid);
@@ -3237,7 +3476,7 @@ Message* Chat::msgSubmit(const char* msg, size_t msglen, unsigned char type, voi
 
         msgSubmit(message, recipients);
 
-    }, mChatdClient.mKarereClient->appCtx);
+    }, mChatdClient.mKarereClient->appCtx, workClass(), mChatId.val);
     return message;
 }
 void Chat::msgSubmit(Message* msg, SetOfIds recipients)
@@ -3598,7 +3837,7 @@ Message* Chat::msgModify(Message& msg, const char* newdata, size_t newlen, void*
             }
         }
 
-    }, mChatdClient.mKarereClient->appCtx);
+    }, mChatdClient.mKarereClient->appCtx, workClass(), mChatId.val);
 
     return upd;
 }
@@ -4843,6 +5082,8 @@ Idx Chat::msgIncoming(bool isNew, Message* message, bool isLocal)
         {
             mNextHistFetchIdx = -1;
         }
+
+        scheduleEviction();
     }
     else
     {
@@ -5222,9 +5463,7 @@ bool Chat::msgNodeHistIncoming(Message *msg)
         if (pms.succeeded())
         {
             assert(!msg->isEncrypted());
-            mAttachmentNodes->addMessage(*msg, false, false);
-            delete msg;
-
+            mAttachmentNodes->addMessage(std::unique_ptr<Message>(msg), false, false);
             return true;
         }
         else
@@ -5234,9 +5473,12 @@ bool Chat::msgNodeHistIncoming(Message *msg)
             {
                 if (!mTruncateAttachment)
                 {
-                    mAttachmentNodes->addMessage(*msg, false, false);
+                    mAttachmentNodes->addMessage(std::unique_ptr<Message>(msg), false, false);
+                }
+                else
+                {
+                    delete msg;
                 }
-                delete msg;
                 mTruncateAttachment = false;
                 bool decrypt = true;
                 mDecryptionAttachmentsHalted = false;
@@ -5385,50 +5627,86 @@ void Chat::onUserLeave(Id userid)
     }
 }
 
-void Chat::onAddReaction(Id msgId, Id userId, std::string reaction)
+bool Chat::getReactionKey(const char *caller, Id msgId, Id &msgUserId, KeyId &keyId)
 {
-    if (reaction.empty())
-    {
-        CHATID_LOG_ERROR("onAddReaction: reaction received is empty. msgid: %s", ID_CSTR(msgId));
-        return;
-    }
-
-    promise::Promise<std::shared_ptr<Buffer>> pms;
     Idx messageIdx = msgIndexFromId(msgId);
     if (messageIdx != CHATD_IDX_INVALID)
     {
         // message loaded in RAM
-        Message &message = at(messageIdx);
+        const Message &message = at(messageIdx);
         if (message.isManagementMessage())
         {
-            CHATID_LOG_ERROR("onAddReaction: reaction received for a management message with msgid: %s", ID_CSTR(msgId));
-            return;
+            CHATID_LOG_ERROR("%s: reaction received for a management message with msgid: %s", caller, ID_CSTR(msgId));
+            return false;
         }
-        pms = mCrypto->reactionDecrypt(msgId, message.userid, message.keyid, reaction);
+        msgUserId = message.userid;
+        keyId = message.keyid;
+        return true;
     }
-    else
+
+    if (!mDbInterface->isValidReactedMessage(msgId, messageIdx))
     {
-        if (!mDbInterface->isValidReactedMessage(msgId, messageIdx))
-        {
-            (messageIdx == CHATD_IDX_INVALID)
-                    ? CHATID_LOG_WARNING("onAddReaction: message id not found. msgid: %s", ID_CSTR(msgId))
-                    : CHATID_LOG_ERROR("onAddReaction: reaction received for a management message with msgid: %s", ID_CSTR(msgId));
-            return;
-        }
+        (messageIdx == CHATD_IDX_INVALID)
+                ? CHATID_LOG_WARNING("%s: message id not found. msgid: %s", caller, ID_CSTR(msgId))
+                : CHATID_LOG_ERROR("%s: reaction received for a management message with msgid: %s", caller, ID_CSTR(msgId));
+        return false;
+    }
+
+    mDbInterface->getMessageUserKeyId(msgId, msgUserId, keyId);
+    return true;
+}
+
+promise::Promise<ReactionId> Chat::decryptReaction(Id msgId, Id msgUserId, KeyId keyId, const std::string &encReaction)
+{
+    // the same reaction to the same message has the same ciphertext, whoever sends it
+    std::string cacheKey;
+    cacheKey.reserve(sizeof(msgId.val) + sizeof(keyId) + encReaction.size());
+    cacheKey.append(reinterpret_cast<const char*>(&msgId.val), sizeof(msgId.val));
+    cacheKey.append(reinterpret_cast<const char*>(&keyId), sizeof(keyId));
+    cacheKey.append(encReaction);
 
-        uint32_t keyId = 0;
-        Id msgUserId = Id::inval();
-        mDbInterface->getMessageUserKeyId(msgId, msgUserId, keyId);
-        pms = mCrypto->reactionDecrypt(msgId, msgUserId, keyId, reaction);
+    ReactionId *cached = mDecryptedReactions.find(cacheKey);
+    if (cached)
+    {
+        return *cached;
     }
 
     auto wptr = weakHandle();
-    pms.then([this, wptr, &msgId, &messageIdx, userId, reaction](std::shared_ptr<Buffer> data)   // data is the UTF-8 string (the emoji)
+    return mCrypto->reactionDecrypt(msgId, msgUserId, keyId, encReaction)
+    .then([this, wptr, cacheKey](std::shared_ptr<Buffer> data) -> ReactionId    // data is the UTF-8 string (the emoji)
+    {
+        if (wptr.deleted())
+            return ReactionTable::kInvalidId;
+
+        ReactionId reaction = mReactionTable.intern(std::string(data->buf(), data->size()));
+        mDecryptedReactions.put(cacheKey, reaction);
+        return reaction;
+    });
+}
+
+void Chat::onAddReaction(Id msgId, Id userId, std::string reaction)
+{
+    if (reaction.empty())
+    {
+        CHATID_LOG_ERROR("onAddReaction: reaction received is empty. msgid: %s", ID_CSTR(msgId));
+        return;
+    }
+
+    Id msgUserId = Id::inval();
+    KeyId keyId = 0;
+    if (!getReactionKey("onAddReaction", msgId, msgUserId, keyId))
+    {
+        return;
+    }
+
+    auto wptr = weakHandle();
+    decryptReaction(msgId, msgUserId, keyId, reaction)
+    .then([this, wptr, msgId, userId](ReactionId reactionId)
     {
         if (wptr.deleted())
             return;
 
-        const std::string reaction(data->buf(), data->size());
+        const std::string &reaction = mReactionTable.get(reactionId);
 
         // Add reaction to db
         CALL_DB(addReaction, msgId, userId, reaction);
@@ -5441,16 +5719,20 @@ void Chat::onAddReaction(Id msgId, Id userId, std::string reaction)
             CALL_DB(delPendingReaction, msgId, reaction);
         }
 
+        Idx messageIdx = msgIndexFromId(msgId);
         if (messageIdx != CHATD_IDX_INVALID)
         {
             // If reaction is loaded in RAM
             Message &message = at(messageIdx);
-            message.addReaction(reaction, userId);
-            CALL_LISTENER(onReactionUpdate, msgId, reaction.c_str(), message.getReactionCount(reaction));
+            message.addReaction(reactionId, userId);
+            CALL_LISTENER(onReactionUpdate, msgId, reaction.c_str(), message.getReactionCount(reactionId));
         }
     })
-    .fail([this, msgId](const ::promise::Error& err)
+    .fail([this, wptr, msgId](const ::promise::Error& err)
     {
+        if (wptr.deleted())
+            return;
+
         CHATID_LOG_ERROR("onAddReaction: failed to decrypt reaction. msgid: %s, error: %s", ID_CSTR(msgId), err.what());
     });
 }
@@ -5463,42 +5745,21 @@ void Chat::onDelReaction(Id msgId, Id userId, std::string reaction)
         return;
     }
 
-    promise::Promise<std::shared_ptr<Buffer>> pms;
-    Idx messageIdx = msgIndexFromId(msgId);
-    if (messageIdx != CHATD_IDX_INVALID)
+    Id msgUserId = Id::inval();
+    KeyId keyId = 0;
+    if (!getReactionKey("onDelReaction", msgId, msgUserId, keyId))
     {
-        // message loaded in RAM
-        Message &message = at(messageIdx);
-        if (message.isManagementMessage())
-        {
-            CHATID_LOG_ERROR("onDelReaction: reaction received for a management message with msgid: %s", ID_CSTR(msgId));
-            return;
-        }
-        pms = mCrypto->reactionDecrypt(msgId, message.userid, message.keyid, reaction);
-    }
-    else
-    {
-        if (!mDbInterface->isValidReactedMessage(msgId, messageIdx))
-        {
-            (messageIdx == CHATD_IDX_INVALID)
-                    ? CHATID_LOG_WARNING("onDelReaction: message id not found. msgid: %s", ID_CSTR(msgId))
-                    : CHATID_LOG_ERROR("onDelReaction: reaction received for a management message with msgid: %s", ID_CSTR(msgId));
-            return;
-        }
-
-        uint32_t keyId = 0;
-        Id msgUserId = Id::inval();
-        mDbInterface->getMessageUserKeyId(msgId, msgUserId, keyId);
-        pms = mCrypto->reactionDecrypt(msgId, msgUserId, keyId, reaction);
+        return;
     }
 
     auto wptr = weakHandle();
-    pms.then([this, wptr, &msgId, &messageIdx, userId, reaction](std::shared_ptr<Buffer> data)   // data is the UTF-8 string (the emoji)
+    decryptReaction(msgId, msgUserId, keyId, reaction)
+    .then([this, wptr, msgId, userId](ReactionId reactionId)
     {
         if (wptr.deleted())
             return;
 
-        const std::string reaction(data->buf(), data->size());
+        const std::string &reaction = mReactionTable.get(reactionId);
 
         // Del reaction from db
         CALL_DB(delReaction, msgId, userId, reaction);
@@ -5511,16 +5772,20 @@ void Chat::onDelReaction(Id msgId, Id userId, std::string reaction)
             CALL_DB(delPendingReaction, msgId, reaction);
         }
 
+        Idx messageIdx = msgIndexFromId(msgId);
         if (messageIdx != CHATD_IDX_INVALID)
         {
             // If reaction is loaded in RAM
             Message &message = at(messageIdx);
-            message.delReaction(reaction, userId);
-            CALL_LISTENER(onReactionUpdate, msgId, reaction.c_str(), message.getReactionCount(reaction));
+            message.delReaction(reactionId, userId);
+            CALL_LISTENER(onReactionUpdate, msgId, reaction.c_str(), message.getReactionCount(reactionId));
         }
     })
-    .fail([this, msgId](const ::promise::Error& err)
+    .fail([this, wptr, msgId](const ::promise::Error& err)
     {
+        if (wptr.deleted())
+            return;
+
         CHATID_LOG_ERROR("onDelReaction: failed to decryp reaction. msgid: %s, error: %s", ID_CSTR(msgId), err.what());
     });
 }
@@ -5589,6 +5854,97 @@ void Chat::resetGetHistory()
 {
     mNextHistFetchIdx = CHATD_IDX_INVALID;
     mServerOldHistCbEnabled = false;
+
+    // the app is not browsing history anymore, so old pages can be dropped
+    scheduleEviction();
+}
+
+void Chat::scheduleEviction()
+{
+    uint32_t maxResident = mChatdClient.maxResidentMsgs();
+    if (mEvictionScheduled || !maxResident
+            || static_cast<size_t>(size()) <= maxResident + Client::kResidentPageSize)
+    {
+        return;
+    }
+
+    mEvictionScheduled = true;
+    auto wptr = weakHandle();
+    marshallCall([wptr, this]()
+    {
+        if (wptr.deleted())
+            return;
+
+        mEvictionScheduled = false;
+        evictOldMessages();
+    }, mChatdClient.mKarereClient->appCtx, workClass(), mChatId.val);
+}
+
+void Chat::evictOldMessages()
+{
+    uint32_t maxResident = mChatdClient.maxResidentMsgs();
+    if (!maxResident || static_cast<size_t>(size()) <= maxResident || !mOldestKnownMsgId)
+        return;
+
+    // messages pending to decrypt, or still being received from server, may not be in db yet
+    if (isFetchingFromServer()
+            || mDecryptOldHaltedAt != CHATD_IDX_INVALID
+            || mDecryptNewHaltedAt != CHATD_IDX_INVALID)
+    {
+        CHATID_LOG_DEBUG("evictOldMessages: history is being fetched or decrypted, skipping");
+        return;
+    }
+
+    // drop whole pages from the oldest end, until at most maxResident messages remain
+    Idx pageSize = Client::kResidentPageSize;
+    Idx count = ((size() - maxResident + pageSize - 1) / pageSize) * pageSize;
+    Idx cutoff = lownum() + std::min(count, size()-1); // oldest message that remains in RAM
+
+    // Messages newer than mNextHistFetchIdx have already been returned to the app by the
+    // current getHistory() session. Dropping them would make getHistory() return them again
+    if (mNextHistFetchIdx != CHATD_IDX_INVALID && cutoff > mNextHistFetchIdx + 1)
+    {
+        cutoff = mNextHistFetchIdx + 1;
+    }
+
+    for (Idx i = lownum(); i < cutoff; i++)
+    {
+        if (at(i).isPendingToDecrypt())
+        {
+            cutoff = i;
+            break;
+        }
+    }
+
+    Idx low = lownum();
+    if (cutoff <= low)
+        return;
+
+    removePendingRichLinks(cutoff - 1);
+    for (Idx i = low; i < cutoff; i++)
+    {
+        const Message& msg = at(i);
+        auto it = mIdToIndexMap.find(msg.id());
+        if (it != mIdToIndexMap.end() && it->second == i)
+        {
+            mIdToIndexMap.erase(it);
+        }
+
+        if (msg.backRefId)
+        {
+            auto refIt = mRefidToIdxMap.find(msg.backRefId);
+            if (refIt != mRefidToIdxMap.end() && refIt->second == i)
+            {
+                mRefidToIdxMap.erase(refIt);
+            }
+        }
+    }
+    deleteMessagesBefore(cutoff);
+
+    // the dropped messages are still in db, and will be loaded again by getHistoryFromDb()
+    mHasMoreHistoryInDb = true;
+    mEvictedMsgCount += (cutoff - low);
+    CHATID_LOG_DEBUG("Dropped %d messages from RAM [%d - %d], %d remain resident", cutoff - low, low, cutoff - 1, size());
 }
 
 void Chat::setOnlineState(ChatState state)
@@ -5606,6 +5962,7 @@ void Chat::setOnlineState(ChatState state)
     {
         if (mChatdClient.areAllChatsLoggedIn(connection().shardNo()))
         {
+            mConnection.onAllChatsLoggedIn();
             mChatdClient.mKarereClient->initStats().shardEnd(InitStats::kStatsLoginChatd, connection().shardNo());
         }
 
@@ -5756,7 +6113,7 @@ bool Chat::findLastTextMsg()
             mLastTextMsg.setState(LastTextMsgState::kFetching);
         }
 
-    }, mChatdClient.mKarereClient->appCtx);
+    }, mChatdClient.mKarereClient->appCtx, workClass(), mChatId.val);
 
     return false;
 }
@@ -6072,40 +6429,50 @@ FilteredHistory::FilteredHistory(DbInterface &db, Chat &chat)
 
 void FilteredHistory::addMessage(Message &msg, bool isNew, bool isLocal)
 {
-    if (msg.size()) // protect against deleted node-attachment messages
+    if (!isNew && mIdToIdxMap.find(msg.id()) != mIdToIdxMap.end())
     {
-        msg.type = msg.buf()[1] + Message::Type::kMsgOffset;
-        assert(msg.type == Message::Type::kMsgAttachment);
+        return; // already loaded, avoid the copy
     }
 
-    Id msgid = msg.id();
+    addMessage(std::unique_ptr<Message>(new Message(msg)), isNew, isLocal);
+}
+
+void FilteredHistory::addMessage(std::unique_ptr<Message> msg, bool isNew, bool isLocal)
+{
+    if (msg->size()) // protect against deleted node-attachment messages
+    {
+        msg->type = msg->buf()[1] + Message::Type::kMsgOffset;
+        assert(msg->type == Message::Type::kMsgAttachment);
+    }
+
+    Id msgid = msg->id();
     if (isNew)
     {
-        mBuffer.emplace_front(new Message(msg));
-        mIdToMsgMap[msgid] =  mBuffer.begin();
         mNewestIdx++;
-        CALL_DB_FH(addMsgToNodeHistory, msg, mNewestIdx);
-        CALL_LISTENER_FH(onReceived, mBuffer.front().get(), mNewestIdx);
+        mIdToIdxMap[msgid] = mNewestIdx;
+        mBuffer.emplace_back(std::move(msg));
+        CALL_DB_FH(addMsgToNodeHistory, *mBuffer.back(), mNewestIdx);
+        CALL_LISTENER_FH(onReceived, mBuffer.back().get(), mNewestIdx);
     }
     else    // from DB or from NODEHIST/HIST
     {
-        if (mIdToMsgMap.find(msgid) == mIdToMsgMap.end())  // if it doesn't exist
+        if (mIdToIdxMap.find(msgid) == mIdToIdxMap.end())  // if it doesn't exist
         {
-            mBuffer.emplace_back(isLocal ? &msg : new Message(msg));    // if it's local (from DB), take the ownership
-            mIdToMsgMap[msgid] = --mBuffer.end();
             mOldestIdx--;
+            mIdToIdxMap[msgid] = mOldestIdx;
+            mBuffer.emplace_front(std::move(msg));
             if (!isLocal)
             {
                 // mOldestIdx can be updated with value in DB
-                CALL_DB_FH(addMsgToNodeHistory, msg, mOldestIdx);
+                CALL_DB_FH(addMsgToNodeHistory, *mBuffer.front(), mOldestIdx);
                 mOldestIdxInDb = (mOldestIdx < mOldestIdxInDb) ? mOldestIdx : mOldestIdxInDb;  // avoid update if already in cache
             }
 
             // I can receive an old message but we don't have to notify because it was not requested by the app
             if (mListener && (mFetchingFromServer || isLocal))
             {
-                CALL_LISTENER_FH(onLoaded, mBuffer.back().get(), mOldestIdx);
-                mNextMsgToNotify = mBuffer.end();
+                CALL_LISTENER_FH(onLoaded, mBuffer.front().get(), mOldestIdx);
+                mNextIdxToNotify = CHATD_IDX_INVALID;
             }
         }
     }
@@ -6113,13 +6480,14 @@ void FilteredHistory::addMessage(Message &msg, bool isNew, bool isLocal)
 
 void FilteredHistory::deleteMessage(const Message &msg)
 {
-    auto it = mIdToMsgMap.find(msg.id());
-    if (it != mIdToMsgMap.end())
+    auto it = mIdToIdxMap.find(msg.id());
+    if (it != mIdToIdxMap.end())
     {
         // Remove message's content and modify updated field, it is the same that delete a file
-        (*it->second)->free();
-        (*it->second)->updated = msg.updated;
-        (*it->second)->type = msg.type;
+        Message *deletedMsg = at(it->second);
+        deletedMsg->free();
+        deletedMsg->updated = msg.updated;
+        deletedMsg->type = msg.type;
         // Only it's necessary notify messages that are loaded in RAM
         CALL_LISTENER_FH(onDeleted, msg.id());
     }
@@ -6131,33 +6499,40 @@ void FilteredHistory::truncateHistory(Id id)
 {
     if (id.isValid())
     {
-        auto it = mIdToMsgMap.find(id);
-        if (it != mIdToMsgMap.end())
+        auto it = mIdToIdxMap.find(id);
+        if (it != mIdToIdxMap.end())
         {
             // id is a message in the history, we want to remove from the next message until the oldest
-            for (auto itLoop = ++it->second; itLoop != mBuffer.end(); itLoop++)
+            Idx truncateIdx = it->second;
+            for (Idx idx = mOldestIdx; idx < truncateIdx; idx++)
             {
-                mIdToMsgMap.erase((*itLoop)->id());
+                mIdToIdxMap.erase(at(idx)->id());
+            }
+            mBuffer.erase(mBuffer.begin(), mBuffer.begin() + (truncateIdx - mOldestIdx));
+            mOldestIdx = truncateIdx;
 
-                // if next message to notify was truncated, point to the end of the buffer
-                if (itLoop == mNextMsgToNotify)
-                {
-                    mNextMsgToNotify = mBuffer.end();
-                }
+            // if next message to notify was truncated, there are no more messages to notify
+            if (mNextIdxToNotify < mOldestIdx)
+            {
+                mNextIdxToNotify = CHATD_IDX_INVALID;
             }
-            mBuffer.erase(it->second, mBuffer.end());
         }
 
         CALL_DB_FH(truncateNodeHistory, id);
-        CALL_DB_FH(getNodeHistoryInfo, mNewestIdx, mOldestIdxInDb);
+        Idx newestIdxInDb;
+        CALL_DB_FH(getNodeHistoryInfo, newestIdxInDb, mOldestIdxInDb);
         CALL_LISTENER_FH(onTruncated, id);
-        mOldestIdx = (mOldestIdx < mOldestIdxInDb) ? mOldestIdxInDb : mOldestIdx;
+        if (mBuffer.empty())
+        {
+            mNewestIdx = newestIdxInDb;
+            mOldestIdx = mNewestIdx + 1;
+        }
     }
     else    // full-history truncated or no remaining attachments
     {
         if (!mBuffer.empty())
         {
-            CALL_LISTENER_FH(onTruncated, (*mBuffer.begin())->id());
+            CALL_LISTENER_FH(onTruncated, mBuffer.back()->id());
         }
 
         clear();
@@ -6169,7 +6544,7 @@ void FilteredHistory::truncateHistory(Id id)
 void FilteredHistory::clear()
 {
     mBuffer.clear();
-    mIdToMsgMap.clear();
+    mIdToIdxMap.clear();
     CALL_DB_FH(clearNodeHistory);
     init();
 }
@@ -6177,18 +6552,19 @@ void FilteredHistory::clear()
 HistSource FilteredHistory::getHistory(uint32_t count)
 {
     // Get messages from RAM
-    if (mNextMsgToNotify != mBuffer.end())
+    if (mNextIdxToNotify != CHATD_IDX_INVALID)
     {
         uint32_t msgsLoadedFromRam = 0;
-        auto it = mNextMsgToNotify;
-        while ((it != mBuffer.end()) && (msgsLoadedFromRam < count))
+        while ((mNextIdxToNotify >= mOldestIdx) && (msgsLoadedFromRam < count))
         {
-            Idx index = mNewestIdx - std::distance(mBuffer.begin(), it);
-            CALL_LISTENER_FH(onLoaded,  it->get(), index);
+            CALL_LISTENER_FH(onLoaded, at(mNextIdxToNotify), mNextIdxToNotify);
             msgsLoadedFromRam++;
+            mNextIdxToNotify--;
+        }
 
-            it++;
-            mNextMsgToNotify = it;
+        if (mNextIdxToNotify < mOldestIdx)
+        {
+            mNextIdxToNotify = CHATD_IDX_INVALID;
         }
 
         if (msgsLoadedFromRam)
@@ -6210,7 +6586,7 @@ HistSource FilteredHistory::getHistory(uint32_t count)
         {
             for (unsigned int i = 0; i < messages.size(); i++)
             {
-                addMessage(*messages[i], false, true);   // takes ownership of Message*
+                addMessage(std::unique_ptr<Message>(messages[i]), false, true);
             }
 
             CALL_LISTENER_FH(onLoaded, NULL, 0);  // All messages requested has been returned or no more messages from this source
@@ -6223,7 +6599,7 @@ HistSource FilteredHistory::getHistory(uint32_t count)
     {
         if (!mFetchingFromServer)
         {
-            const Message *msgNode = !mBuffer.empty() ? mBuffer.back().get() : NULL;
+            const Message *msgNode = !mBuffer.empty() ? mBuffer.front().get() : NULL;
             const Message *msgText = mChat->oldest();
             Id oldestMsgid = Id::inval();
             if (msgNode && msgText)
@@ -6264,7 +6640,7 @@ void FilteredHistory::setHandler(FilteredHistoryHandler *handler)
     if (mListener)
         throw std::runtime_error("App node history handler is already set, remove it first");
 
-    mNextMsgToNotify = mBuffer.begin();
+    mNextIdxToNotify = mBuffer.empty() ? CHATD_IDX_INVALID : mNewestIdx;
     mListener = handler;
 }
 
@@ -6282,14 +6658,8 @@ void FilteredHistory::finishFetchingFromServer()
 
 Message *FilteredHistory::getMessage(Id id)
 {
-    Message *msg = NULL;
-    auto msgItetrator = mIdToMsgMap.find(id);
-    if (msgItetrator != mIdToMsgMap.end())
-    {
-        msg = msgItetrator->second->get();
-    }
-
-    return msg;
+    auto it = mIdToIdxMap.find(id);
+    return (it != mIdToIdxMap.end()) ? at(it->second) : NULL;
 }
 
 Idx FilteredHistory::getMessageIdx(Id id)
@@ -6302,7 +6672,7 @@ void FilteredHistory::init()
     mNewestIdx = -1;
     mOldestIdx = 0;
     mOldestIdxInDb = 0;
-    mNextMsgToNotify = mBuffer.begin();
+    mNextIdxToNotify = CHATD_IDX_INVALID;
     mHaveAllHistory = false;
 }
 
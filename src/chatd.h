@@ -11,7 +11,10 @@
 #include <base/promise.h>
 #include <base/timers.hpp>
 #include <base/trackDelete.h>
+#include <base/flatHashMap.h>
+#include <base/lruCache.h>
 #include <chatdMsg.h>
+#include <chatdTrace.h>
 #include <url.h>
 #include <net/websocketsIO.h>
 #include <userAttrCache.h>
@@ -455,9 +458,6 @@ protected:
     /** Target IP address being used for the reconnection in-flight */
     std::string mTargetIp;
 
-    /** ip version to try first (both are tried) */
-    bool usingipv6 = false;
-
     /** RetryController that manages the reconnection's attempts */
     std::unique_ptr<karere::rh::IRetryController> mRetryCtrl;
 
@@ -469,6 +469,13 @@ protected:
     /** Timestamp of the last received data from chatd */
     time_t mTsLastRecv = 0;
 
+    /** Time (in ms) when the chats started to be joined after the last (re)connection.
+     * Zero once all of them are logged in */
+    int64_t mLoginStartTs = 0;
+
+    /** Bytes received since the chats started to be joined, until all of them are logged in */
+    size_t mLoginBytesRecv = 0;
+
     /** Handler of the timeout for the ECHO command */
     megaHandle mEchoTimer = 0;
 
@@ -481,6 +488,10 @@ protected:
     /** Flag to indicate if a fresh URL is being fetched */
     bool mFetchingUrl = false;
 
+    /** Flag to indicate that the IPs in the DNS cache have just been resolved by prefetchDns(),
+     * so the first connection attempt uses them without resolving the hostname again */
+    bool mDnsPrefetched = false;
+
     // ---- callbacks called from libwebsocketsIO ----
     virtual void wsConnectCb();
     virtual void wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len);
@@ -495,6 +506,8 @@ protected:
 // Destroys the buffer content
     bool sendBuf(Buffer&& buf);
     bool rejoinExistingChats();
+    void onAllChatsLoggedIn();
+    void prefetchDns();
     void resendPending();
     void join(karere::Id chatid);
     void hist(karere::Id chatid, long count);
@@ -652,7 +665,11 @@ class FilteredHistory
 public:
     FilteredHistory(DbInterface &db, Chat &chat);
 
+    /** @brief Adds a copy of \c msg, which remains owned by the caller */
     void addMessage(Message &msg, bool isNew, bool isLocal);
+
+    /** @brief Adds \c msg, taking its ownership */
+    void addMessage(std::unique_ptr<Message> msg, bool isNew, bool isLocal);
     void deleteMessage(const Message &msg);
     void truncateHistory(karere::Id id);
     void clear();
@@ -672,11 +689,12 @@ protected:
     Chat *mChat;
     FilteredHistoryHandler *mListener;
 
-    /** Contains the messages in the history-buffer */
-    std::list<std::unique_ptr<Message>> mBuffer;
+    /** Contains the messages in the history-buffer, ordered by idx: the front is
+     * the message with \c mOldestIdx and the back the one with \c mNewestIdx */
+    std::deque<std::unique_ptr<Message>> mBuffer;
 
-    /** Maps msgid's to their position in the history-buffer */
-    std::map<karere::Id, std::list<std::unique_ptr<Message>>::iterator> mIdToMsgMap;
+    /** Maps msgid's to their idx in the history-buffer */
+    karere::FlatHashMap<karere::Id, Idx> mIdToIdxMap;
 
     /** Index of the newest (most recent) message loaded in RAM */
     Idx mNewestIdx;
@@ -687,8 +705,9 @@ protected:
     /** Index of the oldest message available in DB */
     Idx mOldestIdxInDb;
 
-    /** Iterator pointing to the next message to be notified from buffer in memory */
-    std::list<std::unique_ptr<Message>>::iterator mNextMsgToNotify;
+    /** Index of the next message to be notified from buffer in memory, or
+     * CHATD_IDX_INVALID if there are no more */
+    Idx mNextIdxToNotify;
 
     /** True if we reached the beginning of the history */
     bool mHaveAllHistory = false;
@@ -697,6 +716,13 @@ protected:
     bool mFetchingFromServer = false;
 
     void init();
+
+    /** Returns the message with index \c idx in the history-buffer, or NULL if not loaded in RAM */
+    Message *at(Idx idx) const
+    {
+        assert(mBuffer.size() == (size_t)(mNewestIdx - mOldestIdx + 1));
+        return (idx >= mOldestIdx && idx <= mNewestIdx) ? mBuffer[idx - mOldestIdx].get() : NULL;
+    }
 };
 
 struct ChatDbInfo;
@@ -782,7 +808,7 @@ protected:
     PendingReactions mPendingReactions;
     OutputQueue::iterator mNextUnsent;
     bool mIsFirstJoin = true;
-    std::map<karere::Id, Idx> mIdToIndexMap;
+    karere::FlatHashMap<karere::Id, Idx> mIdToIndexMap;
     karere::Id mLastReceivedId;
     Idx mLastReceivedIdx = CHATD_IDX_INVALID;
     karere::Id mLastSeenId;
@@ -811,6 +837,12 @@ protected:
     /** @brief Have reached the beggining of the history (not necessarily the end of it) */
     bool mHaveAllHistory = false;
     bool mIsDisabled = false;
+    /** @brief The JOIN is deferred by the lazy-join policy until the chat is needed */
+    bool mJoinOnDemand = false;
+    /** @brief The chat has been needed (opened, pushed...), so it's joined even if deferred */
+    bool mJoinRequested = false;
+    /** @brief The chat is opened by the app, so its work is scheduled with priority */
+    bool mForeground = false;
     Idx mNextHistFetchIdx = CHATD_IDX_INVALID;
     Idx mOldestIdxInDb = CHATD_IDX_INVALID;
     DbInterface* mDbInterface = nullptr;
@@ -867,11 +899,21 @@ protected:
     bool mTruncateAttachment = false;
     /** Indicates the reaction sequence number for this chatroom */
     karere::Id mReactionSn = karere::Id::inval();
+    /** Reactions (emoji strings) seen in this chat. Messages keep only their ids */
+    ReactionTable mReactionTable;
+    enum { kDecryptedReactionsCacheSize = 512 };
+    /** Decrypted reactions, keyed by msgid, keyid and ciphertext, so that repeated
+     * ADDREACTION/DELREACTION of the same reaction are not decrypted again */
+    karere::LruCache<std::string, ReactionId> mDecryptedReactions;
     /** Indicates the retention time for this chat room, after which the previous messages are automatically deleted */
     uint32_t mRetentionTime = 0;
+    /** Total number of messages dropped from RAM by the resident window (see Client::setMaxResidentMsgs) */
+    uint64_t mEvictedMsgCount = 0;
+    /** True while an eviction pass is queued in the event loop */
+    bool mEvictionScheduled = false;
     // ====
     std::map<karere::Id, Message*> mPendingEdits;
-    std::map<BackRefId, Idx> mRefidToIdxMap;
+    karere::FlatHashMap<BackRefId, Idx> mRefidToIdxMap;
     Chat(Connection& conn, karere::Id chatid, Listener* listener,
     const karere::SetOfIds& users, uint32_t chatCreationTs, ICrypto* crypto, bool isGroup);
     void push_forward(Message* msg) { mForwardList.emplace_back(msg); }
@@ -893,6 +935,8 @@ protected:
     void onUserLeave(karere::Id userid);
     void onAddReaction(karere::Id msgId, karere::Id userId, std::string reaction);
     void onDelReaction(karere::Id msgId, karere::Id userId, std::string reaction);
+    bool getReactionKey(const char *caller, karere::Id msgId, karere::Id &msgUserId, KeyId &keyId);
+    promise::Promise<ReactionId> decryptReaction(karere::Id msgId, karere::Id msgUserId, KeyId keyId, const std::string &encReaction);
     void onReactionSn(karere::Id rsn);
     void onPreviewersUpdate(uint32_t numPrev);
     void onJoinComplete();
@@ -935,6 +979,8 @@ protected:
     void removeMessageReactions(Idx idx, bool cleanPrevious = false);
     void manageRichLinkMessage(Message &message);
     void attachmentHistDone();
+    void scheduleEviction();
+    void evictOldMessages();
     friend class Connection;
     friend class Client;
 /// @endcond PRIVATE
@@ -960,9 +1006,25 @@ public:
     Idx size() const { return mForwardList.size() + mBackwardList.size(); }
     /** @brief Whether we have any messages in the history buffer */
     bool empty() const { return mForwardList.empty() && mBackwardList.empty();}
+    /** @brief The number of messages that have been dropped from the RAM history
+     * buffer because they fell out of the resident window. They are re-loaded
+     * from the local db when needed */
+    uint64_t evictedMsgCount() const { return mEvictedMsgCount; }
     bool isDisabled() const { return mIsDisabled; }
     bool isFirstJoin() const { return mIsFirstJoin; }
     void disable(bool state);
+    /** @brief Defers the JOIN of the chat until requestJoin() is called, so it's neither
+     * joined at connection nor at reconnections. Used by the lazy-join policy for archived
+     * and idle chats (see karere::Client::setLazyJoin) */
+    void deferJoin();
+    /** @brief Signals that the chat is needed. If its JOIN was deferred, it's joined now */
+    void requestJoin();
+    bool isJoinDeferred() const { return mJoinOnDemand && !mJoinRequested; }
+    /** @brief Sets whether the chat is opened by the app. The work of the chats opened by
+     * the app is processed before the work of the rest (see karere::WorkScheduler) */
+    void setForeground(bool foreground) { mForeground = foreground; }
+    /** @brief The class of the work that this chat posts to the event loop */
+    karere::WorkClass workClass() const { return mForeground ? karere::kWorkForeground : karere::kWorkBackground; }
     /** The index of the oldest decrypted message in the RAM history buffer.
      * This will be greater than lownum() if there are not-yet-decrypted messages
      * at the start of the buffer, i.e. when more history has been fetched, but
@@ -1116,6 +1178,16 @@ public:
         return (it == mIdToIndexMap.end()) ? CHATD_IDX_INVALID : it->second;
     }
 
+    /**
+     * @brief Loads from db a message that has been dropped from the RAM history buffer
+     * by the resident window (see Client::setMaxResidentMsgs)
+     * @param msgid The message id
+     * @param idx Output parameter with the index of the message
+     * @return A new message owned by the caller, with its confirmed reactions, or NULL
+     * if the message has not been dropped from RAM or it's not in db
+     */
+    Message *loadEvictedMsg(karere::Id msgid, Idx& idx);
+
     /**
      * @brief Returns the message with specific msgid that it's stored at node history
      * @param msgid The message id
@@ -1354,6 +1426,10 @@ public:
     void sendSync();
     void manageReaction(const Message &message, const std::string &reaction, Opcode opcode);
     const PendingReactions &getPendingReactions() const;
+    /** @brief Returns the id of \c reaction in this chat, or ReactionTable::kInvalidId
+     * if it has never been added to a message of this chat */
+    ReactionId reactionId(const std::string &reaction) const { return mReactionTable.find(reaction); }
+    const std::string &reactionString(ReactionId id) const { return mReactionTable.get(id); }
     void addPendingReaction(const std::string &reaction, const std::string &encReaction, karere::Id msgId, uint8_t status);
     void removePendingReaction(const std::string &reaction, karere::Id msgId);
     void retryPendingReactions();
@@ -1523,6 +1599,12 @@ protected:
     /** Timestamp of the next check of retention history for all chats, or zero (disabled) */
     uint32_t mRetentionCheckTs;
 
+    /** Max number of messages kept in the RAM history buffer of each chat, or zero (no limit) */
+    uint32_t mMaxResidentMsgs = 0;
+
+    /** Capture of the frames sent and received by all the connections, if enabled */
+    std::unique_ptr<TraceWriter> mTrace;
+
 public:
     // Chatd Version:
     // - Version 0: initial version
@@ -1547,6 +1629,9 @@ public:
     // Minimum retention history check period (in seconds)
     static const unsigned kMinRetentionTimeout = 60;
 
+    // Messages are dropped from the RAM history buffer in pages of this size
+    static const unsigned kResidentPageSize = 256;
+
     Client(karere::Client *aKarereClient);
     ~Client();
 
@@ -1564,6 +1649,10 @@ public:
     uint8_t richLinkState() const;
     bool areAllChatsLoggedIn(int shard = -1);
 
+    /** @brief Starts resolving the hostnames of the given shards, before their chats are
+     * created, so the IPs in the DNS cache are fresh by the time they are connected */
+    void prefetchShards(const std::set<int>& shards);
+
     uint8_t keepaliveType();
     void setKeepaliveType(bool isInBackground);
 
@@ -1630,6 +1719,48 @@ public:
      */
     void setRetentionTimer();
 
+    /**
+     * @brief Limits the number of messages kept in the RAM history buffer of each chat.
+     *
+     * When a chat holds more than \c count + kResidentPageSize messages, its oldest
+     * messages are dropped from RAM in pages of kResidentPageSize, until at most
+     * \c count messages remain. Dropped messages stay in the local db and are
+     * loaded again by Chat::getHistory() when the app scrolls back to them.
+     * Messages that have been returned to the app by the ongoing getHistory()
+     * session, and messages that are not yet decrypted, are never dropped.
+     *
+     * @param count Max number of resident messages per chat. Zero disables the limit.
+     */
+    void setMaxResidentMsgs(uint32_t count);
+    uint32_t maxResidentMsgs() const;
+
+    /** @brief Number of messages currently loaded in RAM, for all chats */
+    size_t residentMsgCount() const;
+
+    /** @brief Number of messages dropped from RAM by the resident window, for all chats */
+    uint64_t evictedMsgCount() const;
+
+    /**
+     * @brief Starts capturing the frames sent to and received from chatd, by all the
+     * connections, to a trace file (see TraceWriter). A capture in progress is replaced.
+     *
+     * @param path Path of the trace file. It is overwritten if it exists
+     * @param maxBytes Size at which the capture stops, or zero for no limit
+     * @return false if the file can't be created
+     */
+    bool startTrace(const std::string& path, size_t maxBytes = 0);
+    void stopTrace();
+    bool isTracing() const;
+
+    /**
+     * @brief Processes a frame of a trace as if it had been received from chatd by
+     * the connection to shard \c shardNo. Used to replay traces offline, against
+     * chats created with createChat() and a connection that is never connected
+     *
+     * @return false if there is no connection for that shard
+     */
+    bool replayFrame(int shardNo, const StaticBuffer& frame);
+
     friend class Connection;
     friend class Chat;
 };
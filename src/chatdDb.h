@@ -569,6 +569,7 @@ public:
 
         SqliteStmt stmt(mDb, query.c_str());
         stmt << mChat.chatId() << idx << count;
+        chatd::MessageArena arena;
         int i = 0;
         while(stmt.step())
         {
@@ -577,8 +578,7 @@ public:
             karere::Id userid(stmt.uint64Col(1));
             unsigned ts = stmt.uintCol(2);
             chatd::KeyId keyid = stmt.uintCol(6);
-            Buffer buf;
-            stmt.blobCol(4, buf);
+            StaticBuffer data = stmt.blobColView(4);
 #ifndef NDEBUG
             auto tableIdx = stmt.intCol(5);
             if(tableIdx != idx - (int)messages.size()) //we go backward in history, hence the -messages.size()
@@ -589,8 +589,8 @@ public:
                 assert(false);
             }
 #endif
-            auto msg = new chatd::Message(msgid, userid, ts, stmt.intCol(8), std::move(buf),
-                false, keyid, (unsigned char)stmt.intCol(3));
+            auto msg = chatd::Message::create(&arena, msgid, userid, ts, stmt.intCol(8), data.buf(),
+                data.dataSize(), keyid, (unsigned char)stmt.intCol(3));
             msg->backRefId = stmt.uint64Col(7);
             msg->setEncrypted((uint8_t)stmt.intCol(9));
             messages.push_back(msg);
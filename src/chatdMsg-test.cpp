@@ -0,0 +1,203 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include <chatdMsg.h>
+#include <vector>
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#include <malloc.h>
+#endif
+
+TESTS_INIT();
+using namespace chatd;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+//Count heap allocations by interposing malloc
+extern "C" void* __libc_malloc(size_t size);
+static size_t gMallocCount = 0;
+extern "C" void* malloc(size_t size)
+{
+    gMallocCount++;
+    return __libc_malloc(size);
+}
+#define ALLOC_COUNT_SUPPORTED 1
+#else
+static size_t gMallocCount = 0;
+#endif
+
+//Benchmark that also prints the number of heap allocations, where they can be counted
+template <class F>
+void benchmarkAllocs(const char* name, int count, F&& func)
+{
+    size_t mallocsBefore = gMallocCount;
+    test::benchmark(name, count, std::forward<F>(func));
+#ifdef ALLOC_COUNT_SUPPORTED
+    printf("      %zu allocations\n", gMallocCount - mallocsBefore);
+#else
+    (void)mallocsBefore;
+#endif
+}
+
+//Loads a page of messages the way ChatdSqliteDb::loadMessages() does
+void loadPage(MessageArena* arena, std::vector<std::unique_ptr<Message>>& page, const std::string& payload)
+{
+    for (int i = 0; i < 256; i++)
+    {
+        page.emplace_back(Message::create(arena, 1000 + i, 123, 1600000000 + i, 0,
+            payload.c_str(), payload.size() - (i % 16), 0xfffffffe, Message::kMsgNormal));
+    }
+}
+
+int main()
+{
+
+TestGroup("MessageArena")
+{
+    syncTest("Messages allocated in an arena own their payload")
+    {
+        std::string text = "hello world, this is a message";
+        std::unique_ptr<Message> msg;
+        {
+            MessageArena arena;
+            msg.reset(Message::create(&arena, 1, 2, 3, 0, text.c_str(), text.size(), 4, Message::kMsgNormal));
+        }
+        //arena has been destroyed, the message keeps the block alive
+        check(msg->id().val == 1 && msg->userid.val == 2 && msg->ts == 3 && msg->keyid == 4);
+        check(msg->type == Message::kMsgNormal && !msg->isSending());
+        check(msg->dataEquals(text.c_str(), text.size()));
+        //growing the payload moves it to the heap
+        msg->append(std::string(4000, 'x'));
+        check(msg->dataSize() == text.size() + 4000);
+        check(memcmp(msg->buf(), text.c_str(), text.size()) == 0);
+        msg->assign("short", 5);
+        check(msg->dataEquals("short", 5));
+    });
+    syncTest("Empty and large payloads")
+    {
+        MessageArena arena;
+        std::unique_ptr<Message> empty(Message::create(&arena, 1, 2, 3, 0, nullptr, 0));
+        check(empty->empty() && !empty->buf());
+        std::string big(MessageArena::kMaxPayloadSize + 1, 'y');
+        std::unique_ptr<Message> large(Message::create(&arena, 1, 2, 3, 0, big.c_str(), big.size()));
+        check(large->dataEquals(big.c_str(), big.size()));
+        std::unique_ptr<Message> heap(Message::create(nullptr, 5, 6, 7, 0, "abc", 3));
+        check(heap->dataEquals("abc", 3));
+        std::unique_ptr<Message> copy(new Message(*heap));
+        check(copy->dataEquals("abc", 3) && copy->id().val == 5);
+    });
+    syncTest("Messages outlive the arena in any order")
+    {
+        std::string text(100, 'z');
+        std::vector<std::unique_ptr<Message>> page;
+        {
+            MessageArena arena;
+            for (int i = 0; i < 1000; i++) //spans several blocks
+            {
+                page.emplace_back(Message::create(&arena, i, 0, 0, 0, text.c_str(), text.size()));
+            }
+        }
+        for (size_t i = 0; i < page.size(); i += 2)
+        {
+            page[i].reset();
+        }
+        for (size_t i = 1; i < page.size(); i += 2)
+        {
+            check(page[i]->id().val == i && page[i]->dataEquals(text.c_str(), text.size()));
+        }
+        page.clear();
+    });
+});
+
+TestGroup("Reactions")
+{
+    syncTest("Interned reactions keep the order in which they were added")
+    {
+        ReactionTable table;
+        ReactionId smile = table.intern("\xF0\x9F\x98\x80");
+        ReactionId heart = table.intern("\xE2\x9D\xA4");
+        check(table.intern("\xF0\x9F\x98\x80") == smile && table.size() == 2);
+        check(table.find("\xE2\x9D\xA4") == heart);
+        check(table.find("x") == ReactionTable::kInvalidId);
+        check(table.get(heart) == "\xE2\x9D\xA4");
+
+        std::unique_ptr<Message> msg(Message::create(nullptr, 1, 2, 3, 0, "abc", 3));
+        check(!msg->hasConfirmedReactions());
+        msg->addReaction(heart, 10);
+        msg->addReaction(smile, 11);
+        msg->addReaction(heart, 12);
+        msg->addReaction(heart, 12); //duplicate is ignored
+        check(msg->getReactionCount(heart) == 2 && msg->getReactionCount(smile) == 1);
+        check(msg->hasReacted(heart, 12) && !msg->hasReacted(smile, 12));
+        check(!msg->hasReacted(ReactionTable::kInvalidId, 12));
+        auto users = msg->getReactionUsers(heart);
+        check(users.size() == 2 && users[0].val == 10 && users[1].val == 12);
+        auto reactions = msg->getReactions();
+        check(reactions.size() == 2);
+        check(reactions[0].first == heart && reactions[0].second == 2);
+        check(reactions[1].first == smile && reactions[1].second == 1);
+
+        //the reaction keeps its position until its last user removes it
+        msg->delReaction(heart, 10);
+        check(msg->getReactions()[0].first == heart && msg->getReactionCount(heart) == 1);
+        check(msg->getReactionUsers(smile).size() == 1 && msg->getReactionUsers(smile)[0].val == 11);
+        msg->delReaction(heart, 12);
+        check(msg->getReactionCount(heart) == 0 && msg->getReactions().size() == 1);
+        msg->delReaction(smile, 12); //not reacted, nothing changes
+        check(msg->getReactionCount(smile) == 1);
+        msg->cleanReactions();
+        check(!msg->hasConfirmedReactions());
+    });
+    syncTest("Reaction limits")
+    {
+        ReactionTable table;
+        std::unique_ptr<Message> msg(Message::create(nullptr, 1, 2, 3, 0, "abc", 3));
+        karere::Id me(100);
+        for (int i = 0; i < Message::maxOwnReactions; i++)
+        {
+            check(msg->allowReact(me, table.intern(std::to_string(i))) == 0);
+            msg->addReaction(table.intern(std::to_string(i)), me);
+        }
+        check(msg->allowReact(me, table.intern("new")) == 1);
+        for (int i = Message::maxOwnReactions; i < Message::maxMessageReactions; i++)
+        {
+            msg->addReaction(table.intern(std::to_string(i)), i);
+        }
+        karere::Id other(200);
+        check(msg->allowReact(other, table.intern("new")) == -1);
+        check(msg->allowReact(other, table.find("0")) == 0);
+    });
+});
+
+TestGroup("Performance")
+{
+    syncTest("Loading history pages of 256 messages")
+    {
+        std::string payload(150, 'p');
+        size_t total = 0;
+        benchmarkAllocs("Heap, 1000 pages", 1000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                std::vector<std::unique_ptr<Message>> page;
+                page.reserve(256);
+                loadPage(nullptr, page, payload);
+                total += page.size();
+            }
+        });
+        benchmarkAllocs("MessageArena, 1000 pages", 1000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+            {
+                std::vector<std::unique_ptr<Message>> page;
+                page.reserve(256);
+                MessageArena arena;
+                loadPage(&arena, page, payload);
+                total += page.size();
+            }
+        });
+        check(total == 2 * 1000 * 256);
+    });
+});
+
+return test::gNumFailed;
+}
@@ -5,6 +5,9 @@
 #include <string>
 #include <buffer.h>
 #include <memory>
+#include <new>
+#include <deque>
+#include <unordered_map>
 #include "karereId.h"
 
 enum
@@ -481,6 +484,129 @@ enum Priv: signed char
     PRIV_OPER = 3
 };
 
+typedef uint32_t ReactionId;
+
+/** @brief Intern table of the reactions (UTF-8 emoji strings) seen in a chat.
+ *
+ * Messages store reactions as small integer ids into this table, so that the
+ * same emoji used in many messages is stored once, and comparisons are integer
+ * comparisons. Ids are never reused, and the strings are kept until the table is
+ * destroyed, so references returned by get() remain valid.
+ */
+class ReactionTable
+{
+public:
+    enum: ReactionId { kInvalidId = 0xffffffff };
+
+    /** @brief Returns the id of \c reaction, adding it to the table if needed */
+    ReactionId intern(const std::string& reaction)
+    {
+        auto it = mIds.find(reaction);
+        if (it != mIds.end())
+            return it->second;
+
+        ReactionId id = static_cast<ReactionId>(mReactions.size());
+        assert(id != kInvalidId);
+        mReactions.emplace_back(reaction);
+        mIds.emplace(reaction, id);
+        return id;
+    }
+
+    /** @brief Returns the id of \c reaction, or kInvalidId if it has never been interned */
+    ReactionId find(const std::string& reaction) const
+    {
+        auto it = mIds.find(reaction);
+        return (it != mIds.end()) ? it->second : static_cast<ReactionId>(kInvalidId);
+    }
+
+    const std::string& get(ReactionId id) const
+    {
+        assert(id < mReactions.size());
+        return mReactions[id];
+    }
+
+    size_t size() const { return mReactions.size(); }
+
+protected:
+    std::deque<std::string> mReactions;  // deque keeps references stable on growth
+    std::unordered_map<std::string, ReactionId> mIds;
+};
+
+/** @brief Page-scoped allocator for the Message objects of a history page.
+ *
+ * The message object and its payload are carved from a shared block, instead
+ * of being two separate heap allocations. A block is freed when the arena and
+ * all the messages allocated from it have been deleted, so messages created by
+ * Message::create() can be owned by std::unique_ptr<Message> like any other.
+ * Intended to live for the duration of a history load: a message that outlives
+ * its page keeps the whole block alive.
+ *
+ * Not thread safe: all messages of an arena must be deleted by the same thread.
+ */
+class MessageArena
+{
+public:
+    enum
+    {
+        kBlockSize = 16384,
+        kMaxPayloadSize = 2048  // larger payloads go to the heap
+    };
+    MessageArena() {}
+    MessageArena(const MessageArena&) = delete;
+    MessageArena& operator=(const MessageArena&) = delete;
+    ~MessageArena()
+    {
+        if (mBlock)
+            release(mBlock);
+    }
+
+protected:
+    struct Block
+    {
+        size_t mRefs;
+        size_t mUsed;
+    };
+    // Every Message allocation is preceded by a header pointing to its block, or null if heap-allocated
+    enum { kHeaderSize = 16 };
+    Block* mBlock = nullptr;
+
+    static char* blockData(Block* block) { return reinterpret_cast<char*>(block) + kHeaderSize; }
+    static Block*& headerOf(void* ptr) { return *reinterpret_cast<Block**>(static_cast<char*>(ptr) - kHeaderSize); }
+    static void release(Block* block)
+    {
+        if (--block->mRefs == 0)
+            ::free(block);
+    }
+
+    /** Returns storage for \c size bytes, preceded by its header, or nullptr if it doesn't fit in a block */
+    void* alloc(size_t size)
+    {
+        size = kHeaderSize + ((size + kHeaderSize - 1) & ~(size_t)(kHeaderSize - 1));
+        if (size > kBlockSize)
+            return nullptr;
+
+        if (!mBlock || mBlock->mUsed + size > kBlockSize)
+        {
+            Block* block = static_cast<Block*>(::malloc(kHeaderSize + kBlockSize));
+            if (!block)
+                throw std::bad_alloc();
+
+            if (mBlock)
+                release(mBlock);
+            mBlock = block;
+            mBlock->mRefs = 1;  // held by the arena
+            mBlock->mUsed = 0;
+        }
+
+        char* ptr = blockData(mBlock) + mBlock->mUsed + kHeaderSize;
+        mBlock->mUsed += size;
+        mBlock->mRefs++;
+        headerOf(ptr) = mBlock;
+        return ptr;
+    }
+    friend class Message;
+};
+
 class Message: public Buffer
 {
 public:
@@ -575,38 +701,6 @@ public:
         Priv privilege = PRIV_INVALID;
     };
 
-    /** @brief Contains a UTF-8 string that represents the reaction
-     * and a vector of userid's associated to that reaction. */
-    struct Reaction
-    {
-        std::string mReaction;
-        std::vector<karere::Id> mUsers;
-
-        Reaction(std::string reaction)
-        {
-            mReaction = reaction;
-        }
-
-         /** @brief Returns the userId index in case that exists. Otherwise returns -1 **/
-        int userIndex(karere::Id userId) const
-        {
-            int i = 0;
-            for (auto &it : mUsers)
-            {
-                if (it == userId)
-                {
-                    return i;
-                }
-                i++;
-            }
-            return -1;
-        }
-        bool hasReacted(karere::Id userId) const
-        {
-            return userIndex(userId) != -1;
-        }
-    };
-
     class CallEndedInfo
     {
         public:
@@ -664,9 +758,10 @@ private:
     karere::Id mId;
     bool mIdIsXid = false;
 
-    /* Reactions must be ordered in the same order as they were added,
-    so we need a sequence container */
-    std::vector<Reaction> mReactions;
+    /* Reactions, packed in a single array in the order in which they were added:
+    for each reaction, a header slot with its ReactionId in the high 32 bits and
+    its number of users in the low 32 bits, followed by the userids that reacted */
+    std::vector<uint64_t> mReactions;
 
 protected:
     uint8_t mIsEncrypted = kNotEncrypted;
@@ -714,6 +809,64 @@ public:
           backRefs(msg.backRefs), userp(msg.userp), userFlags(msg.userFlags), richLinkRemoved(msg.richLinkRemoved)
     {}
 
+    /** @brief Creates a received (not sending) message. If \c arena is provided,
+     * the message and its payload are allocated from it, otherwise from the heap.
+     * Either way, the message is released with \c delete */
+    static Message* create(MessageArena* arena, karere::Id aMsgid, karere::Id aUserid, uint32_t aTs,
+            uint16_t aUpdated, const char* msg, size_t msglen, KeyId aKeyid=CHATD_KEYID_INVALID,
+            unsigned char aType=kMsgInvalid)
+    {
+        if (arena && msglen <= MessageArena::kMaxPayloadSize)
+        {
+            void* mem = arena->alloc(sizeof(Message) + msglen);
+            if (mem)
+            {
+                char* payload = msglen ? static_cast<char*>(mem) + sizeof(Message) : nullptr;
+                return ::new (mem) Message(payload, msg, msglen, aMsgid, aUserid, aTs, aUpdated, aKeyid, aType);
+            }
+        }
+        return new Message(aMsgid, aUserid, aTs, aUpdated, msg, msglen, false, aKeyid, aType);
+    }
+
+    static void* operator new(size_t size)
+    {
+        void* mem = ::malloc(MessageArena::kHeaderSize + size);
+        if (!mem)
+            throw std::bad_alloc();
+
+        void* ptr = static_cast<char*>(mem) + MessageArena::kHeaderSize;
+        MessageArena::headerOf(ptr) = nullptr;
+        return ptr;
+    }
+    static void operator delete(void* ptr)
+    {
+        if (!ptr)
+            return;
+
+        MessageArena::Block* block = MessageArena::headerOf(ptr);
+        if (block)
+        {
+            MessageArena::release(block);
+        }
+        else
+        {
+            ::free(static_cast<char*>(ptr) - MessageArena::kHeaderSize);
+        }
+    }
+
+protected:
+    // Used by create(): the payload is stored in \c payload, right after the object
+    Message(char* payload, const char* msg, size_t msglen, karere::Id aMsgid, karere::Id aUserid,
+            uint32_t aTs, uint16_t aUpdated, KeyId aKeyid, unsigned char aType)
+        :Buffer(payload, msglen, msglen, msglen), mId(aMsgid), userid(aUserid), ts(aTs),
+            updated(aUpdated), keyid(aKeyid), type(aType), userp(nullptr)
+    {
+        if (msglen)
+            memcpy(payload, msg, msglen);
+    }
+
+public:
+
     /** @brief Returns the ManagementInfo structure contained within the message
      * content. Throws if the message is not a management message, or if the
      * size of the message contents is smaller than the size of ManagementInfo,
@@ -860,24 +1013,22 @@ public:
         - returns 1, if our own user has reached the maximum limit of maxOwnReactions reactions
         - returns 0, if we can add the reaction
     **/
-    int allowReact(karere::Id myHandle, const char *reaction) const
+    int allowReact(karere::Id myHandle, ReactionId reaction) const
     {
         bool foundReaction = false;
         int ownReacts = 0;
-        for (auto &it : mReactions)
+        size_t numReactions = 0;
+        for (size_t pos = 0; pos < mReactions.size(); pos = nextReactionPos(pos))
         {
-            if (!it.mReaction.compare(reaction))
+            numReactions++;
+            if (reactionIdAt(pos) == reaction)
             {
                 foundReaction = true;
             }
 
-            for (auto &user: it.mUsers)
+            if (userPos(pos, myHandle) >= 0)
             {
-                if (user == myHandle)
-                {
-                    ownReacts++;
-                    break;
-                }
+                ownReacts++;
             }
 
             if (ownReacts >= maxOwnReactions)
@@ -886,7 +1037,7 @@ public:
             }
         }
 
-        if (mReactions.size() >= maxMessageReactions && !foundReaction)
+        if (numReactions >= maxMessageReactions && !foundReaction)
         {
             // Add +1 to existing reaction is allowed, if we haven't reached our own limit (maxOwnReactions)
             return -1;
@@ -895,64 +1046,45 @@ public:
         return 0;
     }
 
-    /** @brief Returns a vector with all the reactions of the message **/
-    const std::vector<Reaction> getReactions() const
+    /** @brief Returns the ids of the reactions of the message and their number of users,
+     * in the order in which they were added **/
+    std::vector<std::pair<ReactionId, int>> getReactions() const
     {
-        return mReactions;
+        std::vector<std::pair<ReactionId, int>> reactions;
+        for (size_t pos = 0; pos < mReactions.size(); pos = nextReactionPos(pos))
+        {
+            reactions.emplace_back(reactionIdAt(pos), static_cast<int>(userCountAt(pos)));
+        }
+        return reactions;
     }
 
     /** @brief Returns true if the user has reacted to this message with the specified reaction **/
-    bool hasReacted(std::string reaction, karere::Id uh) const
+    bool hasReacted(ReactionId reaction, karere::Id uh) const
     {
-        for (auto &it : mReactions)
-        {
-            if (it.mReaction == reaction)
-            {
-                return it.hasReacted(uh);
-            }
-        }
-        return false;
+        int pos = reactionPos(reaction);
+        return pos >= 0 && userPos(pos, uh) >= 0;
     }
 
     /** @brief Returns a vector with the userid's associated to an specific reaction **/
-    const std::vector<karere::Id> getReactionUsers(std::string reaction) const
+    std::vector<karere::Id> getReactionUsers(ReactionId reaction) const
     {
-        for (auto &it : mReactions)
+        std::vector<karere::Id> users;
+        int pos = reactionPos(reaction);
+        if (pos >= 0)
         {
-            if (it.mReaction == reaction)
+            for (size_t i = pos + 1; i < nextReactionPos(pos); i++)
             {
-                return it.mUsers;
+                users.emplace_back(mReactions[i]);
             }
         }
-        return std::vector<karere::Id>();
+        return users;
     }
 
     /** @brief Returns the number of users for an specific reaction **/
-    int getReactionCount(const std::string &reaction) const
-    {
-        for (auto const &it : mReactions)
-        {
-            if (it.mReaction == reaction)
-            {
-                return static_cast<int>(it.mUsers.size());
-            }
-        }
-        return 0;
-    }
-
-    /** @brief Returns the reaction index in case that exists. Otherwise returns -1 **/
-    int getReactionIndex(const std::string &reaction) const
+    int getReactionCount(ReactionId reaction) const
     {
-        int i = 0;
-        for (auto &it : mReactions)
-        {
-            if (it.mReaction == reaction)
-            {
-                return i;
-            }
-            i++;
-        }
-        return -1;
+        int pos = reactionPos(reaction);
+        return (pos >= 0) ? static_cast<int>(userCountAt(pos)) : 0;
     }
 
     /** @brief Clean reactions */
@@ -968,42 +1100,43 @@ public:
     }
 
     /** @brief Add a reaction for an specific userid **/
-    void addReaction(const std::string &reaction, karere::Id userId)
+    void addReaction(ReactionId reaction, karere::Id userId)
     {
-        Reaction *r = NULL;
-        int reactIndex = getReactionIndex(reaction);
-        if (reactIndex >= 0)
+        int pos = reactionPos(reaction);
+        if (pos < 0)    // not found, add reaction at last position, to preserve the order in which reactions were received
         {
-            r =  &mReactions.at(reactIndex);
-        }
-        else    // not found, add reaction at last position, to preserve the order in which reactions were received
-        {
-            mReactions.emplace_back(reaction);
-            r = &mReactions.back();
+            mReactions.emplace_back(static_cast<uint64_t>(reaction) << 32 | 1);
+            mReactions.emplace_back(userId.val);
+            return;
         }
 
-        if (!r->hasReacted(userId))
+        if (userPos(pos, userId) < 0)
         {
-            r->mUsers.emplace_back(userId);
+            mReactions.insert(mReactions.begin() + nextReactionPos(pos), userId.val);
+            mReactions[pos]++;
         }
     }
 
     /** @brief Delete a reaction for an specific userid **/
-    void delReaction(const std::string &reaction, karere::Id userId)
+    void delReaction(ReactionId reaction, karere::Id userId)
     {
-        int reactIndex = getReactionIndex(reaction);
-        if (reactIndex >= 0)
+        int pos = reactionPos(reaction);
+        if (pos < 0)
         {
-            Reaction &r = mReactions.at(reactIndex);
+            return;
+        }
 
-            int userIndex = r.userIndex(userId);
-            if (userIndex >= 0)
+        int user = userPos(pos, userId);
+        if (user >= 0)
+        {
+            if (userCountAt(pos) == 1)
             {
-                r.mUsers.erase(r.mUsers.begin() + userIndex);
-                if (r.mUsers.empty())
-                {
-                    mReactions.erase(mReactions.begin() + reactIndex);
-                }
+                mReactions.erase(mReactions.begin() + pos, mReactions.begin() + pos + 2);
+            }
+            else
+            {
+                mReactions.erase(mReactions.begin() + user);
+                mReactions[pos]--;
             }
         }
     }
@@ -1020,25 +1153,56 @@ public:
 protected:
     static const char* statusNames[];
     friend class Chat;
+
+    ReactionId reactionIdAt(size_t pos) const { return static_cast<ReactionId>(mReactions[pos] >> 32); }
+    uint32_t userCountAt(size_t pos) const { return static_cast<uint32_t>(mReactions[pos]); }
+    size_t nextReactionPos(size_t pos) const { return pos + 1 + userCountAt(pos); }
+
+    /** @brief Returns the position of the header slot of the reaction, or -1 if not found */
+    int reactionPos(ReactionId reaction) const
+    {
+        for (size_t pos = 0; pos < mReactions.size(); pos = nextReactionPos(pos))
+        {
+            if (reactionIdAt(pos) == reaction)
+            {
+                return static_cast<int>(pos);
+            }
+        }
+        return -1;
+    }
+
+    /** @brief Returns the position of the user within the reaction at \c pos, or -1 if not found */
+    int userPos(size_t pos, karere::Id userId) const
+    {
+        for (size_t i = pos + 1; i < nextReactionPos(pos); i++)
+        {
+            if (mReactions[i] == userId.val)
+            {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
 };
 
-class Command: public Buffer
+// Most commands are well below 128 bytes, so they are built without touching the heap
+class Command: public SmallBuffer<128>
 {
 private:
     Command(const Command&) = delete;
 protected:
     Command(uint8_t opcode, uint8_t reserve, uint8_t payloadSize=0)
-    : Buffer(reserve, payloadSize+1) { write(0, opcode); }
-    Command(const char* data, size_t size): Buffer(data, size){}
+    : SmallBuffer(reserve, payloadSize+1) { write(0, opcode); }
+    Command(const char* data, size_t size): SmallBuffer(data, size){}
 public:
     enum { kBroadcastUserTyping = 1,  kBroadcastUserStopTyping = 2};
-    Command(): Buffer(){}
+    Command(): SmallBuffer(){}
     Command(Command&& other)
-    : Buffer(std::forward<Buffer>(other))
+    : SmallBuffer(std::move(other))
     { assert(!other.buf() && !other.bufSize() && !other.dataSize()); }
 
     explicit Command(uint8_t opcode, size_t reserve=64)
-    : Buffer(reserve) { write(0, opcode); }
+    : SmallBuffer(reserve) { write(0, opcode); }
 
     template<class T>
     Command&& operator+(const T& val)
@@ -0,0 +1,71 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include <chatdTrace.h>
+#include <stdio.h>
+#include <string>
+
+TESTS_INIT();
+using namespace chatd;
+
+static const char* kTracePath = "chatdTrace-test.trace";
+
+int main()
+{
+
+TestGroup("Trace")
+{
+    syncTest("Frames are read back in order")
+    {
+        TraceWriter writer;
+        check(writer.open(kTracePath, 8));
+        writer.write(kTraceOut, 3, "\x01out", 4);
+        writer.write(kTraceIn, 3, "", 0);
+        std::string big(100000, 'x');
+        writer.write(kTraceIn, 300, big.data(), big.size());
+        size_t written = writer.bytesWritten();
+        check(written == TraceWriter::kHeaderSize + 3 * TraceWriter::kRecordHeaderSize + 4 + big.size());
+        writer.close();
+
+        TraceReader reader;
+        check(reader.open(kTracePath));
+        check(reader.chatdVersion() == 8 && reader.startMs() > 0);
+        TraceRecord record;
+        check(reader.next(record));
+        check(record.direction == kTraceOut && record.shard == 3);
+        check(record.data.dataSize() == 4 && !memcmp(record.data.buf(), "\x01out", 4));
+        uint64_t ts = record.tsUs;
+        check(reader.next(record));
+        check(record.direction == kTraceIn && record.data.empty() && record.tsUs >= ts);
+        check(reader.next(record));
+        check(record.shard == 300 && record.data.dataSize() == big.size());
+        check(!reader.next(record));
+    });
+    syncTest("Size limit and invalid files")
+    {
+        TraceWriter writer;
+        check(writer.open(kTracePath, 8, TraceWriter::kHeaderSize + TraceWriter::kRecordHeaderSize + 10));
+        writer.write(kTraceIn, 0, "0123456789", 10);
+        check(writer.isOpen());
+        writer.write(kTraceIn, 0, "0", 1); //over the limit, stops the capture
+        check(!writer.isOpen());
+        writer.write(kTraceIn, 0, "0", 1);
+
+        TraceReader reader;
+        check(reader.open(kTracePath));
+        TraceRecord record;
+        check(reader.next(record) && record.data.dataSize() == 10);
+        check(!reader.next(record));
+
+        FILE* file = fopen(kTracePath, "wb");
+        fputs("not a trace file at all", file);
+        fclose(file);
+        check(!reader.open(kTracePath));
+        check(!reader.open("nonexistent.trace"));
+        remove(kTracePath);
+    });
+});
+
+return test::gNumFailed;
+}
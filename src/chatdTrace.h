@@ -0,0 +1,202 @@
+#ifndef CHATD_TRACE_H
+#define CHATD_TRACE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include "buffer.h"
+
+namespace chatd
+{
+/** @brief Compact binary trace of the frames exchanged with chatd.
+ *
+ * The file starts with a header:
+ *  - magic "KRCTRACE" (8 bytes)
+ *  - format version (uint8) and chatd protocol version (uint8), followed by 2 reserved bytes
+ *  - wall-clock time of the start of the capture, in milliseconds since the epoch (uint64)
+ *
+ * Followed by one record per frame, in the order they were sent or received:
+ *  - direction (uint8, a TraceDirection)
+ *  - shard number (uint16)
+ *  - time since the previous record, in microseconds (uint32, saturated)
+ *  - length of the frame (uint32), followed by the frame itself
+ *
+ * All the integers are little-endian, as in the chatd protocol. Inbound frames are
+ * complete websocket messages, as passed to Connection::execCommand(). Outbound frames
+ * are the buffers passed to Connection::sendBuf(), which usually hold one command.
+ */
+enum TraceDirection: uint8_t
+{
+    kTraceIn = 0,
+    kTraceOut = 1
+};
+
+struct TraceRecord
+{
+    TraceDirection direction = kTraceIn;
+    int shard = 0;
+    uint64_t tsUs = 0;      // time since the start of the capture
+    Buffer data;
+};
+
+class TraceWriter
+{
+public:
+    enum: uint8_t { kVersion = 1 };
+    enum { kHeaderSize = 20, kRecordHeaderSize = 11 };
+
+    ~TraceWriter() { close(); }
+
+    /** @brief Creates the trace file, replacing any existing one.
+     * @param maxBytes Size at which the capture stops, or zero for no limit */
+    bool open(const std::string& path, uint8_t chatdVersion, size_t maxBytes = 0)
+    {
+        close();
+        mFile = fopen(path.c_str(), "wb");
+        if (!mFile)
+            return false;
+
+        setvbuf(mFile, nullptr, _IOFBF, 64 * 1024);
+        mMaxBytes = maxBytes;
+        mBytes = 0;
+        mLast = std::chrono::steady_clock::now();
+
+        uint64_t startMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        SmallBuffer<kHeaderSize> header;
+        header.append("KRCTRACE", 8);
+        header.append<uint8_t>(kVersion);
+        header.append<uint8_t>(chatdVersion);
+        header.append<uint16_t>(0);
+        header.append<uint64_t>(startMs);
+        return writeRaw(header.buf(), header.dataSize());
+    }
+
+    /** @brief Appends a frame. Once the size limit is reached or a write fails,
+     * the trace is closed and further frames are ignored */
+    void write(TraceDirection direction, int shard, const char* data, size_t len)
+    {
+        if (!mFile)
+            return;
+
+        if (mMaxBytes && mBytes + kRecordHeaderSize + len > mMaxBytes)
+        {
+            close();
+            return;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        auto deltaUs = std::chrono::duration_cast<std::chrono::microseconds>(now - mLast).count();
+        mLast = now;
+
+        SmallBuffer<kRecordHeaderSize> header;
+        header.append<uint8_t>(direction);
+        header.append<uint16_t>(static_cast<uint16_t>(shard));
+        header.append<uint32_t>(deltaUs > UINT32_MAX ? UINT32_MAX : static_cast<uint32_t>(deltaUs));
+        header.append<uint32_t>(static_cast<uint32_t>(len));
+        if (!writeRaw(header.buf(), header.dataSize()) || !writeRaw(data, len))
+            close();
+    }
+
+    void close()
+    {
+        if (mFile)
+        {
+            fclose(mFile);
+            mFile = nullptr;
+        }
+    }
+
+    bool isOpen() const { return mFile != nullptr; }
+    size_t bytesWritten() const { return mBytes; }
+
+protected:
+    FILE* mFile = nullptr;
+    size_t mMaxBytes = 0;
+    size_t mBytes = 0;
+    std::chrono::steady_clock::time_point mLast;
+
+    bool writeRaw(const void* data, size_t len)
+    {
+        if (len && fwrite(data, 1, len, mFile) != len)
+            return false;
+
+        mBytes += len;
+        return true;
+    }
+};
+
+class TraceReader
+{
+public:
+    ~TraceReader() { close(); }
+
+    /** @brief Opens a trace and reads its header. Returns false if it is not a valid trace */
+    bool open(const std::string& path)
+    {
+        close();
+        mFile = fopen(path.c_str(), "rb");
+        if (!mFile)
+            return false;
+
+        char header[TraceWriter::kHeaderSize];
+        if (fread(header, 1, sizeof(header), mFile) != sizeof(header)
+            || memcmp(header, "KRCTRACE", 8)
+            || static_cast<uint8_t>(header[8]) != TraceWriter::kVersion)
+        {
+            close();
+            return false;
+        }
+
+        StaticBuffer buf(header, sizeof(header));
+        mChatdVersion = buf.read<uint8_t>(9);
+        mStartMs = buf.read<uint64_t>(12);
+        mTsUs = 0;
+        return true;
+    }
+
+    /** @brief Reads the next record. Returns false at the end of the trace,
+     * or if the last record is truncated */
+    bool next(TraceRecord& record)
+    {
+        if (!mFile)
+            return false;
+
+        char header[TraceWriter::kRecordHeaderSize];
+        if (fread(header, 1, sizeof(header), mFile) != sizeof(header))
+            return false;
+
+        StaticBuffer buf(header, sizeof(header));
+        uint32_t len = buf.read<uint32_t>(7);
+        mTsUs += buf.read<uint32_t>(3);
+        record.direction = static_cast<TraceDirection>(buf.read<uint8_t>(0));
+        record.shard = buf.read<uint16_t>(1);
+        record.tsUs = mTsUs;
+        record.data.clear();
+        if (len && fread(record.data.writePtr(0, len), 1, len, mFile) != len)
+            return false;
+
+        return true;
+    }
+
+    void close()
+    {
+        if (mFile)
+        {
+            fclose(mFile);
+            mFile = nullptr;
+        }
+    }
+
+    uint8_t chatdVersion() const { return mChatdVersion; }
+    uint64_t startMs() const { return mStartMs; }
+
+protected:
+    FILE* mFile = nullptr;
+    uint8_t mChatdVersion = 0;
+    uint64_t mStartMs = 0;
+    uint64_t mTsUs = 0;
+};
+}
+#endif // CHATD_TRACE_H
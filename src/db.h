@@ -279,6 +279,16 @@ public:
         buf.setDataSize(size);
     }
 
+    /** Returns the blob without copying it. The data is valid until the next
+     * call to step(), or until the statement is destroyed */
+    StaticBuffer blobColView(int num)
+    {
+        const void* data = sqlite3_column_blob(mStmt, num);
+        if (!data)
+            return StaticBuffer(nullptr, 0);
+        return StaticBuffer(static_cast<const char*>(data), sqlite3_column_bytes(mStmt, num));
+    }
+
     size_t blobCol(int num, char* buf, size_t buflen)
     {
         const void* data = sqlite3_column_blob(mStmt, num);
@@ -3,6 +3,9 @@
 #include "base/timers.hpp"
 #include "megachatapi_impl.h"
 #include "waiter/libuvWaiter.h"
+#include <map>
+#include <mutex>
+#include <set>
 
 #ifndef KARERE_DISABLE_WEBRTC
 namespace rtcModule {void globalCleanup(); }
@@ -14,7 +17,7 @@ namespace rtcModule {void globalCleanup(); }
 
 namespace karere
 {
-const char* gDbSchemaVersionSuffix = "10";
+const char* gDbSchemaVersionSuffix = "11";
 /*
     2 --> +3: invalidate cached chats to reload history (so call-history msgs are fetched)
     3 --> +4: invalidate both caches, SDK + MEGAchat, if there's at least one chat (so deleted chats are re-fetched from API)
@@ -25,6 +28,7 @@ const char* gDbSchemaVersionSuffix = "10";
     7 --> +8: modify chats and create a new table chat_reactions
     8 --> +9: create table DNS cache
     9 --> +10: create table chat_pending_reactions and modify sendkeys table
+    10 --> +11: add column sess to dns_cache, to persist TLS sessions
 */
 
 bool gCatchException = true;
@@ -46,8 +50,92 @@ void globalCleanup()
     services_shutdown();
 }
 
+// timers alive, by app context, protected by timerMutex
+static std::map<void *, std::set<TimerMsg *>> gTimers;
+
+void addTimer(void *ctx, TimerMsg *timer)
+{
+    std::lock_guard<std::recursive_mutex> lock(timerMutex);
+    gTimers[ctx].insert(timer);
+}
+
+void removeTimer(void *ctx, TimerMsg *timer)
+{
+    std::lock_guard<std::recursive_mutex> lock(timerMutex);
+    auto it = gTimers.find(ctx);
+    if (it == gTimers.end())
+        return; //being closed by closeTimers()
+
+    it->second.erase(timer);
+    if (it->second.empty())
+    {
+        gTimers.erase(it);
+    }
+}
+
+void closeTimers(void *ctx)
+{
+    std::set<TimerMsg *> timers;
+    {
+        std::lock_guard<std::recursive_mutex> lock(timerMutex);
+        auto it = gTimers.find(ctx);
+        if (it == gTimers.end())
+            return;
+
+        timers.swap(it->second);
+        gTimers.erase(it);
+    }
+
+    for (TimerMsg *timer: timers)
+    {
+        timer->canceled = true;
+        if (!timer->timerEvent)
+        {
+            // its uv timer was never created, and the message to create it is discarded
+            timer->destroy(timer);
+            continue;
+        }
+
+        uv_timer_stop(timer->timerEvent);
+        uv_close((uv_handle_t *)timer->timerEvent, [](uv_handle_t *handle)
+        {
+            TimerMsg *timer = static_cast<TimerMsg *>(handle->data);
+            timer->timerEvent = nullptr;
+            timer->destroy(timer);
+            delete (uv_timer_t *)handle;
+        });
+    }
+}
+
+static std::mutex gTimersLoopsMutex;
+static std::map<void *, uv_loop_t *> gTimersLoops;
+
+void setTimersLoop(void *ctx, uv_loop_t *loop)
+{
+    std::lock_guard<std::mutex> lock(gTimersLoopsMutex);
+    if (loop)
+    {
+        gTimersLoops[ctx] = loop;
+    }
+    else
+    {
+        gTimersLoops.erase(ctx);
+    }
+}
+
 void init_uv_timer(void *ctx, uv_timer_t *timer)
 {
-    uv_timer_init(((::mega::LibuvWaiter *)(((megachat::MegaChatApiImpl *)ctx)->waiter))->eventloop, timer);
+    // called from the marshalled calls of the instance, so it's still alive
+    megachat::MegaChatApiImpl *instance = megachat::MegaChatApiImpl::getInstance(ctx);
+    if (instance)
+    {
+        uv_timer_init(((::mega::LibuvWaiter *)(instance->waiter))->eventloop, timer);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(gTimersLoopsMutex);
+    auto it = gTimersLoops.find(ctx);
+    assert(it != gTimersLoops.end());
+    uv_timer_init(it->second, timer);
 }
 }
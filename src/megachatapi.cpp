@@ -267,11 +267,36 @@ bool MegaChatCall::isOnHold() const
     return false;
 }
 
+MegaChatRuntime::MegaChatRuntime(int numLoops)
+{
+    this->pImpl = new MegaChatRuntimePrivate(numLoops);
+}
+
+MegaChatRuntime::~MegaChatRuntime()
+{
+    delete pImpl;
+}
+
+int MegaChatRuntime::getNumLoops() const
+{
+    return pImpl->getNumLoops();
+}
+
+int MegaChatRuntime::getNumInstances() const
+{
+    return pImpl->getNumInstances();
+}
+
 MegaChatApi::MegaChatApi(MegaApi *megaApi)
 {
     this->pImpl = new MegaChatApiImpl(this, megaApi);
 }
 
+MegaChatApi::MegaChatApi(MegaApi *megaApi, MegaChatRuntime *runtime)
+{
+    this->pImpl = new MegaChatApiImpl(this, megaApi, runtime ? runtime->pImpl : NULL);
+}
+
 MegaChatApi::~MegaChatApi()
 {
     delete pImpl;
@@ -372,6 +397,41 @@ void MegaChatApi::refreshUrl(MegaChatRequestListener *listener)
     pImpl->retryPendingConnections(true, true, listener);
 }
 
+void MegaChatApi::setWebsocketsCompression(bool enable, int windowBits, int memLevel)
+{
+    pImpl->setWebsocketsCompression(enable, windowBits, memLevel);
+}
+
+bool MegaChatApi::startChatdTrace(const char *path, size_t maxBytes)
+{
+    return pImpl->startChatdTrace(path, maxBytes);
+}
+
+void MegaChatApi::stopChatdTrace()
+{
+    pImpl->stopChatdTrace();
+}
+
+char *MegaChatApi::getSchedulerStats()
+{
+    return pImpl->getSchedulerStats();
+}
+
+void MegaChatApi::setLazyJoin(bool archived, int idleDays)
+{
+    pImpl->setLazyJoin(archived, idleDays);
+}
+
+void MegaChatApi::setTlsSessionPersistence(bool enable)
+{
+    pImpl->setTlsSessionPersistence(enable);
+}
+
+void MegaChatApi::setMaxResidentMessages(unsigned int count)
+{
+    pImpl->setMaxResidentMessages(count);
+}
+
 void MegaChatApi::logout(MegaChatRequestListener *listener)
 {
     pImpl->logout(listener);
@@ -717,6 +777,16 @@ bool MegaChatApi::isFullHistoryLoaded(MegaChatHandle chatid)
     return pImpl->isFullHistoryLoaded(chatid);
 }
 
+void MegaChatApi::enableBatchedMessageLoading(bool enable)
+{
+    pImpl->enableBatchedMessageLoading(enable);
+}
+
+bool MegaChatApi::isBatchedMessageLoadingEnabled()
+{
+    return pImpl->isBatchedMessageLoadingEnabled();
+}
+
 MegaChatMessage *MegaChatApi::getMessage(MegaChatHandle chatid, MegaChatHandle msgid)
 {
     return pImpl->getMessage(chatid, msgid);
@@ -1237,6 +1307,21 @@ unsigned int MegaChatRoomList::size() const
     return 0;
 }
 
+MegaChatMessageList *MegaChatMessageList::copy() const
+{
+    return NULL;
+}
+
+const MegaChatMessage *MegaChatMessageList::get(unsigned int /*i*/) const
+{
+    return NULL;
+}
+
+unsigned int MegaChatMessageList::size() const
+{
+    return 0;
+}
+
 //Request callbacks
 void MegaChatRequestListener::onRequestStart(MegaChatApi *, MegaChatRequest *)
 { }
@@ -1635,6 +1720,16 @@ void MegaChatRoomListener::onMessageLoaded(MegaChatApi * /*api*/, MegaChatMessag
 
 }
 
+void MegaChatRoomListener::onMessagesLoaded(MegaChatApi *api, MegaChatMessageList *msgs)
+{
+    for (unsigned int i = 0; i < msgs->size(); i++)
+    {
+        // the list owns the messages, and they are not modified by the SDK during the callback
+        onMessageLoaded(api, const_cast<MegaChatMessage *>(msgs->get(i)));
+    }
+    onMessageLoaded(api, NULL);
+}
+
 void MegaChatRoomListener::onMessageReceived(MegaChatApi * /*api*/, MegaChatMessage * /*msg*/)
 {
 
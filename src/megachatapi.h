@@ -45,10 +45,12 @@ const MegaChatIndex MEGACHAT_INVALID_INDEX = 0x7fffffff;
 
 class MegaChatApi;
 class MegaChatApiImpl;
+class MegaChatRuntimePrivate;
 class MegaChatRequest;
 class MegaChatRequestListener;
 class MegaChatError;
 class MegaChatMessage;
+class MegaChatMessageList;
 class MegaChatRoom;
 class MegaChatRoomListener;
 class MegaChatCall;
@@ -1728,6 +1730,42 @@ public:
     virtual const MegaChatContainsMeta *getContainsMeta() const;
 };
 
+/**
+ * @brief List of MegaChatMessage objects
+ *
+ * A MegaChatMessageList has the ownership of the MegaChatMessage objects that it contains, so they will be
+ * only valid until the MegaChatMessageList is deleted. If you want to retain a MegaChatMessage returned by
+ * a MegaChatMessageList, use MegaChatMessage::copy.
+ *
+ * Objects of this class are immutable.
+ */
+class MegaChatMessageList
+{
+public:
+    virtual ~MegaChatMessageList() {}
+
+    virtual MegaChatMessageList *copy() const;
+
+    /**
+     * @brief Returns the MegaChatMessage at the position i in the MegaChatMessageList
+     *
+     * The MegaChatMessageList retains the ownership of the returned MegaChatMessage. It will be only valid until
+     * the MegaChatMessageList is deleted.
+     *
+     * If the index is >= the size of the list, this function returns NULL.
+     *
+     * @param i Position of the MegaChatMessage that we want to get for the list
+     * @return MegaChatMessage at the position i in the list
+     */
+    virtual const MegaChatMessage *get(unsigned int i) const;
+
+    /**
+     * @brief Returns the number of MegaChatMessages in the list
+     * @return Number of MegaChatMessages in the list
+     */
+    virtual unsigned int size() const;
+};
+
 /**
  * @brief Provides information about an asynchronous request
  *
@@ -2254,6 +2292,55 @@ public:
     virtual const char* toString() const = 0;
 };
 
+/**
+ * @brief Event loops shared by several instances of MegaChatApi
+ *
+ * By default, every MegaChatApi runs its own thread and event loop, where all its timers and
+ * network events are processed. Apps that handle many accounts in the same process can create
+ * a MegaChatRuntime and pass it to the MegaChatApi constructor, so that all those instances
+ * share a fixed number of threads and event loops. Every instance is assigned to the loop
+ * with the fewest instances at the moment of its creation.
+ *
+ * The instances remain isolated from each other: each one keeps its own websockets, local
+ * cache and listeners, and its callbacks are processed with its own lock, but they are
+ * delivered from the thread of the loop it is assigned to, so a slow listener delays the
+ * other instances on the same loop.
+ *
+ * An instance can be created from a callback (it's assigned to a loop right away), but it
+ * must not be deleted from a callback of the loop it is assigned to, since the loop is the
+ * one that processes the deletion.
+ *
+ * The MegaChatRuntime must outlive all the MegaChatApi instances that use it.
+ */
+class MegaChatRuntime
+{
+public:
+    /**
+     * @brief Creates the event loops and starts their threads
+     *
+     * @param numLoops Number of event loops (and threads) to share among the instances of
+     * MegaChatApi. Values lower than 1 are treated as 1.
+     */
+    MegaChatRuntime(int numLoops = 1);
+    virtual ~MegaChatRuntime();
+
+    /**
+     * @brief Returns the number of event loops of this runtime
+     * @return Number of event loops
+     */
+    int getNumLoops() const;
+
+    /**
+     * @brief Returns the number of MegaChatApi instances currently using this runtime
+     * @return Number of MegaChatApi instances
+     */
+    int getNumInstances() const;
+
+private:
+    MegaChatRuntimePrivate *pImpl;
+    friend class MegaChatApi;
+};
+
 /**
  * @brief Allows to manage the chat-related features of a MEGA account
  *
@@ -2349,6 +2436,17 @@ public:
      */
     MegaChatApi(mega::MegaApi *megaApi);
 
+    /**
+     * @brief Creates an instance of MegaChatApi that runs on a shared event loop
+     *
+     * Instead of starting its own thread, this instance is processed by one of the event
+     * loops of \c runtime. @see MegaChatRuntime.
+     *
+     * @param megaApi Instance of MegaApi to be used by the chat-engine.
+     * @param runtime Event loops shared with other instances. It must outlive this instance.
+     */
+    MegaChatApi(mega::MegaApi *megaApi, MegaChatRuntime *runtime);
+
     virtual ~MegaChatApi();
 
     static const char *getAppDir();
@@ -2465,12 +2563,21 @@ public:
      *
      * This method allows to import messages from an external cache. The cache should be a copy
      * of the app's cache, but may include new messages that wants to be imported into the app's
-     * cache in one shot. In case the history has been truncated, this method applies truncation.
+     * cache. In case the history has been truncated, this method applies truncation.
+     *
+     * Messages are imported in batches, so the app remains responsive during large imports, and
+     * MegaChatRequestListener::onRequestUpdate is called after every batch. Imported messages
+     * are saved after every batch too, so if the app is killed before the request finishes,
+     * the next call to this method resumes the import.
      *
      * The associated request type with this request is MegaChatRequest::TYPE_IMPORT_MESSAGES
      * Valid data in the MegaChatRequest object received on callbacks:
      * - MegaChatRequest::getText - Returns the cache path
      *
+     * Valid data in the MegaChatRequest object received in onRequestUpdate:
+     * - MegaChatRequest::getNumber - Number of messages added/updated so far
+     * - MegaChatRequest::getChatHandle - Handle of the chat being imported
+     *
      * Valid data in the MegaChatRequest object received in onRequestFinish when the error code
      * is MegaError::ERROR_OK:
      * - MegaChatRequest::getNumber - Total number of messages added/updated
@@ -2480,7 +2587,10 @@ public:
      *
      * The request will fail with MegaChatError::ERROR_ACCESS when this function is
      * called without a previous call to \c MegaChatApi::init or when the initialization
-     * state is other than MegaChatApi::INIT_OFFLINE_SESSION or MegaChatApi::INIT_ONLINE_SESSION.
+     * state is other than MegaChatApi::INIT_OFFLINE_SESSION or MegaChatApi::INIT_ONLINE_SESSION,
+     * or when there is another import in progress.
+     * The request will fail with MegaChatError::ERROR_ARGS when the external DB can't be
+     * imported.
      *
      * @param externalDbPath path of the external BD
      * @param listener MegaChatRequestListener to track this request
@@ -2656,6 +2766,122 @@ public:
      */
     void refreshUrl(MegaChatRequestListener *listener = NULL);
 
+    /**
+     * @brief Enable/disable the compression of the websockets to chatd and presenced
+     *
+     * When enabled, the permessage-deflate extension (RFC 7692) is offered to the server for
+     * the connections established afterwards, so it doesn't apply to the current connections
+     * until they are restarted (@see MegaChatApi::retryPendingConnections). Although the
+     * content of messages is encrypted, the protocol metadata sent along (ids, timestamps,
+     * keys) usually compresses well, saving bandwidth when loading history.
+     *
+     * By default, compression is disabled.
+     *
+     * @param enable True to offer compression to the servers, false to disable it
+     * @param windowBits Base-2 logarithm of the compression window, between 9 and 15. Lower
+     * values require less memory per connection, at the cost of worse compression.
+     * @param memLevel Memory used by the compressor, between 1 and 9
+     */
+    void setWebsocketsCompression(bool enable, int windowBits = 15, int memLevel = 8);
+
+    /**
+     * @brief Start capturing the traffic with chatd to a trace file
+     *
+     * Every frame sent to or received from chatd, for all the shards, is appended to
+     * the file with a timestamp, so that a history sync or any other burst of activity can
+     * be reproduced offline, in a deterministic way (see the tests/chatd_replay tool).
+     * The content of messages is encrypted, but the trace includes the ids of the chats,
+     * users and messages, so it must be handled like the app's local database.
+     *
+     * The capture stops when stopChatdTrace is called, when the file reaches \c maxBytes,
+     * or at logout. This function must be called after a successful init.
+     *
+     * @param path Path of the trace file. It is overwritten if it already exists
+     * @param maxBytes Size at which the capture stops, or 0 for no limit
+     * @return True if the capture started, false if the file can't be created or the
+     * chat engine is not initialized
+     */
+    bool startChatdTrace(const char *path, size_t maxBytes = 0);
+
+    /**
+     * @brief Stop a capture started with MegaChatApi::startChatdTrace
+     */
+    void stopChatdTrace();
+
+    /**
+     * @brief Get the time spent by the internal work in the queue of the chat engine
+     *
+     * The work of the chat engine is processed by priority: first the chatrooms opened by
+     * the app (and any other work not related to a chatroom), then the calls, the rest of
+     * chatrooms and finally maintenance tasks, like the cleanup of history by retention time.
+     * For each one of these classes, the result includes the number of items processed ("n"),
+     * the average and maximum time they waited in the queue, in microseconds ("avg" and "max"),
+     * and the number of items waiting at the moment ("q"), as a JSON object:
+     * {"fg":{"n":..,"avg":..,"max":..,"q":..},"call":{...},"bg":{...},"mnt":{...}}
+     *
+     * You take the ownership of the returned value. Use delete [] to free it.
+     *
+     * @return The statistics of the queue of the chat engine
+     */
+    char *getSchedulerStats();
+
+    /**
+     * @brief Set the policy to join chats lazily
+     *
+     * By default, all the chats are joined when connecting to chatd, and again at every
+     * reconnection, which includes fetching the new history of each one of them. With
+     * large accounts, most of that traffic is due to chats that are not going to be opened.
+     *
+     * The chats matching this policy are not joined at connection, but only once they
+     * are needed: when they are opened (@see MegaChatApi::openChatRoom), when a push
+     * notification is received for them (@see MegaChatApi::pushReceived), when they are
+     * unarchived or, for the chats that are not archived, when MegaChatApi::getUnreadChats
+     * is called. Until then, their state is MegaChatApi::CHAT_CONNECTION_OFFLINE, their
+     * unread count is the one known at the last connection, and they are not considered by
+     * MegaChatApi::areAllChatsLoggedIn. Push notifications without a chatid don't join them.
+     *
+     * The policy applies from the next connection, so it should be set before calling
+     * MegaChatApi::connect. By default, it's disabled.
+     *
+     * @param archived True to defer the join of archived chats
+     * @param idleDays Defer the join of the chats without messages for more than this
+     * number of days, or 0 to join them regardless of their activity
+     */
+    void setLazyJoin(bool archived, int idleDays = 0);
+
+    /**
+     * @brief Enable/disable the persistence of TLS sessions in the local cache
+     *
+     * The TLS sessions established with chatd and presenced are always kept in memory, so
+     * reconnections resume them and skip the full handshake. When persistence is enabled,
+     * they are also stored in the local cache, so the first connections after a restart of
+     * the app can resume them too.
+     *
+     * Since a TLS session allows to resume the encrypted connection, apps should enable it
+     * only if the local cache is adequately protected. Disabling it removes the sessions
+     * already stored. By default, it's disabled.
+     *
+     * @param enable True to store the TLS sessions in the local cache
+     */
+    void setTlsSessionPersistence(bool enable);
+
+    /**
+     * @brief Limits the number of messages of each chat that are kept in memory
+     *
+     * When a chat holds more messages than the limit (plus a page of 256 messages), its
+     * oldest messages are dropped from memory in pages, and they are loaded again from
+     * the local cache by MegaChatApi::loadMessages when the app scrolls back to them.
+     * Messages already loaded by the ongoing MegaChatApi::loadMessages session are kept.
+     *
+     * MegaChatApi::getMessage still returns the messages dropped from memory, by loading
+     * them from the local cache.
+     *
+     * By default, there's no limit.
+     *
+     * @param count Max number of messages in memory per chat, or zero to remove the limit
+     */
+    void setMaxResidentMessages(unsigned int count);
+
     /**
      * @brief Logout of chat servers invalidating the session
      *
@@ -3292,6 +3518,10 @@ public:
      * Archived chatrooms or chatrooms in preview mode with unread messages
      * are not considered.
      *
+     * For the chats not joined yet due to the lazy-join policy, the unread count known
+     * at the last connection is considered. This function joins them, so their unread
+     * count may change afterwards (@see MegaChatApi::setLazyJoin).
+     *
      * @return The number of chatrooms with unread messages
      */
     int getUnreadChats();
@@ -3956,6 +4186,9 @@ public:
      * (local / remote), or when the requested \c count has been already loaded,
      * the callback MegaChatRoomListener::onMessageLoaded will be called with a NULL message.
      *
+     * If batched message loading is enabled (see MegaChatApi::enableBatchedMessageLoading), the
+     * loaded messages are notified all at once by MegaChatRoomListener::onMessagesLoaded instead.
+     *
      * @param chatid MegaChatHandle that identifies the chat room
      * @param count The number of requested messages to load.
      *
@@ -3978,11 +4211,40 @@ public:
      */
     bool isFullHistoryLoaded(MegaChatHandle chatid);
 
+    /**
+     * @brief Enable/disable the notification of loaded messages in batches
+     *
+     * When enabled, the messages loaded by a call to MegaChatApi::loadMessages are not notified
+     * one by one by MegaChatRoomListener::onMessageLoaded. Instead, they are notified all at once,
+     * in the same order, by MegaChatRoomListener::onMessagesLoaded when the load has finished.
+     * It saves one callback per message, which is significant when callbacks cross a language
+     * binding.
+     *
+     * Messages that are not the result of loading history, like the pending ones notified when
+     * the chatroom is opened or the ones requiring manual sending, are still notified by
+     * MegaChatRoomListener::onMessageLoaded.
+     *
+     * By default, batched message loading is disabled.
+     *
+     * @param enable True to notify loaded messages in batches. False to notify them one by one.
+     */
+    void enableBatchedMessageLoading(bool enable);
+
+    /**
+     * @brief Returns true if loaded messages are notified in batches
+     *
+     * @see MegaChatApi::enableBatchedMessageLoading
+     *
+     * @return True if batched message loading is enabled. Otherwise, false.
+     */
+    bool isBatchedMessageLoadingEnabled();
+
     /**
      * @brief Returns the MegaChatMessage specified from the chat room.
      *
      * This function allows to retrieve only those messages that are been loaded, received and/or
-     * sent (confirmed and not yet confirmed). For any other message, this function
+     * sent (confirmed and not yet confirmed), including the ones dropped from memory by
+     * MegaChatApi::setMaxResidentMessages. For any other message, this function
      * will return NULL.
      *
      * You take the ownership of the returned value.
@@ -6082,6 +6344,28 @@ public:
      */
     virtual void onMessageLoaded(MegaChatApi* api, MegaChatMessage *msg);   // loaded by loadMessages()
 
+    /**
+     * @brief This function is called when a batch of messages has been loaded
+     *
+     * It's only called if batched message loading is enabled (see MegaChatApi::enableBatchedMessageLoading).
+     * In that case, it replaces the calls to MegaChatRoomListener::onMessageLoaded for the messages
+     * loaded by MegaChatApi::loadMessages: all of them are notified at once, in the same order (from
+     * newest to oldest), when there are no more messages to load from the reported source. The list can
+     * be empty if no messages were loaded.
+     *
+     * The default implementation calls MegaChatRoomListener::onMessageLoaded for each message in the list,
+     * followed by a call with a NULL message, so listeners that don't override this function receive the
+     * same notifications than without batching.
+     *
+     * The SDK retains the ownership of the MegaChatMessageList in the second parameter. The MegaChatMessageList
+     * object will be valid until this function returns. If you want to save the MegaChatMessageList object,
+     * use MegaChatMessageList::copy.
+     *
+     * @param api MegaChatApi connected to the account
+     * @param msgs The MegaChatMessageList with the loaded messages
+     */
+    virtual void onMessagesLoaded(MegaChatApi* api, MegaChatMessageList *msgs);
+
     /**
      * @brief This function is called when a new message is received
      *
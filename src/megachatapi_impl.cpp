@@ -38,6 +38,7 @@
 #include <chatClient.h>
 #include <mega/base64.h>
 #include <chatdMsg.h>
+#include <algorithm>
 
 #ifdef _WIN32
 #pragma warning(push)
@@ -70,10 +71,200 @@ using namespace karere;
 using namespace chatd;
 
 LoggerHandler *MegaChatApiImpl::loggerHandler = NULL;
+std::mutex MegaChatApiImpl::sInstancesMutex;
+std::map<void *, MegaChatApiImpl *> MegaChatApiImpl::sInstances;
+uintptr_t MegaChatApiImpl::sLastAppCtx = 0;
+std::mutex MegaChatApiImpl::sRunningLoopsMutex;
+int MegaChatApiImpl::sRunningLoops = 0;
 
-MegaChatApiImpl::MegaChatApiImpl(MegaChatApi *chatApi, MegaApi *megaApi)
+MegaChatRuntimePrivate::MegaChatRuntimePrivate(int numLoops)
 {
-    init(chatApi, megaApi);
+    if (numLoops < 1)
+    {
+        numLoops = 1;
+    }
+
+    for (int i = 0; i < numLoops; i++)
+    {
+        Loop *loop = new Loop;
+        loop->waiter = new MegaChatWaiter();
+        mLoops.emplace_back(loop);
+        MegaChatApiImpl::loopStarted();
+        loop->thread.start(threadEntryPoint, loop);
+    }
+}
+
+MegaChatRuntimePrivate::~MegaChatRuntimePrivate()
+{
+    for (auto& loop : mLoops)
+    {
+        {
+            std::lock_guard<std::mutex> lock(loop->mutex);
+            assert(loop->instances.empty() && loop->attaching.empty());
+            loop->exit = true;
+        }
+        loop->waiter->notify();
+        loop->thread.join();
+
+        // the loop closed the handles of the deleted instances before exiting
+        delete loop->waiter;
+    }
+}
+
+int MegaChatRuntimePrivate::getNumLoops() const
+{
+    return static_cast<int>(mLoops.size());
+}
+
+int MegaChatRuntimePrivate::getNumInstances() const
+{
+    size_t count = 0;
+    for (auto& loop : mLoops)
+    {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        count += loop->instances.size() + loop->attaching.size();
+    }
+    return static_cast<int>(count);
+}
+
+MegaChatRuntimePrivate::Loop *MegaChatRuntimePrivate::attach(MegaChatApiImpl *instance)
+{
+    std::thread::id currentThread = std::this_thread::get_id();
+    Loop *target = nullptr;
+    size_t minCount = 0;
+    for (auto& loop : mLoops)
+    {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        size_t count = loop->instances.size() + loop->attaching.size();
+        if (!target || count < minCount)
+        {
+            target = loop.get();
+            minCount = count;
+        }
+    }
+
+    instance->waiter = target->waiter;
+
+    std::unique_lock<std::mutex> lock(target->mutex);
+    if (target->threadId == currentThread)
+    {
+        // created from a callback of the loop, which can't process the attachment while waiting for it
+        attached(target, instance);
+        return target;
+    }
+
+    target->attaching.push_back(instance);
+    target->waiter->notify();
+    target->changed.wait(lock, [target, instance]()
+    {
+        return std::find(target->attaching.begin(), target->attaching.end(), instance) == target->attaching.end();
+    });
+    return target;
+}
+
+void MegaChatRuntimePrivate::waitDetached(Loop *loop, MegaChatApiImpl *instance)
+{
+    std::unique_lock<std::mutex> lock(loop->mutex);
+    assert(loop->threadId != std::this_thread::get_id());   // the deletion would never be processed
+    loop->changed.wait(lock, [loop, instance]()
+    {
+        return std::find(loop->instances.begin(), loop->instances.end(), instance) == loop->instances.end();
+    });
+}
+
+void *MegaChatRuntimePrivate::threadEntryPoint(void *param)
+{
+#ifndef _WIN32
+    struct sigaction noaction;
+    memset(&noaction, 0, sizeof(noaction));
+    noaction.sa_handler = SIG_IGN;
+    ::sigaction(SIGPIPE, &noaction, 0);
+#endif
+
+    run(static_cast<Loop *>(param));
+    return 0;
+}
+
+void MegaChatRuntimePrivate::attached(Loop *loop, MegaChatApiImpl *instance)
+{
+    // must be called from the thread of the loop, with its mutex locked
+    instance->websocketsIO = new MegaWebsocketsIO(instance->sdkMutex, loop->waiter, instance->megaApi, instance->mAppCtx);
+    loop->instances.push_back(instance);
+}
+
+void MegaChatRuntimePrivate::run(Loop *loop)
+{
+    {
+        std::lock_guard<std::mutex> lock(loop->mutex);
+        loop->threadId = std::this_thread::get_id();
+    }
+
+    std::vector<MegaChatApiImpl *> instances;
+    while (true)
+    {
+        loop->waiter->init(NEVER);
+        loop->waiter->wait();
+
+        {
+            std::lock_guard<std::mutex> lock(loop->mutex);
+            if (loop->exit)
+            {
+                break;
+            }
+
+            if (!loop->attaching.empty())
+            {
+                for (MegaChatApiImpl *instance : loop->attaching)
+                {
+                    attached(loop, instance);
+                }
+                loop->attaching.clear();
+                loop->changed.notify_all();
+            }
+            instances = loop->instances;
+        }
+
+        // every instance is processed with its own lock, as if it were running on its own thread
+        for (MegaChatApiImpl *instance : instances)
+        {
+            if (!instance->processEvents())
+            {
+                // the network layer (and its lws context) was created from this thread, so it's
+                // destroyed from it too, before the instance is deleted
+                delete instance->websocketsIO;
+                instance->websocketsIO = NULL;
+
+                // the loop keeps running, so the timers of the instance are stopped and freed, once
+                // the messages they already posted are discarded (they still refer to the timers)
+                karere::closeTimers(instance->mAppCtx);
+                {
+                    karere::DiscardScope discard;
+                    instance->mScheduler.drain(0, [](void *msg) { megaProcessMessage(msg); });
+                }
+
+                std::lock_guard<std::mutex> lock(loop->mutex);
+                loop->instances.erase(std::find(loop->instances.begin(), loop->instances.end(), instance));
+                loop->changed.notify_all();
+            }
+        }
+    }
+
+    // close the handles left by the deleted instances (i.e. timers that were never cancelled),
+    // since the destruction of the waiter runs the loop until all of them are closed
+    uv_walk(loop->waiter->eventloop, [](uv_handle_t *handle, void *asynchandle)
+    {
+        if (handle != asynchandle && !uv_is_closing(handle))
+        {
+            uv_close(handle, NULL);
+        }
+    }, loop->waiter->asynchandle);
+
+    MegaChatApiImpl::loopFinished();
+}
+
+MegaChatApiImpl::MegaChatApiImpl(MegaChatApi *chatApi, MegaApi *megaApi, MegaChatRuntimePrivate *runtime)
+{
+    init(chatApi, megaApi, runtime);
 }
 
 MegaChatApiImpl::~MegaChatApiImpl()
@@ -81,9 +272,27 @@ MegaChatApiImpl::~MegaChatApiImpl()
     MegaChatRequestPrivate *request = new MegaChatRequestPrivate(MegaChatRequest::TYPE_DELETE);
     requestQueue.push(request);
     waiter->notify();
-    thread.join();
+    if (mRuntimeLoop)
+    {
+        mRuntime->waitDetached(mRuntimeLoop, this);
+    }
+    else
+    {
+        thread.join();
+    }
     delete request;
 
+    {
+        std::lock_guard<std::mutex> lock(sInstancesMutex);
+        sInstances.erase(mAppCtx);
+    }
+
+    {
+        // free the calls posted after the deletion was processed, without running them
+        karere::DiscardScope discard;
+        mScheduler.drain(0, [](void *msg) { megaProcessMessage(msg); });
+    }
+
     for (auto it = chatPeerListItemHandler.begin(); it != chatPeerListItemHandler.end(); it++)
     {
         delete *it;
@@ -93,15 +302,19 @@ MegaChatApiImpl::~MegaChatApiImpl()
         delete *it;
     }
 
-    // TODO: destruction of waiter hangs forever or may cause crashes
-    //delete waiter;
+    // the waiter and the network layer of a shared event loop are deleted by the loop
+    if (!mRuntimeLoop)
+    {
+        // TODO: destruction of waiter hangs forever or may cause crashes
+        //delete waiter;
 
-    // TODO: destruction of network layer may cause hangs on MegaApi's network layer.
-    // It may terminate the OpenSSL required by cUrl in SDK, so better to skip it.
-    //delete websocketsIO;
+        // TODO: destruction of network layer may cause hangs on MegaApi's network layer.
+        // It may terminate the OpenSSL required by cUrl in SDK, so better to skip it.
+        //delete websocketsIO;
+    }
 }
 
-void MegaChatApiImpl::init(MegaChatApi *chatApi, MegaApi *megaApi)
+void MegaChatApiImpl::init(MegaChatApi *chatApi, MegaApi *megaApi, MegaChatRuntimePrivate *runtime)
 {
     if (!megaPostMessageToGui)
     {
@@ -113,12 +326,28 @@ void MegaChatApiImpl::init(MegaChatApi *chatApi, MegaApi *megaApi)
 
     this->mClient = NULL;
     this->terminating = false;
-    this->waiter = new MegaChatWaiter();
-    this->websocketsIO = new MegaWebsocketsIO(sdkMutex, waiter, megaApi, this);
     this->reqtag = 0;
+    threadExit = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(sInstancesMutex);
+        mAppCtx = reinterpret_cast<void *>(++sLastAppCtx);
+        sInstances[mAppCtx] = this;
+    }
+
+    if (runtime)
+    {
+        // the waiter and the network layer are set by the event loop
+        mRuntime = runtime;
+        mRuntimeLoop = runtime->attach(this);
+        return;
+    }
+
+    this->waiter = new MegaChatWaiter();
+    this->websocketsIO = new MegaWebsocketsIO(sdkMutex, waiter, megaApi, mAppCtx);
 
     //Start blocking thread
-    threadExit = 0;
+    loopStarted();
     thread.start(threadEntryPoint, this);
 }
 
@@ -139,42 +368,85 @@ void *MegaChatApiImpl::threadEntryPoint(void *param)
 
 void MegaChatApiImpl::loop()
 {
-    sdkMutex.lock();
     while (true)
     {
-        sdkMutex.unlock();
-
         waiter->init(NEVER);
         waiter->wakeupby(websocketsIO, ::mega::Waiter::NEEDEXEC);
         waiter->wait();
 
-        sdkMutex.lock();
-
-        sendPendingEvents();
-        sendPendingRequests();
-
-        if (threadExit)
+        if (!processEvents())
         {
-            // There must be only one pending events, at maximum: the logout marshall call to delete the client
-            assert(eventQueue.isEmpty() || (eventQueue.size() == 1));
-            sendPendingEvents();
-
-            sdkMutex.unlock();
             break;
         }
     }
 
+    loopFinished();
+}
+
+void MegaChatApiImpl::loopStarted()
+{
+    std::lock_guard<std::mutex> lock(sRunningLoopsMutex);
+    sRunningLoops++;
+}
+
+void MegaChatApiImpl::loopFinished()
+{
+    // the lock is held during the cleanup, so a loop that starts meanwhile waits for it
+    std::lock_guard<std::mutex> lock(sRunningLoopsMutex);
+    assert(sRunningLoops > 0);
+    if (--sRunningLoops)
+    {
+        return;
+    }
+
 #ifndef KARERE_DISABLE_WEBRTC
     rtcModule::globalCleanup();
 #endif
 }
 
+// returns false once the instance has been deleted, so it must not be processed anymore
+bool MegaChatApiImpl::processEvents()
+{
+    SdkMutexGuard g(sdkMutex);
+
+    if (!sendPendingEvents())
+    {
+        // process the rest of events in the next iteration, after the network events. The
+        // requests wait until all the events queued before them have been processed, as the
+        // handlers of some of them (i.e. logout's terminate()) rely on it
+        waiter->notify();
+        return true;
+    }
+    sendPendingRequests();
+
+    if (threadExit)
+    {
+        // There must be only one pending events, at maximum: the logout marshall call to delete the client
+        assert(mScheduler.size() <= 1);
+        sendPendingEvents(false);
+        return false;
+    }
+
+    return true;
+}
+
 void MegaChatApiImpl::megaApiPostMessage(void* msg, void* ctx)
 {
-    MegaChatApiImpl *megaChatApi = (MegaChatApiImpl *)ctx;
-    if (megaChatApi)
+    if (ctx)
     {
-        megaChatApi->postMessage(msg);
+        {
+            std::lock_guard<std::mutex> lock(sInstancesMutex);
+            auto it = sInstances.find(ctx);
+            if (it != sInstances.end())
+            {
+                it->second->postMessage(msg);
+                return;
+            }
+        }
+
+        API_LOG_WARNING("Discarding a message posted to a deleted instance");
+        karere::DiscardScope discard;
+        megaProcessMessage(msg);    // frees it without running its function
     }
     else
     {
@@ -186,9 +458,16 @@ void MegaChatApiImpl::megaApiPostMessage(void* msg, void* ctx)
     }
 }
 
+MegaChatApiImpl *MegaChatApiImpl::getInstance(void *appCtx)
+{
+    std::lock_guard<std::mutex> lock(sInstancesMutex);
+    auto it = sInstances.find(appCtx);
+    return (it != sInstances.end()) ? it->second : NULL;
+}
+
 void MegaChatApiImpl::postMessage(void *msg)
 {
-    eventQueue.push(msg);
+    mScheduler.push(msg);   // with the class of the posting thread
     waiter->notify();
 }
 
@@ -350,7 +629,9 @@ void MegaChatApiImpl::sendPendingRequests()
             mClient->terminate(deleteDb);
 
             API_LOG_INFO("Chat engine is logged out!");
-            marshallCall([request, this]() //post destruction asynchronously so that all pending messages get processed before that
+            //post destruction asynchronously so that all pending messages get processed before that
+            //(with the lowest class, so it goes after the pending messages of every class)
+            marshallCall([request, this]()
             {
                 MegaChatErrorPrivate *megaChatError = new MegaChatErrorPrivate(MegaChatError::ERROR_OK);
                 fireOnChatRequestFinish(request, megaChatError);
@@ -358,7 +639,7 @@ void MegaChatApiImpl::sendPendingRequests()
                 delete mClient;
                 mClient = NULL;
                 terminating = false;
-            }, this);
+            }, mAppCtx, karere::kWorkMaintenance);
 
             break;
         }
@@ -2019,11 +2300,12 @@ void MegaChatApiImpl::sendPendingRequests()
             }
 
             int pendingStatus = chat.getPendingReactionStatus(reaction, msg.id());
-            bool hasReacted = msg.hasReacted(reaction, mClient->myHandle());
+            ReactionId reactionId = chat.reactionId(reaction);
+            bool hasReacted = msg.hasReacted(reactionId, mClient->myHandle());
             if (request->getFlag())
             {
                 // check if max number of reactions has been reached
-                int res = msg.allowReact(mClient->myHandle(), reaction);
+                int res = msg.allowReact(mClient->myHandle(), reactionId);
                 if (res != 0)
                 {
                     request->setNumber(res);
@@ -2073,16 +2355,26 @@ void MegaChatApiImpl::sendPendingRequests()
                 break;
             }
 
-            int count = mClient->importMessages(request->getText());
-            if (count < 0)
+            mClient->importMessages(request->getText(), [request, this](int count, karere::Id chatid)
             {
-                errorCode = MegaChatError::ERROR_ARGS;
-                break;
-            }
+                request->setNumber(count);
+                request->setChatHandle(chatid);
+                fireOnChatRequestUpdate(request);
+            })
+            .then([request, this](int count)
+            {
+                MegaChatErrorPrivate *megaChatError = new MegaChatErrorPrivate(MegaChatError::ERROR_OK);
+                request->setNumber(count);
+                request->setChatHandle(MEGACHAT_INVALID_HANDLE);
+                fireOnChatRequestFinish(request, megaChatError);
+            })
+            .fail([request, this](const ::promise::Error& err)
+            {
+                API_LOG_ERROR("Error importing messages: %s", err.what());
 
-            MegaChatErrorPrivate *megaChatError = new MegaChatErrorPrivate(MegaChatError::ERROR_OK);
-            request->setNumber(count);
-            fireOnChatRequestFinish(request, megaChatError);
+                MegaChatErrorPrivate *megaChatError = new MegaChatErrorPrivate(err.msg(), err.code(), err.type());
+                fireOnChatRequestFinish(request, megaChatError);
+            });
             break;
         }
 #ifndef KARERE_DISABLE_WEBRTC
@@ -2133,13 +2425,12 @@ void MegaChatApiImpl::sendPendingRequests()
     }
 }
 
-void MegaChatApiImpl::sendPendingEvents()
+bool MegaChatApiImpl::sendPendingEvents(bool sliced)
 {
-    void *msg;
-    while ((msg = eventQueue.pop()))
+    return mScheduler.drain(sliced ? kEventsTimeSliceMs : 0, [](void *msg)
     {
         megaProcessMessage(msg);
-    }
+    });
 }
 
 void MegaChatApiImpl::setLogLevel(int logLevel)
@@ -2237,7 +2528,10 @@ void MegaChatApiImpl::createKarereClient()
 #else
         uint8_t caps = karere::kClientIsMobile | karere::kClientSupportLastGreen;
 #endif
-        mClient = new karere::Client(*megaApi, websocketsIO, *this, megaApi->getBasePath(), caps, this);
+        mClient = new karere::Client(*megaApi, websocketsIO, *this, megaApi->getBasePath(), caps, mAppCtx);
+        mClient->setLazyJoin(mLazyJoinArchived, mLazyJoinIdleDays);
+        mClient->setTlsSessionPersistence(mPersistTlsSessions);
+        mClient->setMaxResidentMsgs(mMaxResidentMsgs);
         terminating = false;
     }
 }
@@ -2804,6 +3098,89 @@ void MegaChatApiImpl::retryPendingConnections(bool disconnect, bool refreshURL,
     waiter->notify();
 }
 
+void MegaChatApiImpl::setWebsocketsCompression(bool enable, int windowBits, int memLevel)
+{
+    // the offer of the extension is read by libwebsockets from the event loop
+    marshallCall([this, enable, windowBits, memLevel]()
+    {
+        websocketsIO->setCompression(enable, windowBits, memLevel);    // locks the sdkMutex
+    }, mAppCtx);
+}
+
+bool MegaChatApiImpl::startChatdTrace(const char *path, size_t maxBytes)
+{
+    if (!path)
+    {
+        return false;
+    }
+
+    SdkMutexGuard g(sdkMutex);
+    if (!mClient || !mClient->mChatdClient)
+    {
+        API_LOG_ERROR("startChatdTrace: the chat engine is not initialized");
+        return false;
+    }
+
+    return mClient->mChatdClient->startTrace(path, maxBytes);
+}
+
+void MegaChatApiImpl::stopChatdTrace()
+{
+    SdkMutexGuard g(sdkMutex);
+    if (mClient && mClient->mChatdClient)
+    {
+        mClient->mChatdClient->stopTrace();
+    }
+}
+
+char *MegaChatApiImpl::getSchedulerStats()
+{
+    return MegaApi::strdup(mScheduler.statsToJson().c_str());
+}
+
+void MegaChatApiImpl::setLazyJoin(bool archived, int idleDays)
+{
+    SdkMutexGuard g(sdkMutex);
+    mLazyJoinArchived = archived;
+    mLazyJoinIdleDays = (idleDays > 0) ? static_cast<unsigned>(idleDays) : 0;
+    if (mClient)
+    {
+        mClient->setLazyJoin(mLazyJoinArchived, mLazyJoinIdleDays);
+    }
+}
+
+void MegaChatApiImpl::setTlsSessionPersistence(bool enable)
+{
+    SdkMutexGuard g(sdkMutex);
+    mPersistTlsSessions = enable;
+
+    // the local cache is only accessed from the karere thread
+    marshallCall([this, enable]()
+    {
+        SdkMutexGuard g(sdkMutex);
+        if (mClient)
+        {
+            mClient->setTlsSessionPersistence(enable);
+        }
+    }, mAppCtx);
+}
+
+void MegaChatApiImpl::setMaxResidentMessages(unsigned int count)
+{
+    SdkMutexGuard g(sdkMutex);
+    mMaxResidentMsgs = count;
+
+    // evictions are scheduled in the karere thread
+    marshallCall([this, count]()
+    {
+        SdkMutexGuard g(sdkMutex);
+        if (mClient)
+        {
+            mClient->setMaxResidentMsgs(count);
+        }
+    }, mAppCtx);
+}
+
 void MegaChatApiImpl::logout(MegaChatRequestListener *listener)
 {
     MegaChatRequestPrivate *request = new MegaChatRequestPrivate(MegaChatRequest::TYPE_LOGOUT, listener);
@@ -3305,15 +3682,49 @@ int MegaChatApiImpl::getUnreadChats()
 
     if (mClient && !terminating)
     {
+        std::vector<karere::Id> deferredChats;
         ChatRoomList::iterator it;
         for (it = mClient->chats->begin(); it != mClient->chats->end(); it++)
         {
             ChatRoom *room = it->second;
-            if (!room->isArchived() && !room->previewMode() && room->chat().unreadMsgCount())
+            if (room->isArchived() || room->previewMode())
+            {
+                continue;
+            }
+
+            if (room->chat().isJoinDeferred())
+            {
+                deferredChats.push_back(room->chatid());
+            }
+
+            if (room->chat().unreadMsgCount())
             {
                 count++;
             }
         }
+
+        // the local count of the chats deferred by the lazy-join policy may be outdated, so they
+        // are joined. The connections are started from the karere thread, not the app's one
+        if (!deferredChats.empty())
+        {
+            marshallCall([this, deferredChats]()
+            {
+                SdkMutexGuard g(sdkMutex);
+                if (!mClient || terminating)
+                {
+                    return;
+                }
+
+                for (karere::Id chatid: deferredChats)
+                {
+                    ChatRoomList::iterator it = mClient->chats->find(chatid);
+                    if (it != mClient->chats->end())
+                    {
+                        it->second->chat().requestJoin();
+                    }
+                }
+            }, mAppCtx);
+        }
     }
 
     sdkMutex.unlock();
@@ -3658,6 +4069,16 @@ int MegaChatApiImpl::loadMessages(MegaChatHandle chatid, int count)
     return ret;
 }
 
+void MegaChatApiImpl::enableBatchedMessageLoading(bool enable)
+{
+    mBatchedMessageLoading = enable;
+}
+
+bool MegaChatApiImpl::isBatchedMessageLoadingEnabled() const
+{
+    return mBatchedMessageLoading;
+}
+
 bool MegaChatApiImpl::isFullHistoryLoaded(MegaChatHandle chatid)
 {
     bool ret = false;
@@ -3703,6 +4124,11 @@ MegaChatMessage *MegaChatApiImpl::getMessage(MegaChatHandle chatid, MegaChatHand
             {
                 megaMsg = new MegaChatMessagePrivate(*msg, Message::Status::kSending, MEGACHAT_INVALID_INDEX);
             }
+            else if ((msg = chat.loadEvictedMsg(msgid, index)))   // dropped from RAM, but still in db
+            {
+                megaMsg = new MegaChatMessagePrivate(*msg, chat.getMsgStatus(*msg, index), index);
+                delete msg;
+            }
             else
             {
                 API_LOG_ERROR("Failed to find message by temporal id (id: %d)", msgid);
@@ -4723,9 +5149,9 @@ int MegaChatApiImpl::getMessageReactionCount(MegaChatHandle chatid, MegaChatHand
     }
 
     // Update users of confirmed reactions with pending reactions
-    int count = msg->getReactionCount(reaction);
     ChatRoom *chatroom = findChatRoom(chatid);
-    auto pendingReactions = chatroom->chat().getPendingReactions();
+    int count = msg->getReactionCount(chatroom->chat().reactionId(reaction));
+    auto &pendingReactions = chatroom->chat().getPendingReactions();
     for (auto &auxReact : pendingReactions)
     {
         if (auxReact.mMsgId == msgid && auxReact.mReactionString == reaction)
@@ -4752,17 +5178,19 @@ MegaStringList* MegaChatApiImpl::getMessageReactions(MegaChatHandle chatid, Mega
     }
 
     vector<char *> reactList;
-    const std::vector<Message::Reaction> &confirmedReactions = msg->getReactions();
-    const Chat::PendingReactions& pendingReactions = (findChatRoom(chatid))->chat().getPendingReactions();
+    const Chat &chat = findChatRoom(chatid)->chat();
+    const std::vector<std::pair<ReactionId, int>> &confirmedReactions = msg->getReactions();
+    const Chat::PendingReactions& pendingReactions = chat.getPendingReactions();
 
     // iterate through confirmed reactions list
     for (auto &auxReact : confirmedReactions)
     {
-         int reactUsers = static_cast<int>(auxReact.mUsers.size());
+         const std::string &reactionString = chat.reactionString(auxReact.first);
+         int reactUsers = auxReact.second;
          for (auto &pendingReact : pendingReactions)
          {
              if (pendingReact.mMsgId == msgid
-                     && !pendingReact.mReactionString.compare(auxReact.mReaction))
+                     && !pendingReact.mReactionString.compare(reactionString))
              {
                 // increment or decrement reactUsers, for the confirmed reaction we are checking
                 (pendingReact.mStatus == OP_ADDREACTION)
@@ -4776,7 +5204,7 @@ MegaStringList* MegaChatApiImpl::getMessageReactions(MegaChatHandle chatid, Mega
 
          if (reactUsers > 0)
          {
-             reactList.emplace_back(MegaApi::strdup(auxReact.mReaction.c_str()));
+             reactList.emplace_back(MegaApi::strdup(reactionString.c_str()));
          }
     }
 
@@ -4784,7 +5212,7 @@ MegaStringList* MegaChatApiImpl::getMessageReactions(MegaChatHandle chatid, Mega
     for (auto &pendingReact : pendingReactions)
     {
         if (pendingReact.mMsgId == msgid
-                && !msg->getReactionCount(pendingReact.mReactionString)
+                && !msg->getReactionCount(chat.reactionId(pendingReact.mReactionString))
                 && pendingReact.mStatus == OP_ADDREACTION)
         {
             reactList.emplace_back (MegaApi::strdup(pendingReact.mReactionString.c_str()));
@@ -4814,7 +5242,7 @@ MegaHandleList* MegaChatApiImpl::getReactionUsers(MegaChatHandle chatid, MegaCha
     bool reacted = false;
     string reactionStr(reaction);
     int pendingReactionStatus = chatroom->chat().getPendingReactionStatus(reactionStr, msgid);
-    const std::vector<karere::Id> &users = msg->getReactionUsers(reactionStr);
+    const std::vector<karere::Id> &users = msg->getReactionUsers(chatroom->chat().reactionId(reactionStr));
     for (auto user: users)
     {
         if (user != mClient->myHandle())
@@ -5178,56 +5606,6 @@ void ChatRequestQueue::removeListener(MegaChatRequestListener *listener)
     mutex.unlock();
 }
 
-void EventQueue::push(void *transfer)
-{
-    mutex.lock();
-    events.push_back(transfer);
-    mutex.unlock();
-}
-
-void EventQueue::push_front(void *event)
-{
-    mutex.lock();
-    events.push_front(event);
-    mutex.unlock();
-}
-
-void* EventQueue::pop()
-{
-    mutex.lock();
-    if(events.empty())
-    {
-        mutex.unlock();
-        return NULL;
-    }
-    void* event = events.front();
-    events.pop_front();
-    mutex.unlock();
-    return event;
-}
-
-bool EventQueue::isEmpty()
-{
-    bool ret;
-
-    mutex.lock();
-    ret = events.empty();
-    mutex.unlock();
-
-    return ret;
-}
-
-size_t EventQueue::size()
-{
-    size_t ret;
-
-    mutex.lock();
-    ret = events.size();
-    mutex.unlock();
-
-    return ret;
-}
-
 MegaChatRequestPrivate::MegaChatRequestPrivate(int type, MegaChatRequestListener *listener)
 {
     this->type = type;
@@ -6384,6 +6762,39 @@ void MegaChatRoomHandler::fireOnMessageLoaded(MegaChatMessage *msg)
     delete msg;
 }
 
+void MegaChatRoomHandler::fireOnMessagesLoaded(MegaChatMessageList *msgs)
+{
+    for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end() ; it++)
+    {
+        (*it)->onMessagesLoaded(chatApi, msgs);
+    }
+
+    delete msgs;
+}
+
+void MegaChatRoomHandler::notifyHistoryMessage(MegaChatMessage *message)
+{
+    if (!chatApiImpl->isBatchedMessageLoadingEnabled() && !mLoadedMessages)
+    {
+        fireOnMessageLoaded(message);
+        return;
+    }
+
+    if (!mLoadedMessages)
+    {
+        mLoadedMessages.reset(new MegaChatMessageListPrivate());
+    }
+
+    if (message)
+    {
+        mLoadedMessages->addMessage(message);
+    }
+    else    // end of the load: notify the whole batch
+    {
+        fireOnMessagesLoaded(mLoadedMessages.release());
+    }
+}
+
 void MegaChatRoomHandler::fireOnHistoryTruncatedByRetentionTime(MegaChatMessage *msg)
 {
     for(set<MegaChatRoomListener *>::iterator it = roomListeners.begin(); it != roomListeners.end() ; it++)
@@ -6667,12 +7078,12 @@ void MegaChatRoomHandler::onRecvHistoryMessage(Idx idx, Message &msg, Message::S
     MegaChatMessagePrivate *message = new MegaChatMessagePrivate(msg, status, idx);
     handleHistoryMessage(message);
 
-    fireOnMessageLoaded(message);
+    notifyHistoryMessage(message);
 }
 
 void MegaChatRoomHandler::onHistoryDone(chatd::HistSource /*source*/)
 {
-    fireOnMessageLoaded(NULL);
+    notifyHistoryMessage(NULL);
 }
 
 void MegaChatRoomHandler::onHistoryTruncatedByRetentionTime(const Message &msg, const Idx &idx, const Message::Status &status)
@@ -8003,7 +8414,12 @@ MegaChatPeerListItemHandler::MegaChatPeerListItemHandler(MegaChatApiImpl &chatAp
 
 MegaChatMessagePrivate::MegaChatMessagePrivate(const MegaChatMessage *msg)
 {
-    this->msg = MegaApi::strdup(msg->getContent());
+    const char *content = msg->getContent();
+    if (content)
+    {
+        this->mContent = content;
+        this->mHasTextContent = true;
+    }
     this->uh = msg->getUserHandle();
     this->hAction = msg->getHandleOfAction();
     this->msgId = msg->getMsgId();
@@ -8040,16 +8456,32 @@ MegaChatMessagePrivate::MegaChatMessagePrivate(const MegaChatMessage *msg)
     }
 }
 
-MegaChatMessagePrivate::MegaChatMessagePrivate(const Message &msg, Message::Status status, Idx index)
+MegaChatMessagePrivate::MegaChatMessagePrivate(const MegaChatMessagePrivate &msg)
+    : changed(msg.changed), type(msg.type), status(msg.status), msgId(msg.msgId), tempId(msg.tempId),
+      rowId(msg.rowId), uh(msg.uh), hAction(msg.hAction), index(msg.index), ts(msg.ts),
+      mContent(msg.mContent), mHasTextContent(msg.mHasTextContent),
+      edited(msg.edited), deleted(msg.deleted), priv(msg.priv), code(msg.code), mHasReactions(msg.mHasReactions)
 {
-    if (msg.type == TYPE_NORMAL || msg.type == TYPE_CHAT_TITLE)
+    // if the source has not been decoded yet, this copy will decode its own content on demand
+    std::lock_guard<std::mutex> lock(msg.mDecodeMutex);
+    this->mContentDecoded = msg.mContentDecoded.load();
+    if (msg.megaChatUsers)
     {
-        string tmp(msg.buf(), msg.size());
-        this->msg = msg.size() ? MegaApi::strdup(tmp.c_str()) : NULL;
+        this->megaChatUsers = new std::vector<MegaChatAttachedUser>(*msg.megaChatUsers);
     }
-    else    // for other types, content is irrelevant
+    this->megaNodeList = msg.megaNodeList ? msg.megaNodeList->copy() : NULL;
+    this->megaHandleList = msg.megaHandleList ? msg.megaHandleList->copy() : NULL;
+    this->mContainsMeta = msg.mContainsMeta ? msg.mContainsMeta->copy() : NULL;
+}
+
+MegaChatMessagePrivate::MegaChatMessagePrivate(const Message &msg, Message::Status status, Idx index)
+{
+    // Only cheap header fields are filled here. Attachments, contacts, meta and call participants
+    // are kept as raw content, and parsed by decodeContent() if the app asks for them
+    if (msg.type == TYPE_NORMAL || msg.type == TYPE_CHAT_TITLE)
     {
-        this->msg = NULL;
+        this->mContent.assign(msg.buf(), msg.size());
+        this->mHasTextContent = msg.size();
     }
     this->uh = msg.userid;
     this->msgId = msg.isSending() ? MEGACHAT_INVALID_HANDLE : (MegaChatHandle) msg.id();
@@ -8080,8 +8512,11 @@ MegaChatMessagePrivate::MegaChatMessagePrivate(const Message &msg, Message::Stat
         }
         case MegaChatMessage::TYPE_NODE_ATTACHMENT:
         case MegaChatMessage::TYPE_VOICE_CLIP:
+        case MegaChatMessage::TYPE_CONTACT_ATTACHMENT:
+        case MegaChatMessage::TYPE_CONTAINS_META:
         {
-            megaNodeList = JSonUtils::parseAttachNodeJSon(msg.toText().c_str());
+            this->mContent.assign(msg.buf(), msg.size());
+            this->mContentDecoded = false;
             break;
         }
         case MegaChatMessage::TYPE_REVOKE_NODE_ATTACHMENT:
@@ -8089,33 +8524,27 @@ MegaChatMessagePrivate::MegaChatMessagePrivate(const Message &msg, Message::Stat
             this->hAction = MegaApi::base64ToHandle(msg.toText().c_str());
             break;
         }
-        case MegaChatMessage::TYPE_CONTACT_ATTACHMENT:
-        {
-            megaChatUsers = JSonUtils::parseAttachContactJSon(msg.toText().c_str());
-            break;
-        }
-        case MegaChatMessage::TYPE_CONTAINS_META:
-        {
-            uint8_t containsMetaType = msg.containMetaSubtype();
-            string containsMetaJson = msg.containsMetaJson();
-            mContainsMeta = JSonUtils::parseContainsMeta(containsMetaJson.c_str(), containsMetaType);
-            break;
-        }
         case MegaChatMessage::TYPE_CALL_ENDED:
         {
-            megaHandleList = new MegaHandleListPrivate();
-            Message::CallEndedInfo *callEndInfo = Message::CallEndedInfo::fromBuffer(msg.buf(), msg.size());
-            if (callEndInfo)
+            // duration and termcode are read in place, participants are decoded on demand
+            Message::CallEndedInfo callEndInfo;
+            size_t headerLen = sizeof(callEndInfo.callid) + sizeof(callEndInfo.duration) + sizeof(callEndInfo.termCode);
+            size_t numParticipants = 0;
+            if (msg.size() >= headerLen + sizeof(numParticipants))
             {
-                for (size_t i = 0; i < callEndInfo->participants.size(); i++)
-                {
-                    megaHandleList->addMegaHandle(callEndInfo->participants[i]);
-                }
-
-                priv = callEndInfo->duration;
-                code = MegaChatMessagePrivate::convertEndCallTermCodeToUI(*callEndInfo);
-                delete callEndInfo;
+                memcpy(&numParticipants, msg.buf() + headerLen, sizeof(numParticipants));
             }
+            // same validation as CallEndedInfo::fromBuffer()
+            if (msg.size() >= headerLen + sizeof(numParticipants)
+                    && (msg.size() - headerLen - sizeof(numParticipants)) / sizeof(karere::Id) >= numParticipants)
+            {
+                memcpy(&callEndInfo.duration, msg.buf() + sizeof(callEndInfo.callid), sizeof(callEndInfo.duration));
+                callEndInfo.termCode = Message::extractTermCodeEndCall(msg);
+                priv = callEndInfo.duration;
+                code = MegaChatMessagePrivate::convertEndCallTermCodeToUI(callEndInfo);
+            }
+            this->mContent.assign(msg.buf(), msg.size());
+            this->mContentDecoded = false;
             break;
         }
 
@@ -8163,7 +8592,6 @@ MegaChatMessagePrivate::MegaChatMessagePrivate(const Message &msg, Message::Stat
 
 MegaChatMessagePrivate::~MegaChatMessagePrivate()
 {
-    delete [] msg;
     delete megaChatUsers;
     delete megaNodeList;
     delete mContainsMeta;
@@ -8172,7 +8600,69 @@ MegaChatMessagePrivate::~MegaChatMessagePrivate()
 
 MegaChatMessage *MegaChatMessagePrivate::copy() const
 {
-    return new MegaChatMessagePrivate(this);
+    return new MegaChatMessagePrivate(*this);
+}
+
+void MegaChatMessagePrivate::decodeContent() const
+{
+    if (mContentDecoded)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mDecodeMutex);
+    if (mContentDecoded)    // decoded by another thread meanwhile
+    {
+        return;
+    }
+
+    // the same layout as chatd::Message: special messages have a 2-byte binary prefix
+    switch (type)
+    {
+        case MegaChatMessage::TYPE_NODE_ATTACHMENT:
+        case MegaChatMessage::TYPE_VOICE_CLIP:
+        {
+            if (mContent.size() > 2)
+            {
+                megaNodeList = JSonUtils::parseAttachNodeJSon(mContent.c_str() + 2);
+            }
+            break;
+        }
+        case MegaChatMessage::TYPE_CONTACT_ATTACHMENT:
+        {
+            if (mContent.size() > 2)
+            {
+                megaChatUsers = JSonUtils::parseAttachContactJSon(mContent.c_str() + 2);
+            }
+            break;
+        }
+        case MegaChatMessage::TYPE_CONTAINS_META:
+        {
+            uint8_t containsMetaType = (mContent.size() > 2) ? mContent[2] : (uint8_t)Message::ContainsMetaSubType::kInvalid;
+            string containsMetaJson = (mContent.size() > 3) ? mContent.substr(3) : "";
+            mContainsMeta = JSonUtils::parseContainsMeta(containsMetaJson.c_str(), containsMetaType);
+            break;
+        }
+        case MegaChatMessage::TYPE_CALL_ENDED:
+        {
+            megaHandleList = new MegaHandleListPrivate();
+            Message::CallEndedInfo *callEndInfo = Message::CallEndedInfo::fromBuffer(mContent.data(), mContent.size());
+            if (callEndInfo)
+            {
+                for (size_t i = 0; i < callEndInfo->participants.size(); i++)
+                {
+                    megaHandleList->addMegaHandle(callEndInfo->participants[i]);
+                }
+                delete callEndInfo;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    // set last, so the members are complete for the threads that skip the lock
+    mContentDecoded = true;
 }
 
 int MegaChatMessagePrivate::getStatus() const
@@ -8223,7 +8713,7 @@ const char *MegaChatMessagePrivate::getContent() const
         return getContainsMeta()->getTextMessage();
 
     }
-    return msg;
+    return mHasTextContent ? mContent.c_str() : NULL;
 }
 
 bool MegaChatMessagePrivate::isEdited() const
@@ -8345,6 +8835,7 @@ int MegaChatMessagePrivate::convertEndCallTermCodeToUI(const Message::CallEndedI
 
 unsigned int MegaChatMessagePrivate::getUsersCount() const
 {
+    decodeContent();
     unsigned int size = 0;
     if (megaChatUsers != NULL)
     {
@@ -8356,6 +8847,7 @@ unsigned int MegaChatMessagePrivate::getUsersCount() const
 
 MegaChatHandle MegaChatMessagePrivate::getUserHandle(unsigned int index) const
 {
+    decodeContent();
     if (!megaChatUsers || index >= megaChatUsers->size())
     {
         return MEGACHAT_INVALID_HANDLE;
@@ -8366,6 +8858,7 @@ MegaChatHandle MegaChatMessagePrivate::getUserHandle(unsigned int index) const
 
 const char *MegaChatMessagePrivate::getUserName(unsigned int index) const
 {
+    decodeContent();
     if (!megaChatUsers || index >= megaChatUsers->size())
     {
         return NULL;
@@ -8376,6 +8869,7 @@ const char *MegaChatMessagePrivate::getUserName(unsigned int index) const
 
 const char *MegaChatMessagePrivate::getUserEmail(unsigned int index) const
 {
+    decodeContent();
     if (!megaChatUsers || index >= megaChatUsers->size())
     {
         return NULL;
@@ -8386,16 +8880,19 @@ const char *MegaChatMessagePrivate::getUserEmail(unsigned int index) const
 
 MegaNodeList *MegaChatMessagePrivate::getMegaNodeList() const
 {
+    decodeContent();
     return megaNodeList;
 }
 
 const MegaChatContainsMeta *MegaChatMessagePrivate::getContainsMeta() const
 {
+    decodeContent();
     return mContainsMeta;
 }
 
 MegaHandleList *MegaChatMessagePrivate::getMegaHandleList() const
 {
+    decodeContent();
     return megaHandleList;
 }
 
@@ -9024,6 +9521,56 @@ void MegaChatSessionHandler::onOnHold(bool onHold)
 
 #endif
 
+MegaChatMessageListPrivate::MegaChatMessageListPrivate()
+{
+}
+
+MegaChatMessageListPrivate::~MegaChatMessageListPrivate()
+{
+    for (unsigned int i = 0; i < list.size(); i++)
+    {
+        delete list[i];
+        list[i] = NULL;
+    }
+
+    list.clear();
+}
+
+MegaChatMessageListPrivate::MegaChatMessageListPrivate(const MegaChatMessageListPrivate *list)
+{
+    for (unsigned int i = 0; i < list->size(); i++)
+    {
+        this->list.push_back(list->get(i)->copy());
+    }
+}
+
+MegaChatMessageListPrivate *MegaChatMessageListPrivate::copy() const
+{
+    return new MegaChatMessageListPrivate(this);
+}
+
+const MegaChatMessage *MegaChatMessageListPrivate::get(unsigned int i) const
+{
+    if (i >= size())
+    {
+        return NULL;
+    }
+    else
+    {
+        return list.at(i);
+    }
+}
+
+unsigned int MegaChatMessageListPrivate::size() const
+{
+    return list.size();
+}
+
+void MegaChatMessageListPrivate::addMessage(MegaChatMessage *msg)
+{
+    list.push_back(msg);
+}
+
 MegaChatListItemListPrivate::MegaChatListItemListPrivate()
 {
 }
@@ -42,7 +42,11 @@
 #include <sdkApi.h>
 #include <karereCommon.h>
 #include <logger.h>
+#include <workScheduler.h>
 #include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
 #include "net/libwebsocketsIO.h"
 #include "waiter/libuvWaiter.h"
 
@@ -453,6 +457,23 @@ public:
     MegaChatPeerListItemHandler(MegaChatApiImpl &, karere::ChatRoom&);
 };
 
+class MegaChatMessageListPrivate :  public MegaChatMessageList
+{
+public:
+    MegaChatMessageListPrivate();
+    virtual ~MegaChatMessageListPrivate();
+    virtual MegaChatMessageListPrivate *copy() const;
+
+    virtual const MegaChatMessage *get(unsigned int i) const;
+    virtual unsigned int size() const;
+
+    void addMessage(MegaChatMessage *msg);
+
+private:
+    MegaChatMessageListPrivate(const MegaChatMessageListPrivate *list);
+    std::vector<MegaChatMessage *> list;
+};
+
 class MegaChatRoomHandler :public karere::IApp::IChatHandler
 {
 public:
@@ -464,6 +485,7 @@ public:
     // MegaChatRoomListener callbacks
     void fireOnChatRoomUpdate(MegaChatRoom *chat);
     void fireOnMessageLoaded(MegaChatMessage *msg);
+    void fireOnMessagesLoaded(MegaChatMessageList *msgs);
     void fireOnMessageReceived(MegaChatMessage *msg);
     void fireOnHistoryTruncatedByRetentionTime(MegaChatMessage *msg);
     void fireOnMessageUpdate(MegaChatMessage *msg);
@@ -519,6 +541,8 @@ public:
     bool isRevoked(MegaChatHandle h);
     // update access to attachments
     void handleHistoryMessage(MegaChatMessage *message);
+    // notifies a message loaded by loadMessages(), or the end of the load if NULL
+    void notifyHistoryMessage(MegaChatMessage *message);
     // update access to attachments, returns messages requiring updates (you take ownership)
     std::set<MegaChatHandle> *handleNewMessage(MegaChatMessage *msg);
 
@@ -535,6 +559,9 @@ private:
 
     std::set<MegaChatRoomListener *> roomListeners;
 
+    // messages loaded so far, if batched message loading is enabled
+    std::unique_ptr<MegaChatMessageListPrivate> mLoadedMessages;
+
     // nodes with granted/revoked access from loaded messsages
     std::map<MegaChatHandle, bool> attachmentsAccess;  // handle, access
     std::map<MegaChatHandle, std::set<MegaChatHandle>> attachmentsIds;    // nodehandle, msgids
@@ -820,6 +847,7 @@ class MegaChatMessagePrivate : public MegaChatMessage
 {
 public:
     MegaChatMessagePrivate(const MegaChatMessage *msg);
+    MegaChatMessagePrivate(const MegaChatMessagePrivate &msg);
     MegaChatMessagePrivate(const chatd::Message &msg, chatd::Message::Status status, chatd::Idx index);
 
     virtual ~MegaChatMessagePrivate();
@@ -870,6 +898,9 @@ public:
 
 private:
     bool isGiphy() const;
+    // Parses the attached nodes, contacts, meta or call participants from mContent, on first use.
+    // The app and the karere thread may hold the same message, so it's guarded by mDecodeMutex
+    void decodeContent() const;
 
     int changed;
 
@@ -882,16 +913,21 @@ private:
     MegaChatHandle hAction;// certain messages need additional handle: such us priv changes, revoke attachment
     int index;              // position within the history buffer
     int64_t ts;
-    const char *msg;
+    // Raw content of the message. It's the text for normal messages and titles,
+    // or the payload to be decoded by decodeContent() for the other types
+    std::string mContent;
+    bool mHasTextContent = false;
+    mutable std::atomic<bool> mContentDecoded { true };
+    mutable std::mutex mDecodeMutex;    // protects the decoding of the members below
     bool edited;
     bool deleted;
     int priv;               // certain messages need additional info, like priv changes
     int code;               // generic field for additional information (ie. the reason of manual sending)
     bool mHasReactions;
-    std::vector<MegaChatAttachedUser> *megaChatUsers = NULL;
-    mega::MegaNodeList *megaNodeList = NULL;
-    mega::MegaHandleList *megaHandleList = NULL;
-    const MegaChatContainsMeta *mContainsMeta = NULL;
+    mutable std::vector<MegaChatAttachedUser> *megaChatUsers = NULL;
+    mutable mega::MegaNodeList *megaNodeList = NULL;
+    mutable mega::MegaHandleList *megaHandleList = NULL;
+    mutable const MegaChatContainsMeta *mContainsMeta = NULL;
 };
 
 //Thread safe request queue
@@ -908,19 +944,44 @@ class ChatRequestQueue
         void removeListener(MegaChatRequestListener *listener);
 };
 
-//Thread safe transfer queue
-class EventQueue
+// Event loops shared by several MegaChatApiImpl (see MegaChatRuntime)
+class MegaChatRuntimePrivate
 {
-protected:
-    std::deque<void *> events;
-    std::mutex mutex;
-
 public:
-    void push(void* event);
-    void push_front(void *event);
-    void* pop();
-    bool isEmpty();
-    size_t size();
+    // A thread running an event loop, which processes the instances assigned to it
+    struct Loop
+    {
+        MegaChatWaiter *waiter = nullptr;
+        mega::MegaThread thread;
+        std::mutex mutex;   // protects the members below
+        std::condition_variable changed;   // notified when an instance is attached or detached
+        std::vector<MegaChatApiImpl *> attaching;   // waiting for the loop to create their websockets
+        std::vector<MegaChatApiImpl *> instances;
+        std::thread::id threadId;   // set by the loop when it starts
+        bool exit = false;
+    };
+
+    explicit MegaChatRuntimePrivate(int numLoops);
+    ~MegaChatRuntimePrivate();
+
+    int getNumLoops() const;
+    int getNumInstances() const;
+
+    // Assigns the instance to the loop with the fewest instances, and waits until the loop
+    // has created its network layer (libuv handles can only be created from its thread).
+    // If called from the thread of that loop, the network layer is created right away
+    Loop *attach(MegaChatApiImpl *instance);
+
+    // Waits until the loop has processed the deletion of the instance and destroyed its
+    // network layer. Must not be called from the thread of the loop
+    void waitDetached(Loop *loop, MegaChatApiImpl *instance);
+
+private:
+    std::vector<std::unique_ptr<Loop>> mLoops;
+
+    static void *threadEntryPoint(void *param);
+    static void run(Loop *loop);
+    static void attached(Loop *loop, MegaChatApiImpl *instance);
 };
 
 class MegaChatApiImpl :
@@ -929,7 +990,7 @@ class MegaChatApiImpl :
 {
 public:
 
-    MegaChatApiImpl(MegaChatApi *chatApi, mega::MegaApi *megaApi);
+    MegaChatApiImpl(MegaChatApi *chatApi, mega::MegaApi *megaApi, MegaChatRuntimePrivate *runtime = NULL);
     virtual ~MegaChatApiImpl();
 
     using SdkMutexGuard = std::unique_lock<std::recursive_mutex>;   // (equivalent to typedef)
@@ -942,18 +1003,54 @@ private:
     WebsocketsIO *websocketsIO;
     karere::Client *mClient;
     bool terminating;
+    std::atomic<bool> mBatchedMessageLoading { false };
+
+    // lazy-join policy, applied to every karere::Client created
+    bool mLazyJoinArchived = false;
+    unsigned mLazyJoinIdleDays = 0;
+
+    // TLS sessions are stored in the cache of every karere::Client created
+    bool mPersistTlsSessions = false;
+
+    // max messages in RAM per chat, applied to every karere::Client created
+    unsigned mMaxResidentMsgs = 0;
 
     mega::MegaThread thread;
     int threadExit;
     static void *threadEntryPoint(void *param);
     void loop();
+    bool processEvents();
+
+    // set when running on the event loop of a MegaChatRuntime, instead of its own thread
+    MegaChatRuntimePrivate *mRuntime = nullptr;
+    MegaChatRuntimePrivate::Loop *mRuntimeLoop = nullptr;
+    friend class MegaChatRuntimePrivate;
+
+    // Context of the marshalled calls of this instance. It's an id that is never reused
+    // rather than a pointer to the instance, so that messages posted to a deleted instance
+    // (i.e. by timers of a shared event loop, which keeps running after the deletion) are
+    // discarded, even if another instance is created at the same address
+    void *mAppCtx = nullptr;
 
-    void init(MegaChatApi *chatApi, mega::MegaApi *megaApi);
+    // instances alive, by context
+    static std::mutex sInstancesMutex;
+    static std::map<void *, MegaChatApiImpl *> sInstances;
+    static uintptr_t sLastAppCtx;
+
+    // event loops running (one per instance, or per loop of a MegaChatRuntime), which share the
+    // global webrtc state. It's cleaned up when the last one exits
+    static std::mutex sRunningLoopsMutex;
+    static int sRunningLoops;
+    static void loopStarted();
+    static void loopFinished();
+
+    void init(MegaChatApi *chatApi, mega::MegaApi *megaApi, MegaChatRuntimePrivate *runtime);
 
     static LoggerHandler *loggerHandler;
 
     ChatRequestQueue requestQueue;
-    EventQueue eventQueue;
+    // marshalled calls, processed by priority (see karere::WorkScheduler)
+    karere::WorkScheduler mScheduler;
 
     std::set<MegaChatListener *> listeners;
     std::set<MegaChatNotificationListener *> notificationListeners;
@@ -981,10 +1078,16 @@ private:
 
 public:
     static void megaApiPostMessage(void* msg, void* ctx);
+    // returns NULL if the instance of the context was deleted
+    static MegaChatApiImpl *getInstance(void *appCtx);
     void postMessage(void *msg);
 
     void sendPendingRequests();
-    void sendPendingEvents();
+
+    // marshalled calls are processed for up to this time before going back to the event loop
+    enum { kEventsTimeSliceMs = 20 };
+    // returns false if there are still events pending after the time slice (if \c sliced)
+    bool sendPendingEvents(bool sliced = true);
 
     static void setLogLevel(int logLevel);
     static void setLoggerClass(MegaChatLogger *megaLogger);
@@ -1078,6 +1181,13 @@ public:
     bool areAllChatsLoggedIn();
     static int convertChatConnectionState(chatd::ChatState state);
     void retryPendingConnections(bool disconnect = false, bool refreshURL = false, MegaChatRequestListener *listener = NULL);
+    void setWebsocketsCompression(bool enable, int windowBits, int memLevel);
+    bool startChatdTrace(const char *path, size_t maxBytes);
+    void stopChatdTrace();
+    char *getSchedulerStats();
+    void setLazyJoin(bool archived, int idleDays);
+    void setTlsSessionPersistence(bool enable);
+    void setMaxResidentMessages(unsigned int count);
     void logout(MegaChatRequestListener *listener = NULL);
     void localLogout(MegaChatRequestListener *listener = NULL);
 
@@ -1151,6 +1261,8 @@ public:
     void closeChatPreview(MegaChatHandle chatid);
 
     int loadMessages(MegaChatHandle chatid, int count);
+    void enableBatchedMessageLoading(bool enable);
+    bool isBatchedMessageLoadingEnabled() const;
     bool isFullHistoryLoaded(MegaChatHandle chatid);
     void manageReaction(MegaChatHandle chatid, MegaChatHandle msgid, const char *reaction, bool add, MegaChatRequestListener *listener = NULL);
     MegaChatMessage *getMessage(MegaChatHandle chatid, MegaChatHandle msgid);
@@ -6,6 +6,9 @@
 
 using namespace std;
 
+// index of the LibwebsocketsIO in the ex_data of the SSL_CTX
+static int sslCtxIndex = SSL_CTX_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+
 static struct lws_protocols protocols[] =
 {
     {
@@ -30,6 +33,13 @@ LibwebsocketsIO::LibwebsocketsIO(Mutex &mutex, ::mega::Waiter* waiter, ::mega::M
     info.options |= LWS_SERVER_OPTION_DISABLE_OS_CA_CERTS;
     info.options |= LWS_SERVER_OPTION_LIBUV;
     info.options |= LWS_SERVER_OPTION_UV_NO_SIGSEGV_SIGFPE_SPIN;
+    info.user = this;
+
+    memset(mExtensions, 0, sizeof(mExtensions));
+    mExtensions[0].name = "permessage-deflate";
+    mExtensions[0].callback = LibwebsocketsClient::deflateCallback;
+    setCompression(mCompression, mCompressionWindowBits, mCompressionMemLevel);
+    info.extensions = mExtensions;
     
     lws_set_log_level(LLL_ERR | LLL_WARN, NULL);
     wscontext = lws_create_context(&info);
@@ -149,6 +159,92 @@ int LibwebsocketsIO::wsGetNoNameErrorCode()
     return UV__EAI_NONAME;
 }
 
+// offers of permessage-deflate by window size (from 9 to 15 bits). They are constant, since
+// libwebsockets reads the offer of the current extension for every new connection
+static const char *deflateOffers[] =
+{
+    "permessage-deflate; client_max_window_bits=9; server_max_window_bits=9",
+    "permessage-deflate; client_max_window_bits=10; server_max_window_bits=10",
+    "permessage-deflate; client_max_window_bits=11; server_max_window_bits=11",
+    "permessage-deflate; client_max_window_bits=12; server_max_window_bits=12",
+    "permessage-deflate; client_max_window_bits=13; server_max_window_bits=13",
+    "permessage-deflate; client_max_window_bits=14; server_max_window_bits=14",
+    "permessage-deflate; client_max_window_bits"
+};
+
+void LibwebsocketsIO::setCompression(bool enable, int windowBits, int memLevel)
+{
+    MutexGuard lock(mutex);
+    WebsocketsIO::setCompression(enable, windowBits, memLevel);
+    mExtensions[0].client_offer = deflateOffers[mCompressionWindowBits - 9];
+}
+
+void LibwebsocketsIO::initTlsSessionCache(SSL_CTX *sslCtx)
+{
+    if (!sslCtx || SSL_CTX_get_ex_data(sslCtx, sslCtxIndex))
+    {
+        return;
+    }
+
+    // sessions are kept by WebsocketsIO, keyed by host, since libwebsockets creates a new SSL per connection
+    SSL_CTX_set_ex_data(sslCtx, sslCtxIndex, this);
+    SSL_CTX_set_session_cache_mode(sslCtx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(sslCtx, newTlsSessionCb);
+    SSL_CTX_set_info_callback(sslCtx, tlsInfoCb);
+}
+
+int LibwebsocketsIO::newTlsSessionCb(SSL *ssl, SSL_SESSION *session)
+{
+    LibwebsocketsIO *self = static_cast<LibwebsocketsIO *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), sslCtxIndex));
+    const char *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    int len = i2d_SSL_SESSION(session, NULL);
+    if (!self || !host || len <= 0)
+    {
+        return 0;
+    }
+
+    string data(len, '\0');
+    unsigned char *p = (unsigned char *)&data[0];
+    i2d_SSL_SESSION(session, &p);
+
+    WebsocketsIO::MutexGuard lock(self->mutex);
+    self->setTlsSession(host, data);
+    return 0;   // the session is not retained, it's been serialized
+}
+
+void LibwebsocketsIO::tlsInfoCb(const SSL *ssl, int where, int)
+{
+    if (!(where & SSL_CB_HANDSHAKE_START) || SSL_in_init(ssl) == 0 || SSL_get_session(ssl))
+    {
+        return;
+    }
+
+    // the ClientHello is not written yet: offer the session of the last connection to the same host
+    LibwebsocketsIO *self = static_cast<LibwebsocketsIO *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), sslCtxIndex));
+    const char *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+    if (!self || !host)
+    {
+        return;
+    }
+
+    string data;
+    {
+        WebsocketsIO::MutexGuard lock(self->mutex);
+        if (!self->getTlsSession(host, data))
+        {
+            return;
+        }
+    }
+
+    const unsigned char *p = (const unsigned char *)data.data();
+    SSL_SESSION *session = d2i_SSL_SESSION(NULL, &p, data.size());
+    if (session)
+    {
+        SSL_set_session(const_cast<SSL *>(ssl), session);
+        SSL_SESSION_free(session);
+    }
+}
+
 LibwebsocketsClient::LibwebsocketsClient(WebsocketsIO::Mutex &mutex, WebsocketsClient *client) : WebsocketsClientImpl(mutex, client)
 {
     wsi = NULL;
@@ -358,6 +454,27 @@ int LibwebsocketsClient::wsCallback(struct lws *wsi, enum lws_callback_reasons r
 
     switch (reason)
     {
+        case LWS_CALLBACK_OPENSSL_LOAD_EXTRA_CLIENT_VERIFY_CERTS:
+        {
+            LibwebsocketsIO *io = static_cast<LibwebsocketsIO *>(lws_context_user(lws_get_context(wsi)));
+            if (io)
+            {
+                io->initTlsSessionCache((SSL_CTX *)user);
+            }
+            break;
+        }
+        case LWS_CALLBACK_CLIENT_CONFIRM_EXTENSION_SUPPORTED:
+        {
+            // returning non-zero prevents the extension from being offered
+            LibwebsocketsIO *io = static_cast<LibwebsocketsIO *>(lws_context_user(lws_get_context(wsi)));
+            if (!io || strcmp((const char *)data, "permessage-deflate"))
+            {
+                return 1;
+            }
+
+            WebsocketsIO::MutexGuard lock(io->mutex);
+            return io->mCompression ? 0 : 1;
+        }
         case LWS_CALLBACK_OPENSSL_PERFORM_SERVER_CERT_VERIFICATION:
         {
             if (check_public_key((X509_STORE_CTX*)user))
@@ -378,6 +495,33 @@ int LibwebsocketsClient::wsCallback(struct lws *wsi, enum lws_callback_reasons r
             {
                 return -1;
             }
+
+            LibwebsocketsIO *ctxIo = static_cast<LibwebsocketsIO *>(lws_context_user(lws_get_context(wsi)));
+            int memLevel = 0;
+            if (ctxIo)
+            {
+                WebsocketsIO::MutexGuard lock(ctxIo->mutex);
+                memLevel = ctxIo->mCompression ? ctxIo->mCompressionMemLevel : 0;
+            }
+            if (memLevel)
+            {
+                // only has effect if permessage-deflate was negotiated, before the first message is
+                // compressed. The window size is negotiated by the offer, so it's not changed here
+                lws_set_extension_option(wsi, "permessage-deflate", "mem_level", std::to_string(memLevel).c_str());
+            }
+
+            SSL *ssl = lws_get_ssl(wsi);
+            if (ssl)
+            {
+                LibwebsocketsIO *io = static_cast<LibwebsocketsIO *>(lws_context_user(lws_get_context(wsi)));
+                const char *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+                if (io)
+                {
+                    WebsocketsIO::MutexGuard lock(io->mutex);
+                    io->initTlsSessionCache(SSL_get_SSL_CTX(ssl));  // in case the SSL_CTX was created later
+                    io->tlsHandshakeDone(host ? host : "", SSL_session_reused(ssl));
+                }
+            }
             
             client->wsConnectCb();
             break;
@@ -477,3 +621,45 @@ int LibwebsocketsClient::wsCallback(struct lws *wsi, enum lws_callback_reasons r
     
     return 0;
 }
+
+int LibwebsocketsClient::deflateCallback(struct lws_context *context, const struct lws_extension *ext, struct lws *wsi,
+                                         enum lws_extension_callback_reasons reason, void *user, void *in, size_t len)
+{
+    LibwebsocketsClient *client = wsi ? (LibwebsocketsClient *)lws_wsi_user(wsi) : NULL;
+    if (!client || (reason != LWS_EXT_CB_PAYLOAD_RX && reason != LWS_EXT_CB_PAYLOAD_TX))
+    {
+        return lws_extension_callback_pm_deflate(context, ext, wsi, reason, user, in, len);
+    }
+
+#if LWS_LIBRARY_VERSION_NUMBER >= 3002000
+    struct lws_ext_pm_deflate_rx_ebufs *ebufs = (struct lws_ext_pm_deflate_rx_ebufs *)in;
+    int inLen = ebufs->eb_in.len;
+    int ret = lws_extension_callback_pm_deflate(context, ext, wsi, reason, user, in, len);
+    if (reason == LWS_EXT_CB_PAYLOAD_TX)
+    {
+        client->traffic.wireTx += ebufs->eb_out.len;
+    }
+    else if (ebufs->eb_out.token == ebufs->eb_in.token)   // not compressed, passed through
+    {
+        client->traffic.wireRx += ebufs->eb_in.len;
+    }
+    else    // the input may not be consumed at once
+    {
+        client->traffic.wireRx += inLen - ebufs->eb_in.len;
+    }
+#else
+    struct lws_tokens *ebuf = (struct lws_tokens *)in;
+    if (reason == LWS_EXT_CB_PAYLOAD_RX)
+    {
+        client->traffic.wireRx += ebuf->token_len;
+    }
+    int ret = lws_extension_callback_pm_deflate(context, ext, wsi, reason, user, in, len);
+    if (reason == LWS_EXT_CB_PAYLOAD_TX)
+    {
+        client->traffic.wireTx += ebuf->token_len;
+    }
+#endif
+
+    client->compressed = true;
+    return ret;
+}
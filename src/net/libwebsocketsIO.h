@@ -19,13 +19,27 @@ public:
     virtual ~LibwebsocketsIO();
     
     virtual void addevents(::mega::Waiter*, int);
+
+    /** @brief Enables the client-side cache of TLS sessions in the given SSL context */
+    void initTlsSessionCache(SSL_CTX *sslCtx);
+
+    /** @brief Must be called from the thread that runs the event loop, since libwebsockets
+     * reads the offer of the extension without locking the mutex */
+    void setCompression(bool enable, int windowBits = 15, int memLevel = 8) override;
     
 protected:
+    // permessage-deflate is always registered, and only offered if compression is enabled
+    struct lws_extension mExtensions[2];
+
     virtual bool wsResolveDNS(const char *hostname, std::function<void(int, const std::vector<std::string>&, const std::vector<std::string>&)> f);
     virtual WebsocketsClientImpl *wsConnect(const char *ip, const char *host,
                                            int port, const char *path, bool ssl,
                                            WebsocketsClient *client);
     int wsGetNoNameErrorCode() override;
+
+    static int newTlsSessionCb(SSL *ssl, SSL_SESSION *session);
+    static void tlsInfoCb(const SSL *ssl, int where, int ret);
+    friend class LibwebsocketsClient;
 };
 
 class LibwebsocketsClient : public WebsocketsClientImpl
@@ -54,6 +68,10 @@ protected:
 public:
     struct lws *wsi;
     static int wsCallback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *data, size_t len);
+
+    // wraps permessage-deflate, to count the compressed bytes of each connection
+    static int deflateCallback(struct lws_context *context, const struct lws_extension *ext, struct lws *wsi,
+                               enum lws_extension_callback_reasons reason, void *user, void *in, size_t len);
 };
 
 
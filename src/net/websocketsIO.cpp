@@ -11,6 +11,70 @@ WebsocketsIO::~WebsocketsIO()
     
 }
 
+void WebsocketsIO::setTlsSessionStore(DNScache *store)
+{
+    MutexGuard lock(mutex);
+    mTlsSessionStore = store;
+}
+
+bool WebsocketsIO::getTlsSession(const std::string &host, std::string &session)
+{
+    auto it = mTlsSessions.find(host);
+    if (it != mTlsSessions.end())
+    {
+        session = it->second;
+        return true;
+    }
+
+    // sessions persisted by a previous run
+    if (mTlsSessionStore && mTlsSessionStore->getTlsSession(host, session))
+    {
+        mTlsSessions[host] = session;
+        return true;
+    }
+
+    return false;
+}
+
+void WebsocketsIO::setTlsSession(const std::string &host, const std::string &session)
+{
+    std::string &cached = mTlsSessions[host];
+    if (cached == session)
+    {
+        return;
+    }
+
+    cached = session;
+    if (mTlsSessionStore)
+    {
+        mTlsSessionStore->setTlsSession(host, session);
+    }
+}
+
+void WebsocketsIO::tlsHandshakeDone(const std::string &host, bool resumed)
+{
+    if (resumed)
+    {
+        mTlsResumedHandshakes++;
+    }
+    else
+    {
+        mTlsFullHandshakes++;
+    }
+
+    WEBSOCKETS_LOG_DEBUG("TLS handshake with %s %s (resumed: %u, full: %u)", host.c_str(),
+                         resumed ? "resumed the session" : "was complete",
+                         mTlsResumedHandshakes, mTlsFullHandshakes);
+}
+
+void WebsocketsIO::setCompression(bool enable, int windowBits, int memLevel)
+{
+    MutexGuard lock(mutex);
+    mCompression = enable;
+    mCompressionWindowBits = std::max(9, std::min(windowBits, 15));
+    mCompressionMemLevel = std::max(1, std::min(memLevel, 9));
+}
+
 WebsocketsClientImpl::WebsocketsClientImpl(WebsocketsIO::Mutex &m, WebsocketsClient *client)
     : mutex(m)
 {
@@ -20,14 +84,31 @@ WebsocketsClientImpl::WebsocketsClientImpl(WebsocketsIO::Mutex &m, WebsocketsCli
 
 WebsocketsClientImpl::~WebsocketsClientImpl()
 {
+    if (traffic.rx || traffic.tx)
+    {
+        WebsocketsTraffic total = getTraffic();
+        WEBSOCKETS_LOG_DEBUG("Connection traffic: received %llu bytes (%llu on the wire), sent %llu bytes (%llu on the wire)",
+                             (unsigned long long)total.rx, (unsigned long long)total.wireRx,
+                             (unsigned long long)total.tx, (unsigned long long)total.wireTx);
+    }
+}
 
+WebsocketsTraffic WebsocketsClientImpl::getTraffic() const
+{
+    WebsocketsTraffic result = traffic;
+    if (!compressed)
+    {
+        result.wireRx = result.rx;
+        result.wireTx = result.tx;
+    }
+    return result;
 }
 
 void WebsocketsClientImpl::wsConnectCb()
 {
     WebsocketsIO::MutexGuard lock(this->mutex);
     WEBSOCKETS_LOG_DEBUG("Connection established");
-    client->wsConnectCb();
+    client->wsConnectCbPrivate(this);
 }
 
 void WebsocketsClientImpl::wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len)
@@ -43,13 +124,14 @@ void WebsocketsClientImpl::wsCloseCb(int errcode, int errtype, const char *preas
         WEBSOCKETS_LOG_DEBUG("Connection closed by server");
     }
 
-    client->wsCloseCbPrivate(errcode, errtype, preason, reason_len);
+    client->wsCloseCbPrivate(this, errcode, errtype, preason, reason_len);
 }
 
 void WebsocketsClientImpl::wsHandleMsgCb(char *data, size_t len)
 {
     WebsocketsIO::MutexGuard lock(this->mutex);
     WEBSOCKETS_LOG_DEBUG("Received %d bytes", len);
+    traffic.rx += len;
     client->wsHandleMsgCb(data, len);
 }
 
@@ -57,6 +139,7 @@ void WebsocketsClientImpl::wsSendMsgCb(const char *data, size_t len)
 {
     WebsocketsIO::MutexGuard lock(this->mutex);
     WEBSOCKETS_LOG_DEBUG("Sent %d bytes", len);
+    traffic.tx += len;
     client->wsSendMsgCb(data, len);
 }
 
@@ -70,6 +153,9 @@ WebsocketsClient::WebsocketsClient()
 
 WebsocketsClient::~WebsocketsClient()
 {
+    cancelRaceTimer();
+    delete mRaceCtx;
+    mRaceCtx = NULL;
     delete ctx;
     ctx = NULL;
 }
@@ -80,6 +166,12 @@ bool WebsocketsClient::wsResolveDNS(WebsocketsIO *websocketIO, const char *hostn
 }
 
 bool WebsocketsClient::wsConnect(WebsocketsIO *websocketIO, const char *ip, const char *host, int port, const char *path, bool ssl)
+{
+    return wsConnect(websocketIO, ip, NULL, host, port, path, ssl);
+}
+
+bool WebsocketsClient::wsConnect(WebsocketsIO *websocketIO, const char *ip, const char *fallbackIp,
+                                 const char *host, int port, const char *path, bool ssl)
 {
 #if defined(_WIN32) && defined(_MSC_VER)
     thread_id = std::this_thread::get_id();
@@ -87,22 +179,98 @@ bool WebsocketsClient::wsConnect(WebsocketsIO *websocketIO, const char *ip, cons
     thread_id = pthread_self();
 #endif
 
-    WEBSOCKETS_LOG_DEBUG("Connecting to %s (%s)  port %d  path: %s   ssl: %d", host, ip, port, path, ssl);
-
-    assert(!ctx);
+    assert(!ctx && !mRaceCtx);
     if (ctx)
     {
         WEBSOCKETS_LOG_ERROR("Valid context at connect()");
         websocketIO->mApi.sdk.sendEvent(99010, "A valid previous context existed upon new wsConnect");
         delete ctx;
+        ctx = NULL;
     }
-
-    ctx = websocketIO->wsConnect(ip, host, port, path, ssl, this);
+    cancelRaceTimer();
+    delete mRaceCtx;
+    mRaceCtx = NULL;
+
+    mWebsocketIO = websocketIO;
+    mHost = host;
+    mPort = port;
+    mPath = path;
+    mSsl = ssl;
+    mFallbackIp = (fallbackIp && fallbackIp != std::string(ip)) ? fallbackIp : "";
+    mRaceIp.clear();
+    mRaced = false;
+
+    mIp = ip;
+    ctx = startAttempt(mIp);
     if (!ctx)
     {
-        WEBSOCKETS_LOG_WARNING("Immediate error in wsConnect");
+        if (mFallbackIp.empty())
+        {
+            return false;
+        }
+
+        // immediate failure --> try the fallback IP right away
+        mIp = mFallbackIp;
+        mFallbackIp.clear();
+        mRaced = true;
+        ctx = startAttempt(mIp);
+        if (!ctx)
+        {
+            return false;
+        }
+    }
+
+    mConnecting = true;
+    if (!mFallbackIp.empty())
+    {
+        mRaceTimer = karere::setTimeout([this]()
+        {
+            mRaceTimer = 0;
+            WebsocketsIO::MutexGuard lock(mWebsocketIO->mutex);
+            startRace();
+        }, kRaceDelayMs, websocketIO->appCtx);
+    }
+    return true;
+}
+
+WebsocketsClientImpl *WebsocketsClient::startAttempt(const std::string &ip)
+{
+    WEBSOCKETS_LOG_DEBUG("Connecting to %s (%s)  port %d  path: %s   ssl: %d", mHost.c_str(), ip.c_str(), mPort, mPath.c_str(), mSsl);
+
+    WebsocketsClientImpl *impl = mWebsocketIO->wsConnect(ip.c_str(), mHost.c_str(), mPort, mPath.c_str(), mSsl, this);
+    if (!impl)
+    {
+        WEBSOCKETS_LOG_WARNING("Immediate error in wsConnect (%s)", ip.c_str());
+    }
+    return impl;
+}
+
+void WebsocketsClient::startRace()
+{
+    if (!mConnecting || mFallbackIp.empty() || mRaceCtx)
+    {
+        return;
+    }
+
+    WEBSOCKETS_LOG_DEBUG("Connection to %s is taking long, racing it with %s", mIp.c_str(), mFallbackIp.c_str());
+    mRaceIp = mFallbackIp;
+    mFallbackIp.clear();
+    mRaced = true;
+    mRaceCtx = startAttempt(mRaceIp);
+}
+
+void WebsocketsClient::cancelRaceTimer()
+{
+    if (mRaceTimer)
+    {
+        karere::cancelTimeout(mRaceTimer, mWebsocketIO->appCtx);
+        mRaceTimer = 0;
     }
-    return ctx != NULL;
+}
+
+WebsocketsTraffic WebsocketsClient::wsTraffic() const
+{
+    return ctx ? ctx->getTraffic() : WebsocketsTraffic();
 }
 
 int WebsocketsClient::wsGetNoNameErrorCode(WebsocketsIO *websocketIO)
@@ -157,6 +325,13 @@ void WebsocketsClient::wsDisconnect(bool immediate)
         delete ctx;
         ctx = NULL;
     }
+
+    // a connection attempt that is still racing is never used
+    mConnecting = false;
+    mFallbackIp.clear();
+    cancelRaceTimer();
+    delete mRaceCtx;
+    mRaceCtx = NULL;
 }
 
 bool WebsocketsClient::wsIsConnected()
@@ -175,16 +350,82 @@ bool WebsocketsClient::wsIsConnected()
     return ctx->wsIsConnected();
 }
 
-void WebsocketsClient::wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len)
+void WebsocketsClient::wsConnectCbPrivate(WebsocketsClientImpl *impl)
 {
-    if (!ctx)   // immediate disconnect ocurred before the marshall is executed (only applies to libws)
+    if (impl == mRaceCtx)   // the fallback IP won the race
+    {
+        WEBSOCKETS_LOG_DEBUG("Connection to %s won the race against %s", mRaceIp.c_str(), mIp.c_str());
+        delete ctx;
+        ctx = mRaceCtx;
+        mIp = mRaceIp;
+        mRaceCtx = NULL;
+    }
+    else if (impl != ctx)
     {
         return;
     }
+    else if (mRaceCtx)
+    {
+        delete mRaceCtx;
+        mRaceCtx = NULL;
+    }
 
-    delete ctx;
-    ctx = NULL;
+    mConnecting = false;
+    mFallbackIp.clear();
+    cancelRaceTimer();
+    wsConnectCb();
+}
+
+void WebsocketsClient::wsCloseCbPrivate(WebsocketsClientImpl *impl, int errcode, int errtype, const char *preason, size_t reason_len)
+{
+    if (impl && impl == mRaceCtx)
+    {
+        WEBSOCKETS_LOG_DEBUG("Connection attempt to %s failed", mRaceIp.c_str());
+        delete mRaceCtx;
+        mRaceCtx = NULL;
+        if (ctx)    // the other attempt is still in progress
+        {
+            return;
+        }
+    }
+    else
+    {
+        if (!ctx || (impl && impl != ctx))   // immediate disconnect ocurred before the marshall is executed (only applies to libws)
+        {
+            return;
+        }
+
+        delete ctx;
+        ctx = NULL;
 
+        if (mConnecting)
+        {
+            WEBSOCKETS_LOG_DEBUG("Connection attempt to %s failed", mIp.c_str());
+            if (mRaceCtx)   // keep waiting for the fallback IP
+            {
+                ctx = mRaceCtx;
+                mIp = mRaceIp;
+                mRaceCtx = NULL;
+                return;
+            }
+
+            if (!mFallbackIp.empty())   // no need to wait for the race delay
+            {
+                cancelRaceTimer();
+                mIp = mFallbackIp;
+                mFallbackIp.clear();
+                mRaced = true;
+                ctx = startAttempt(mIp);
+                if (ctx)
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    mConnecting = false;
+    cancelRaceTimer();
     WEBSOCKETS_LOG_DEBUG("Socket was closed gracefully or by server");
 
     wsCloseCb(errcode, errtype, preason, reason_len);
@@ -239,10 +480,11 @@ void DNScache::updateRecord(int shard, const std::string &url, bool saveToDb)
     }
     record.ipv4.clear();
     record.ipv6.clear();
+    record.tlsSession.clear();
 
     if (saveToDb)
     {
-        mDb.query("update dns_cache set url=?, ipv4=?, ipv6=? where shard=?",
+        mDb.query("update dns_cache set url=?, ipv4=?, ipv6=?, sess=NULL where shard=?",
                   url, record.ipv4, record.ipv6, shard);
     }
 }
@@ -272,7 +514,7 @@ const karere::Url &DNScache::getUrl(int shard)
 
 void DNScache::loadFromDb()
 {
-    SqliteStmt stmt(mDb, "select shard, url, ipv4, ipv6 from dns_cache");
+    SqliteStmt stmt(mDb, "select shard, url, ipv4, ipv6, sess from dns_cache");
     while (stmt.step())
     {
         int shard = stmt.intCol(0);
@@ -282,6 +524,11 @@ void DNScache::loadFromDb()
             // if the record is for chatd, need to add the protocol version to the URL
             addRecord(shard, url, false);
             setIp(shard, stmt.stringCol(2), stmt.stringCol(3));
+            StaticBuffer sess = stmt.blobColView(4);
+            if (sess.dataSize())
+            {
+                mRecords[shard].tlsSession.assign(sess.buf(), sess.dataSize());
+            }
         }
         else
         {
@@ -358,6 +605,53 @@ void DNScache::connectDone(int shard, const std::string &ip)
     }
 }
 
+bool DNScache::preferIpv6(int shard)
+{
+    auto it = mRecords.find(shard);
+    if (it != mRecords.end())
+    {
+        return it->second.connectIpv4Ts <= it->second.connectIpv6Ts;
+    }
+
+    return true;
+}
+
+bool DNScache::getTlsSession(const std::string &host, std::string &session)
+{
+    for (auto &it : mRecords)
+    {
+        if (it.second.mUrl.host == host && !it.second.tlsSession.empty())
+        {
+            session = it.second.tlsSession;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void DNScache::setTlsSession(const std::string &host, const std::string &session)
+{
+    for (auto &it : mRecords)
+    {
+        if (it.second.mUrl.host == host)
+        {
+            it.second.tlsSession = session;
+            mDb.query("update dns_cache set sess=? where shard=?",
+                      StaticBuffer(session.data(), session.size()), it.first);
+        }
+    }
+}
+
+void DNScache::clearTlsSessions()
+{
+    for (auto &it : mRecords)
+    {
+        it.second.tlsSession.clear();
+    }
+    mDb.query("update dns_cache set sess=NULL");
+}
+
 time_t DNScache::age(int shard)
 {
     auto it = mRecords.find(shard);
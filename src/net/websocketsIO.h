@@ -11,6 +11,7 @@
 #include "buffer.h"
 #include "db.h"
 #include "url.h"
+#include "base/timers.hpp"
 
 #define WEBSOCKETS_LOG_DEBUG(fmtString,...) KARERE_LOG_DEBUG(krLogChannel_websockets, fmtString, ##__VA_ARGS__)
 #define WEBSOCKETS_LOG_INFO(fmtString,...) KARERE_LOG_INFO(krLogChannel_websockets, fmtString, ##__VA_ARGS__)
@@ -20,6 +21,16 @@
 class WebsocketsClient;
 class WebsocketsClientImpl;
 
+/** @brief Payload bytes of a websocket connection, as handled by the app and as they
+ * travel once compressed by permessage-deflate (same as the former if not negotiated) */
+struct WebsocketsTraffic
+{
+    uint64_t rx = 0;
+    uint64_t tx = 0;
+    uint64_t wireRx = 0;
+    uint64_t wireTx = 0;
+};
+
 class DNScache
 {
 public:
@@ -40,10 +51,18 @@ public:
     bool getIp(int shard, std::string &ipv4, std::string &ipv6);
     bool invalidateIps(int shard);
     void connectDone(int shard, const std::string &ip);
+    /** @brief Whether the connection to the shard should be attempted first through IPv6:
+     * it is, unless the last successful connection was done through IPv4 */
+    bool preferIpv6(int shard);
     bool isMatch(int shard, const std::vector<std::string> &ipsv4, const std::vector<std::string> &ipsv6);
     bool isMatch(int shard, const std::string &ipv4, const std::string &ipv6);
     time_t age(int shard);
     const karere::Url &getUrl(int shard);
+    /** @brief Serialized TLS session of the given host, so that it can be resumed after a restart */
+    bool getTlsSession(const std::string &host, std::string &session);
+    void setTlsSession(const std::string &host, const std::string &session);
+    /** @brief Removes the TLS sessions of all hosts, both from memory and from the db */
+    void clearTlsSessions();
 
 private:
     struct DNSrecord
@@ -54,6 +73,7 @@ private:
         time_t resolveTs = 0;       // can be used to invalidate IP addresses by age
         time_t connectIpv4Ts = 0;   // can be used for heuristics based on last successful connection
         time_t connectIpv6Ts = 0;   // can be used for heuristics based on last successful connection
+        std::string tlsSession;     // serialized TLS session, to resume it on the next connection
     };
 
     // Maps shard to DNSrecord
@@ -70,6 +90,23 @@ public:
 
     WebsocketsIO(Mutex &mutex, ::mega::MegaApi *megaApi, void *ctx);
     virtual ~WebsocketsIO();
+
+    /** @brief Sets where TLS sessions are persisted, in addition to the in-memory cache,
+     * or NULL to stop persisting them. The store must outlive its usage here. */
+    void setTlsSessionStore(DNScache *store);
+
+    /** @brief Number of TLS handshakes that resumed a cached session */
+    unsigned int tlsResumedHandshakes() const { return mTlsResumedHandshakes; }
+
+    /** @brief Number of full TLS handshakes */
+    unsigned int tlsFullHandshakes() const { return mTlsFullHandshakes; }
+
+    /** @brief Enables permessage-deflate (RFC 7692) for the connections started afterwards,
+     * if the implementation supports it. It is disabled by default.
+     * @param windowBits Base-2 logarithm of the LZ77 window, in both directions [9, 15]
+     * @param memLevel Memory used by the compressor [1, 9]
+     */
+    virtual void setCompression(bool enable, int windowBits = 15, int memLevel = 8);
     
     // apart from the lambda function to be executed, since it needs to be executed on a marshall call,
     // the appCtx is also required for some callbacks, so Msg wraps them both
@@ -98,6 +135,22 @@ protected:
                                            int port, const char *path, bool ssl,
                                            WebsocketsClient *client) = 0;
     virtual int wsGetNoNameErrorCode() = 0;   // depends on the implementation
+
+    // TLS sessions (serialized) by host, so that reconnections skip the full handshake
+    // Implementations must call these methods with the mutex locked
+    bool getTlsSession(const std::string &host, std::string &session);
+    void setTlsSession(const std::string &host, const std::string &session);
+    void tlsHandshakeDone(const std::string &host, bool resumed);
+
+    std::map<std::string, std::string> mTlsSessions;
+    DNScache *mTlsSessionStore = nullptr;
+    unsigned int mTlsResumedHandshakes = 0;
+    unsigned int mTlsFullHandshakes = 0;
+
+    bool mCompression = false;
+    int mCompressionWindowBits = 15;
+    int mCompressionMemLevel = 8;
+
     friend WebsocketsClient;
 };
 
@@ -107,6 +160,10 @@ protected:
 
 class WebsocketsClient
 {
+public:
+    // delay before racing the connection to the fallback IP (RFC 8305 "Connection Attempt Delay")
+    enum { kRaceDelayMs = 250 };
+
 private:
     WebsocketsClientImpl *ctx;
 #if defined(_WIN32) && defined(_MSC_VER)
@@ -114,6 +171,24 @@ private:
 #else
     pthread_t thread_id;
 #endif
+    std::string mIp;                        // IP of ctx
+
+    // second connection attempt, racing the first one (Happy Eyeballs)
+    WebsocketsIO *mWebsocketIO = nullptr;
+    WebsocketsClientImpl *mRaceCtx = nullptr;
+    std::string mRaceIp;                    // IP of mRaceCtx
+    std::string mFallbackIp;                // IP to race, while not started yet
+    std::string mHost;
+    std::string mPath;
+    int mPort = 0;
+    bool mSsl = false;
+    bool mConnecting = false;               // true until an attempt succeeds or all fail
+    bool mRaced = false;
+    megaHandle mRaceTimer = 0;
+
+    WebsocketsClientImpl *startAttempt(const std::string &ip);
+    void startRace();
+    void cancelRaceTimer();
 
 public:
     WebsocketsClient();
@@ -121,11 +196,35 @@ public:
     bool wsResolveDNS(WebsocketsIO *websocketIO, const char *hostname, std::function<void(int, const std::vector<std::string>&, const std::vector<std::string>&)> f);
     bool wsConnect(WebsocketsIO *websocketIO, const char *ip,
                    const char *host, int port, const char *path, bool ssl);
+
+    /**
+     * @brief Connects to \c ip, racing a connection to \c fallbackIp (RFC 8305)
+     *
+     * If the connection to \c ip is not established after kRaceDelayMs, or it fails
+     * before, a connection to \c fallbackIp is started too. The first one to be
+     * established is kept and the other one is cancelled, so wsConnectCb() is called
+     * once, and wsCloseCb() is called only if all the attempts fail.
+     *
+     * @return false if no connection attempt could be started
+     */
+    bool wsConnect(WebsocketsIO *websocketIO, const char *ip, const char *fallbackIp,
+                   const char *host, int port, const char *path, bool ssl);
+
+    /** @brief IP of the established connection, or of the connection in progress */
+    const std::string &wsConnectedIp() const { return mIp; }
+
+    /** @brief Whether the connection to the fallback IP was started by the last wsConnect() */
+    bool wsRaced() const { return mRaced; }
+
+    /** @brief Bytes transferred by the current connection, if any */
+    WebsocketsTraffic wsTraffic() const;
+
     int wsGetNoNameErrorCode(WebsocketsIO *websocketIO);
     bool wsSendMessage(char *msg, size_t len);  // returns true on success, false if error
     void wsDisconnect(bool immediate);
     bool wsIsConnected();
-    void wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len);
+    void wsConnectCbPrivate(WebsocketsClientImpl *impl);
+    void wsCloseCbPrivate(WebsocketsClientImpl *impl, int errcode, int errtype, const char *preason, size_t reason_len);
 
     virtual void wsConnectCb() = 0;
     virtual void wsCloseCb(int errcode, int errtype, const char *preason, size_t reason_len) = 0;
@@ -140,6 +239,8 @@ protected:
     WebsocketsClient *client;
     WebsocketsIO::Mutex &mutex;
     bool disconnecting;
+    WebsocketsTraffic traffic;
+    bool compressed = false;    // wire counters are updated by the implementation
     
 public:
     WebsocketsClientImpl(WebsocketsIO::Mutex &mutex, WebsocketsClient *client);
@@ -152,6 +253,7 @@ public:
     virtual bool wsSendMessage(char *msg, size_t len) = 0;
     virtual void wsDisconnect(bool immediate) = 0;
     virtual bool wsIsConnected() = 0;
+    WebsocketsTraffic getTraffic() const;
 };
 
 #endif /* websocketsIO_h */
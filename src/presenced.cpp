@@ -117,6 +117,7 @@ void Client::pushPeers()
 
 void Client::wsConnectCb()
 {
+    mTargetIp = wsConnectedIp();    // the IP that won the race, if both families were tried
     setConnState(kConnected);
 }
 
@@ -182,7 +183,6 @@ void Client::onSocketClose(int errcode, int errtype, const std::string& reason)
 
     assert(oldState != kDisconnected);
 
-    usingipv6 = !usingipv6;
     mTargetIp.clear();
 
     if (oldState >= kConnected)
@@ -785,49 +785,28 @@ void Client::doConnect()
     string ipv4, ipv6;
     bool cachedIPs = mDnsCache.getIp(kPresencedShard, ipv4, ipv6);
     assert(cachedIPs);
-    mTargetIp = (usingipv6 && ipv6.size()) ? ipv6 : ipv4;
+
+    // race both IP families, starting with the one that connected last time
+    bool ipv6First = ipv6.size() && (ipv4.empty() || mDnsCache.preferIpv6(kPresencedShard));
+    mTargetIp = ipv6First ? ipv6 : ipv4;
+    string fallbackIp = ipv6First ? ipv4 : ipv6;
 
     const karere::Url &url = mDnsCache.getUrl(kPresencedShard);
     assert (url.isValid());
 
     setConnState(kConnecting);
-    PRESENCED_LOG_DEBUG("Connecting to presenced using the IP: %s", mTargetIp.c_str());
+    PRESENCED_LOG_DEBUG("Connecting to presenced using the IP: %s (fallback IP: %s)", mTargetIp.c_str(), fallbackIp.c_str());
 
-    bool rt = wsConnect(mKarereClient->websocketIO, mTargetIp.c_str(),
-          url.host.c_str(),
-          url.port,
-          url.path.c_str(),
-          url.isSecure);
+    bool rt = wsConnect(mKarereClient->websocketIO, mTargetIp.c_str(), fallbackIp.c_str(),
+              url.host.c_str(),
+              url.port,
+              url.path.c_str(),
+              url.isSecure);
 
-    if (!rt)    // immediate failure --> try the other IP family (if available)
+    if (!rt)    // immediate failure of all the IPs
     {
-        PRESENCED_LOG_DEBUG("Connection to presenced failed using the IP: %s", mTargetIp.c_str());
-
-        string oldTargetIp = mTargetIp;
-        mTargetIp.clear();
-        if (oldTargetIp == ipv6 && ipv4.size())
-        {
-            mTargetIp = ipv4;
-        }
-        else if (oldTargetIp == ipv4 && ipv6.size())
-        {
-            mTargetIp = ipv6;
-        }
-
-        if (mTargetIp.size())
-        {
-            PRESENCED_LOG_DEBUG("Retrying using the IP: %s", mTargetIp.c_str());
-            if (wsConnect(mKarereClient->websocketIO, mTargetIp.c_str(),
-                          url.host.c_str(),
-                          url.port,
-                          url.path.c_str(),
-                          url.isSecure))
-            {
-                return;
-            }
-            PRESENCED_LOG_DEBUG("Connection to presenced failed using the IP: %s", mTargetIp.c_str());
-        }        
-        else
+        PRESENCED_LOG_DEBUG("Connection to presenced failed using the IP: %s", wsConnectedIp().c_str());
+        if (fallbackIp.empty())
         {
             // do not close the socket, which forces a new retry attempt and turns the DNS response obsolete
             // Instead, let the DNS request to complete, in order to refresh IPs
@@ -280,14 +280,14 @@ public:
     friend class Client;
 };
 
-class Command: public Buffer
+class Command: public SmallBuffer<64>
 {
 private:
     Command(const Command&) = delete;
 public:
-    Command(): Buffer(){}
-    Command(Command&& other): Buffer(std::forward<Buffer>(other)) {assert(!other.buf() && !other.bufSize() && !other.dataSize());}
-    Command(uint8_t opcode, uint8_t reserve=10): Buffer(reserve+1) { write(0, opcode); }
+    Command(): SmallBuffer(){}
+    Command(Command&& other): SmallBuffer(std::move(other)) {assert(!other.buf() && !other.bufSize() && !other.dataSize());}
+    Command(uint8_t opcode, uint8_t reserve=10): SmallBuffer(reserve+1) { write(0, opcode); }
     template<class T>
     Command&& operator+(const T& val)
     {
@@ -346,9 +346,6 @@ protected:
     /** Target IP address being used for the reconnection in-flight */
     std::string mTargetIp;
 
-    /** ip version to try first (both are tried) */
-    bool usingipv6 = false;
-
     /** RetryController that manages the reconnection's attempts */
     std::unique_ptr<karere::rh::IRetryController> mRetryCtrl;
 
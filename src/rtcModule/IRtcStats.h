@@ -38,6 +38,8 @@ struct Sample
             long firtx = 0;         // full intra request
             long plitx = 0;         // picture loss indication
             long nacktx = 0;        // Negative Acknowledgement
+            long cvt = 0;           // average frame rotation and conversion time for rendering (us)
+            long cvtmax = 0;        // maximum frame rotation and conversion time for rendering (us)
         } r;    // receive
 
         struct : BwInfo
@@ -93,7 +95,7 @@ public:
     virtual bool isCaller() const = 0;
     virtual karere::Id callId() const = 0;
     virtual size_t sampleCnt() const = 0;
-    virtual const std::vector<Sample*>* samples() const = 0;
+    virtual Sample sample(size_t index) const = 0;
     virtual const IConnInfo* connInfo() const = 0;
     virtual void toJson(std::string&) const = 0;
     virtual ~IRtcStats(){}
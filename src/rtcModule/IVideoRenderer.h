@@ -13,6 +13,8 @@ namespace rtcModule
  * its internal image buffer. In that case the application needs to also associate a pointer
  * to that bitmap object (rather than to the raw memory) so that it can use and free
  * the high-level bitmap object properly.
+ * Renderers that can draw YUV images may implement \c onI420Frame() instead, to skip
+ * the conversion to ARGB.
  */
 class IVideoRenderer
 {
@@ -37,6 +39,25 @@ public:
      */
     virtual void frameComplete(void* userData) = 0;
 
+    /**
+     * @brief onI420Frame Called _by a worker thread_ before \c getImageBuffer(), with the
+     * decoded frame in I420 (YUV 4:2:0) format. Renderers that can draw YUV directly
+     * (i.e. with a shader) can consume the frame here and return true, and then the
+     * frame is neither rotated nor converted to ARGB, and \c getImageBuffer() is not called.
+     * The planes are only valid during this call.
+     * @param width The width of the frame, before applying \c rotation
+     * @param height The height of the frame, before applying \c rotation
+     * @param rotation Clockwise rotation, in degrees (0, 90, 180 or 270), to apply to
+     * the frame when rendering it
+     * @return true if the frame has been consumed, false to have it delivered in ARGB format
+     */
+    virtual bool onI420Frame(unsigned short /*width*/, unsigned short /*height*/,
+                             const unsigned char* /*dataY*/, int /*strideY*/,
+                             const unsigned char* /*dataU*/, int /*strideU*/,
+                             const unsigned char* /*dataV*/, int /*strideV*/,
+                             int /*rotation*/)
+    { return false; }
+
     /**
      * @brief onVideoAttach Called when a video stream is attached to the player component
      * Frames can be expected after that point
@@ -0,0 +1,133 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include <audioLevel.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+TESTS_INIT();
+using namespace rtcModule;
+
+//Plain implementation to compare the vectorised kernel with
+AudioLevel referenceLevel(const int16_t* data, size_t count)
+{
+    double sumSquares = 0;
+    int peak = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        sumSquares += (double)data[i] * data[i];
+        int magnitude = std::min(abs((int)data[i]), 32767);
+        if (magnitude > peak)
+            peak = magnitude;
+    }
+    AudioLevel level;
+    level.rms = count ? sqrt(sumSquares / count) / 32768.0 : 0;
+    level.peak = peak / 32767.0f;
+    return level;
+}
+
+bool sameLevel(const AudioLevel& a, const AudioLevel& b)
+{
+    return fabs(a.rms - b.rms) < 1e-5 && a.peak == b.peak;
+}
+
+int main()
+{
+
+TestGroup("AudioLevel")
+{
+    syncTest("Matches the scalar computation for any length and alignment")
+    {
+        std::mt19937 rng(7);
+        std::vector<int16_t> samples(1000);
+        for (auto& sample: samples)
+            sample = static_cast<int16_t>(rng());
+        for (size_t offset = 0; offset < 8; offset++)
+        {
+            for (size_t count = 0; count + offset <= 200; count++)
+            {
+                check(sameLevel(measureAudioLevel(samples.data() + offset, count),
+                                referenceLevel(samples.data() + offset, count)));
+            }
+        }
+        check(sameLevel(measureAudioLevel(samples.data(), samples.size()),
+                        referenceLevel(samples.data(), samples.size())));
+    });
+    syncTest("Silence and full scale")
+    {
+        std::vector<int16_t> samples(960, 0);
+        AudioLevel level = measureAudioLevel(samples.data(), samples.size());
+        check(level.rms == 0 && level.peak == 0);
+        //worst case for overflows in the vectorised sum of squares
+        std::fill(samples.begin(), samples.end(), -32768);
+        level = measureAudioLevel(samples.data(), samples.size());
+        check(fabs(level.rms - 1) < 1e-6 && level.peak == 1);
+        for (size_t i = 0; i < samples.size(); i++)
+            samples[i] = (i & 1) ? 16384 : -16384;
+        level = measureAudioLevel(samples.data(), samples.size());
+        check(fabs(level.rms - 0.5) < 1e-6);
+    });
+    syncTest("Smoothed level rises quickly and decays slowly")
+    {
+        AudioLevelSmoother smoother;
+        for (int i = 0; i < 10; i++) //100 ms of speech
+            smoother.update(0.5, 10);
+        check(smoother.level() > 0.49);
+        smoother.update(0, 10);
+        check(smoother.level() > 0.45); //a short pause barely changes it
+        for (int i = 0; i < 200; i++) //2 s of silence
+            smoother.update(0, 10);
+        check(smoother.level() < 0.01);
+    });
+    syncTest("Speech detection has hysteresis")
+    {
+        AudioActivityDetector detector(0.1f, 0.05f, 500);
+        check(!detector.update(0.09f, 10));
+        check(detector.update(0.11f, 10));
+        bool flickered = false;
+        for (int i = 0; i < 100; i++) //1 s hovering around the start threshold
+            flickered = flickered || !detector.update((i & 1) ? 0.11f : 0.08f, 10);
+        check(!flickered);
+        for (int i = 0; i < 49; i++) //490 ms of silence
+            detector.update(0.01f, 10);
+        check(detector.active());
+        check(detector.update(0.06f, 10)); //above the stop threshold, the hold time restarts
+        for (int i = 0; i < 49; i++)
+            detector.update(0.01f, 10);
+        check(detector.active());
+        check(!detector.update(0.01f, 10)); //500 ms below the stop threshold
+        detector.update(0.2f, 10);
+        detector.reset();
+        check(!detector.active());
+    });
+});
+
+TestGroup("Performance")
+{
+    syncTest("10 ms stereo frames at 48 kHz")
+    {
+        std::mt19937 rng(1);
+        std::vector<int16_t> frame(960);
+        for (auto& sample: frame)
+            sample = static_cast<int16_t>(rng() % 2000) - 1000;
+        float total = 0;
+        test::benchmark("scalar", 100000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+                total += referenceLevel(frame.data(), frame.size()).rms;
+        });
+        float vectorTotal = 0;
+        test::benchmark("measureAudioLevel", 100000, [&](int count)
+        {
+            for (int i = 0; i < count; i++)
+                vectorTotal += measureAudioLevel(frame.data(), frame.size()).rms;
+        });
+        check(fabs(total - vectorTotal) < total * 1e-3);
+    });
+});
+
+return test::gNumFailed;
+}
@@ -0,0 +1,157 @@
+#ifndef AUDIOLEVEL_H
+#define AUDIOLEVEL_H
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define RTCM_AUDIOLEVEL_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define RTCM_AUDIOLEVEL_NEON 1
+#endif
+
+namespace rtcModule
+{
+/** @brief Level of a block of 16-bit PCM samples, normalized to [0, 1] */
+struct AudioLevel
+{
+    float rms = 0;
+    float peak = 0;
+};
+
+/** @brief Computes the RMS and peak level of \c count interleaved 16-bit samples.
+ *
+ * Uses SSE2 or NEON when available, processing 8 samples per step, so that it
+ * can run on every 10 ms audio frame of every session.
+ */
+inline AudioLevel measureAudioLevel(const int16_t* data, size_t count)
+{
+    AudioLevel level;
+    if (!count)
+        return level;
+
+    uint64_t sumSquares = 0;
+    int peak = 0;
+    size_t i = 0;
+#if defined(RTCM_AUDIOLEVEL_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;     // 2 x uint64
+    __m128i vpeak = zero;   // 8 x int16
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        // pairs of squares add up to at most 2^31, which fits in an unsigned lane
+        __m128i squares = _mm_madd_epi16(x, x);
+        sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(squares, zero));
+        sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(squares, zero));
+        // saturating negation, so that -32768 becomes 32767
+        vpeak = _mm_max_epi16(vpeak, _mm_max_epi16(x, _mm_subs_epi16(zero, x)));
+    }
+    uint64_t sums[2];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sums), sum);
+    sumSquares = sums[0] + sums[1];
+    int16_t peaks[8];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(peaks), vpeak);
+    for (int16_t value: peaks)
+    {
+        if (value > peak)
+            peak = value;
+    }
+#elif defined(RTCM_AUDIOLEVEL_NEON)
+    uint64x2_t sum = vdupq_n_u64(0);
+    int16x8_t vpeak = vdupq_n_s16(0);
+    for (; i + 8 <= count; i += 8)
+    {
+        int16x8_t x = vld1q_s16(data + i);
+        int32x4_t squares = vmull_s16(vget_low_s16(x), vget_low_s16(x));
+        squares = vmlal_s16(squares, vget_high_s16(x), vget_high_s16(x));
+        sum = vpadalq_u32(sum, vreinterpretq_u32_s32(squares));
+        vpeak = vmaxq_s16(vpeak, vqabsq_s16(x));
+    }
+    sumSquares = vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+    int16_t peaks[8];
+    vst1q_s16(peaks, vpeak);
+    for (int16_t value: peaks)
+    {
+        if (value > peak)
+            peak = value;
+    }
+#endif
+    for (; i < count; i++)
+    {
+        int value = data[i];
+        sumSquares += static_cast<uint64_t>(value * value);
+        int magnitude = (value < 0) ? ((value == -32768) ? 32767 : -value) : value;
+        if (magnitude > peak)
+            peak = magnitude;
+    }
+
+    level.rms = static_cast<float>(sqrt(static_cast<double>(sumSquares) / count) / 32768.0);
+    level.peak = peak / 32767.0f;
+    return level;
+}
+
+/** @brief Smooths a sequence of audio levels, so that they can be compared
+ * between sessions: rises quickly when a peer starts talking and decays
+ * slowly across the pauses between words */
+class AudioLevelSmoother
+{
+public:
+    enum { kAttackMs = 20, kReleaseMs = 400 };
+    float level() const { return mLevel; }
+    float update(float rms, double durationMs)
+    {
+        double tau = (rms > mLevel) ? kAttackMs : kReleaseMs;
+        float alpha = static_cast<float>(1.0 - exp(-durationMs / tau));
+        mLevel += (rms - mLevel) * alpha;
+        return mLevel;
+    }
+    void reset() { mLevel = 0; }
+protected:
+    float mLevel = 0;
+};
+
+/** @brief Decides whether a peer is speaking from its smoothed level, with hysteresis:
+ * speech starts when the level rises above \c onLevel, and stops only once it has
+ * stayed below the lower \c offLevel for \c holdMs, so that the detection doesn't
+ * flicker while the level hovers around a single threshold */
+class AudioActivityDetector
+{
+public:
+    AudioActivityDetector(float onLevel, float offLevel, double holdMs)
+        : mOnLevel(onLevel), mOffLevel(offLevel), mHoldMs(holdMs) {}
+    bool active() const { return mActive; }
+    bool update(float level, double durationMs)
+    {
+        if (level > mOnLevel)
+        {
+            mActive = true;
+            mQuietMs = 0;
+        }
+        else if (level >= mOffLevel)
+        {
+            mQuietMs = 0;
+        }
+        else if (mActive)
+        {
+            mQuietMs += durationMs;
+            mActive = (mQuietMs < mHoldMs);
+        }
+        return mActive;
+    }
+    void reset()
+    {
+        mActive = false;
+        mQuietMs = 0;
+    }
+protected:
+    float mOnLevel;
+    float mOffLevel;
+    double mHoldMs;
+    double mQuietMs = 0;
+    bool mActive = false;
+};
+}
+
+#endif // AUDIOLEVEL_H
@@ -0,0 +1,160 @@
+#ifndef FRAMECONVERTER_H
+#define FRAMECONVERTER_H
+#include <libyuv/convert.h>
+#include <stdint.h>
+#include <assert.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace artc
+{
+/** @brief Plane pointers and strides of an I420 image */
+struct I420Planes
+{
+    const uint8_t* y;
+    int strideY;
+    const uint8_t* u;
+    int strideU;
+    const uint8_t* v;
+    int strideV;
+    int width;
+    int height;
+};
+
+/** @brief Small pool of threads that converts I420 frames to the 32bit format
+ * expected by IVideoRenderer.
+ *
+ * The frame is split in bands of rows, which are converted in parallel by the
+ * workers and by the calling thread. Bands start at even rows, so every band
+ * maps to whole rows of the subsampled U and V planes. Only one frame at a time
+ * is split: if the pool is busy with a frame of another player, or the frame is
+ * small, the calling thread converts it alone.
+ */
+class FrameConverter
+{
+public:
+    enum { kMaxWorkers = 4, kMinRowsPerBand = 64 };
+    static FrameConverter& get()
+    {
+        static FrameConverter instance;
+        return instance;
+    }
+
+    void convert(const I420Planes& src, uint8_t* dst, int dstStride)
+    {
+        int bands = std::min<int>(static_cast<int>(mWorkers.size()) + 1, src.height / kMinRowsPerBand);
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (bands < 2 || mBusy)
+        {
+            lock.unlock();
+            convertRows(src, dst, dstStride, 0, src.height);
+            return;
+        }
+
+        mBusy = true;
+        int bandRows = ((src.height + bands - 1) / bands + 1) & ~1;
+        mJob.src = src;
+        mJob.dst = dst;
+        mJob.dstStride = dstStride;
+        mJob.bandRows = bandRows;
+        mBands = (src.height + bandRows - 1) / bandRows;
+        mNextBand = 0;
+        mPendingBands = mBands;
+        mCondition.notify_all();
+        while (mNextBand < mBands)
+        {
+            runBand(lock);
+        }
+        mDoneCondition.wait(lock, [this]() { return mPendingBands == 0; });
+        mBusy = false;
+    }
+
+    size_t workerCount() const { return mWorkers.size(); }
+
+    ~FrameConverter()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mTerminating = true;
+        }
+        mCondition.notify_all();
+        for (auto& worker: mWorkers)
+        {
+            worker.join();
+        }
+    }
+
+protected:
+    struct Job
+    {
+        I420Planes src;
+        uint8_t* dst;
+        int dstStride;
+        int bandRows;
+    };
+
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex; //guards all members below
+    std::condition_variable mCondition;
+    std::condition_variable mDoneCondition;
+    Job mJob;
+    int mBands = 0;
+    int mNextBand = 0;
+    int mPendingBands = 0;
+    bool mBusy = false;
+    bool mTerminating = false;
+
+    FrameConverter()
+    {
+        // leave one core for the decoder thread that delivers the frames
+        unsigned cpus = std::thread::hardware_concurrency();
+        unsigned count = (cpus > 1) ? std::min<unsigned>(cpus - 1, kMaxWorkers) : 0;
+        for (unsigned i = 0; i < count; i++)
+        {
+            mWorkers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    static void convertRows(const I420Planes& src, uint8_t* dst, int dstStride, int row, int rows)
+    {
+        assert((row & 1) == 0);
+        libyuv::I420ToABGR(src.y + row * src.strideY, src.strideY,
+                           src.u + (row / 2) * src.strideU, src.strideU,
+                           src.v + (row / 2) * src.strideV, src.strideV,
+                           dst + row * dstStride, dstStride, src.width, rows);
+    }
+
+    // Called with mMutex locked, returns with it locked
+    void runBand(std::unique_lock<std::mutex>& lock)
+    {
+        int band = mNextBand++;
+        Job job = mJob;
+        lock.unlock();
+        int row = band * job.bandRows;
+        convertRows(job.src, job.dst, job.dstStride, row, std::min(job.bandRows, job.src.height - row));
+        lock.lock();
+        if (--mPendingBands == 0)
+        {
+            mDoneCondition.notify_all();
+        }
+    }
+
+    void workerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;)
+        {
+            mCondition.wait(lock, [this]() { return mTerminating || mNextBand < mBands; });
+            if (mTerminating)
+                return;
+
+            runBand(lock);
+        }
+    }
+};
+}
+
+#endif // FRAMECONVERTER_H
@@ -43,11 +43,9 @@ Recorder::Recorder(Session& sess, int scanPeriod, int maxSamplePeriod)
 
 void Recorder::addSample()
 {
-    Sample* sample = mCurrSample.release();
-    assert(sample);
-    mStats->mSamples.push_back(sample);
-    mCurrSample.reset(new Sample(*sample));
-    resetBwCalculators();
+    assert(mCurrSample);
+    mStats->mSamples.push(*mCurrSample);
+    mLastSample = *mCurrSample;
 }
 void Recorder::resetBwCalculators()
 {
@@ -118,7 +116,7 @@ bool Recorder::checkShouldAddSample()
         return true;
     }
 
-    Sample *last = mStats->mSamples.back();
+    const Sample *last = &mLastSample;
 
     mCurrSample->astats.plDifference = mCurrSample->astats.r.pl - last->astats.r.pl;
     if (mCurrSample->astats.plDifference)
@@ -284,6 +282,11 @@ void Recorder::onStats(const webrtc::StatsReports &data)
         }
     } //end item loop
 
+    if (mSession.mRemotePlayer)
+    {
+        auto& sample = mCurrSample->vstats.r;
+        mSession.mRemotePlayer->takeConversionStats(sample.cvt, sample.cvtmax);
+    }
 
     mCurrSample->lq = mSession.calculateNetworkQuality(mCurrSample.get());
 
@@ -337,16 +340,6 @@ Recorder::~Recorder()
 {
 }
 
-RtcStats::~RtcStats()
-{
-    for (unsigned int i = 0; i < mSamples.size(); i++)
-    {
-        delete mSamples[i];
-    }
-
-    mSamples.clear();
-}
-
 const char* decToString(float v)
 {
     static char buf[128];
@@ -363,74 +356,80 @@ const char* decToString(float v)
 #define JSON_SUBOBJ(name) json+="\"" name "\":{";
 #define JSON_END_SUBOBJ() json[json.size()-1]='}'; json+=','
 
-#define JSON_ADD_SAMPLES_WITH_CONV(path, name, conv)   \
+#define JSON_ADD_SAMPLES_WITH_CONV(column, name, conv)  \
     json.append("\"" #name "\":[");    \
     if (mSamples.empty())              \
         json+=']';                     \
     else                               \
     {                                  \
-        for (auto sample: mSamples)    \
-            json.append(conv(sample->path name))+=","; \
+        for (size_t i = 0; i < mSamples.size(); i++) \
+            json.append(conv(mSamples.column[i]))+=","; \
         json[json.size()-1]=']';       \
     }\
     json+=',';
 
-#define JSON_ADD_SAMPLES(path, name) JSON_ADD_SAMPLES_WITH_CONV(path, name, std::to_string)
-#define JSON_ADD_DEC_SAMPLES(path, name) JSON_ADD_SAMPLES_WITH_CONV(path, name, decToString)
+#define JSON_ADD_SAMPLES(column, name) JSON_ADD_SAMPLES_WITH_CONV(column, name, std::to_string)
+#define JSON_ADD_DEC_SAMPLES(column, name) JSON_ADD_SAMPLES_WITH_CONV(column, name, decToString)
+
+#define JSON_ADD_BWINFO(prefix)         \
+    JSON_ADD_SAMPLES(prefix##Bt, bt);   \
+    JSON_ADD_SAMPLES(prefix##Bps, bps); \
+    JSON_ADD_SAMPLES(prefix##Abps, abps)
 
-#define JSON_ADD_BWINFO(path)           \
-    JSON_ADD_SAMPLES(path., bt);        \
-    JSON_ADD_SAMPLES(path., bps);       \
-    JSON_ADD_SAMPLES(path., abps)
+// Upper bound of the JSON size of a sample, to reserve the output at once
+static const size_t kJsonBytesPerSample = 320;
 
 void RtcStats::toJson(std::string& json) const
 {
-    json.reserve(10240);
+    json.clear();
+    json.reserve(2048 + mSamples.size() * kJsonBytesPerSample);
     json ="{";
     JSON_ADD_STR(cid, mCallId.toString());
     JSON_ADD_STR(sid, mSessionId.toString());
     JSON_ADD_INT(ts, round((float)mStartTs/1000));
     JSON_ADD_INT(dur, round((float)mDur/1000));
     JSON_SUBOBJ("samples");
-        JSON_ADD_SAMPLES(, ts);
-        JSON_ADD_SAMPLES(, lq);
-        JSON_ADD_SAMPLES(, f);
+        JSON_ADD_SAMPLES(ts, ts);
+        JSON_ADD_SAMPLES(lq, lq);
+        JSON_ADD_SAMPLES(f, f);
         JSON_SUBOBJ("v");
-            JSON_ADD_SAMPLES(vstats., rtt);
+            JSON_ADD_SAMPLES(vRtt, rtt);
             JSON_SUBOBJ("s");
-                JSON_ADD_BWINFO(vstats.s);
-                JSON_ADD_SAMPLES(vstats.s., fps);
-                JSON_ADD_SAMPLES(vstats.s., cfps);
-                JSON_ADD_SAMPLES(vstats.s., width);
-                JSON_ADD_SAMPLES(vstats.s., height);
-                JSON_ADD_DEC_SAMPLES(vstats.s., el);
-                JSON_ADD_SAMPLES(vstats.s., bwav);
-                JSON_ADD_SAMPLES(vstats.s., gbps);
+                JSON_ADD_BWINFO(vs);
+                JSON_ADD_SAMPLES(vsFps, fps);
+                JSON_ADD_SAMPLES(vsCfps, cfps);
+                JSON_ADD_SAMPLES(vsWidth, width);
+                JSON_ADD_SAMPLES(vsHeight, height);
+                JSON_ADD_DEC_SAMPLES(vsEl, el);
+                JSON_ADD_SAMPLES(vsBwav, bwav);
+                JSON_ADD_SAMPLES(vsGbps, gbps);
             JSON_END_SUBOBJ();
             JSON_SUBOBJ("r");
-                JSON_ADD_BWINFO(vstats.r);
-                JSON_ADD_SAMPLES(vstats.r., pl);
-                JSON_ADD_SAMPLES(vstats.r., jtr);
-                JSON_ADD_SAMPLES(vstats.r., fps);
-                JSON_ADD_SAMPLES(vstats.r., dly);
-                JSON_ADD_SAMPLES(vstats.r., width);
-                JSON_ADD_SAMPLES(vstats.r., height);
-                JSON_ADD_SAMPLES(vstats.r., firtx);
-                JSON_ADD_SAMPLES(vstats.r., plitx);
-                JSON_ADD_SAMPLES(vstats.r., nacktx);
+                JSON_ADD_BWINFO(vr);
+                JSON_ADD_SAMPLES(vrPl, pl);
+                JSON_ADD_SAMPLES(vrJtr, jtr);
+                JSON_ADD_SAMPLES(vrFps, fps);
+                JSON_ADD_SAMPLES(vrDly, dly);
+                JSON_ADD_SAMPLES(vrWidth, width);
+                JSON_ADD_SAMPLES(vrHeight, height);
+                JSON_ADD_SAMPLES(vrFirtx, firtx);
+                JSON_ADD_SAMPLES(vrPlitx, plitx);
+                JSON_ADD_SAMPLES(vrNacktx, nacktx);
+                JSON_ADD_SAMPLES(vrCvt, cvt);
+                JSON_ADD_SAMPLES(vrCvtmax, cvtmax);
             JSON_END_SUBOBJ(); //r
         JSON_END_SUBOBJ(); //v
         JSON_SUBOBJ("a");
-            JSON_ADD_SAMPLES(astats., rtt);
+            JSON_ADD_SAMPLES(aRtt, rtt);
             JSON_SUBOBJ("s");
-                JSON_ADD_BWINFO(astats.s);
+                JSON_ADD_BWINFO(as);
             JSON_END_SUBOBJ();
             JSON_SUBOBJ("r");
-                JSON_ADD_BWINFO(astats.r);
-                JSON_ADD_SAMPLES(astats.r., jtr);
-                JSON_ADD_SAMPLES(astats.r., pl);
-                JSON_ADD_SAMPLES(astats.r., dly);
-                JSON_ADD_SAMPLES(astats.r., al);
+                JSON_ADD_BWINFO(ar);
+                JSON_ADD_SAMPLES(arJtr, jtr);
+                JSON_ADD_SAMPLES(arPl, pl);
+                JSON_ADD_SAMPLES(arDly, dly);
+                JSON_ADD_SAMPLES(arAl, al);
             JSON_END_SUBOBJ();
         JSON_END_SUBOBJ(); //a
     JSON_END_SUBOBJ(); //samples
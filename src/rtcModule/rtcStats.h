@@ -2,6 +2,7 @@
 #define RTCSTATS_H
 #include "webrtcAdapter.h"
 #include "IRtcStats.h"
+#include "sampleSeries.h"
 #include "ITypesImpl.h"
 #include <timers.hpp>
 #include <karereId.h>
@@ -61,19 +62,18 @@ public:
     karere::Id mPeerAnonId;
     std::string mDeviceInfo;
     bool mIsGroupCall;
-    std::vector<Sample*> mSamples;
+    SampleSeries mSamples;
     ConnInfo mConnInfo;
     unsigned long mMaxIceDisconnectionTime = 0;
     unsigned int mIceDisconnections = 0;
     karere::Id mPreviousSessionId;
     unsigned int mReconnections = 0;
-    ~RtcStats();
     //IRtcStats implementation
     virtual const std::string& termRsn() const { return mTermRsn; }
     virtual bool isCaller() const { return !mIsJoiner; }
     virtual karere::Id callId() const { return mCallId; }
     virtual size_t sampleCnt() const { return mSamples.size(); }
-    virtual const std::vector<Sample*>* samples() const { return &mSamples; }
+    virtual Sample sample(size_t index) const { return mSamples.at(index); }
     virtual const IConnInfo* connInfo() const { return &mConnInfo; }
     virtual void toJson(std::string& out) const;
 };
@@ -99,6 +99,7 @@ protected:
     static const int STATFLAG_SEND_CPU_LIMITED_RESOLUTION = 4;
     static const int STATFLAG_SEND_BANDWIDTH_LIMITED_RESOLUTION = 8;
     std::unique_ptr<Sample> mCurrSample;
+    Sample mLastSample; //copy of the last sample added to mStats
     BwCalculator mVideoRxBwCalc;
     BwCalculator mVideoTxBwCalc;
     BwCalculator mAudioRxBwCalc;
@@ -118,6 +119,7 @@ public:
     virtual void OnComplete(const webrtc::StatsReports& data);
     void onStats(const webrtc::StatsReports &data);
     webrtc::PeerConnectionInterface::StatsOutputLevel getStatsLevel() const;
+    const Sample& lastSample() const { return mLastSample; }
     std::function<void(void*, int)> onSample;
 };
 }
@@ -0,0 +1,145 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include <sampleSeries.h>
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+TESTS_INIT();
+using namespace rtcModule::stats;
+
+static const int kCallSamples = 100000;
+
+Sample makeSample(int i, long rtt)
+{
+    Sample sample;
+    sample.ts = i;
+    sample.vstats.rtt = rtt;
+    sample.vstats.r.bt = i * 10L;
+    return sample;
+}
+
+//Percentile of the values of the series, where each sample stands for the
+//ones added since the previous one that was kept
+long weightedPercentile(const SampleSeries& series, double pct)
+{
+    std::vector<std::pair<long, int64_t>> values;
+    int64_t prevTs = -1;
+    for (size_t i = 0; i < series.size(); i++)
+    {
+        Sample sample = series.at(i);
+        values.emplace_back(sample.vstats.rtt, sample.ts - prevTs);
+        prevTs = sample.ts;
+    }
+    std::sort(values.begin(), values.end());
+    int64_t target = static_cast<int64_t>(pct * (prevTs + 1) / 100);
+    int64_t covered = 0;
+    for (const auto& value: values)
+    {
+        covered += value.second;
+        if (covered > target)
+        {
+            return value.first;
+        }
+    }
+    return values.back().first;
+}
+
+int main()
+{
+
+TestGroup("SampleSeries")
+{
+    syncTest("Keeps all the samples until it is full")
+    {
+        SampleSeries series;
+        check(series.empty());
+        for (int i = 0; i < SampleSeries::kCapacity; i++)
+        {
+            series.push(makeSample(i, i));
+        }
+        check(series.size() == SampleSeries::kCapacity);
+        bool exact = true;
+        for (size_t i = 0; i < series.size(); i++)
+        {
+            Sample sample = series.at(i);
+            exact = exact && sample.ts == (int64_t)i && sample.vstats.rtt == (long)i && !series.levelAt(i);
+        }
+        check(exact);
+    });
+    syncTest("Memory is bounded, and the whole call stays covered")
+    {
+        size_t bytes = sizeof(SampleSeries);
+        SampleSeries* series = new SampleSeries;
+        bool bounded = true;
+        for (int i = 0; i < kCallSamples; i++)
+        {
+            series->push(makeSample(i, 0));
+            bounded = bounded && series->size() == std::min(i + 1, (int)SampleSeries::kCapacity);
+        }
+        check(bounded);
+        check(sizeof(*series) == bytes && bytes < 64 * 1024);
+        check(series->addedCount() == kCallSamples);
+
+        // timestamps are increasing, levels decrease towards the newest
+        // samples, and cumulative counters are exact
+        bool ordered = true;
+        bool exact = true;
+        int64_t maxGap = 0;
+        for (size_t i = 0; i < series->size(); i++)
+        {
+            Sample sample = series->at(i);
+            exact = exact && sample.vstats.r.bt == sample.ts * 10;
+            if (i)
+            {
+                Sample prev = series->at(i - 1);
+                ordered = ordered && prev.ts < sample.ts && series->levelAt(i - 1) >= series->levelAt(i);
+                maxGap = std::max(maxGap, sample.ts - prev.ts);
+            }
+        }
+        check(ordered);
+        check(exact);
+        check(series->at(0).ts < maxGap);
+        check(series->at(series->size() - 1).ts == kCallSamples - 1);
+
+        // the newest samples are kept with full resolution
+        bool recent = true;
+        for (size_t i = 1; i <= SampleSeries::kMinSamplesPerLevel; i++)
+        {
+            recent = recent && series->at(series->size() - i).ts == kCallSamples - (int64_t)i;
+        }
+        check(recent);
+        printf("      oldest kept sample: %lld, max gap: %lld\n",
+               (long long)series->at(0).ts, (long long)maxGap);
+        delete series;
+    });
+    syncTest("Percentiles are preserved when downsampling")
+    {
+        std::mt19937 rng(12345);
+        std::uniform_int_distribution<long> dist(0, 999);
+        std::vector<long> all;
+        SampleSeries series;
+        for (int i = 0; i < kCallSamples; i++)
+        {
+            long rtt = dist(rng);
+            all.push_back(rtt);
+            series.push(makeSample(i, rtt));
+        }
+        std::sort(all.begin(), all.end());
+        bool close = true;
+        for (double pct: {10.0, 50.0, 90.0, 99.0})
+        {
+            long expected = all[static_cast<size_t>(pct * all.size() / 100)];
+            long actual = weightedPercentile(series, pct);
+            printf("      p%.0f: %ld (all samples: %ld)\n", pct, actual, expected);
+            close = close && std::abs(actual - expected) <= 100;
+        }
+        check(close);
+    });
+});
+
+return test::gNumFailed;
+}
@@ -0,0 +1,164 @@
+#ifndef SAMPLESERIES_H
+#define SAMPLESERIES_H
+#include "IRtcStats.h"
+#include <assert.h>
+#include <algorithm>
+
+namespace rtcModule
+{
+namespace stats
+{
+// Fields of Sample that are recorded: name of the column, path of the field
+// in Sample, and type used to store it
+#define RTCSTATS_SAMPLE_COLUMNS(X)                      \
+    X(ts, ts, int64_t)                                  \
+    X(lq, lq, int8_t)                                   \
+    X(f, f, int32_t)                                    \
+    X(vRtt, vstats.rtt, int32_t)                        \
+    X(vrBt, vstats.r.bt, int64_t)                       \
+    X(vrBps, vstats.r.bps, int32_t)                     \
+    X(vrAbps, vstats.r.abps, int32_t)                   \
+    X(vrPl, vstats.r.pl, int32_t)                       \
+    X(vrFps, vstats.r.fps, int16_t)                     \
+    X(vrDly, vstats.r.dly, int32_t)                     \
+    X(vrJtr, vstats.r.jtr, int32_t)                     \
+    X(vrWidth, vstats.r.width, int16_t)                 \
+    X(vrHeight, vstats.r.height, int16_t)               \
+    X(vrBwav, vstats.r.bwav, int32_t)                   \
+    X(vrFirtx, vstats.r.firtx, int32_t)                 \
+    X(vrPlitx, vstats.r.plitx, int32_t)                 \
+    X(vrNacktx, vstats.r.nacktx, int32_t)               \
+    X(vrCvt, vstats.r.cvt, int32_t)                     \
+    X(vrCvtmax, vstats.r.cvtmax, int32_t)               \
+    X(vsBt, vstats.s.bt, int64_t)                       \
+    X(vsBps, vstats.s.bps, int32_t)                     \
+    X(vsAbps, vstats.s.abps, int32_t)                   \
+    X(vsGbps, vstats.s.gbps, int32_t)                   \
+    X(vsFps, vstats.s.fps, int16_t)                     \
+    X(vsCfps, vstats.s.cfps, int16_t)                   \
+    X(vsWidth, vstats.s.width, int16_t)                 \
+    X(vsHeight, vstats.s.height, int16_t)               \
+    X(vsEl, vstats.s.el, float)                         \
+    X(vsBwav, vstats.s.bwav, int32_t)                   \
+    X(vsTargetEncBitrate, vstats.s.targetEncBitrate, int32_t) \
+    X(aRtt, astats.rtt, int32_t)                        \
+    X(aPlDifference, astats.plDifference, int32_t)      \
+    X(arBt, astats.r.bt, int64_t)                       \
+    X(arBps, astats.r.bps, int32_t)                     \
+    X(arAbps, astats.r.abps, int32_t)                   \
+    X(arPl, astats.r.pl, int32_t)                       \
+    X(arJtr, astats.r.jtr, int32_t)                     \
+    X(arDly, astats.r.dly, int32_t)                     \
+    X(arAl, astats.r.al, int8_t)                        \
+    X(asBt, astats.s.bt, int64_t)                       \
+    X(asBps, astats.s.bps, int32_t)                     \
+    X(asAbps, astats.s.abps, int32_t)                   \
+    X(cRtt, cstats.rtt, int32_t)                        \
+    X(crBt, cstats.r.bt, int64_t)                       \
+    X(crBps, cstats.r.bps, int32_t)                     \
+    X(crAbps, cstats.r.abps, int32_t)                   \
+    X(csBt, cstats.s.bt, int64_t)                       \
+    X(csBps, cstats.s.bps, int32_t)                     \
+    X(csAbps, cstats.s.abps, int32_t)
+
+/** @brief Bounded time series of stats samples, stored as one array per field.
+ *
+ * The memory used per session is fixed. When the series is full, older
+ * samples are downsampled, so that the whole call is still covered, with less
+ * resolution the older the samples are: every sample has a level, and it
+ * stands for 2^level of the samples that were added. When a sample has to be
+ * dropped, the two oldest samples of the finest level that has more than
+ * kMinSamplesPerLevel of them are merged into one of the next level. The
+ * later sample of the pair is kept, so that cumulative counters stay exact.
+ */
+class SampleSeries
+{
+public:
+    enum { kCapacity = 256, kMinSamplesPerLevel = 16 };
+#define RTCSTATS_DECLARE_COLUMN(name, path, type) type name[kCapacity];
+    RTCSTATS_SAMPLE_COLUMNS(RTCSTATS_DECLARE_COLUMN)
+#undef RTCSTATS_DECLARE_COLUMN
+
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+    /** @brief Number of samples ever added, including the ones merged when downsampling */
+    uint64_t addedCount() const { return mAddedCount; }
+    void push(const Sample& sample)
+    {
+        if (mSize == kCapacity)
+        {
+            downsample();
+        }
+
+#define RTCSTATS_PUSH_COLUMN(name, path, type) name[mSize] = static_cast<type>(sample.path);
+        RTCSTATS_SAMPLE_COLUMNS(RTCSTATS_PUSH_COLUMN)
+#undef RTCSTATS_PUSH_COLUMN
+        mLevels[mSize] = 0;
+        mSize++;
+        mAddedCount++;
+    }
+
+    Sample at(size_t index) const
+    {
+        assert(index < mSize);
+        Sample sample;
+#define RTCSTATS_GET_COLUMN(name, path, type) sample.path = name[index];
+        RTCSTATS_SAMPLE_COLUMNS(RTCSTATS_GET_COLUMN)
+#undef RTCSTATS_GET_COLUMN
+        return sample;
+    }
+
+    /** @brief Level of the sample at \c index, which stands for 2^level added samples */
+    unsigned levelAt(size_t index) const
+    {
+        assert(index < mSize);
+        return mLevels[index];
+    }
+
+protected:
+    uint8_t mLevels[kCapacity];
+    size_t mSize = 0;
+    uint64_t mAddedCount = 0;
+
+    template <class T>
+    static void eraseFromColumn(T* column, size_t size, size_t index)
+    {
+        std::copy(column + index + 1, column + size, column + index);
+    }
+
+    void downsample()
+    {
+        // levels never increase from the oldest to the newest sample, so the
+        // samples of each level are contiguous
+        size_t end = mSize;
+        size_t begin;
+        for (;;)
+        {
+            begin = end - 1;
+            while (begin > 0 && mLevels[begin - 1] == mLevels[end - 1])
+            {
+                begin--;
+            }
+
+            if (begin == 0 || end - begin > kMinSamplesPerLevel)
+            {
+                break;
+            }
+            end = begin;
+        }
+
+        assert(begin + 1 < mSize);
+        if (mLevels[begin + 1] < 255)
+        {
+            mLevels[begin + 1]++;
+        }
+#define RTCSTATS_ERASE_COLUMN(name, path, type) eraseFromColumn(name, mSize, begin);
+        RTCSTATS_SAMPLE_COLUMNS(RTCSTATS_ERASE_COLUMN)
+        RTCSTATS_ERASE_COLUMN(mLevels, , )
+#undef RTCSTATS_ERASE_COLUMN
+        mSize--;
+    }
+};
+}
+}
+#endif
@@ -2,11 +2,14 @@
 #define STREAMPLAYER_H
 #include <api/media_stream_interface.h>
 #include <api/video/i420_buffer.h>
-#include <libyuv/convert.h>
+#include <libyuv/rotate.h>
 #include <IVideoRenderer.h>
 #include "base/gcm.h"
 #include "webrtcAdapter.h"
+#include "frameConverter.h"
 #include <mutex>
+#include <atomic>
+#include <chrono>
 
 namespace artc
 {
@@ -23,6 +26,39 @@ protected:
     std::function<void()> mOnMediaStart;
     std::mutex mMutex; //guards onMediaStart and mRenderer (stuff that is accessed by public API and by webrtc threads)
     bool mVideoEnable = true;
+    rtc::scoped_refptr<webrtc::I420Buffer> mRotatedFrame; //reused for all rotated frames, guarded by mMutex
+    //frame conversion times, for stats
+    std::atomic<uint32_t> mConvertedFrames{0};
+    std::atomic<uint64_t> mConversionTimeUs{0};
+    std::atomic<uint32_t> mMaxConversionTimeUs{0};
+
+    void addConversionTime(uint32_t us)
+    {
+        mConvertedFrames++;
+        mConversionTimeUs += us;
+        uint32_t max = mMaxConversionTimeUs;
+        while (us > max && !mMaxConversionTimeUs.compare_exchange_weak(max, us));
+    }
+
+    const webrtc::I420BufferInterface& rotate(const webrtc::I420BufferInterface& buffer, webrtc::VideoRotation rotation)
+    {
+        bool swapSides = (rotation == webrtc::kVideoRotation_90 || rotation == webrtc::kVideoRotation_270);
+        int width = swapSides ? buffer.height() : buffer.width();
+        int height = swapSides ? buffer.width() : buffer.height();
+        if (!mRotatedFrame || mRotatedFrame->width() != width || mRotatedFrame->height() != height)
+        {
+            mRotatedFrame = webrtc::I420Buffer::Create(width, height);
+        }
+
+        libyuv::I420Rotate(buffer.DataY(), buffer.StrideY(),
+                           buffer.DataU(), buffer.StrideU(),
+                           buffer.DataV(), buffer.StrideV(),
+                           mRotatedFrame->MutableDataY(), mRotatedFrame->StrideY(),
+                           mRotatedFrame->MutableDataU(), mRotatedFrame->StrideU(),
+                           mRotatedFrame->MutableDataV(), mRotatedFrame->StrideV(),
+                           buffer.width(), buffer.height(), static_cast<libyuv::RotationMode>(rotation));
+        return *mRotatedFrame;
+    }
 
 public:
     IVideoRenderer* videoRenderer() const {return mRenderer;}
@@ -158,25 +194,50 @@ public:
 
         if (mVideoEnable)
         {
-            void* userData = NULL;
             auto buffer = frame.video_frame_buffer()->ToI420();   // smart ptr type changed
-            if (frame.rotation() != webrtc::kVideoRotation_0)
+            if (mRenderer->onI420Frame((unsigned short)buffer->width(), (unsigned short)buffer->height(),
+                                       buffer->DataY(), buffer->StrideY(),
+                                       buffer->DataU(), buffer->StrideU(),
+                                       buffer->DataV(), buffer->StrideV(), frame.rotation()))
             {
-                buffer = webrtc::I420Buffer::Rotate(*buffer, frame.rotation());
+                return; //renderer consumed the frame in YUV format
             }
-            unsigned short width = (unsigned short)buffer->width();
-            unsigned short height = (unsigned short)buffer->height();
+
+            auto start = std::chrono::steady_clock::now();
+            const webrtc::I420BufferInterface& image = (frame.rotation() != webrtc::kVideoRotation_0)
+                    ? rotate(*buffer, frame.rotation())
+                    : *buffer;
+            unsigned short width = (unsigned short)image.width();
+            unsigned short height = (unsigned short)image.height();
+            auto elapsed = std::chrono::steady_clock::now() - start;
+
+            void* userData = NULL;
             void* frameBuf = mRenderer->getImageBuffer(width, height, userData);
             if (!frameBuf) //image is frozen or app is minimized/covered
                 return;
-            libyuv::I420ToABGR(buffer->DataY(), buffer->StrideY(),
-                               buffer->DataU(), buffer->StrideU(),
-                               buffer->DataV(), buffer->StrideV(),
-                               (uint8_t*)frameBuf, width * 4, width, height);
+
+            start = std::chrono::steady_clock::now();
+            I420Planes planes = { image.DataY(), image.StrideY(),
+                                  image.DataU(), image.StrideU(),
+                                  image.DataV(), image.StrideV(),
+                                  width, height };
+            FrameConverter::get().convert(planes, (uint8_t*)frameBuf, width * 4);
+            elapsed += std::chrono::steady_clock::now() - start;
+            addConversionTime(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
             mRenderer->frameComplete(userData);
         }
     }
 
+    /** @brief Returns the average and maximum time, in microseconds, spent rotating
+     * and converting a frame for the renderer since the previous call, and resets them */
+    void takeConversionStats(long& avgUs, long& maxUs)
+    {
+        uint32_t frames = mConvertedFrames.exchange(0);
+        uint64_t total = mConversionTimeUs.exchange(0);
+        maxUs = mMaxConversionTimeUs.exchange(0);
+        avgUs = frames ? static_cast<long>(total / frames) : 0;
+    }
+
     webrtc::AudioTrackInterface *getAudioTrack()
     {
         return mAudio.get();
@@ -9,6 +9,7 @@
 #include "rtcCrypto.h"
 #include "streamPlayer.h"
 #include "rtcStats.h"
+#include <algorithm>
 
 #define SUB_LOG_DEBUG(fmtString,...) RTCM_LOG_DEBUG("%s: " fmtString, mName.c_str(), ##__VA_ARGS__)
 #define SUB_LOG_INFO(fmtString,...) RTCM_LOG_INFO("%s: " fmtString, mName.c_str(), ##__VA_ARGS__)
@@ -1943,7 +1944,7 @@ bool Call::cmdBroadcast(uint8_t type, Args... args)
         if (wptr.deleted())
             return;
         destroy(TermCode::kErrNetSignalling, false, "Failure to send BroadCast command");
-    }, mManager.mKarereClient.appCtx);
+    }, mManager.mKarereClient.appCtx, kWorkCall, mChat.chatId().val);
     return false;
 }
 
@@ -2016,7 +2017,7 @@ void Call::asyncDestroy(TermCode code, bool weTerminate)
         if (wptr.deleted())
             return;
         destroy(code, weTerminate, "Failure to send a command");
-    }, mManager.mKarereClient.appCtx);
+    }, mManager.mKarereClient.appCtx, kWorkCall, mChat.chatId().val);
 }
 
 void Call::stopIncallPingTimer(bool endCall)
@@ -2100,7 +2101,7 @@ void Call::removeSession(Session& sess, TermCode reason)
 
             rejoin(sessionPeer, sessionPeerClient);
 
-        }, mManager.mKarereClient.appCtx);
+        }, mManager.mKarereClient.appCtx, kWorkCall, mChat.chatId().val);
     }
     else
     {
@@ -2269,7 +2270,7 @@ bool Call::sendCallData(CallDataState state)
             if (wptr.deleted())
                 return;
             destroy(TermCode::kErrNetSignalling, true, "Failure to send Calldata");
-        }, mManager.mKarereClient.appCtx);
+        }, mManager.mKarereClient.appCtx, kWorkCall, mChat.chatId().val);
 
         return false;
     }
@@ -2900,6 +2901,22 @@ std::map<Id, uint8_t> Call::sessionState() const
     return sessionState;
 }
 
+std::vector<std::pair<Id, float>> Call::activeSpeakers() const
+{
+    std::vector<std::pair<Id, float>> speakers;
+    speakers.reserve(mSessions.size());
+    for (auto& item: mSessions)
+    {
+        speakers.emplace_back(item.first, item.second->audioLevel());
+    }
+
+    std::stable_sort(speakers.begin(), speakers.end(), [](const std::pair<Id, float>& a, const std::pair<Id, float>& b)
+    {
+        return a.second > b.second;
+    });
+    return speakers;
+}
+
 void Call::setOnHold(bool onHold)
 {
     assert(onHold != mLocalFlags.onHold());
@@ -3017,6 +3034,7 @@ void Call::enableAudioLevelMonitor(bool enable)
             else
             {
                 sessionIt.second->mRemotePlayer->getAudioTrack()->RemoveSink(sessionIt.second->mAudioLevelMonitor.get());
+                sessionIt.second->mAudioLevelMonitor->reset();
             }
         }
     }
@@ -3160,7 +3178,7 @@ Session::Session(Call& call, RtMessage& packet, const SessionInfo *sessionParame
 {
     // Packet can be RTCMD_SESSION or RTCMD_SDP_OFFER
     mHandler = call.callHandler()->onNewSession(*this);
-    mAudioLevelMonitor.reset(new AudioLevelMonitor(*this, *mHandler));
+    mAudioLevelMonitor.reset(new AudioLevelMonitor(*this, *mHandler, mManager.mKarereClient.appCtx));
     assert(!sessionParameters || packet.type == RTCMD_SDP_OFFER);
     if (packet.type == RTCMD_SDP_OFFER) // peer's offer
     {
@@ -4088,15 +4106,15 @@ Session::~Session()
 void Session::pollStats()
 {
     mRtcConn->GetStats(static_cast<webrtc::StatsObserver*>(mStatRecorder.get()), nullptr, mStatRecorder->getStatsLevel());
-    unsigned int statsSize = mStatRecorder->mStats->mSamples.size();
+    uint64_t statsSize = mStatRecorder->mStats->mSamples.addedCount();
     if (statsSize != mPreviousStatsSize)
     {
-        manageNetworkQuality(mStatRecorder->mStats->mSamples.back());
+        manageNetworkQuality(&mStatRecorder->lastSample());
         mPreviousStatsSize = statsSize;
     }
 }
 
-void Session::manageNetworkQuality(stats::Sample *sample)
+void Session::manageNetworkQuality(const stats::Sample *sample)
 {
     int previousNetworkquality = mNetworkQuality;
     mNetworkQuality = sample->lq;
@@ -4678,53 +4696,57 @@ void Session::processPackets()
     }
 }
 
-AudioLevelMonitor::AudioLevelMonitor(const Session &session, ISessionHandler &sessionHandler)
-    : mSessionHandler(sessionHandler), mSession(session)
+AudioLevelMonitor::AudioLevelMonitor(const Session &session, ISessionHandler &sessionHandler, void *appCtx)
+    : mSessionHandler(sessionHandler), mSession(session), mAppCtx(appCtx),
+      mDetector(kAudioThreshold / 32768.0f, kAudioOffThreshold / 32768.0f, kAudioHoldMs)
 {
 }
 
-void AudioLevelMonitor::OnData(const void *audio_data, int bits_per_sample, int /*sample_rate*/, size_t number_of_channels, size_t number_of_frames)
+void AudioLevelMonitor::OnData(const void *audio_data, int bits_per_sample, int sample_rate, size_t number_of_channels, size_t number_of_frames)
 {
-    if (!mSession.receivedAv().audio())
+    if (mResetPending.exchange(false) || !mSession.receivedAv().audio())
     {
-        if (mAudioDetected)
-        {
-            mAudioDetected = false;
-            mSessionHandler.onSessionAudioDetected(mAudioDetected);
-        }
+        mSmoother.reset();
+        mDetector.reset();
+        mLevel = 0;
+    }
 
+    if (!mSession.receivedAv().audio())
+    {
+        notifyAudioDetected(false);
         return;
     }
 
     assert(bits_per_sample == 16);
-    time_t nowTime = time(NULL);
-    if (nowTime - mPreviousTime > 2) // Two seconds between samples
-    {
-        mPreviousTime = nowTime;
-        size_t valueCount = number_of_channels * number_of_frames;
-        int16_t *data = (int16_t*)audio_data;
-        int16_t audioMaxValue = data[0];
-        int16_t audioMinValue = data[0];
-        for (size_t i = 1; i < valueCount; i++)
-        {
-            if (data[i] > audioMaxValue)
-            {
-                audioMaxValue = data[i];
-            }
+    AudioLevel frameLevel = measureAudioLevel(static_cast<const int16_t*>(audio_data), number_of_channels * number_of_frames);
+    double durationMs = sample_rate ? number_of_frames * 1000.0 / sample_rate : 10;
+    float level = mSmoother.update(frameLevel.rms, durationMs);
+    mLevel = level;
+    notifyAudioDetected(mDetector.update(level, durationMs));
+}
 
-            if (data[i] < audioMinValue)
-            {
-                audioMinValue = data[i];
-            }
-        }
+void AudioLevelMonitor::reset()
+{
+    // called from the karere thread, while the audio thread may be delivering a frame
+    mResetPending = true;
+    mLevel = 0;
+}
 
-        bool audioDetected = (abs(audioMaxValue) + abs(audioMinValue) > kAudioThreshold);
-        if (audioDetected != mAudioDetected)
-        {
-            mAudioDetected = audioDetected;
-            mSessionHandler.onSessionAudioDetected(mAudioDetected);
-        }
+void AudioLevelMonitor::notifyAudioDetected(bool audioDetected)
+{
+    if (mAudioDetected.exchange(audioDetected) == audioDetected)
+    {
+        return;
     }
+
+    auto wptr = weakHandle();
+    marshallCall([wptr, this, audioDetected]()
+    {
+        if (wptr.deleted())
+            return;
+
+        mSessionHandler.onSessionAudioDetected(audioDetected);
+    }, mAppCtx, kWorkCall);
 }
 
 void globalCleanup()
@@ -142,7 +142,15 @@ enum TermCode: uint8_t
 };
 
 static const uint8_t kNetworkQualityDefault = 2;    // By default, while not enough samples
-static const int kAudioThreshold = 100;             // Threshold to consider a user is speaking
+/* Levels to consider a user is speaking, compared with the smoothed RMS level of the received
+ * audio, in 16-bit sample units. A user starts speaking above kAudioThreshold, and stops after
+ * staying below kAudioOffThreshold for kAudioHoldMs.
+ * kAudioThreshold used to be compared with the peak-to-peak amplitude of a single frame every
+ * 2 seconds: since the RMS of a tone is about a third of that, the same value now requires
+ * louder audio, and short noises are filtered by the smoothing */
+static const int kAudioThreshold = 100;
+static const int kAudioOffThreshold = 50;
+static const unsigned int kAudioHoldMs = 500;
 static const unsigned int kStatsPeriod = 1;         // Timeout to get new stats (in seconds)
 static const unsigned int kMaxStatsPeriod = 5;      // Maximum timeout without adding new sample to stats (in seconds)
 
@@ -352,6 +360,12 @@ public:
     virtual bool isAudioLevelMonitorEnabled() const = 0;
     virtual void enableAudioLevelMonitor(bool enable) = 0;
     virtual void setOnHold(bool setOnHold) = 0;
+
+    /** @brief Returns the sessions of the call ordered by the smoothed level of the
+     * audio received from them, loudest first, as pairs of session id and level
+     * (from 0 to 1). Levels are only measured while the audio level monitor is enabled.
+     */
+    virtual std::vector<std::pair<karere::Id, float>> activeSpeakers() const = 0;
 };
 struct SdpKey
 {
@@ -28,6 +28,15 @@ rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> gWebrtcContext = null
 static bool gIsInitialized = false;
 AsyncWaiter* gAsyncWaiter = nullptr;
 
+#ifndef RTCM_SHARED_WORKER_THREAD
+/** Threads owned by karere for the webrtc stack. The network thread handles sockets,
+ * ICE and DTLS/SRTP; the worker thread runs the media engine, codec setup and stats.
+ * Only signaling, and hence all the PeerConnection callbacks, stays in the main thread.
+ * Define RTCM_SHARED_WORKER_THREAD to run the worker in the main thread, as before */
+static std::unique_ptr<rtc::Thread> gNetworkThread;
+static std::unique_ptr<rtc::Thread> gWorkerThread;
+#endif
+
 bool isInitialized() { return gIsInitialized; }
 bool init(void *appCtx)
 {
@@ -51,11 +60,24 @@ bool init(void *appCtx)
     thread->SetName("Main Thread", thread);
     threadMgr->SetCurrentThread(thread);
 
+    rtc::Thread* networkThread = nullptr;   // created by webrtc
+    rtc::Thread* workerThread = thread;
+#ifndef RTCM_SHARED_WORKER_THREAD
+    gNetworkThread = rtc::Thread::CreateWithSocketServer();
+    gNetworkThread->SetName("Network Thread", gNetworkThread.get());
+    gWorkerThread = rtc::Thread::Create();
+    gWorkerThread->SetName("Worker Thread", gWorkerThread.get());
+    if (!gNetworkThread->Start() || !gWorkerThread->Start())
+        throw std::runtime_error("Error starting webrtc network/worker threads");
+    networkThread = gNetworkThread.get();
+    workerThread = gWorkerThread.get();
+#endif
+
     if (gWebrtcContext == nullptr)
     {
         gWebrtcContext = webrtc::CreatePeerConnectionFactory(
-                    nullptr /* network_thread */, thread /* worker_thread */,
-                    thread, nullptr /* default_adm */,
+                    networkThread, workerThread,
+                    thread /* signaling_thread */, nullptr /* default_adm */,
                     webrtc::CreateBuiltinAudioEncoderFactory(),
                     webrtc::CreateBuiltinAudioDecoderFactory(),
                     webrtc::CreateBuiltinVideoEncoderFactory(),
@@ -75,6 +97,13 @@ void cleanup()
         return;
     gWebrtcContext.release();
     gWebrtcContext = NULL;
+#ifndef RTCM_SHARED_WORKER_THREAD
+    // all calls have been destroyed by now, so nothing else is posted to these threads
+    gWorkerThread->Stop();
+    gWorkerThread.reset();
+    gNetworkThread->Stop();
+    gNetworkThread.reset();
+#endif
     rtc::CleanupSSL();
     rtc::ThreadManager::Instance()->SetCurrentThread(nullptr);
     delete gAsyncWaiter->guiThread();
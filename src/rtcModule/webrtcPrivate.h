@@ -7,6 +7,7 @@
 #include <chatd.h>
 #include <base/trackDelete.h>
 #include <streamPlayer.h>
+#include <audioLevel.h>
 
 namespace rtcModule
 {
@@ -21,21 +22,33 @@ struct StateDesc
 namespace stats { class Recorder; }
 
 class Session;
-class AudioLevelMonitor : public webrtc::AudioTrackSinkInterface
+/** Audio samples are delivered by a webrtc audio thread: the level is computed there,
+ * and changes are notified to the session handler from the karere thread */
+class AudioLevelMonitor : public webrtc::AudioTrackSinkInterface, public karere::DeleteTrackable
 {
     public:
-    AudioLevelMonitor(const Session &session, ISessionHandler &sessionHandler);
+    AudioLevelMonitor(const Session &session, ISessionHandler &sessionHandler, void *appCtx);
     virtual void OnData(const void *audio_data,
                         int bits_per_sample,
                         int sample_rate,
                         size_t number_of_channels,
                         size_t number_of_frames);
+    /** @brief Smoothed RMS level of the received audio, from 0 to 1 */
+    float level() const { return mLevel; }
+    /** @brief Clears the level. The smoother and the detector are reset by the audio thread,
+     * at the next frame */
+    void reset();
 
 private:
-    time_t mPreviousTime = 0;
     ISessionHandler &mSessionHandler;
     const Session &mSession;
-    bool mAudioDetected = false;
+    void *mAppCtx;
+    AudioLevelSmoother mSmoother;       // only accessed by the audio thread
+    AudioActivityDetector mDetector;    // only accessed by the audio thread
+    std::atomic<float> mLevel { 0 };
+    std::atomic<bool> mAudioDetected { false };
+    std::atomic<bool> mResetPending { false };
+    void notifyAudioDetected(bool audioDetected);
 };
 
 class Session: public ISession
@@ -96,7 +109,7 @@ protected:
     bool mVideoReceived = false;
     int mNetworkQuality = kNetworkQualityDefault;    // from 0 (worst) to 5 (best)
     long mAudioPacketLostAverage = 0;
-    unsigned int mPreviousStatsSize = 0;
+    uint64_t mPreviousStatsSize = 0;
     std::unique_ptr<AudioLevelMonitor> mAudioLevelMonitor;
     bool mPeerSupportRenegotiation = false;
     bool mRenegotiationInProgress = false;
@@ -147,7 +160,8 @@ public:
     void pollStats();
     artc::myPeerConnection<Session> rtcConn() const { return mRtcConn; }
     virtual bool videoReceived() const { return mVideoReceived; }
-    void manageNetworkQuality(stats::Sample* sample);
+    float audioLevel() const { return mAudioLevelMonitor ? mAudioLevelMonitor->level() : 0; }
+    void manageNetworkQuality(const stats::Sample* sample);
     void createRtcConn();
     promise::Promise<void> processSdpOfferSendAnswer();
     void forceDestroy();
@@ -316,6 +330,7 @@ public:
     void changeVideoInDevice();
     bool isAudioLevelMonitorEnabled() const override;
     void enableAudioLevelMonitor(bool enable) override;
+    std::vector<std::pair<karere::Id, float>> activeSpeakers() const override;
 };
 
 /*
@@ -330,11 +345,14 @@ public:
 
     bool wsConnect(WebsocketsIO *websocketIO, const char *ip,
                    const char *host, int port, const char *path, bool ssl) = delete;
+    bool wsConnect(WebsocketsIO *websocketIO, const char *ip, const char *fallbackIp,
+                   const char *host, int port, const char *path, bool ssl) = delete;
     int wsGetNoNameErrorCode(WebsocketsIO *websocketIO) = delete;
     bool wsSendMessage(char *msg, size_t len) = delete;  // returns true on success, false if error
     void wsDisconnect(bool immediate) = delete;
     bool wsIsConnected() = delete;
-    void wsCloseCbPrivate(int errcode, int errtype, const char *preason, size_t reason_len) = delete;
+    void wsConnectCbPrivate(WebsocketsClientImpl *impl) = delete;
+    void wsCloseCbPrivate(WebsocketsClientImpl *impl, int errcode, int errtype, const char *preason, size_t reason_len) = delete;
 
     void wsConnectCb() override {}
     void wsCloseCb(int errcode, int errtype, const char *preason, size_t /*preason_len*/) override {}
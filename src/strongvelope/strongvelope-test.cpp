@@ -0,0 +1,137 @@
+//#define TESTLOOP_LOG_DONES
+//#define TESTLOOP_DEBUG
+
+#include <asyncTest-framework.h>
+#include "strongvelope.h"
+#include <db.h>
+#include <karereCommon.h>
+#include <userAttrCache.h>
+#include <string.h>
+
+TESTS_INIT();
+using namespace strongvelope;
+
+static const karere::Id kOwnHandle(0x1111);
+static const karere::Id kChatid(0x2222);
+static const karere::Id kSender(0x3333);
+
+//Storage for the UserAttrCache reference of the handler. It's never constructed nor used:
+//the keys are added already decrypted, so no public key is fetched
+alignas(karere::UserAttrCache) static char gNoUserAttrCache[sizeof(karere::UserAttrCache)];
+static const char gPrivKey[32] = {};
+
+//Exposes the send keys cache of ProtocolHandler
+class TestProtocolHandler: public ProtocolHandler
+{
+public:
+    enum { kCacheSize = kResidentKeysCacheSize };
+
+    TestProtocolHandler(SqliteDb& db)
+        : ProtocolHandler(kOwnHandle, StaticBuffer(gPrivKey, sizeof(gPrivKey)), StaticBuffer(gPrivKey, sizeof(gPrivKey)),
+                          *reinterpret_cast<karere::UserAttrCache*>(gNoUserAttrCache), db, kChatid,
+                          false, nullptr, 0, karere::Id::inval(), nullptr)
+    {}
+
+    using ProtocolHandler::getKey;
+    using ProtocolHandler::addDecryptedKey;
+
+    bool isResident(UserKeyId ukid) { return mKeys.find(ukid) != nullptr; }
+    size_t pendingCount() const { return mPendingKeys.size(); }
+
+    //As onKeyReceived() does while the key is decrypted asynchronously
+    void addPendingKey(UserKeyId ukid)
+    {
+        mPendingKeys[ukid].reset(new promise::Promise<std::shared_ptr<SendKey>>);
+    }
+};
+
+static std::shared_ptr<SendKey> makeKey(uint32_t keyid)
+{
+    auto key = std::make_shared<SendKey>();
+    memset(key->buf(), 0, key->dataSize());
+    memcpy(key->buf(), &keyid, sizeof(keyid));
+    return key;
+}
+
+static bool sameKey(const std::shared_ptr<SendKey>& a, const std::shared_ptr<SendKey>& b)
+{
+    return a && b && a->dataSize() == b->dataSize() && !memcmp(a->buf(), b->buf(), a->dataSize());
+}
+
+int main()
+{
+
+TestGroup("Send keys cache")
+{
+    syncTest("Evicted keys are faulted back in from the db")
+    {
+        SqliteDb db;
+        check(db.open(":memory:"));
+        db.simpleQuery(gDbSchema);
+        TestProtocolHandler handler(db);
+
+        //one more than fits, so the first one is evicted
+        for (uint32_t keyid = 0; keyid <= TestProtocolHandler::kCacheSize; keyid++)
+        {
+            handler.addDecryptedKey(UserKeyId(kSender, keyid), makeKey(keyid));
+        }
+        UserKeyId first(kSender, 0);
+        check(!handler.isResident(first));
+        check(handler.isResident(UserKeyId(kSender, TestProtocolHandler::kCacheSize)));
+
+        auto pms = handler.getKey(first);
+        check(pms.succeeded() && sameKey(pms.value(), makeKey(0)));
+        check(handler.isResident(first));
+
+        //faulting it in evicted the least recently used one
+        check(!handler.isResident(UserKeyId(kSender, 1)));
+        check(handler.getKey(UserKeyId(kSender, 1)).succeeded());
+
+        check(handler.getKey(UserKeyId(kSender, TestProtocolHandler::kCacheSize + 1)).failed());
+    });
+    syncTest("Evicted key received again resolves the pending fetch from the db")
+    {
+        SqliteDb db;
+        check(db.open(":memory:"));
+        db.simpleQuery(gDbSchema);
+        TestProtocolHandler handler(db);
+
+        for (uint32_t keyid = 0; keyid <= TestProtocolHandler::kCacheSize; keyid++)
+        {
+            handler.addDecryptedKey(UserKeyId(kSender, keyid), makeKey(keyid));
+        }
+        UserKeyId first(kSender, 0);
+        check(!handler.isResident(first));
+
+        //the key is received again, and its decryption is pending
+        handler.addPendingKey(first);
+        auto pms = handler.getKey(first);
+        check(!pms.done());
+
+        //once decrypted, the known key is loaded from the db and the fetch is resolved with it
+        handler.addDecryptedKey(first, makeKey(0));
+        check(pms.succeeded() && sameKey(pms.value(), makeKey(0)));
+        check(handler.isResident(first));
+        check(handler.pendingCount() == 0);
+
+        //a different key with the same id is rejected, even if the known one is not resident
+        for (uint32_t keyid = 1; keyid <= TestProtocolHandler::kCacheSize; keyid++)
+        {
+            handler.getKey(UserKeyId(kSender, keyid));
+        }
+        check(!handler.isResident(first));
+        bool thrown = false;
+        try
+        {
+            handler.addDecryptedKey(first, makeKey(1));
+        }
+        catch (std::runtime_error&)
+        {
+            thrown = true;
+        }
+        check(thrown);
+    });
+});
+
+return test::gNumFailed;
+}
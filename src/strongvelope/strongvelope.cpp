@@ -521,10 +521,9 @@ ProtocolHandler::ProtocolHandler(karere::Id ownHandle,
     int isUnifiedKeyEncrypted, karere::Id ph, void *ctx)
 : chatd::ICrypto(ctx), mOwnHandle(ownHandle), myPrivCu25519(privCu25519),
   myPrivEd25519(privEd25519), mUserAttrCache(userAttrCache),
-  mDb(db), chatid(aChatId), mPh(ph)
+  mDb(db), mKeys(kResidentKeysCacheSize), chatid(aChatId), mPh(ph)
 {
     getPubKeyFromPrivKey(myPrivEd25519, kKeyTypeEd25519, myPubEd25519);
-    loadKeysFromDb();
     loadUnconfirmedKeysFromDb();
 
     if (isPublic)
@@ -606,10 +605,8 @@ ProtocolHandler::reactionEncrypt(const Message &msg, const std::string &reaction
     }
     else
     {
-        UserKeyId ukid(msg.userid, msg.keyid);
-        auto it = mKeys.find(ukid);
-        assert(it != mKeys.end());
-        data = it->second.key;
+        data = findKey(UserKeyId(msg.userid, msg.keyid));
+        assert(data);
     }
 
     // Inside this function str_to_a32 and a32_to_str calls must be done with type <T> = <uint32_t>
@@ -662,7 +659,8 @@ ProtocolHandler::reactionDecrypt(const karere::Id &msgid, const karere::Id &user
     }
 
     auto wptr = weakHandle();
-    return symPms.then([wptr, &msgid, &reaction](const std::shared_ptr<SendKey>& data)
+    // msgid and reaction are captured by value: the key may arrive after the caller has returned
+    return symPms.then([wptr, msgid, reaction](const std::shared_ptr<SendKey>& data)
     {
         wptr.throwIfDeleted();
 
@@ -702,31 +700,40 @@ ProtocolHandler::reactionDecrypt(const karere::Id &msgid, const karere::Id &user
     });
 }
 
+ProtocolHandler::~ProtocolHandler()
+{
+    // defined here, where SqliteStmt is complete
+}
+
 unsigned int ProtocolHandler::getCacheVersion() const
 {
     return mCacheVersion;
 }
 
-void ProtocolHandler::loadKeysFromDb()
+std::shared_ptr<SendKey> ProtocolHandler::findKey(UserKeyId ukid)
 {
-    SqliteStmt stmt(mDb, "select userid, keyid, key from sendkeys where chatid=?");
-    stmt << chatid;
-    while(stmt.step())
+    std::shared_ptr<SendKey>* resident = mKeys.find(ukid);
+    if (resident)
     {
-        auto key = std::make_shared<SendKey>();
-        stmt.blobCol(2, *key);
-        Id userid(stmt.uint64Col(0));
-        uint32_t keyid = stmt.uintCol(1);
+        return *resident;
+    }
 
-#ifndef NDEBUG
-        auto ret =
-#endif
-        mKeys.emplace(std::piecewise_construct,
-            std::forward_as_tuple(userid, keyid),
-            std::forward_as_tuple(key));
-        assert(ret.second);
+    if (!mStmtFindKey)
+    {
+        mStmtFindKey.reset(new SqliteStmt(mDb, "select key from sendkeys where chatid=? and userid=? and keyid=?"));
+    }
+    SqliteStmt& stmt = *mStmtFindKey;
+    stmt.reset().clearBind();
+    stmt << chatid << ukid.user << ukid.keyid;
+    std::shared_ptr<SendKey> key;
+    if (stmt.step())
+    {
+        key = std::make_shared<SendKey>();
+        stmt.blobCol(0, *key);
+        mKeys.put(ukid, key);
     }
-    STRONGVELOPE_LOG_DEBUG("(%" PRId64 "): Loaded %zu send keys from database", chatid, mKeys.size());
+    stmt.reset();   // don't keep the read open until the next lookup
+    return key;
 }
 
 void ProtocolHandler::loadUnconfirmedKeysFromDb()
@@ -1245,8 +1252,8 @@ void ProtocolHandler::onKeyReceived(KeyId keyid, Id sender, Id receiver,
     }
 
     // check if key is already being decrypted (received twice)
-    auto& entry = mKeys[ukid];
-    if (entry.pms)
+    auto& pending = mPendingKeys[ukid];
+    if (pending)
     {
         STRONGVELOPE_LOG_WARNING("Key %u from user %s is already being decrypted", keyid, sender.toString().c_str());
         return;
@@ -1255,12 +1262,12 @@ void ProtocolHandler::onKeyReceived(KeyId keyid, Id sender, Id receiver,
     // if it was not being decrypted yet, associate a promise
     STRONGVELOPE_LOG_DEBUG("onKeyReceived: Created a key entry with promise for key %u of user %s", keyid, sender.toString().c_str());
     auto wptr = weakHandle();
-    entry.pms.reset(new Promise<std::shared_ptr<SendKey>>);
+    pending.reset(new Promise<std::shared_ptr<SendKey>>);
     pms.then([this, wptr, ukid](const std::shared_ptr<SendKey>& key)
     {
         wptr.throwIfDeleted();
-        //addDecryptedKey will remove entry.pms, but anyone that has already
-        //attached to it will be notified first
+        //addDecryptedKey will remove the pending entry, but anyone that has
+        //already attached to its promise will be notified
         addDecryptedKey(ukid, key);
     });
     pms.fail([this, wptr, ukid](const ::promise::Error& err)
@@ -1268,11 +1275,11 @@ void ProtocolHandler::onKeyReceived(KeyId keyid, Id sender, Id receiver,
         wptr.throwIfDeleted();
         STRONGVELOPE_LOG_ERROR("Removing key entry for key %u - decryptKey() failed with error '%s'", ukid.keyid, err.what());
 
-        auto it = mKeys.find(ukid);
-        assert(it != mKeys.end());
-        assert(it->second.pms);
-        it->second.pms->reject(err);
-        mKeys.erase(it);
+        auto it = mPendingKeys.find(ukid);
+        assert(it != mPendingKeys.end());
+        auto pendingPms = it->second;
+        mPendingKeys.erase(it);
+        pendingPms->reject(err);
         return err;
     });
 }
@@ -1282,17 +1289,18 @@ void ProtocolHandler::addDecryptedKey(UserKeyId ukid, const std::shared_ptr<Send
     assert(key->dataSize() == SVCRYPTO_KEY_SIZE);
     STRONGVELOPE_LOG_DEBUG("Adding key %u of user %s", ukid.keyid, ukid.user.toString().c_str());
 
-    auto& entry = mKeys[ukid];
-    if (entry.key)  // if KeyEntry already had a decrypted key assigned to it...
+    std::shared_ptr<SendKey> knownKey = findKey(ukid);
+    if (knownKey)  // if the key was already decrypted...
     {
-        if (memcmp(entry.key->buf(), key->buf(), SVCRYPTO_KEY_SIZE))
+        if (memcmp(knownKey->buf(), key->buf(), SVCRYPTO_KEY_SIZE))
             throw std::runtime_error("addDecryptedKey: Key with id "+std::to_string(ukid.keyid)+" from user '"+ukid.user.toString()+"' already known but different");
 
         STRONGVELOPE_LOG_DEBUG("addDecryptedKey: Key %u from user %s already known and is same", ukid.keyid, ukid.user.toString().c_str());
     }
     else    // new key was confirmed or received key wast not decrypted yet...
     {
-        entry.key = key;
+        knownKey = key;
+        mKeys.put(ukid, key);
         try
         {
             mDb.query("insert or ignore into sendkeys(chatid, userid, keyid, key, ts) values(?,?,?,?,?)",
@@ -1306,36 +1314,38 @@ void ProtocolHandler::addDecryptedKey(UserKeyId ukid, const std::shared_ptr<Send
     }
 
     // finally, notify anyone waiting for decryption of the received key (if decryption was asynchronous)
-    if (entry.pms)
+    auto it = mPendingKeys.find(ukid);
+    if (it != mPendingKeys.end())
     {
-        entry.pms->resolve(entry.key);
-        entry.pms.reset();
+        auto pendingPms = it->second;
+        mPendingKeys.erase(it);
+        pendingPms->resolve(knownKey);
     }
 }
 promise::Promise<std::shared_ptr<SendKey>>
 ProtocolHandler::getKey(UserKeyId ukid)
 {
-    auto kit = mKeys.find(ukid);
-    if (kit == mKeys.end())
+    std::shared_ptr<SendKey>* resident = mKeys.find(ukid);
+    if (resident)  // key is available
     {
-        return ::promise::Error("Key with id "+std::to_string(ukid.keyid)+
-        " from user "+ukid.user.toString()+" not found", EINVAL, SVCRYPTO_ENOKEY);
+        return *resident;
     }
 
-    auto& entry = kit->second;
-    if (entry.key)  // key is available
-    {
-        return entry.key;
-    }
-    else if (entry.pms) // key is being decrypted
+    // check the keys being decrypted before the db, which doesn't have them yet
+    auto it = mPendingKeys.find(ukid);
+    if (it != mPendingKeys.end()) // key is being decrypted
     {
-        return (*entry.pms);
+        return *it->second;
     }
-    else
+
+    std::shared_ptr<SendKey> key = findKey(ukid);
+    if (key)
     {
-        assert(false && "Key found but no promise not key member are set");
-        return std::shared_ptr<SendKey>(); //return something, just to mute the gcc warning
+        return key;
     }
+
+    return ::promise::Error("Key with id "+std::to_string(ukid.keyid)+
+        " from user "+ukid.user.toString()+" not found", EINVAL, SVCRYPTO_ENOKEY);
 }
 
 void ProtocolHandler::onKeyConfirmed(KeyId localkeyid, KeyId keyid)
@@ -1352,9 +1362,9 @@ void ProtocolHandler::onKeyConfirmed(KeyId localkeyid, KeyId keyid)
     UserKeyId userKeyId(mOwnHandle, keyid);
     std::shared_ptr<SendKey> confirmedKey = entry.key;
     assert(entry.localKeyid == localkeyid);
-    assert(mKeys.find(userKeyId) == mKeys.end());
+    assert(!findKey(userKeyId));
 
-    // add confirmed key to mKeys
+    // add confirmed key to the known keys
     addDecryptedKey(userKeyId, confirmedKey);
 
     // check if confirmed key is the currentKey
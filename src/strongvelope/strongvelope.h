@@ -20,6 +20,7 @@
 #include <logger.h>
 #include <karereCommon.h>
 #include <base/trackDelete.h>
+#include <base/lruCache.h>
 
 #define STRONGVELOPE_LOG_DEBUG(fmtString,...) KARERE_LOG_DEBUG(krLogChannel_strongvelope, "%s: " fmtString, chatid.toString().c_str(), ##__VA_ARGS__)
 #define STRONGVELOPE_LOG_WARNING(fmtString,...) KARERE_LOG_WARNING(krLogChannel_strongvelope, "%s: " fmtString, chatid.toString().c_str(), ##__VA_ARGS__)
@@ -46,6 +47,7 @@ namespace karere
     class UserAttrCache;
 }
 class SqliteDb;
+class SqliteStmt;
 
 namespace strongvelope
 {
@@ -206,7 +208,8 @@ enum
 enum
 {
     CHAT_MODE_PRIVATE = 0,
-    CHAT_MODE_PUBLIC = 1
+    CHAT_MODE_PUBLIC = 1,
+    CHAT_MODE_PREVIEW = 2   // public chat in preview mode, only stored in the column 'mode' of the table 'chats'
 };
 
 enum
@@ -243,6 +246,18 @@ struct UserKeyId
         else
             return keyid < other.keyid;
     }
+    bool operator==(UserKeyId other) const
+    {
+        return user == other.user && keyid == other.keyid;
+    }
+};
+
+struct UserKeyIdHash
+{
+    size_t operator()(UserKeyId ukid) const
+    {
+        return std::hash<uint64_t>()(ukid.user.val) ^ (static_cast<size_t>(ukid.keyid) << 1);
+    }
 };
 
 class TlvWriter;
@@ -256,22 +271,6 @@ void deriveSharedKey(const StaticBuffer& sharedSecret, SendKey& output, const st
 class ProtocolHandler: public chatd::ICrypto, public karere::DeleteTrackable
 {
 protected:
-    /**
-     * @brief The KeyEntry struct represents a Key in the map of keys (mKeys)
-     * If the received key is still encrypted (because the required public key
-     * has to be fetched from API), then a promise will be attached to this KeyEntry.key
-     * Such promise will be resolved once the key is successfully decrypted.
-     * If decryption fails, then the promise will be rejected.
-     * For new keys getting confirmed, the promise is never used.
-     */
-    struct KeyEntry
-    {
-        std::shared_ptr<SendKey> key;
-        std::shared_ptr<promise::Promise<std::shared_ptr<SendKey>>> pms;
-        KeyEntry(){}
-        KeyEntry(const std::shared_ptr<SendKey>& aKey): key(aKey){}
-    };
-
     // own keys
     karere::Id mOwnHandle;
     EcKey myPrivCu25519;
@@ -303,8 +302,23 @@ protected:
     // in-fligth new-keys
     std::vector<NewKeyEntry> mUnconfirmedKeys;
 
-    // received and confirmed keys (doesn't include unconfirmed keys)
-    std::map<UserKeyId, KeyEntry> mKeys;
+    /**
+     * Received and confirmed keys (doesn't include unconfirmed keys) are stored in the
+     * `sendkeys` table and loaded on demand by findKey(). Only the most recently used
+     * ones are kept in memory, so the cost of a chat doesn't grow with its key history
+     */
+    enum { kResidentKeysCacheSize = 128 };
+    karere::LruCache<UserKeyId, std::shared_ptr<SendKey>, UserKeyIdHash> mKeys;
+
+    // statement of findKey(), prepared on the first cache miss and reused for the next ones
+    std::unique_ptr<SqliteStmt> mStmtFindKey;
+
+    /**
+     * Received keys that are still encrypted, because the public key of the sender
+     * has to be fetched from API. The promise is resolved once the key is decrypted
+     * and rejected if decryption fails
+     */
+    std::map<UserKeyId, std::shared_ptr<promise::Promise<std::shared_ptr<SendKey>>>> mPendingKeys;
 
     // cache of symmetric keys (pubCu255 * privCu255)
     std::map<karere::Id, std::shared_ptr<SendKey>> mSymmKeyCache;
@@ -328,6 +342,7 @@ public:
         karere::UserAttrCache& userAttrCache,
         SqliteDb& db, karere::Id aChatId, bool isPublic, std::shared_ptr<std::string> unifiedKey,
         int isUnifiedKeyEncrypted, karere::Id ph, void *ctx);
+    ~ProtocolHandler();
 
     promise::Promise<std::shared_ptr<SendKey>> //must be public to access from ParsedMessage
         decryptKey(std::shared_ptr<Buffer>& key, karere::Id sender, karere::Id receiver);
@@ -335,7 +350,11 @@ public:
     unsigned int getCacheVersion() const;
 
 protected:
-    void loadKeysFromDb();
+    /**
+     * @brief Returns the decrypted key, loading it from the cache if it's not
+     * resident in memory, or nullptr if the key is unknown
+     */
+    std::shared_ptr<SendKey> findKey(UserKeyId ukid);
 
     /**
      * @brief Load unconfirmed keys stored in cache
@@ -78,14 +78,14 @@ public:
         return true;
 }
 };
-class TlvWriter: public Buffer
+class TlvWriter: public SmallBuffer<128>
 {
 protected:
 #ifndef NDEBUG
     bool mEnded = false;
 #endif
 public:
-    explicit TlvWriter(size_t reserve=128): Buffer(reserve){}
+    explicit TlvWriter(size_t reserve=128): SmallBuffer(reserve){}
 
 /**
  * Generates a binary encoded TLV record from a key-value pair.
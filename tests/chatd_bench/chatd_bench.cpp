@@ -0,0 +1,501 @@
+/**
+ * Protocol benchmark for the chatd connections.
+ *
+ * An in-process fake server (see fakeServer.h) generates the configured chats and
+ * histories, and every device is a real karere::Client, with its chatd::Client, that
+ * connects to it through karere's websockets layer (LibwebsocketsIO on a libuv loop,
+ * as in the app). No accounts or live shards are needed, so runs can be compared before
+ * and after a change in the networking or the protocol handling.
+ *
+ * The clients are anonymous, with a scratch database per device in the working directory,
+ * and the crypto is stubbed (see fakeKarere.h): messages are sent and stored with their
+ * plain text as payload. So this measures the transport, the framing, the protocol
+ * handling, the history and the database, but not the crypto. Presenced is not covered,
+ * since anonymous clients don't connect to it.
+ *
+ * It reports:
+ *  - Cold sync time: from connect until all the chats are logged in, on every device
+ *  - Delivery latency percentiles of the messages sent by the first device: until
+ *    NEWMSGID is received by the sender, and until NEWMSG is received by the others
+ *  - Delivery latency percentiles of the messages injected by the server (churn)
+ *  - Resync time of a reconnection with JOINRANGEHIST, after missing the churn
+ *  - Bytes on the wire and the server's counters
+ *
+ * Usage: chatd_bench [chats] [messagesPerChat] [devices] [seconds] [msgsPerSec]
+ *                    [churnMsgsPerSec] [churnSeenPerSec] [deflate] [workDir]
+ */
+
+#include "fakeServer.h"
+#include "fakeKarere.h"
+#include <chatClient.h>
+#include <chatd.h>
+#include <chatdDb.h>
+#include <chatdICrypto.h>
+#include <megaapi.h>
+#include <waiter/libuvWaiter.h>
+#include <net/libwebsocketsIO.h>
+#include <base/timers.hpp>
+#include <logger.h>
+#include <gcm.h>
+#include <uv.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace karere;
+
+static const int kShard = 0;
+
+static double msSince(int64_t startNs, int64_t endNs = fakechatd::nowNs())
+{
+    return (endNs - startNs) / 1e6;
+}
+
+/** Marshalled calls are run by the libuv loop of the benchmark, as in the app */
+class UvMessageQueue: public test::MessageQueue
+{
+public:
+    explicit UvMessageQueue(uv_loop_t* loop)
+    {
+        mAsync.data = this;
+        uv_async_init(loop, &mAsync, [](uv_async_t* handle)
+        {
+            static_cast<UvMessageQueue*>(handle->data)->processAll();
+        });
+    }
+
+    void close()
+    {
+        uv_close((uv_handle_t*)&mAsync, nullptr);
+    }
+
+protected:
+    uv_async_t mAsync;
+
+    void wakeup() override
+    {
+        uv_async_send(&mAsync);
+    }
+};
+
+/** Runs the loop until \c done returns true or \c timeoutMs elapse. Returns the last value of \c done */
+static bool runUntil(uv_loop_t* loop, const std::function<bool()>& done, int timeoutMs)
+{
+    uv_timer_t wakeup;
+    uv_timer_init(loop, &wakeup);
+    uv_timer_start(&wakeup, [](uv_timer_t*) {}, 5, 5);
+    int64_t deadline = fakechatd::nowNs() + (int64_t)timeoutMs * 1000000;
+    bool result;
+    while (!(result = done()) && fakechatd::nowNs() < deadline)
+    {
+        uv_run(loop, UV_RUN_ONCE);
+    }
+    uv_timer_stop(&wakeup);
+    uv_close((uv_handle_t*)&wakeup, nullptr);
+    uv_run(loop, UV_RUN_NOWAIT);
+    return result;
+}
+
+class Latencies
+{
+public:
+    void add(double ms) { mSamples.push_back(ms); }
+    void print(const char* name)
+    {
+        if (mSamples.empty())
+        {
+            printf("    %s: no samples\n", name);
+            return;
+        }
+        std::sort(mSamples.begin(), mSamples.end());
+        printf("    %s: %zu samples, p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+               name, mSamples.size(), percentile(0.5), percentile(0.9), percentile(0.99), mSamples.back());
+    }
+
+protected:
+    std::vector<double> mSamples;
+    double percentile(double p) const
+    {
+        size_t index = std::min(mSamples.size() - 1, (size_t)(p * mSamples.size()));
+        return mSamples[index];
+    }
+};
+
+struct Results
+{
+    Latencies confirmed;    // NEWMSG -> NEWMSGID, on the sender
+    Latencies delivered;    // NEWMSG -> NEWMSG, on the other devices
+    Latencies churn;        // creation in the server -> NEWMSG, on all the devices
+};
+
+class Device;
+
+/** Listener of a chat of a device, which reports the logins and the messages to it */
+class ChatListener: public chatd::Listener
+{
+public:
+    ChatListener(Device& device): mDevice(device) {}
+
+    void init(chatd::Chat& chat, chatd::DbInterface*& dbIntf) override;
+    void onOnlineStateChange(chatd::ChatState state) override;
+    void onRecvNewMessage(chatd::Idx, chatd::Message& msg, chatd::Message::Status) override;
+    void onRecvHistoryMessage(chatd::Idx, chatd::Message&, chatd::Message::Status, bool isLocal) override;
+    void onMessageConfirmed(Id, const chatd::Message& msg, chatd::Idx, bool) override;
+
+protected:
+    Device& mDevice;
+    bool mOnline = false;
+};
+
+class Device
+{
+public:
+    Device(mega::MegaApi& api, WebsocketsIO& io, UvMessageQueue& queue, const fakechatd::Server& server,
+           const std::string& dir, Results& results)
+        : mServer(server), mResults(results), mClient(api, &io, mApp, dir, 0, &queue)
+    {}
+
+    bool init(const std::string& url)
+    {
+        if (mClient.initWithAnonymousSession() != Client::kInitAnonymousMode)
+        {
+            return false;
+        }
+
+        mClient.mDnsCache.addRecord(kShard, url);
+        for (unsigned i = 0; i < mServer.config().numChats; i++)
+        {
+            Id chatid = mServer.chatId(i);
+            mClient.db.query("insert or replace into chats(chatid, shard, own_priv) values(?,?,?)",
+                             chatid, kShard, chatd::PRIV_FULL);
+            mListeners.emplace_back(new ChatListener(*this));
+            chatd::Chat& chat = mClient.mChatdClient->createChat(chatid, kShard, mListeners.back().get(),
+                                                                 SetOfIds(), new test::PlaintextCrypto(mClient), 0, true);
+            // the whole history is fetched by the cold sync
+            chat.initialHistoryFetchCount = mServer.config().messagesPerChat;
+            mChats.push_back(&chat);
+        }
+        return true;
+    }
+
+    void connect()
+    {
+        startSync();
+        mClient.connect();
+        for (chatd::Chat* chat: mChats)
+        {
+            chat->connect();
+        }
+    }
+
+    void disconnect()
+    {
+        mClient.mChatdClient->disconnect();
+    }
+
+    void reconnect()
+    {
+        startSync();
+        mClient.mChatdClient->retryPendingConnections(true);
+    }
+
+    void terminate()
+    {
+        mClient.terminate(true);
+    }
+
+    void sendMessage(unsigned chatIndex)
+    {
+        std::string payload = mServer.makePayload();
+        if (mChats[chatIndex]->msgSubmit(payload.data(), payload.size(), chatd::Message::kMsgNormal, nullptr))
+        {
+            mPendingConfirmations++;
+        }
+    }
+
+    bool synced() const { return mSyncedNs != 0; }
+    double syncMs() const { return msSince(mConnectStartNs, mSyncedNs); }
+    size_t messagesSynced() const { return mMessagesSynced; }
+    size_t pendingConfirmations() const { return mPendingConfirmations; }
+    WebsocketsTraffic traffic() const
+    {
+        return mChats.empty() ? WebsocketsTraffic() : mChats.front()->connection().wsTraffic();
+    }
+    SqliteDb& db() { return mClient.db; }
+
+    void onChatOnline(bool online)
+    {
+        mChatsOnline += online ? 1 : -1;
+        if (online && mChatsOnline == mChats.size() && !mSyncedNs)
+        {
+            mSyncedNs = fakechatd::nowNs();
+        }
+    }
+
+    void onMessage(const chatd::Message& msg, bool synced)
+    {
+        if (synced)
+        {
+            mMessagesSynced++;
+            return;
+        }
+
+        if (msg.dataSize() < sizeof(int64_t))
+        {
+            return;
+        }
+        double ms = msSince(msg.read<int64_t>(0));
+        if (msg.userid == fakechatd::Server::kMyHandle)
+        {
+            mResults.delivered.add(ms);
+        }
+        else
+        {
+            mResults.churn.add(ms);
+        }
+    }
+
+    void onConfirmed(const chatd::Message& msg)
+    {
+        if (mPendingConfirmations && msg.dataSize() >= sizeof(int64_t))
+        {
+            mPendingConfirmations--;
+            mResults.confirmed.add(msSince(msg.read<int64_t>(0)));
+        }
+    }
+
+protected:
+    const fakechatd::Server& mServer;
+    Results& mResults;
+    test::FakeApp mApp;
+    // declared before the client, so that they outlive its chats
+    std::vector<std::unique_ptr<ChatListener>> mListeners;
+    Client mClient;
+    std::vector<chatd::Chat*> mChats;
+    size_t mChatsOnline = 0;
+    size_t mMessagesSynced = 0;
+    size_t mPendingConfirmations = 0;
+    int64_t mConnectStartNs = 0;
+    int64_t mSyncedNs = 0;
+
+    void startSync()
+    {
+        mConnectStartNs = fakechatd::nowNs();
+        mSyncedNs = 0;
+        mMessagesSynced = 0;
+    }
+};
+
+void ChatListener::init(chatd::Chat& chat, chatd::DbInterface*& dbIntf)
+{
+    dbIntf = new ChatdSqliteDb(chat, mDevice.db());
+}
+
+void ChatListener::onOnlineStateChange(chatd::ChatState state)
+{
+    bool online = (state == chatd::kChatStateOnline);
+    if (online != mOnline)
+    {
+        mOnline = online;
+        mDevice.onChatOnline(online);
+    }
+}
+
+void ChatListener::onRecvNewMessage(chatd::Idx, chatd::Message& msg, chatd::Message::Status)
+{
+    // the NEWMSGs received while joining are the ones missed while offline
+    mDevice.onMessage(msg, !mOnline);
+}
+
+void ChatListener::onRecvHistoryMessage(chatd::Idx, chatd::Message& msg, chatd::Message::Status, bool isLocal)
+{
+    if (!isLocal)
+    {
+        mDevice.onMessage(msg, true);
+    }
+}
+
+void ChatListener::onMessageConfirmed(Id, const chatd::Message& msg, chatd::Idx, bool)
+{
+    mDevice.onConfirmed(msg);
+}
+
+int main(int argc, char** argv)
+{
+    fakechatd::Config config;
+    config.numChats = (argc > 1) ? atoi(argv[1]) : 100;
+    config.messagesPerChat = (argc > 2) ? atoi(argv[2]) : 32;
+    unsigned numDevices = std::max((argc > 3) ? atoi(argv[3]) : 2, 1);
+    int seconds = (argc > 4) ? atoi(argv[4]) : 10;
+    double msgsPerSec = (argc > 5) ? atof(argv[5]) : 20;
+    config.churnMessagesPerSec = (argc > 6) ? atof(argv[6]) : 50;
+    config.churnSeenPerSec = (argc > 7) ? atof(argv[7]) : 20;
+    config.deflate = (argc > 8) && atoi(argv[8]);
+    std::string workDir = (argc > 9) ? argv[9] : ".";
+    if (!config.numChats)
+    {
+        printf("At least one chat is needed\n");
+        return 1;
+    }
+
+    // the debug logs of every frame would dominate the measurements
+    krLoggerChannels[krLogChannel_websockets].logLevel = krLogLevelWarn;
+    krLoggerChannels[krLogChannel_chatd].logLevel = krLogLevelWarn;
+    krLoggerChannels[krLogChannel_default].logLevel = krLogLevelWarn;
+
+    fakechatd::Server server(config);
+    if (!server.start())
+    {
+        printf("Can't listen on port %d\n", config.port);
+        return 1;
+    }
+    std::string url = "http://127.0.0.1:" + std::to_string(config.port) + "/chatd";
+
+    int result = 0;
+    globalInit(test::MessageQueue::post);
+    {
+        mega::MegaApi api("chatd_bench", workDir.c_str(), "chatd_bench");
+        mega::LibuvWaiter waiter;
+        uv_loop_t* loop = waiter.eventloop;
+        UvMessageQueue queue(loop);
+        setTimersLoop(&queue, loop);
+        WebsocketsIO::Mutex mutex;
+        LibwebsocketsIO io(mutex, &waiter, &api, &queue);
+        io.setCompression(config.deflate);
+
+        Results results;
+        std::vector<std::unique_ptr<Device>> devices;
+        for (unsigned i = 0; i < numDevices && !result; i++)
+        {
+            std::string dir = workDir + "/device" + std::to_string(i);
+            mkdir(dir.c_str(), 0700);
+            devices.emplace_back(new Device(api, io, queue, server, dir, results));
+            if (!devices.back()->init(url))
+            {
+                printf("Can't create the scratch database in %s\n", dir.c_str());
+                result = 1;
+            }
+        }
+
+        if (!result)
+        {
+            // cold sync: all the devices at once, like the app at startup with a new session
+            printf("Cold sync of %u chats with %u messages each, %u devices%s\n", config.numChats,
+                   config.messagesPerChat, numDevices, config.deflate ? ", permessage-deflate" : "");
+            for (auto& device: devices)
+            {
+                device->connect();
+            }
+            bool synced = runUntil(loop, [&]()
+            {
+                bool done = true;
+                for (auto& device: devices)
+                {
+                    done = done && device->synced();
+                }
+                return done;
+            }, 60000);
+
+            for (unsigned i = 0; i < numDevices; i++)
+            {
+                Device& device = *devices[i];
+                if (device.synced())
+                {
+                    printf("    device %u: %.1f ms, %zu messages, %.0f messages/s\n", i, device.syncMs(),
+                           device.messagesSynced(), device.messagesSynced() * 1000 / std::max(device.syncMs(), 0.001));
+                }
+                else
+                {
+                    printf("    device %u: not synced\n", i);
+                }
+            }
+
+            if (!synced)
+            {
+                result = 1;
+            }
+        }
+
+        if (!result)
+        {
+            // steady state: the first device sends, while the server injects the churn
+            printf("Steady state for %d s: %.0f messages/s sent, %.0f messages/s and %.0f SEEN/s of churn\n",
+                   seconds, msgsPerSec, config.churnMessagesPerSec, config.churnSeenPerSec);
+            uint64_t churnStart = server.stats().churnMessages;
+            int64_t startNs = fakechatd::nowNs();
+            int64_t intervalNs = (msgsPerSec > 0) ? (int64_t)(1e9 / msgsPerSec) : 0;
+            unsigned sent = 0;
+            runUntil(loop, [&]()
+            {
+                while (intervalNs && startNs + sent * intervalNs <= fakechatd::nowNs())
+                {
+                    devices[0]->sendMessage(sent++ % config.numChats);
+                }
+                return false;
+            }, seconds * 1000);
+            runUntil(loop, [&]() { return !devices[0]->pendingConfirmations(); }, 5000);
+
+            printf("    %u messages sent, %llu messages of churn\n", sent,
+                   (unsigned long long)(server.stats().churnMessages - churnStart));
+            results.confirmed.print("NEWMSG -> NEWMSGID");
+            if (numDevices > 1)
+            {
+                results.delivered.print("NEWMSG -> other devices");
+            }
+            results.churn.print("churn -> all devices");
+
+            // resync: the last device misses some churn, then reconnects with JOINRANGEHIST
+            Device& last = *devices.back();
+            last.disconnect();
+            runUntil(loop, [&]() { return false; }, 1000);
+            last.reconnect();
+            if (runUntil(loop, [&]() { return last.synced(); }, 30000))
+            {
+                printf("Resync after 1 s offline: %.1f ms, %zu messages\n", last.syncMs(), last.messagesSynced());
+            }
+            else
+            {
+                printf("Resync failed\n");
+                result = 1;
+            }
+        }
+
+        uint64_t wireRx = 0;
+        uint64_t wireTx = 0;
+        uint64_t rx = 0;
+        for (auto& device: devices)
+        {
+            WebsocketsTraffic traffic = device->traffic();
+            rx += traffic.rx;
+            wireRx += traffic.wireRx;
+            wireTx += traffic.wireTx;
+        }
+        printf("Traffic of the chatd connections: %llu bytes received, %llu on the wire; %llu bytes sent on the wire\n",
+               (unsigned long long)rx, (unsigned long long)wireRx, (unsigned long long)wireTx);
+
+        const fakechatd::Stats& stats = server.stats();
+        printf("Server: %llu connections, %llu commands in, %llu commands out, %llu bytes in, %llu bytes out\n",
+               (unsigned long long)stats.connections, (unsigned long long)stats.commandsIn,
+               (unsigned long long)stats.commandsOut, (unsigned long long)stats.bytesIn,
+               (unsigned long long)stats.bytesOut);
+
+        for (auto& device: devices)
+        {
+            device->terminate();
+        }
+        runUntil(loop, [&]() { return false; }, 100);
+        devices.clear();
+        queue.processAll();
+        setTimersLoop(&queue, nullptr);
+        queue.close();
+        uv_run(loop, UV_RUN_NOWAIT);
+    }
+    globalCleanup();
+    server.stop();
+    return result;
+}
@@ -0,0 +1,584 @@
+#include "fakeServer.h"
+#include <libwebsockets.h>
+#include <chatdMsg.h>
+#include <presenced.h>
+#include <string.h>
+#include <stdio.h>
+
+using namespace karere;
+
+namespace fakechatd
+{
+static int callback(struct lws* wsi, enum lws_callback_reasons reason, void* user, void* in, size_t len)
+{
+    return Server::wsCallback(wsi, reason, user, in, len);
+}
+
+static struct lws_protocols protocols[] =
+{
+    { "MEGAchat", callback, 0, 128 * 1024 },
+    { NULL, NULL, 0, 0 }
+};
+
+static const struct lws_extension extensions[] =
+{
+    { "permessage-deflate", lws_extension_callback_pm_deflate, "permessage-deflate" },
+    { NULL, NULL, NULL }
+};
+
+const uint64_t Server::kMyHandle;
+
+Server::Server(const Config& config)
+: mConfig(config)
+{
+    generateHistory();
+}
+
+Server::~Server()
+{
+    stop();
+}
+
+unsigned Server::random(unsigned range)
+{
+    //xorshift64, deterministic so that runs can be compared
+    mRandom ^= mRandom << 13;
+    mRandom ^= mRandom >> 7;
+    mRandom ^= mRandom << 17;
+    return range ? (unsigned)(mRandom % range) : 0;
+}
+
+std::string Server::makePayload() const
+{
+    std::string payload(std::max<size_t>(mConfig.messageSize, sizeof(int64_t)), '\0');
+    int64_t ts = nowNs();
+    memcpy(&payload[0], &ts, sizeof(ts));
+    for (size_t i = sizeof(ts); i < payload.size(); i++)
+    {
+        payload[i] = (char)(i * 31 + ts);   //incompressible enough, like an encrypted message
+    }
+    return payload;
+}
+
+void Server::generateHistory()
+{
+    mChats.resize(mConfig.numChats);
+    uint32_t now = (uint32_t)time(NULL);
+    for (unsigned i = 0; i < mConfig.numChats; i++)
+    {
+        Chat& chat = mChats[i];
+        chat.id = 0x4348415400000000ULL + i;
+        mChatIndex[chat.id] = i;
+        chat.users.push_back(kMyHandle);
+        for (unsigned j = 1; j < std::max(2u, mConfig.participantsPerChat); j++)
+        {
+            chat.users.push_back(0x5045455200000000ULL + j);
+        }
+        chat.history.reserve(mConfig.messagesPerChat);
+        for (unsigned j = 0; j < mConfig.messagesPerChat; j++)
+        {
+            Msg& msg = addMessage(chat, chat.users[random(chat.users.size())], makePayload());
+            msg.ts = now - (mConfig.messagesPerChat - j) * 60;
+        }
+        if (!chat.history.empty())
+        {
+            chat.lastSeen = chat.history[chat.history.size() / 2].msgid;
+        }
+    }
+}
+
+Server::Msg& Server::addMessage(Chat& chat, Id userid, std::string&& payload)
+{
+    chat.index[mNextMsgid] = chat.history.size();
+    chat.history.emplace_back();
+    Msg& msg = chat.history.back();
+    msg.msgid = mNextMsgid++;
+    msg.userid = userid;
+    msg.ts = (uint32_t)time(NULL);
+    msg.payload = std::move(payload);
+    return msg;
+}
+
+bool Server::start()
+{
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    info.port = mConfig.port;
+    info.protocols = protocols;
+    info.gid = -1;
+    info.uid = -1;
+    info.user = this;
+    if (mConfig.deflate)
+    {
+        info.extensions = extensions;
+    }
+
+    lws_set_log_level(LLL_ERR | LLL_WARN, NULL);
+    mContext = lws_create_context(&info);
+    if (!mContext)
+    {
+        return false;
+    }
+
+    mStopping = false;
+    mLastChurnNs = nowNs();
+    mThread = std::thread([this]() { run(); });
+    return true;
+}
+
+void Server::stop()
+{
+    if (!mContext)
+    {
+        return;
+    }
+
+    mStopping = true;
+    lws_cancel_service(mContext);
+    mThread.join();
+    lws_context_destroy(mContext);
+    mContext = nullptr;
+    mSessions.clear();
+    for (Chat& chat: mChats)
+    {
+        chat.sessions.clear();
+    }
+}
+
+void Server::run()
+{
+    while (!mStopping)
+    {
+        lws_service(mContext, 5);
+        churn();
+    }
+}
+
+void Server::churn()
+{
+    int64_t now = nowNs();
+    double elapsed = (now - mLastChurnNs) / 1e9;
+    mLastChurnNs = now;
+    if (mChats.empty())
+    {
+        return;
+    }
+
+    mChurnMessageCredit += mConfig.churnMessagesPerSec * elapsed;
+    mChurnSeenCredit += mConfig.churnSeenPerSec * elapsed;
+    std::set<Session*> touched;
+    for (; mChurnMessageCredit >= 1; mChurnMessageCredit--)
+    {
+        Chat& chat = mChats[random(mChats.size())];
+        Id userid = chat.users[1 + random(chat.users.size() - 1)];
+        Msg& msg = addMessage(chat, userid, makePayload());
+        for (Session* session: chat.sessions)
+        {
+            queueMsg(*session, chatd::OP_NEWMSG, chat.id, msg);
+            touched.insert(session);
+        }
+        mStats.churnMessages++;
+    }
+    for (; mChurnSeenCredit >= 1; mChurnSeenCredit--)
+    {
+        Chat& chat = mChats[random(mChats.size())];
+        if (chat.history.empty())
+        {
+            continue;
+        }
+        chat.lastSeen = chat.history.back().msgid;
+        for (Session* session: chat.sessions)
+        {
+            queue(*session, chatd::Command(chatd::OP_SEEN) + chat.id + chat.lastSeen);
+            touched.insert(session);
+        }
+        mStats.churnSeen++;
+    }
+    for (Session* session: touched)
+    {
+        flush(*session);
+    }
+}
+
+int Server::wsCallback(struct lws* wsi, int reason, void* /*user*/, void* in, size_t len)
+{
+    Server* self = static_cast<Server*>(lws_context_user(lws_get_context(wsi)));
+    switch (reason)
+    {
+        case LWS_CALLBACK_ESTABLISHED:
+        {
+            char uri[256];
+            uri[0] = 0;
+            lws_hdr_copy(wsi, uri, sizeof(uri), WSI_TOKEN_GET_URI);
+            std::unique_ptr<Session> session(new Session);
+            session->wsi = wsi;
+            session->presenced = !strncmp(uri, presencedPath(), strlen(presencedPath()));
+            self->mSessions[wsi] = std::move(session);
+            self->mStats.connections++;
+            break;
+        }
+        case LWS_CALLBACK_RECEIVE:
+        {
+            auto it = self->mSessions.find(wsi);
+            if (it == self->mSessions.end())
+            {
+                return -1;
+            }
+            Session& session = *it->second;
+            self->mStats.bytesIn += len;
+            if (session.rx.empty() && lws_is_final_fragment(wsi) && !lws_remaining_packet_payload(wsi))
+            {
+                self->onReceive(session, (const char*)in, len);
+            }
+            else
+            {
+                session.rx.append((const char*)in, len);
+                if (lws_is_final_fragment(wsi) && !lws_remaining_packet_payload(wsi))
+                {
+                    std::string frame;
+                    frame.swap(session.rx);
+                    self->onReceive(session, frame.data(), frame.size());
+                }
+            }
+            break;
+        }
+        case LWS_CALLBACK_SERVER_WRITEABLE:
+        {
+            auto it = self->mSessions.find(wsi);
+            if (it != self->mSessions.end() && !self->writeFrame(*it->second))
+            {
+                return -1;
+            }
+            break;
+        }
+        case LWS_CALLBACK_CLOSED:
+        {
+            auto it = self->mSessions.find(wsi);
+            if (it != self->mSessions.end())
+            {
+                for (Chat& chat: self->mChats)
+                {
+                    chat.sessions.erase(it->second.get());
+                }
+                self->mSessions.erase(it);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return 0;
+}
+
+void Server::onReceive(Session& session, const char* data, size_t len)
+{
+    StaticBuffer buf(data, len);
+    try
+    {
+        if (session.presenced)
+        {
+            execPresenced(session, buf);
+        }
+        else
+        {
+            execChatd(session, buf);
+        }
+    }
+    catch (BufferRangeError& e)
+    {
+        fprintf(stderr, "fakechatd: truncated command: %s\n", e.what());
+    }
+    flush(session);
+}
+
+void Server::execChatd(Session& session, const StaticBuffer& buf)
+{
+    size_t pos = 0;
+    while (pos < buf.dataSize())
+    {
+        uint8_t opcode = buf.read<uint8_t>(pos);
+        mStats.commandsIn++;
+        switch (opcode)
+        {
+            case chatd::OP_KEEPALIVE:
+            case chatd::OP_KEEPALIVEAWAY:
+                pos += 1;
+                break;
+
+            case chatd::OP_ECHO:
+                queue(session, chatd::Command(chatd::OP_ECHO));
+                pos += 1;
+                break;
+
+            case chatd::OP_CLIENTID:
+                queue(session, chatd::Command(chatd::OP_CLIENTID) + mNextClientId++);
+                pos += 9;
+                break;
+
+            case chatd::OP_JOIN:
+            {
+                auto it = mChatIndex.find(buf.read<uint64_t>(pos + 1));
+                pos += 18;
+                if (it == mChatIndex.end())
+                {
+                    break;
+                }
+                Chat& chat = mChats[it->second];
+                chat.sessions.insert(&session);
+                sendJoins(session, chat);
+                break;
+            }
+            case chatd::OP_HIST:
+            {
+                auto it = mChatIndex.find(buf.read<uint64_t>(pos + 1));
+                int32_t count = buf.read<int32_t>(pos + 9);
+                pos += 13;
+                if (it != mChatIndex.end())
+                {
+                    sendHist(session, mChats[it->second], count < 0 ? -count : count);
+                }
+                break;
+            }
+            case chatd::OP_JOINRANGEHIST:
+            {
+                auto it = mChatIndex.find(buf.read<uint64_t>(pos + 1));
+                Id newest = buf.read<uint64_t>(pos + 17);
+                pos += 25;
+                if (it == mChatIndex.end())
+                {
+                    break;
+                }
+                Chat& chat = mChats[it->second];
+                chat.sessions.insert(&session);
+                sendJoins(session, chat);
+
+                // everything newer than the newest message known by the client
+                auto known = chat.index.find(newest);
+                size_t start = (known != chat.index.end()) ? known->second + 1 : 0;
+                for (size_t i = start; i < chat.history.size(); i++)
+                {
+                    queueMsg(session, chatd::OP_NEWMSG, chat.id, chat.history[i]);
+                }
+                queue(session, chatd::Command(chatd::OP_HISTDONE) + chat.id);
+                break;
+            }
+            case chatd::OP_NEWMSG:
+            case chatd::OP_NEWNODEMSG:
+            {
+                Id chatid = buf.read<uint64_t>(pos + 1);
+                Id msgxid = buf.read<uint64_t>(pos + 17);
+                uint32_t msglen = buf.read<uint32_t>(pos + 35);
+                std::string payload(buf.readPtr(pos + 39, msglen), msglen);
+                pos += 39 + msglen;
+
+                auto it = mChatIndex.find(chatid);
+                if (it == mChatIndex.end())
+                {
+                    queue(session, chatd::Command(chatd::OP_REJECT) + chatid + msgxid + (uint8_t)opcode + (uint8_t)0);
+                    break;
+                }
+                Chat& chat = mChats[it->second];
+                Msg& msg = addMessage(chat, kMyHandle, std::move(payload));
+                queue(session, chatd::Command(chatd::OP_NEWMSGID) + msgxid + msg.msgid);
+                for (Session* other: chat.sessions)
+                {
+                    if (other != &session)
+                    {
+                        queueMsg(*other, chatd::OP_NEWMSG, chat.id, msg);
+                        flush(*other);
+                    }
+                }
+                break;
+            }
+            case chatd::OP_SEEN:
+            {
+                auto it = mChatIndex.find(buf.read<uint64_t>(pos + 1));
+                Id msgid = buf.read<uint64_t>(pos + 9);
+                pos += 17;
+                if (it != mChatIndex.end())
+                {
+                    Chat& chat = mChats[it->second];
+                    chat.lastSeen = msgid;
+                    broadcast(chat, chatd::Command(chatd::OP_SEEN) + chat.id + msgid, &session);
+                }
+                break;
+            }
+            case chatd::OP_RECEIVED:
+                pos += 17;
+                break;
+
+            case chatd::OP_BROADCAST:
+            {
+                auto it = mChatIndex.find(buf.read<uint64_t>(pos + 1));
+                uint8_t type = buf.read<uint8_t>(pos + 17);
+                pos += 18;
+                if (it != mChatIndex.end())
+                {
+                    Chat& chat = mChats[it->second];
+                    broadcast(chat, chatd::Command(chatd::OP_BROADCAST) + chat.id + Id(kMyHandle) + type, &session);
+                }
+                break;
+            }
+            default:
+                // the length of unsupported commands is unknown, so the rest of the frame is lost
+                fprintf(stderr, "fakechatd: unsupported chatd opcode %d, skipping the rest of the frame\n", opcode);
+                return;
+        }
+    }
+}
+
+void Server::execPresenced(Session& session, const StaticBuffer& buf)
+{
+    size_t pos = 0;
+    while (pos < buf.dataSize())
+    {
+        uint8_t opcode = buf.read<uint8_t>(pos);
+        mStats.commandsIn++;
+        switch (opcode)
+        {
+            case presenced::OP_KEEPALIVE:
+                // presenced answers the keepalives of the client
+                queue(session, presenced::Command(presenced::OP_KEEPALIVE));
+                pos += 1;
+                break;
+
+            case presenced::OP_HELLO:
+                // the current prefs complete the login: online, without autoaway
+                queue(session, presenced::Command(presenced::OP_PREFS) + (uint16_t)Presence::kOnline);
+                pos += 3;
+                break;
+
+            case presenced::OP_USERACTIVE:
+                pos += 2;
+                break;
+
+            case presenced::OP_PREFS:
+                // acknowledge them, as if the prefs were broadcast
+                queue(session, presenced::Command(presenced::OP_PREFS) + buf.read<uint16_t>(pos + 1));
+                pos += 3;
+                break;
+
+            case presenced::OP_SNSETPEERS:
+            case presenced::OP_SNADDPEERS:
+            case presenced::OP_SNDELPEERS:
+            {
+                uint32_t count = buf.read<uint32_t>(pos + 9);
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    Id peer = buf.read<uint64_t>(pos + 13 + i * 8);
+                    if (opcode != presenced::OP_SNDELPEERS)
+                    {
+                        queue(session, presenced::Command(presenced::OP_PEERSTATUS) + (uint8_t)Presence::kOnline + peer);
+                    }
+                }
+                pos += 13 + count * 8;
+                break;
+            }
+            case presenced::OP_LASTGREEN:
+            {
+                Id peer = buf.read<uint64_t>(pos + 1);
+                queue(session, presenced::Command(presenced::OP_LASTGREEN) + peer + (uint16_t)5);
+                pos += 9;
+                break;
+            }
+            default:
+                fprintf(stderr, "fakechatd: unsupported presenced opcode %d, skipping the rest of the frame\n", opcode);
+                return;
+        }
+    }
+}
+
+void Server::sendJoins(Session& session, Chat& chat)
+{
+    for (Id userid: chat.users)
+    {
+        queue(session, chatd::Command(chatd::OP_JOIN) + chat.id + userid + (int8_t)chatd::PRIV_OPER);
+    }
+}
+
+void Server::sendHist(Session& session, Chat& chat, int count)
+{
+    // like chatd, every HIST continues from the oldest message sent to this connection
+    auto posIt = session.histPos.find(chat.id);
+    if (posIt == session.histPos.end())
+    {
+        posIt = session.histPos.emplace(chat.id, chat.history.size()).first;
+        if (chat.lastSeen.isValid())
+        {
+            queue(session, chatd::Command(chatd::OP_SEEN) + chat.id + chat.lastSeen);
+        }
+    }
+
+    size_t& histPos = posIt->second;
+    for (int i = 0; i < count && histPos > 0; i++)
+    {
+        queueMsg(session, chatd::OP_OLDMSG, chat.id, chat.history[--histPos]);
+    }
+    queue(session, chatd::Command(chatd::OP_HISTDONE) + chat.id);
+}
+
+void Server::queue(Session& session, const Buffer& cmd)
+{
+    if (session.pending.size() + cmd.dataSize() > kMaxFrameSize)
+    {
+        flush(session);
+    }
+    session.pending.append(cmd.buf(), cmd.dataSize());
+    mStats.commandsOut++;
+}
+
+void Server::queueMsg(Session& session, uint8_t opcode, Id chatid, const Msg& msg)
+{
+    chatd::MsgCommand cmd(opcode, chatid, msg.userid, msg.msgid, msg.ts, 0, 1);
+    cmd.setMsg(msg.payload.data(), msg.payload.size());
+    queue(session, cmd);
+}
+
+void Server::broadcast(Chat& chat, const Buffer& cmd, Session* except)
+{
+    for (Session* session: chat.sessions)
+    {
+        if (session != except)
+        {
+            queue(*session, cmd);
+            flush(*session);
+        }
+    }
+}
+
+void Server::flush(Session& session)
+{
+    if (session.pending.empty())
+    {
+        return;
+    }
+
+    std::string frame(LWS_PRE, '\0');
+    frame.append(session.pending);
+    session.pending.clear();
+    session.frames.push_back(std::move(frame));
+    lws_callback_on_writable(session.wsi);
+}
+
+bool Server::writeFrame(Session& session)
+{
+    if (session.frames.empty())
+    {
+        return true;
+    }
+
+    std::string& frame = session.frames.front();
+    size_t len = frame.size() - LWS_PRE;
+    if (lws_write(session.wsi, (unsigned char*)&frame[LWS_PRE], len, LWS_WRITE_BINARY) < (int)len)
+    {
+        return false;
+    }
+    mStats.bytesOut += len;
+    session.frames.pop_front();
+    if (!session.frames.empty())
+    {
+        lws_callback_on_writable(session.wsi);
+    }
+    return true;
+}
+}
@@ -0,0 +1,161 @@
+#ifndef FAKECHATD_SERVER_H
+#define FAKECHATD_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <karereId.h>
+#include <buffer.h>
+
+struct lws;
+struct lws_context;
+
+/** In-process stand-in for chatd and presenced, so that the client side can be
+ * benchmarked without accounts or live shards.
+ *
+ * It is a libwebsockets server (plain ws://, no TLS) that speaks the subset of the
+ * protocol needed to log in: chatd's JOIN, HIST, JOINRANGEHIST, NEWMSG, SEEN,
+ * CLIENTID, ECHO and BROADCAST, and presenced's HELLO, PREFS, SNSETPEERS/SNADDPEERS
+ * and LASTGREEN. Everything else is ignored.
+ *
+ * Histories are generated from the Config, and new messages and SEEN updates from
+ * other users can be injected at a given rate. Message payloads are opaque bytes
+ * (nothing is encrypted), that start with the steady-clock time, in nanoseconds,
+ * at which the message was created, so that the client can measure the delivery
+ * latency. All the protocol handling runs in the service thread.
+ */
+namespace fakechatd
+{
+struct Config
+{
+    int port = 9556;
+    unsigned numChats = 10;
+    unsigned messagesPerChat = 100;
+    unsigned messageSize = 200;         // bytes of payload, including the timestamp
+    unsigned participantsPerChat = 2;   // including the own user
+    double churnMessagesPerSec = 0;     // new messages from other users, to random chats
+    double churnSeenPerSec = 0;         // SEEN updates from other devices, to random chats
+    bool deflate = false;               // accept permessage-deflate
+};
+
+/** Counters of the server, which can be read from any thread */
+struct Stats
+{
+    std::atomic<uint64_t> connections{0};
+    std::atomic<uint64_t> commandsIn{0};
+    std::atomic<uint64_t> commandsOut{0};
+    std::atomic<uint64_t> bytesIn{0};
+    std::atomic<uint64_t> bytesOut{0};
+    std::atomic<uint64_t> churnMessages{0};
+    std::atomic<uint64_t> churnSeen{0};
+};
+
+/** Steady-clock time in nanoseconds, as embedded in the message payloads */
+inline int64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Server
+{
+public:
+    /** Own user of the client, which sends the NEWMSGs and owns the SEENs. It's the
+     * handle of an anonymous karere::Client (all zeros) */
+    static const uint64_t kMyHandle = 0;
+
+    explicit Server(const Config& config);
+    ~Server();
+
+    /** Starts listening and the service thread. Returns false if the port can't be bound */
+    bool start();
+    void stop();
+
+    const Config& config() const { return mConfig; }
+    const Stats& stats() const { return mStats; }
+    karere::Id chatId(unsigned index) const { return mChats[index].id; }
+
+    /** Paths of the URLs to connect to (ws://127.0.0.1:<port><path>). Any path that
+     * does not start with presencedPath() is served as chatd */
+    static const char* chatdPath() { return "/chatd/8"; }
+    static const char* presencedPath() { return "/presenced"; }
+
+    /** Payload of a message created now, of the configured size */
+    std::string makePayload() const;
+
+    static int wsCallback(struct lws* wsi, int reason, void* user, void* in, size_t len);
+
+protected:
+    struct Msg
+    {
+        karere::Id msgid;
+        karere::Id userid;
+        uint32_t ts;
+        std::string payload;
+    };
+    struct Session;
+    struct Chat
+    {
+        karere::Id id;
+        std::vector<karere::Id> users;
+        std::vector<Msg> history;           // oldest first
+        std::map<karere::Id, size_t> index; // msgid -> position in history
+        karere::Id lastSeen = karere::Id::inval();
+        std::set<Session*> sessions;        // joined connections
+    };
+    struct Session
+    {
+        struct lws* wsi = nullptr;
+        bool presenced = false;
+        std::string rx;                     // fragments of the current frame
+        std::string pending;                // commands not flushed to a frame yet
+        std::deque<std::string> frames;     // frames to write, with LWS_PRE bytes of headroom
+        std::map<karere::Id, size_t> histPos;   // chatid -> position of the last OLDMSG sent
+    };
+
+    Config mConfig;
+    Stats mStats;
+    std::vector<Chat> mChats;
+    std::map<karere::Id, size_t> mChatIndex;
+    std::map<struct lws*, std::unique_ptr<Session>> mSessions;
+    uint64_t mNextMsgid = 1;
+    uint32_t mNextClientId = 1;
+    struct lws_context* mContext = nullptr;
+    std::thread mThread;
+    std::atomic<bool> mStopping{false};
+    double mChurnMessageCredit = 0;
+    double mChurnSeenCredit = 0;
+    int64_t mLastChurnNs = 0;
+    uint64_t mRandom = 0x9e3779b97f4a7c15ULL;
+
+    void generateHistory();
+    void run();
+    void churn();
+    unsigned random(unsigned range);
+    Msg& addMessage(Chat& chat, karere::Id userid, std::string&& payload);
+
+    void onReceive(Session& session, const char* data, size_t len);
+    void execChatd(Session& session, const StaticBuffer& buf);
+    void execPresenced(Session& session, const StaticBuffer& buf);
+    void sendHist(Session& session, Chat& chat, int count);
+    void sendJoins(Session& session, Chat& chat);
+
+    /** Appends a command to the next frame of the session */
+    void queue(Session& session, const Buffer& cmd);
+    void queueMsg(Session& session, uint8_t opcode, karere::Id chatid, const Msg& msg);
+    /** Sends the queued commands, in frames of at most kMaxFrameSize */
+    void flush(Session& session);
+    void broadcast(Chat& chat, const Buffer& cmd, Session* except);
+    bool writeFrame(Session& session);
+
+    enum { kMaxFrameSize = 64 * 1024 };
+};
+}
+
+#endif // FAKECHATD_SERVER_H
@@ -0,0 +1,244 @@
+/**
+ * Offline replay of a chatd trace, for deterministic performance regression tests.
+ *
+ * A trace is captured by the app with MegaChatApi::startChatdTrace() (see chatdTrace.h
+ * for the format). This tool creates an anonymous karere::Client with a scratch database
+ * in the working directory, creates the chats joined in the trace, and feeds the inbound
+ * frames to Connection::execCommand(), in order and as fast as possible. Nothing is
+ * connected: the commands that the client would send in response are dropped.
+ *
+ * The crypto is stubbed (see fakeKarere.h): messages are stored with their encrypted
+ * payload as if it was the plain text, so this measures the protocol handling, the
+ * history and the database, but not the decryption.
+ *
+ * It reports the wall time, the CPU time and the heap allocations spent in the replay,
+ * in total and per frame, and the messages received by the chats.
+ *
+ * Usage: chatd_replay <trace> [workDir]
+ */
+
+#include "fakeKarere.h"
+#include <chatClient.h>
+#include <chatd.h>
+#include <chatdDb.h>
+#include <chatdICrypto.h>
+#include <chatdTrace.h>
+#include <megaapi.h>
+#include <logger.h>
+#include <gcm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <chrono>
+#include <map>
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#include <malloc.h>
+#endif
+
+using namespace karere;
+
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+//Count heap allocations by interposing malloc
+extern "C" void* __libc_malloc(size_t size);
+static size_t gMallocCount = 0;
+extern "C" void* malloc(size_t size)
+{
+    gMallocCount++;
+    return __libc_malloc(size);
+}
+#define ALLOC_COUNT_SUPPORTED 1
+#else
+static size_t gMallocCount = 0;
+#endif
+
+static int64_t processCpuUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** The network is never used */
+class NullWebsocketsIO: public WebsocketsIO
+{
+public:
+    NullWebsocketsIO(Mutex& mutex, ::mega::MegaApi* api, void* ctx): WebsocketsIO(mutex, api, ctx) {}
+    void addevents(::mega::Waiter*, int) override {}
+
+protected:
+    bool wsResolveDNS(const char*, std::function<void(int, const std::vector<std::string>&, const std::vector<std::string>&)>) override
+    {
+        return false;
+    }
+    WebsocketsClientImpl* wsConnect(const char*, const char*, int, const char*, bool, WebsocketsClient*) override
+    {
+        return nullptr;
+    }
+    int wsGetNoNameErrorCode() override { return -1; }
+};
+
+/** Shared by all the chats, it stores their history in the client's db and counts the messages */
+class ReplayListener: public chatd::Listener
+{
+public:
+    ReplayListener(SqliteDb& db): mDb(db) {}
+
+    void init(chatd::Chat& chat, chatd::DbInterface*& dbIntf) override
+    {
+        dbIntf = new ChatdSqliteDb(chat, mDb);
+    }
+    void onOnlineStateChange(chatd::ChatState) override {}
+    void onRecvNewMessage(chatd::Idx, chatd::Message&, chatd::Message::Status) override { mNewMessages++; }
+    void onRecvHistoryMessage(chatd::Idx, chatd::Message&, chatd::Message::Status, bool isLocal) override
+    {
+        if (!isLocal)
+            mHistoryMessages++;
+    }
+    void onMessageEdited(const chatd::Message&, chatd::Idx) override { mEdits++; }
+
+    size_t mNewMessages = 0;
+    size_t mHistoryMessages = 0;
+    size_t mEdits = 0;
+
+protected:
+    SqliteDb& mDb;
+};
+
+struct TraceStats
+{
+    size_t inFrames = 0;
+    size_t inBytes = 0;
+    size_t outFrames = 0;
+    uint64_t durationUs = 0;
+    std::map<Id, int> chats;    // chatid -> shard, from the JOINs sent by the client
+};
+
+/** Scans the trace for the chats joined by the client */
+static bool scanTrace(const char* path, TraceStats& stats)
+{
+    chatd::TraceReader reader;
+    if (!reader.open(path))
+        return false;
+
+    chatd::TraceRecord record;
+    while (reader.next(record))
+    {
+        stats.durationUs = record.tsUs;
+        if (record.direction == chatd::kTraceIn)
+        {
+            stats.inFrames++;
+            stats.inBytes += record.data.dataSize();
+            continue;
+        }
+
+        stats.outFrames++;
+        if (record.data.dataSize() < 9)
+            continue;
+
+        switch (record.data.read<uint8_t>(0))
+        {
+            case chatd::OP_JOIN:
+            case chatd::OP_JOINRANGEHIST:
+            case chatd::OP_HANDLEJOIN:
+            case chatd::OP_HANDLEJOINRANGEHIST:
+                stats.chats[record.data.read<uint64_t>(1)] = record.shard;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: chatd_replay <trace> [workDir]\n");
+        return 1;
+    }
+    const char* tracePath = argv[1];
+    std::string workDir = (argc > 2) ? argv[2] : ".";
+
+    TraceStats stats;
+    if (!scanTrace(tracePath, stats))
+    {
+        printf("%s is not a chatd trace\n", tracePath);
+        return 1;
+    }
+    printf("Trace: %zu frames (%zu bytes) received and %zu sent in %.1f s, %zu chats joined\n",
+           stats.inFrames, stats.inBytes, stats.outFrames, stats.durationUs / 1e6, stats.chats.size());
+
+    // the debug logs of every command would dominate the measurements
+    krLoggerChannels[krLogChannel_chatd].logLevel = krLogLevelWarn;
+    krLoggerChannels[krLogChannel_default].logLevel = krLogLevelWarn;
+
+    test::MessageQueue queue;
+    globalInit(test::MessageQueue::post);
+    {
+        mega::MegaApi api("chatd_replay", workDir.c_str(), "chatd_replay");
+        WebsocketsIO::Mutex mutex;
+        NullWebsocketsIO io(mutex, &api, &queue);
+        test::FakeApp app;
+        Client client(api, &io, app, workDir, 0, &queue);
+        if (client.initWithAnonymousSession() != Client::kInitAnonymousMode)
+        {
+            printf("Can't create the scratch database in %s\n", workDir.c_str());
+            return 1;
+        }
+
+        ReplayListener listener(client.db);
+        chatd::Client& chatdClient = *client.mChatdClient;
+        for (auto& it: stats.chats)
+        {
+            client.db.query("insert or replace into chats(chatid, shard, own_priv) values(?,?,?)",
+                            it.first, it.second, chatd::PRIV_FULL);
+            chatdClient.createChat(it.first, it.second, &listener, SetOfIds(),
+                                   new test::PlaintextCrypto(client), 0, true);
+        }
+        queue.processAll();
+
+        chatd::TraceReader reader;
+        reader.open(tracePath);
+        chatd::TraceRecord record;
+        size_t replayed = 0;
+        size_t mallocsBefore = gMallocCount;
+        int64_t cpuStart = processCpuUs();
+        auto start = std::chrono::steady_clock::now();
+        while (reader.next(record))
+        {
+            if (record.direction != chatd::kTraceIn)
+                continue;
+
+            if (chatdClient.replayFrame(record.shard, record.data))
+            {
+                replayed++;
+            }
+            queue.processAll();
+        }
+        client.db.commit();
+        auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        int64_t cpuUs = processCpuUs() - cpuStart;
+        size_t mallocs = gMallocCount - mallocsBefore;
+
+        printf("Replayed %zu frames in %.1f ms, %.1f ms of CPU (%.1f us per frame)\n",
+               replayed, elapsedUs / 1000.0, cpuUs / 1000.0, replayed ? (double)cpuUs / replayed : 0.0);
+#ifdef ALLOC_COUNT_SUPPORTED
+        printf("    %zu heap allocations (%.1f per frame)\n", mallocs, replayed ? (double)mallocs / replayed : 0.0);
+#else
+        (void)mallocs;
+#endif
+        printf("    %zu history messages, %zu new messages, %zu edits received\n",
+               listener.mHistoryMessages, listener.mNewMessages, listener.mEdits);
+        if (replayed < stats.inFrames)
+        {
+            printf("    %zu frames skipped, for shards without joined chats\n", stats.inFrames - replayed);
+        }
+
+        client.terminate(true);
+        queue.processAll();
+    }
+    globalCleanup();
+    return 0;
+}
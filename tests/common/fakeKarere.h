@@ -0,0 +1,161 @@
+#ifndef FAKE_KARERE_H
+#define FAKE_KARERE_H
+
+/**
+ * Stand-ins for the app and the crypto of a karere::Client, shared by the test tools
+ * that drive a real client without an account (chatd_bench, chatd_replay).
+ */
+
+#include <chatClient.h>
+#include <chatd.h>
+#include <chatdICrypto.h>
+#include <gcm.h>
+#include <stdlib.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace karere
+{
+namespace test
+{
+
+/** Queue of the marshalled calls, which are run by the tool with processAll().
+ *
+ * Pass MessageQueue::post to globalInit() and the queue as the appCtx of the client.
+ * Subclasses override wakeup() to signal the loop that runs the queue.
+ */
+class MessageQueue
+{
+public:
+    virtual ~MessageQueue() {}
+
+    static void post(void* msg, void* ctx)
+    {
+        MessageQueue* self = static_cast<MessageQueue*>(ctx);
+        {
+            std::lock_guard<std::mutex> lock(self->mMutex);
+            self->mMessages.push_back(msg);
+        }
+        self->wakeup();
+    }
+
+    void processAll()
+    {
+        for (;;)
+        {
+            void* msg;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mMessages.empty())
+                    return;
+                msg = mMessages.front();
+                mMessages.pop_front();
+            }
+            megaProcessMessage(msg);
+        }
+    }
+
+protected:
+    std::mutex mMutex;
+    std::deque<void*> mMessages;
+
+    /** Called, from any thread, after a message is posted */
+    virtual void wakeup() {}
+};
+
+/** The app has no chat list and ignores presenced */
+class FakeApp: public IApp
+{
+public:
+    IChatListHandler* chatListHandler() override { return nullptr; }
+    void onPresenceConfigChanged(const presenced::Config&, bool) override {}
+    void onPresenceLastGreenUpdated(Id, uint16_t) override {}
+};
+
+/** Stands in for strongvelope: the payload of the messages is their plain text,
+ * both when they are sent and when they are received. Keys, titles and unified keys
+ * are not supported.
+ */
+class PlaintextCrypto: public chatd::ICrypto
+{
+public:
+    PlaintextCrypto(Client& client): chatd::ICrypto(client.appCtx), mClient(client) {}
+
+    void setUsers(SetOfIds*) override {}
+    promise::Promise<std::pair<chatd::MsgCommand*, chatd::KeyCommand*>>
+    msgEncrypt(chatd::Message* msg, const SetOfIds&, chatd::MsgCommand* msgCmd) override
+    {
+        msgCmd->setMsg(msg->buf(), msg->dataSize());
+        return std::pair<chatd::MsgCommand*, chatd::KeyCommand*>(msgCmd, nullptr);
+    }
+    promise::Promise<chatd::Message*> msgDecrypt(chatd::Message* src) override
+    {
+        if (!src->empty() && src->type == chatd::Message::kMsgInvalid)
+        {
+            src->type = chatd::Message::kMsgNormal;
+        }
+        src->setEncrypted(chatd::Message::kNotEncrypted);
+        return promise::Promise<chatd::Message*>(src);
+    }
+    void onKeyReceived(chatd::KeyId, Id, Id, const char*, uint16_t, bool) override {}
+    void onKeyConfirmed(chatd::KeyId, chatd::KeyId) override {}
+    void onKeyRejected() override {}
+    void resetSendKey() override {}
+    void randomBytes(void* buf, size_t bufsize) const override
+    {
+        for (size_t i = 0; i < bufsize; i++)
+        {
+            static_cast<uint8_t*>(buf)[i] = (uint8_t)rand();
+        }
+    }
+    promise::Promise<std::shared_ptr<Buffer>> encryptChatTitle(const std::string&, uint64_t, bool) override
+    {
+        return ::promise::Error("Not supported");
+    }
+    promise::Promise<chatd::KeyCommand*> encryptUnifiedKeyForAllParticipants(uint64_t) override
+    {
+        return ::promise::Error("Not supported");
+    }
+    promise::Promise<std::string> decryptChatTitleFromApi(const Buffer&) override
+    {
+        return ::promise::Error("Not supported");
+    }
+    promise::Promise<std::string> encryptUnifiedKeyToUser(Id) override
+    {
+        return ::promise::Error("Not supported");
+    }
+    promise::Promise<std::string> decryptUnifiedKey(std::shared_ptr<Buffer>&, uint64_t, uint64_t) override
+    {
+        return ::promise::Error("Not supported");
+    }
+    promise::Promise<std::shared_ptr<std::string>> getUnifiedKey() override
+    {
+        return ::promise::Error("Not supported");
+    }
+    bool previewMode() override { return false; }
+    bool isPublicChat() const override { return false; }
+    void setPrivateChatMode() override {}
+    void onHistoryReload() override {}
+    uint64_t getPublicHandle() const override { return Id::inval(); }
+    void setPublicHandle(const uint64_t) override {}
+    UserAttrCache& userAttrCache() override { return mClient.userAttrCache(); }
+    std::shared_ptr<Buffer> reactionEncrypt(const chatd::Message&, const std::string& reaction) override
+    {
+        return std::make_shared<Buffer>(reaction.data(), reaction.size());
+    }
+    promise::Promise<std::shared_ptr<Buffer>> reactionDecrypt(const Id&, const Id&, const chatd::KeyId&, const std::string& reaction) override
+    {
+        return std::make_shared<Buffer>(reaction.data(), reaction.size());
+    }
+    void fetchUserKeys(Id) override {}
+
+protected:
+    Client& mClient;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,610 @@
+/**
+ * Loopback call benchmark for the rtcModule media path.
+ *
+ * Two peer connections are created in this process, each one sending a synthetic
+ * video track and an audio track, and connected through an in-process relay that
+ * stands in for chatd. No accounts, servers, STUN or TURN are needed: ICE only
+ * uses the host candidates of this machine.
+ *
+ * It reports:
+ *  - SDP offer->answer latency, as seen by the caller
+ *  - ICE completion time, for each peer
+ *  - Frames rendered per second by each peer's StreamPlayer
+ *  - Time and CPU per frame spent in StreamPlayer::OnFrame(), and the conversion
+ *    time recorded by StreamPlayer for the stats
+ *  - Process CPU time per rendered frame, which includes encoding and decoding
+ *
+ * One peer renders like a GUI that keeps a bitmap, and the other one like
+ * MegaChatVideoReceiver, which allocates a buffer for every frame.
+ *
+ * Usage: rtc_loopback [seconds] [relayDelayMs]
+ */
+
+#include <webrtcAdapter.h>
+#include <streamPlayer.h>
+#include <IVideoRenderer.h>
+#include <gcm.h>
+#include <api/jsep.h>
+#include <api/video/i420_buffer.h>
+#include <api/video/video_frame.h>
+#include <rtc_base/time_utils.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const int kWidth = 640;
+static const int kHeight = 480;
+static const int kFps = 30;
+
+static double msSince(Clock::time_point start, Clock::time_point end = Clock::now())
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+}
+
+static int64_t threadCpuUs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int64_t processCpuUs()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL
+            + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/** The application's message loop, run by the main thread. This is where
+ * marshallCall() posts to, and where webrtc runs its signaling thread */
+class MessageLoop
+{
+public:
+    static void post(void* msg, void* ctx)
+    {
+        static_cast<MessageLoop*>(ctx)->push(msg);
+    }
+
+    void push(void* msg)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mMessages.push_back(msg);
+        mCondition.notify_one();
+    }
+
+    void postDelayed(std::function<void()>&& func, int delayMs)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mTimers.emplace(Clock::now() + std::chrono::milliseconds(delayMs), std::move(func));
+        mCondition.notify_one();
+    }
+
+    /** Processes messages until \c done returns true or \c timeoutMs elapse.
+     * Returns the last value of \c done */
+    bool runUntil(const std::function<bool()>& done, int timeoutMs)
+    {
+        auto deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+        std::unique_lock<std::mutex> lock(mMutex);
+        for (;;)
+        {
+            auto now = Clock::now();
+            while (!mTimers.empty() && mTimers.begin()->first <= now)
+            {
+                auto func = std::move(mTimers.begin()->second);
+                mTimers.erase(mTimers.begin());
+                lock.unlock();
+                func();
+                lock.lock();
+            }
+            while (!mMessages.empty())
+            {
+                void* msg = mMessages.front();
+                mMessages.pop_front();
+                lock.unlock();
+                megaProcessMessage(msg);
+                lock.lock();
+            }
+
+            lock.unlock();
+            bool finished = done();
+            lock.lock();
+            if (finished || Clock::now() >= deadline)
+                return finished;
+
+            auto wakeup = deadline;
+            if (!mTimers.empty() && mTimers.begin()->first < wakeup)
+            {
+                wakeup = mTimers.begin()->first;
+            }
+            mCondition.wait_until(lock, wakeup, [this]() { return !mMessages.empty(); });
+        }
+    }
+
+protected:
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<void*> mMessages;
+    std::multimap<Clock::time_point, std::function<void()>> mTimers;
+};
+
+/** Stands in for chatd: carries the signalling between the peers through the
+ * message loop, as RTMSG/CALLDATA packets would arrive, with an optional delay */
+class LoopbackRelay
+{
+public:
+    LoopbackRelay(MessageLoop& loop, int delayMs): mLoop(loop), mDelayMs(delayMs) {}
+    ~LoopbackRelay() { close(); }
+    void send(size_t bytes, std::function<void()>&& deliver)
+    {
+        if (*mClosed)
+            return;
+
+        mMessages++;
+        mBytes += bytes;
+        // the timer can fire after the peers are gone, so it checks the relay is still open
+        std::shared_ptr<bool> closed = mClosed;
+        mLoop.postDelayed([closed, deliver]()
+        {
+            if (!*closed)
+                deliver();
+        }, mDelayMs);
+    }
+    /** Drops the messages still in flight, and the ones sent from now on */
+    void close() { *mClosed = true; }
+    size_t messages() const { return mMessages; }
+    size_t bytes() const { return mBytes; }
+
+protected:
+    MessageLoop& mLoop;
+    int mDelayMs;
+    size_t mMessages = 0;
+    size_t mBytes = 0;
+    std::shared_ptr<bool> mClosed = std::make_shared<bool>(false);
+};
+
+/** Video source that generates a moving pattern, instead of capturing from a camera */
+class SyntheticVideoSource: public artc::VideoManager
+{
+public:
+    ~SyntheticVideoSource() override { releaseDevice(); }
+    void openDevice(const std::string& /*videoDevice*/) override
+    {
+        mRunning = true;
+        mThread = std::thread([this]()
+        {
+            auto next = Clock::now();
+            for (int i = 0; mRunning; i++)
+            {
+                rtc::scoped_refptr<webrtc::I420Buffer> buffer = webrtc::I420Buffer::Create(kWidth, kHeight);
+                for (int y = 0; y < kHeight; y++)
+                {
+                    uint8_t* row = buffer->MutableDataY() + y * buffer->StrideY();
+                    for (int x = 0; x < kWidth; x++)
+                    {
+                        row[x] = static_cast<uint8_t>(x + y + i * 4);
+                    }
+                }
+                memset(buffer->MutableDataU(), (i * 2) & 0xff, buffer->StrideU() * buffer->ChromaHeight());
+                memset(buffer->MutableDataV(), 128, buffer->StrideV() * buffer->ChromaHeight());
+                mBroadcaster.OnFrame(webrtc::VideoFrame::Builder()
+                                     .set_video_frame_buffer(buffer)
+                                     .set_timestamp_us(rtc::TimeMicros())
+                                     .build());
+                next += std::chrono::microseconds(1000000 / kFps);
+                std::this_thread::sleep_until(next);
+            }
+        });
+    }
+    void releaseDevice() override
+    {
+        mRunning = false;
+        if (mThread.joinable())
+        {
+            mThread.join();
+        }
+    }
+    rtc::scoped_refptr<webrtc::VideoTrackSourceInterface> getVideoTrackSource() override { return this; }
+    bool is_screencast() const override { return false; }
+    absl::optional<bool> needs_denoising() const override { return absl::nullopt; }
+    bool GetStats(webrtc::VideoTrackSourceInterface::Stats* /*stats*/) override { return false; }
+    webrtc::MediaSourceInterface::SourceState state() const override { return webrtc::MediaSourceInterface::kLive; }
+    bool remote() const override { return false; }
+    void AddOrUpdateSink(rtc::VideoSinkInterface<webrtc::VideoFrame>* sink, const rtc::VideoSinkWants& wants) override
+    {
+        mBroadcaster.AddOrUpdateSink(sink, wants);
+    }
+    void RemoveSink(rtc::VideoSinkInterface<webrtc::VideoFrame>* sink) override
+    {
+        mBroadcaster.RemoveSink(sink);
+    }
+    void RegisterObserver(webrtc::ObserverInterface* /*observer*/) override {}
+    void UnregisterObserver(webrtc::ObserverInterface* /*observer*/) override {}
+
+protected:
+    rtc::VideoBroadcaster mBroadcaster;
+    std::thread mThread;
+    std::atomic<bool> mRunning { false };
+};
+
+/** Renders into one buffer that is kept between frames, as a GUI bitmap */
+class BitmapRenderer: public rtcModule::IVideoRenderer
+{
+public:
+    std::atomic<uint32_t> mFrames { 0 };
+    void* getImageBuffer(unsigned short width, unsigned short height, void*& /*userData*/) override
+    {
+        mBuffer.resize(width * height * 4);
+        return mBuffer.data();
+    }
+    void frameComplete(void* /*userData*/) override { mFrames++; }
+
+protected:
+    std::vector<uint8_t> mBuffer;
+};
+
+/** Renders as MegaChatVideoReceiver does, allocating a buffer for every frame
+ * that is handed over to the app and freed in frameComplete() */
+class ReceiverRenderer: public rtcModule::IVideoRenderer
+{
+public:
+    std::atomic<uint32_t> mFrames { 0 };
+    void* getImageBuffer(unsigned short width, unsigned short height, void*& userData) override
+    {
+        uint8_t* buffer = new uint8_t[width * height * 4];
+        userData = buffer;
+        return buffer;
+    }
+    void frameComplete(void* userData) override
+    {
+        delete[] static_cast<uint8_t*>(userData);
+        mFrames++;
+    }
+};
+
+/** StreamPlayer that measures the time and CPU spent per frame */
+class TimedPlayer: public artc::StreamPlayer
+{
+public:
+    std::atomic<uint32_t> mFrames { 0 };
+    std::atomic<int64_t> mWallUs { 0 };
+    std::atomic<int64_t> mCpuUs { 0 };
+    TimedPlayer(rtcModule::IVideoRenderer* renderer, void* appCtx): StreamPlayer(renderer, appCtx) {}
+    void OnFrame(const webrtc::VideoFrame& frame) override
+    {
+        auto start = Clock::now();
+        int64_t cpuStart = threadCpuUs();
+        StreamPlayer::OnFrame(frame);
+        mCpuUs += threadCpuUs() - cpuStart;
+        mWallUs += std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        mFrames++;
+    }
+    void reset()
+    {
+        mFrames = 0;
+        mWallUs = 0;
+        mCpuUs = 0;
+        long avg, max;
+        takeConversionStats(avg, max);
+    }
+};
+
+class LoopbackPeer
+{
+public:
+    std::string mName;
+    MessageLoop& mLoop;
+    LoopbackRelay& mRelay;
+    LoopbackPeer* mRemote = nullptr;
+    artc::myPeerConnection<LoopbackPeer> mRtcConn;
+    rtc::scoped_refptr<SyntheticVideoSource> mVideoSource;
+    rtcModule::IVideoRenderer* mRenderer;
+    std::unique_ptr<TimedPlayer> mPlayer;
+    std::vector<std::shared_ptr<artc::IceCandText>> mPendingCandidates;
+    bool mHasRemoteSdp = false;
+    bool mIceConnected = false;
+    bool mFailed = false;
+    bool mClosed = false;
+    Clock::time_point mStartTs;
+    Clock::time_point mAnswerTs;
+    Clock::time_point mIceConnectedTs;
+
+    LoopbackPeer(const std::string& name, MessageLoop& loop, LoopbackRelay& relay, rtcModule::IVideoRenderer* renderer)
+        : mName(name), mLoop(loop), mRelay(relay), mRenderer(renderer)
+    {
+    }
+
+    ~LoopbackPeer()
+    {
+        close();
+    }
+
+    /** Closes the connection. webrtc doesn't call the observer after that, but the
+     * callbacks it already posted to the loop must be processed before destroying
+     * the peer, since they (and the promises they resolve) refer to it */
+    void close()
+    {
+        mClosed = true;
+        if (mPlayer)
+        {
+            mPlayer->detachFromStream();
+        }
+        if (mRtcConn.get())
+        {
+            mRtcConn->Close();
+        }
+        if (mVideoSource)
+        {
+            mVideoSource->releaseDevice();
+        }
+    }
+
+    void start(Clock::time_point startTs)
+    {
+        mStartTs = startTs;
+        webrtc::PeerConnectionInterface::IceServers noServers; //host candidates only
+        mRtcConn = artc::myPeerConnection<LoopbackPeer>(noServers, *this);
+        mPlayer.reset(new TimedPlayer(mRenderer, &mLoop));
+
+        mVideoSource = new SyntheticVideoSource();
+        mVideoSource->openDevice("");
+        std::vector<std::string> streams(1, mName);
+        auto video = artc::gWebrtcContext->CreateVideoTrack("v" + std::to_string(artc::generateId()), mVideoSource);
+        auto audio = artc::gWebrtcContext->CreateAudioTrack("a" + std::to_string(artc::generateId()),
+                        artc::gWebrtcContext->CreateAudioSource(cricket::AudioOptions()));
+        if (!mRtcConn->AddTrack(video, streams).ok() || !mRtcConn->AddTrack(audio, streams).ok())
+        {
+            fail("Error adding tracks");
+        }
+    }
+
+    void call()
+    {
+        webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
+        mRtcConn.createOffer(options)
+        .then([this](webrtc::SessionDescriptionInterface* sdp)
+        {
+            std::string text;
+            sdp->ToString(&text);
+            return mRtcConn.setLocalDescription(sdp)
+            .then([this, text]()
+            {
+                mRelay.send(text.size(), [this, text]() { mRemote->onOffer(text); });
+            });
+        })
+        .fail([this](const promise::Error& err)
+        {
+            fail("Error creating the SDP offer: " + err.msg());
+        });
+    }
+
+    void onOffer(const std::string& text)
+    {
+        webrtc::SdpParseError error;
+        webrtc::SessionDescriptionInterface* sdp = webrtc::CreateSessionDescription("offer", text, &error);
+        if (!sdp)
+        {
+            fail("Error parsing the SDP offer: " + error.description);
+            return;
+        }
+
+        mRtcConn.setRemoteDescription(sdp)
+        .then([this]()
+        {
+            setHasRemoteSdp();
+            webrtc::PeerConnectionInterface::RTCOfferAnswerOptions options;
+            return mRtcConn.createAnswer(options);
+        })
+        .then([this](webrtc::SessionDescriptionInterface* sdp)
+        {
+            std::string text;
+            sdp->ToString(&text);
+            return mRtcConn.setLocalDescription(sdp)
+            .then([this, text]()
+            {
+                mRelay.send(text.size(), [this, text]() { mRemote->onAnswer(text); });
+            });
+        })
+        .fail([this](const promise::Error& err)
+        {
+            fail("Error answering the SDP offer: " + err.msg());
+        });
+    }
+
+    void onAnswer(const std::string& text)
+    {
+        webrtc::SdpParseError error;
+        webrtc::SessionDescriptionInterface* sdp = webrtc::CreateSessionDescription("answer", text, &error);
+        if (!sdp)
+        {
+            fail("Error parsing the SDP answer: " + error.description);
+            return;
+        }
+
+        mRtcConn.setRemoteDescription(sdp)
+        .then([this]()
+        {
+            mAnswerTs = Clock::now();
+            setHasRemoteSdp();
+        })
+        .fail([this](const promise::Error& err)
+        {
+            fail("Error setting the SDP answer: " + err.msg());
+        });
+    }
+
+    void onRemoteIceCandidate(std::shared_ptr<artc::IceCandText> cand)
+    {
+        if (!mHasRemoteSdp)
+        {
+            mPendingCandidates.push_back(cand);
+            return;
+        }
+
+        std::unique_ptr<webrtc::IceCandidateInterface> candidate(cand->createObject());
+        if (!mRtcConn->AddIceCandidate(candidate.get()))
+        {
+            fail("Error adding ICE candidate");
+        }
+    }
+
+    void setHasRemoteSdp()
+    {
+        mHasRemoteSdp = true;
+        auto pending = std::move(mPendingCandidates);
+        for (auto& cand: pending)
+        {
+            onRemoteIceCandidate(cand);
+        }
+    }
+
+    void fail(const std::string& msg)
+    {
+        if (mClosed)
+            return; //the pending operations fail once the connection is closed
+
+        printf("%s: %s\n", mName.c_str(), msg.c_str());
+        mFailed = true;
+    }
+
+    //myPeerConnection events
+    void onIceCandidate(std::shared_ptr<artc::IceCandText> cand)
+    {
+        if (!cand)
+            return;
+        mRelay.send(cand->candidate.size() + cand->sdpMid.size() + 4, [this, cand]() { mRemote->onRemoteIceCandidate(cand); });
+    }
+    void onIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState state)
+    {
+        if (!mIceConnected && (state == webrtc::PeerConnectionInterface::kIceConnectionConnected
+                               || state == webrtc::PeerConnectionInterface::kIceConnectionCompleted))
+        {
+            mIceConnected = true;
+            mIceConnectedTs = Clock::now();
+        }
+        else if (state == webrtc::PeerConnectionInterface::kIceConnectionFailed)
+        {
+            fail("ICE connection failed");
+        }
+    }
+    void onTrack(rtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver)
+    {
+        if (transceiver->media_type() == cricket::MEDIA_TYPE_VIDEO)
+        {
+            auto track = transceiver->receiver()->track();
+            mPlayer->attachVideo(static_cast<webrtc::VideoTrackInterface*>(track.get()));
+        }
+    }
+    void onAddStream(artc::tspMediaStream /*stream*/) {}
+    void onRemoveStream(artc::tspMediaStream /*stream*/) {}
+    void onIceComplete() {}
+    void onSignalingChange(webrtc::PeerConnectionInterface::SignalingState /*state*/) {}
+    void onRenegotiationNeeded() {}
+    void onDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> /*channel*/) {}
+    void onError() { fail("PeerConnection error"); }
+};
+
+static void printPlayerStats(const LoopbackPeer& peer, const char* renderer, double seconds)
+{
+    TimedPlayer& player = *peer.mPlayer;
+    uint32_t frames = player.mFrames;
+    long convAvg = 0;
+    long convMax = 0;
+    player.takeConversionStats(convAvg, convMax);
+    printf("%s (%s renderer):\n", peer.mName.c_str(), renderer);
+    printf("    ICE connected after %.1f ms\n", msSince(peer.mStartTs, peer.mIceConnectedTs));
+    printf("    %.1f frames/s rendered\n", frames / seconds);
+    if (frames)
+    {
+        printf("    StreamPlayer::OnFrame: %.0f us/frame, %.0f us CPU/frame on the decoder thread\n",
+               (double)player.mWallUs / frames, (double)player.mCpuUs / frames);
+        printf("    rotation and conversion: %ld us/frame on average, %ld us max\n", convAvg, convMax);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int seconds = (argc > 1) ? atoi(argv[1]) : 10;
+    int relayDelayMs = (argc > 2) ? atoi(argv[2]) : 0;
+
+    MessageLoop loop;
+    megaPostMessageToGui = MessageLoop::post;
+    artc::init(&loop);
+
+    int result = 0;
+    {
+        LoopbackRelay relay(loop, relayDelayMs);
+        BitmapRenderer bitmapRenderer;
+        ReceiverRenderer receiverRenderer;
+        LoopbackPeer caller("caller", loop, relay, &bitmapRenderer);
+        LoopbackPeer callee("callee", loop, relay, &receiverRenderer);
+        caller.mRemote = &callee;
+        callee.mRemote = &caller;
+
+        auto startTs = Clock::now();
+        caller.start(startTs);
+        callee.start(startTs);
+        caller.call();
+
+        bool connected = loop.runUntil([&]()
+        {
+            return caller.mFailed || callee.mFailed
+                    || (caller.mIceConnected && callee.mIceConnected
+                        && bitmapRenderer.mFrames && receiverRenderer.mFrames);
+        }, 20000);
+
+        if (!connected || caller.mFailed || callee.mFailed)
+        {
+            printf("Call setup failed\n");
+            result = 1;
+        }
+        else
+        {
+            printf("Call setup: %zu signalling messages, %zu bytes relayed with %d ms delay\n",
+                   relay.messages(), relay.bytes(), relayDelayMs);
+            printf("    SDP offer->answer: %.1f ms\n", msSince(startTs, caller.mAnswerTs));
+            printf("    first frames rendered after %.1f ms\n", msSince(startTs));
+
+            //measure the steady state
+            caller.mPlayer->reset();
+            callee.mPlayer->reset();
+            int64_t cpuStart = processCpuUs();
+            auto measureStart = Clock::now();
+            loop.runUntil([&]() { return caller.mFailed || callee.mFailed; }, seconds * 1000);
+            double elapsed = msSince(measureStart) / 1000.0;
+            int64_t cpu = processCpuUs() - cpuStart;
+            uint32_t frames = caller.mPlayer->mFrames + callee.mPlayer->mFrames;
+
+            printPlayerStats(caller, "bitmap", elapsed);
+            printPlayerStats(callee, "MegaChatVideoReceiver-like", elapsed);
+            printf("Process CPU: %.1f%% of a core, %.0f us per rendered frame (including encoding and decoding)\n",
+                   cpu / (elapsed * 10000.0), frames ? (double)cpu / frames : 0.0);
+            if (!frames || caller.mFailed || callee.mFailed)
+            {
+                result = 1;
+            }
+        }
+
+        // process the messages posted while closing the connections, while the peers still exist
+        relay.close();
+        caller.close();
+        callee.close();
+        loop.runUntil([]() { return false; }, 200);
+    }
+
+    artc::cleanup();
+    return result;
+}
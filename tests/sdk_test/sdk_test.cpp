@@ -5,6 +5,8 @@
 #include "../../src/megachatapi.h"
 #include "../../src/karereCommon.h" // for logging with karere facility
 
+#include <chrono>
+#include <algorithm>
 #include <signal.h>
 #include <stdio.h>
 #include <time.h>
@@ -41,6 +43,8 @@ int main(int argc, char **argv)
     EXECUTE_TEST(t.TEST_SetOnlineStatus(0), "TEST Online status");
     EXECUTE_TEST(t.TEST_GetChatRoomsAndMessages(0), "TEST Load chatrooms & messages");
     EXECUTE_TEST(t.TEST_EditAndDeleteMessages(0, 1), "TEST Edit & delete messages");
+    EXECUTE_TEST(t.TEST_ResidentMessages(0, 1), "TEST Resident messages");
+    EXECUTE_TEST(t.TEST_ImportMessages(0, 1), "TEST Import messages");
     EXECUTE_TEST(t.TEST_SwitchAccounts(0, 1), "TEST Switch accounts");
     EXECUTE_TEST(t.TEST_ResumeSession(0), "TEST Resume session");
     EXECUTE_TEST(t.TEST_Attachment(0, 1), "TEST Attachments");
@@ -55,6 +59,16 @@ int main(int argc, char **argv)
     EXECUTE_TEST(t.TEST_Calls(0, 1), "TEST Signalling calls");
 #endif
 
+    // The tests below are benchmarks. They are slow and their results depend on the timing,
+    // so they only run when the environment variable MEGACHAT_RUN_BENCHMARKS is set
+    if (getenv("MEGACHAT_RUN_BENCHMARKS"))
+    {
+        EXECUTE_TEST(t.TEST_LoadHistoryBenchmark(0), "TEST Load history benchmark");
+#ifndef KARERE_DISABLE_WEBRTC
+        EXECUTE_TEST(t.TEST_CallLoopLatency(0, 1), "TEST Event loop latency during a call");
+#endif
+    }
+
     // The tests below are manual tests. They require the call to be answered from another client
 //    EXECUTE_TEST(t.TEST_ManualCalls(0, 1), "TEST Manual Calls");
 //    EXECUTE_TEST(t.TEST_ManualGroupCalls(0, <name_of_groupchat>), "TEST Manual Calls");
@@ -1115,6 +1129,208 @@ void MegaChatApiTest::TEST_EditAndDeleteMessages(unsigned int a1, unsigned int a
     secondarySession = NULL;
 }
 
+/**
+ * @brief TEST_ResidentMessages
+ *
+ * Requirements:
+ * - Both accounts should be conctacts
+ * - The 1on1 chatroom between them should exist
+ * (if not accomplished, the test automatically solves the above)
+ *
+ * This test does the following:
+ *
+ * - Load the whole history, and send messages until it's larger than a page of the resident window
+ * - Add a reaction to the oldest message
+ * - Limit the messages in RAM and reopen the chatroom, so the oldest messages are dropped from RAM
+ * + Get the oldest message (it's loaded from the local cache, with its reactions)
+ * + Load the whole history again (dropped messages are loaded from the local cache, without gaps)
+ *
+ */
+void MegaChatApiTest::TEST_ResidentMessages(unsigned int a1, unsigned int a2)
+{
+    const int maxResidentMsgs = 16;
+    const int minHistorySize = maxResidentMsgs + 256 + 16;    // 256 is the page size of the resident window
+
+    char *primarySession = login(a1);
+    char *secondarySession = login(a2);
+
+    MegaUser *user = megaApi[a1]->getContact(mAccounts[a2].getEmail().c_str());
+    if (!user || user->getVisibility() != MegaUser::VISIBILITY_VISIBLE)
+    {
+        makeContact(a1, a2);
+    }
+    delete user;
+    user = NULL;
+
+    MegaChatHandle chatid = getPeerToPeerChatRoom(a1, a2);
+
+    TestChatRoomListener *chatroomListener = new TestChatRoomListener(this, megaChatApi, chatid);
+    ASSERT_CHAT_TEST(megaChatApi[a1]->openChatRoom(chatid, chatroomListener), "Can't open chatRoom account " + std::to_string(a1+1));
+
+    // Load the whole history, so the oldest message is known
+    chatroomListener->clearMessages(a1);
+    int historySize = loadHistory(a1, chatid, chatroomListener);
+    MegaChatHandle oldestMsgId = historySize ? chatroomListener->msgId[a1].back() : MEGACHAT_INVALID_HANDLE;
+
+    // Send messages until the history is large enough to drop a page from RAM
+    while (historySize < minHistorySize)
+    {
+        bool *msgConfirmed = &chatroomListener->msgConfirmed[a1]; *msgConfirmed = false;
+        std::string messageToSend = "Resident messages test " + std::to_string(historySize);
+        MegaChatMessage *msgSent = megaChatApi[a1]->sendMessage(chatid, messageToSend.c_str());
+        ASSERT_CHAT_TEST(msgSent, "Failed to send message");
+        delete msgSent; msgSent = NULL;
+        ASSERT_CHAT_TEST(waitForResponse(msgConfirmed), "Timeout expired for receiving confirmation by server");
+        if (oldestMsgId == MEGACHAT_INVALID_HANDLE)
+        {
+            oldestMsgId = chatroomListener->mConfirmedMessageHandle[a1];
+        }
+        historySize++;
+    }
+
+    MegaChatMessage *oldestMsg = megaChatApi[a1]->getMessage(chatid, oldestMsgId);
+    ASSERT_CHAT_TEST(oldestMsg, "Failed to get the oldest message from RAM");
+
+    // Add a reaction to the oldest message (it may have it from a previous run)
+    bool *reactionReceived = &chatroomListener->reactionReceived[a1]; *reactionReceived = false;
+    TestMegaChatRequestListener requestListener(nullptr, megaChatApi[a1]);
+    megaChatApi[a1]->addReaction(chatid, oldestMsgId, "😰", &requestListener);
+    ASSERT_CHAT_TEST(requestListener.waitForResponse(), "Timeout expired for add reaction");
+    ASSERT_CHAT_TEST(requestListener.getErrorCode() == MegaChatError::ERROR_OK || requestListener.getErrorCode() == MegaChatError::ERROR_EXIST,
+                     "addReaction: Unexpected error adding reaction. Error:" + std::string(std::to_string(requestListener.getErrorCode())));
+    if (requestListener.getErrorCode() == MegaChatError::ERROR_OK)
+    {
+        ASSERT_CHAT_TEST(waitForResponse(reactionReceived), "Timeout expired for receiving reaction update");
+    }
+    ASSERT_CHAT_TEST(megaChatApi[a1]->getMessageReactionCount(chatid, oldestMsgId, "😰") > 0, "The oldest message doesn't have the reaction");
+
+    // Reopening the chatroom ends the current history load, so the oldest messages can be dropped
+    megaChatApi[a1]->closeChatRoom(chatid, chatroomListener);
+    megaChatApi[a1]->setMaxResidentMessages(maxResidentMsgs);
+    ASSERT_CHAT_TEST(megaChatApi[a1]->openChatRoom(chatid, chatroomListener), "Can't open chatRoom account " + std::to_string(a1+1));
+    sleep(1);   // messages are dropped asynchronously
+
+    MegaChatMessage *evictedMsg = megaChatApi[a1]->getMessage(chatid, oldestMsgId);
+    ASSERT_CHAT_TEST(evictedMsg, "Failed to get the oldest message after dropping it from RAM");
+    ASSERT_CHAT_TEST(evictedMsg->getMsgIndex() == oldestMsg->getMsgIndex(), "Index of the oldest message doesn't match");
+    ASSERT_CHAT_TEST(evictedMsg->getType() == oldestMsg->getType(), "Type of the oldest message doesn't match");
+    ASSERT_CHAT_TEST(evictedMsg->getStatus() == oldestMsg->getStatus(), "Status of the oldest message doesn't match");
+    std::string oldestContent = oldestMsg->getContent() ? oldestMsg->getContent() : "";
+    std::string evictedContent = evictedMsg->getContent() ? evictedMsg->getContent() : "";
+    ASSERT_CHAT_TEST(oldestContent == evictedContent, "Content of the oldest message doesn't match");
+    ASSERT_CHAT_TEST(evictedMsg->hasConfirmedReactions(), "Reactions of the oldest message were not loaded from the local cache");
+    delete evictedMsg; evictedMsg = NULL;
+    delete oldestMsg; oldestMsg = NULL;
+
+    // Dropped messages are loaded again from the local cache
+    chatroomListener->clearMessages(a1);
+    int reloadedSize = loadHistory(a1, chatid, chatroomListener);
+    ASSERT_CHAT_TEST(reloadedSize == historySize, "Wrong number of messages after dropping them from RAM. Loaded: "
+                     + std::to_string(reloadedSize) + " Expected: " + std::to_string(historySize));
+    ASSERT_CHAT_TEST(chatroomListener->msgId[a1].back() == oldestMsgId, "The oldest message is not the last one loaded");
+    ASSERT_CHAT_TEST(megaChatApi[a1]->getMessageReactionCount(chatid, oldestMsgId, "😰") > 0, "Reaction of the oldest message lost after dropping it from RAM");
+
+    megaChatApi[a1]->setMaxResidentMessages(0);
+    megaChatApi[a1]->closeChatRoom(chatid, chatroomListener);
+    delete chatroomListener;
+
+    delete [] primarySession;
+    primarySession = NULL;
+    delete [] secondarySession;
+    secondarySession = NULL;
+}
+
+/**
+ * @brief TEST_ImportMessages
+ *
+ * Requirements:
+ * - Both accounts should be conctacts
+ * - The 1on1 chatroom between them should exist
+ * (if not accomplished, the test automatically solves the above)
+ *
+ * This test does the following:
+ *
+ * - Keep a copy of the app's DB, before the messages received by the NSE
+ * - Send more messages than a batch of the import, and keep a copy of the DB as the NSE's DB
+ * - Restore the app's DB and import the NSE's DB offline, keeping a copy of the app's DB after the first batch
+ * - Restore the copy taken after the first batch, as if the app had been killed then, and import again
+ * + The import resumes from the checkpoint: only the messages that the first batch didn't import are imported
+ * + A new import has nothing left to import
+ *
+ */
+void MegaChatApiTest::TEST_ImportMessages(unsigned int a1, unsigned int a2)
+{
+    const int messagesToSend = 256 + 16;    // more than a batch of the import (MessageImporter::kBatchSize)
+
+    char *primarySession = login(a1);
+    char *secondarySession = login(a2);
+
+    MegaUser *user = megaApi[a1]->getContact(mAccounts[a2].getEmail().c_str());
+    if (!user || user->getVisibility() != MegaUser::VISIBILITY_VISIBLE)
+    {
+        makeContact(a1, a2);
+    }
+    delete user;
+    user = NULL;
+
+    MegaChatHandle chatid = getPeerToPeerChatRoom(a1, a2);
+
+    std::string dbPath = chatDbPath(primarySession);
+    std::string appDbPath = LOCAL_PATH + "/import_app.db";
+    std::string externalDbPath = LOCAL_PATH + "/import_external.db";
+    std::string interruptedDbPath = LOCAL_PATH + "/import_interrupted.db";
+
+    // The app's DB, with the history known before the NSE receives new messages
+    TestChatRoomListener *chatroomListener = new TestChatRoomListener(this, megaChatApi, chatid);
+    ASSERT_CHAT_TEST(megaChatApi[a1]->openChatRoom(chatid, chatroomListener), "Can't open chatRoom account " + std::to_string(a1+1));
+    loadHistory(a1, chatid, chatroomListener);
+    megaChatApi[a1]->closeChatRoom(chatid, chatroomListener);
+    logout(a1, false);
+    copyChatDb(dbPath, appDbPath);
+
+    // The NSE's DB, with the new messages
+    char *session = login(a1, primarySession);
+    delete [] primarySession;
+    primarySession = session;
+    ASSERT_CHAT_TEST(megaChatApi[a1]->openChatRoom(chatid, chatroomListener), "Can't open chatRoom account " + std::to_string(a1+1));
+    for (int i = 0; i < messagesToSend; i++)
+    {
+        bool *msgConfirmed = &chatroomListener->msgConfirmed[a1]; *msgConfirmed = false;
+        std::string messageToSend = "Import messages test " + std::to_string(i);
+        MegaChatMessage *msgSent = megaChatApi[a1]->sendMessage(chatid, messageToSend.c_str());
+        ASSERT_CHAT_TEST(msgSent, "Failed to send message");
+        delete msgSent; msgSent = NULL;
+        ASSERT_CHAT_TEST(waitForResponse(msgConfirmed), "Timeout expired for receiving confirmation by server");
+    }
+    megaChatApi[a1]->closeChatRoom(chatid, chatroomListener);
+    delete chatroomListener;
+    logout(a1, false);
+    copyChatDb(dbPath, externalDbPath);
+
+    // Import into the app's DB, keeping a copy of it after the first batch
+    TestImportMessagesListener importListener(megaChatApi[a1], dbPath, interruptedDbPath);
+    long long total = importMessagesOffline(a1, primarySession, appDbPath, externalDbPath, importListener);
+    ASSERT_CHAT_TEST(total >= messagesToSend, "Wrong number of messages imported: " + std::to_string(total));
+    long long firstBatch = importListener.mFirstBatchCount;
+    ASSERT_CHAT_TEST(firstBatch > 0 && firstBatch < total, "Wrong number of messages imported by the first batch: " + std::to_string(firstBatch));
+
+    // The app is killed after the first batch: the import resumes from its checkpoint
+    TestImportMessagesListener resumeListener(megaChatApi[a1], dbPath, LOCAL_PATH + "/import_resumed.db");
+    long long resumed = importMessagesOffline(a1, primarySession, interruptedDbPath, externalDbPath, resumeListener);
+    ASSERT_CHAT_TEST(resumed == total - firstBatch, "Wrong number of messages imported by the resumed import: " + std::to_string(resumed)
+                     + " Expected: " + std::to_string(total - firstBatch));
+
+    // Once finished, there is nothing left to import
+    TestImportMessagesListener finalListener(megaChatApi[a1], dbPath, LOCAL_PATH + "/import_final.db");
+    long long pending = importMessagesOffline(a1, primarySession, dbPath, externalDbPath, finalListener);
+    ASSERT_CHAT_TEST(pending == 0, "Messages imported again after the import finished: " + std::to_string(pending));
+
+    delete [] primarySession;
+    primarySession = NULL;
+    delete [] secondarySession;
+    secondarySession = NULL;
+}
+
 /**
  * @brief TEST_GroupChatManagement
  *
@@ -3512,6 +3728,113 @@ void MegaChatApiTest::TEST_ManualGroupCalls(unsigned int a1, const std::string&
     primarySession = NULL;
 }
 
+/**
+ * @brief TEST_CallLoopLatency
+ *
+ * Requirements:
+ *      - Both accounts should be conctacts
+ * (if not accomplished, the test automatically solves them)
+ *
+ * This test does the following:
+ * - Measure the latency of the karere event loop of A while idle
+ * - A calls B with video, B answers with video. Both peers run in this process,
+ * so the media flows through the loopback
+ * - Measure the latency of the karere event loop of A while the call is in progress
+ * - A hangs up the call
+ *
+ * Latencies are reported in the log. Media, codecs and stats run in the
+ * webrtc network and worker threads, so they should barely affect the karere loop.
+ */
+void MegaChatApiTest::TEST_CallLoopLatency(unsigned int a1, unsigned int a2)
+{
+    const int numProbes = 200;
+    char *primarySession = login(a1);
+    char *secondarySession = login(a2);
+
+    MegaUser *user = megaApi[a1]->getContact(mAccounts[a2].getEmail().c_str());
+    if (!user || user->getVisibility() != MegaUser::VISIBILITY_VISIBLE)
+    {
+        makeContact(a1, a2);
+    }
+    delete user;
+
+    MegaChatHandle chatid = getPeerToPeerChatRoom(a1, a2);
+
+    TestChatRoomListener *chatroomListener = new TestChatRoomListener(this, megaChatApi, chatid);
+    ASSERT_CHAT_TEST(megaChatApi[a1]->openChatRoom(chatid, chatroomListener), "Can't open chatRoom account 1");
+    ASSERT_CHAT_TEST(megaChatApi[a2]->openChatRoom(chatid, chatroomListener), "Can't open chatRoom account 2");
+    loadHistory(a1, chatid, chatroomListener);
+    loadHistory(a2, chatid, chatroomListener);
+
+    for (unsigned int i : {a1, a2})
+    {
+        bool *audioVideoDeviceListLoaded = &requestFlagsChat[i][MegaChatRequest::TYPE_LOAD_AUDIO_VIDEO_DEVICES]; *audioVideoDeviceListLoaded = false;
+        megaChatApi[i]->loadAudioVideoDeviceList();
+        ASSERT_CHAT_TEST(waitForResponse(audioVideoDeviceListLoaded), "Timeout expired for load audio video devices in account " + std::to_string(i+1));
+        ASSERT_CHAT_TEST(!lastErrorChat[i], "Failed to load Devide list account " + std::to_string(i+1) + ": " + std::to_string(lastErrorChat[i]));
+        mLocalVideoListener[i] = new TestChatVideoListener();
+        megaChatApi[i]->addChatLocalVideoListener(chatid, mLocalVideoListener[i]);
+    }
+
+    LoopLatencyProbe probe;
+    std::vector<long long> idleLatencies = probe.measure(megaChatApi[a1], numProbes);
+    ASSERT_CHAT_TEST(idleLatencies.size() == static_cast<size_t>(numProbes), "Timeout expired for event loop probes while idle");
+
+    // A calls B with video and B answers with video
+    bool *flagStartCall = &requestFlagsChat[a1][MegaChatRequest::TYPE_START_CHAT_CALL]; *flagStartCall = false;
+    bool *callReceived = &mCallReceived[a2]; *callReceived = false;
+    bool *callAnswered = &mCallAnswered[a1]; *callAnswered = false;
+    mChatIdRingInCall[a2] = MEGACHAT_INVALID_HANDLE;
+    megaChatApi[a1]->startChatCall(chatid, true);
+    ASSERT_CHAT_TEST(waitForResponse(flagStartCall), "Timeout after start chat call " + std::to_string(maxTimeout) + " seconds");
+    ASSERT_CHAT_TEST(!lastErrorChat[a1], "Failed to start chat call: " + std::to_string(lastErrorChat[a1]));
+    ASSERT_CHAT_TEST(waitForResponse(callReceived), "Timeout expired for receiving a call");
+    ASSERT_CHAT_TEST(mChatIdRingInCall[a2] == chatid, "Incorrect chat id at call receptor");
+
+    bool *flagAnswerCall = &requestFlagsChat[a2][MegaChatRequest::TYPE_ANSWER_CHAT_CALL]; *flagAnswerCall = false;
+    megaChatApi[a2]->answerChatCall(chatid, true);
+    ASSERT_CHAT_TEST(waitForResponse(flagAnswerCall), "Timeout after answer chat call " + std::to_string(maxTimeout) + " seconds");
+    ASSERT_CHAT_TEST(!lastErrorChat[a2], "Failed to answer chat call: " + std::to_string(lastErrorChat[a2]));
+    ASSERT_CHAT_TEST(waitForResponse(callAnswered), "Timeout expired for the call to be in progress");
+
+    sleep(5);   // let the media flow
+
+    std::vector<long long> callLatencies = probe.measure(megaChatApi[a1], numProbes);
+    ASSERT_CHAT_TEST(callLatencies.size() == static_cast<size_t>(numProbes), "Timeout expired for event loop probes during the call");
+
+    bool *callDestroyed0 = &mCallDestroyed[a1]; *callDestroyed0 = false;
+    bool *callDestroyed1 = &mCallDestroyed[a2]; *callDestroyed1 = false;
+    megaChatApi[a1]->hangChatCall(chatid);
+    ASSERT_CHAT_TEST(waitForResponse(callDestroyed0), "The call has to be finished account 1");
+    ASSERT_CHAT_TEST(waitForResponse(callDestroyed1), "The call has to be finished account 2");
+
+    std::stringstream buffer;
+    buffer << "Event loop latency (us) idle: p50 " << idleLatencies[numProbes / 2]
+           << ", p99 " << idleLatencies[numProbes * 99 / 100]
+           << ", max " << idleLatencies.back()
+           << " / during a video call: p50 " << callLatencies[numProbes / 2]
+           << ", p99 " << callLatencies[numProbes * 99 / 100]
+           << ", max " << callLatencies.back() << endl;
+    postLog(buffer.str());
+    std::cout << buffer.str();
+
+    for (unsigned int i : {a1, a2})
+    {
+        megaChatApi[i]->removeChatLocalVideoListener(chatid, mLocalVideoListener[i]);
+        delete mLocalVideoListener[i];
+        mLocalVideoListener[i] = NULL;
+        megaChatApi[i]->closeChatRoom(chatid, chatroomListener);
+    }
+
+    delete chatroomListener;
+    chatroomListener = NULL;
+
+    delete [] primarySession;
+    primarySession = NULL;
+    delete [] secondarySession;
+    secondarySession = NULL;
+}
+
 #endif
 
 /**
@@ -3685,6 +4008,74 @@ void MegaChatApiTest::initChat(unsigned int a1, unsigned int a2, MegaUser*& user
     loadHistory(a2, chatid, chatroomListener);
 }
 
+/**
+ * @brief TEST_LoadHistoryBenchmark
+ *
+ * Requirements:
+ * - The account should have at least one chatroom with history (the longer, the better)
+ *
+ * This test does the following:
+ *
+ * - Open every chatroom and load up to 10k messages, from server or local cache
+ * - Close and reopen it, and load the same messages again from the local cache
+ * + Log the time taken and the throughput of each load, in messages per second
+ *
+ */
+void MegaChatApiTest::TEST_LoadHistoryBenchmark(unsigned int accountIndex)
+{
+    const int maxMessages = 10000;
+    char *session = login(accountIndex);
+
+    MegaChatRoomList *chats = megaChatApi[accountIndex]->getChatRooms();
+    for (int i = 0; i < chats->size(); i++)
+    {
+        MegaChatHandle chatid = chats->get(i)->getChatId();
+        const char *hstr = MegaApi::userHandleToBase64(chatid);
+        std::string chatidB64(hstr);
+        delete [] hstr;
+
+        for (int pass = 0; pass < 2; pass++)
+        {
+            BenchmarkChatRoomListener chatroomListener;
+            ASSERT_CHAT_TEST(megaChatApi[accountIndex]->openChatRoom(chatid, &chatroomListener), "Can't open chatRoom " + chatidB64);
+
+            bool *flagChatdOnline = &mChatConnectionOnline[accountIndex]; *flagChatdOnline = false;
+            while (megaChatApi[accountIndex]->getChatConnectionState(chatid) != MegaChatApi::CHAT_CONNECTION_ONLINE)
+            {
+                ASSERT_CHAT_TEST(waitForResponse(flagChatdOnline), "Timeout expired for connecting to chatd");
+                *flagChatdOnline = false;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            while (chatroomListener.msgCount < maxMessages)
+            {
+                chatroomListener.historyLoaded = false;
+                int source = megaChatApi[accountIndex]->loadMessages(chatid, 256);
+                if (source == MegaChatApi::SOURCE_NONE || source == MegaChatApi::SOURCE_ERROR)
+                {
+                    break;
+                }
+                ASSERT_CHAT_TEST(waitForResponse(&chatroomListener.historyLoaded), "Timeout expired for loading history from chat: " + chatidB64);
+            }
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            megaChatApi[accountIndex]->closeChatRoom(chatid, &chatroomListener);
+
+            std::stringstream buffer;
+            buffer << "Chat " << chatidB64 << ": loaded " << chatroomListener.msgCount << " messages "
+                   << (pass ? "from local cache" : "from server/cache") << " in " << elapsed << " us ("
+                   << (elapsed ? chatroomListener.msgCount * 1000000.0 / elapsed : 0) << " msg/s)" << endl;
+            postLog(buffer.str());
+            std::cout << buffer.str();
+        }
+    }
+
+    delete chats;
+    chats = NULL;
+
+    delete [] session;
+    session = NULL;
+}
+
 int MegaChatApiTest::loadHistory(unsigned int accountIndex, MegaChatHandle chatid, TestChatRoomListener *chatroomListener)
 {
     // first of all, ensure the chatd connection is ready
@@ -4242,6 +4633,64 @@ void MegaChatApiTest::getContactRequest(unsigned int accountIndex, bool outgoing
     delete crl;
 }
 
+void MegaChatApiTest::copyChatDb(const std::string &from, const std::string &to)
+{
+    // the shared-memory index is rebuilt from the log when the copy is opened
+    remove((to + "-shm").c_str());
+
+    const char *suffixes[] = { "", "-wal" };
+    for (const char *suffix : suffixes)
+    {
+        std::ifstream src(from + suffix, std::ios::binary);
+        if (!src)
+        {
+            remove((to + suffix).c_str());
+            continue;
+        }
+
+        std::ofstream dst(to + suffix, std::ios::binary | std::ios::trunc);
+        dst << src.rdbuf();
+    }
+}
+
+std::string MegaChatApiTest::chatDbPath(const char *session)
+{
+    // the same path as karere::Client::dbPath(), in the base path of the MegaApi
+    char path[1024];
+    getcwd(path, sizeof path);
+    return std::string(path) + "/karere-" + (session + 44) + ".db";
+}
+
+long long MegaChatApiTest::importMessagesOffline(unsigned int accountIndex, const char *session, const std::string &appDbPath,
+                                                 const std::string &externalDbPath, TestImportMessagesListener &listener)
+{
+    std::string dbPath = chatDbPath(session);
+    if (appDbPath != dbPath)
+    {
+        copyChatDb(appDbPath, dbPath);
+    }
+
+    // resume the session offline, as the app does while the NSE's messages are imported
+    bool *flagInit = &initStateChanged[accountIndex]; *flagInit = false;
+    megaChatApi[accountIndex]->init(session);
+    MegaApi::removeLoggerObject(logger);
+    ASSERT_CHAT_TEST(waitForResponse(flagInit), "Expired timeout for initialization");
+    int initStateValue = initState[accountIndex];
+    ASSERT_CHAT_TEST(initStateValue == MegaChatApi::INIT_OFFLINE_SESSION,
+                     "Wrong chat initialization state. Expected: " + std::to_string(MegaChatApi::INIT_OFFLINE_SESSION) + "   Received: " + std::to_string(initStateValue));
+
+    megaChatApi[accountIndex]->importMessages(externalDbPath.c_str(), &listener);
+    ASSERT_CHAT_TEST(listener.waitForResponse(), "Timeout expired for import messages");
+    ASSERT_CHAT_TEST(listener.getErrorCode() == MegaChatError::ERROR_OK, "importMessages: Unexpected error. Error:" + std::to_string(listener.getErrorCode()));
+    long long count = listener.getMegaChatRequest()->getNumber();
+
+    bool *flagRequestLogoutChat = &requestFlagsChat[accountIndex][MegaChatRequest::TYPE_LOGOUT]; *flagRequestLogoutChat = false;
+    megaChatApi[accountIndex]->localLogout();
+    ASSERT_CHAT_TEST(waitForResponse(flagRequestLogoutChat), "Expired timeout for chat logout");
+    MegaApi::addLoggerObject(logger);   // need to restore customized logger
+    return count;
+}
+
 int MegaChatApiTest::purgeLocalTree(const std::string &path)
 {
     DIR *directory = opendir(path.c_str());
@@ -4753,6 +5202,56 @@ void TestChatRoomListener::onChatRoomUpdate(MegaChatApi *api, MegaChatRoom *chat
     chatUpdated[apiIndex] = chat->getChatId();
 }
 
+void BenchmarkChatRoomListener::onMessageLoaded(MegaChatApi *, MegaChatMessage *msg)
+{
+    if (!msg)
+    {
+        historyLoaded = true;
+        return;
+    }
+
+    msgCount++;
+    if (msgCount <= kRenderedRows)
+    {
+        const char *content = msg->getContent();
+        contentSize += content ? strlen(content) : 0;
+        if (msg->getType() == MegaChatMessage::TYPE_NODE_ATTACHMENT && msg->getMegaNodeList())
+        {
+            contentSize += msg->getMegaNodeList()->size();
+        }
+    }
+}
+
+std::vector<long long> LoopLatencyProbe::measure(MegaChatApi *api, int count)
+{
+    std::vector<long long> latencies;
+    for (int i = 0; i < count; i++)
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mFinished = false;
+        auto start = std::chrono::steady_clock::now();
+        // own firstname is served from the attribute cache, without any network access
+        api->getUserFirstname(api->getMyUserHandle(), NULL, this);
+        if (!mCondVar.wait_for(lock, std::chrono::seconds(10), [this]() { return mFinished; }))
+        {
+            break;
+        }
+        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        lock.unlock();
+        usleep(20000);  // sample along the call, not in a burst
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    return latencies;
+}
+
+void LoopLatencyProbe::onRequestFinish(MegaChatApi *, MegaChatRequest *, MegaChatError *)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mFinished = true;
+    mCondVar.notify_one();
+}
+
 void TestChatRoomListener::onMessageLoaded(MegaChatApi *api, MegaChatMessage *msg)
 {
     unsigned int apiIndex = getMegaChatApiIndex(api);
@@ -5134,6 +5633,21 @@ MegaChatRequest *TestMegaChatRequestListener::getMegaChatRequest() const
     return mRequest;
 }
 
+TestImportMessagesListener::TestImportMessagesListener(MegaChatApi *megaChatApi, const std::string &dbPath, const std::string &snapshotPath)
+    : TestMegaChatRequestListener(nullptr, megaChatApi), mDbPath(dbPath), mSnapshotPath(snapshotPath)
+{
+}
+
+void TestImportMessagesListener::onRequestUpdate(MegaChatApi *, MegaChatRequest *request)
+{
+    if (mFirstBatchCount < 0)
+    {
+        // the batch has been committed, and the next one hasn't started yet
+        MegaChatApiTest::copyChatDb(mDbPath, mSnapshotPath);
+        mFirstBatchCount = request->getNumber();
+    }
+}
+
 bool RequestListener::waitForResponse(unsigned int timeout)
 {
     assert(!mFinished);
@@ -28,6 +28,9 @@
 
 #include <iostream>
 #include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 
 static const std::string APPLICATION_KEY = "MBoVFSyZ";
 static const std::string USER_AGENT_DESCRIPTION  = "MEGAChatTest";
@@ -189,6 +192,20 @@ private:
     megachat::MegaChatError *mError = nullptr;
 };
 
+// Copies the app's DB after the first batch of an import, as it would be if the app was killed then
+class TestImportMessagesListener : public TestMegaChatRequestListener
+{
+public:
+    TestImportMessagesListener(megachat::MegaChatApi *megaChatApi, const std::string &dbPath, const std::string &snapshotPath);
+    void onRequestUpdate(megachat::MegaChatApi *api, megachat::MegaChatRequest *request) override;
+
+    long long mFirstBatchCount = -1;    // messages imported by the first batch, -1 if no batch has finished
+
+private:
+    std::string mDbPath;
+    std::string mSnapshotPath;
+};
+
 class MegaChatApiTest :
         public ::mega::MegaListener,
         public ::mega::MegaRequestListener,
@@ -239,21 +256,28 @@ public:
     void TEST_LastMessage(unsigned int a1, unsigned int a2);
     void TEST_GroupLastMessage(unsigned int a1, unsigned int a2);
     void TEST_RetentionHistory(unsigned int a1, unsigned int a2);
+    void TEST_ResidentMessages(unsigned int a1, unsigned int a2);
+    void TEST_ImportMessages(unsigned int a1, unsigned int a2);
     void TEST_ChangeMyOwnName(unsigned int a1);
 #ifndef KARERE_DISABLE_WEBRTC
     void TEST_Calls(unsigned int a1, unsigned int a2);
     void TEST_ManualCalls(unsigned int a1, unsigned int a2);
     void TEST_ManualGroupCalls(unsigned int a1, const std::string& chatRoomName);
+    void TEST_CallLoopLatency(unsigned int a1, unsigned int a2);
 #endif
 
     void TEST_RichLinkUserAttribute(unsigned int a1);
     void TEST_SendRichLink(unsigned int a1, unsigned int a2);
     void TEST_SendGiphy(unsigned int a1, unsigned int a2);
+    void TEST_LoadHistoryBenchmark(unsigned int accountIndex);
 
     unsigned mOKTests = 0;
     unsigned mFailedTests = 0;
     bool testHasFailed = false;
 
+    // copies a karere DB, with its write-ahead log, so the copy has all the committed changes
+    static void copyChatDb(const std::string& from, const std::string& to);
+
 private:
     void initChat(unsigned int a1, unsigned int a2, mega::MegaUser*& user, megachat::MegaChatHandle& chatid, char*& primarySession, char*& secondarySession, TestChatRoomListener*& chatroomListener);
     int loadHistory(unsigned int accountIndex, megachat::MegaChatHandle chatid, TestChatRoomListener *chatroomListener);
@@ -291,6 +315,9 @@ private:
     void getContactRequest(unsigned int accountIndex, bool outgoing, int expectedSize = 1);
 
     int purgeLocalTree(const std::string& path);
+    std::string chatDbPath(const char *session);
+    long long importMessagesOffline(unsigned int accountIndex, const char *session, const std::string &appDbPath,
+                                    const std::string &externalDbPath, TestImportMessagesListener &listener);
     void purgeCloudTree(unsigned int accountIndex, ::mega::MegaNode* node);
     void clearAndLeaveChats(unsigned int accountIndex, megachat::MegaChatHandle skipChatId =  megachat::MEGACHAT_INVALID_HANDLE);
     void removePendingContactRequest(unsigned int accountIndex);
@@ -461,7 +488,35 @@ private:
     unsigned int getMegaChatApiIndex(megachat::MegaChatApi *api);
 };
 
+// Lightweight listener for TEST_LoadHistoryBenchmark: it behaves like an app that
+// only renders the last rows of the history
+class BenchmarkChatRoomListener : public megachat::MegaChatRoomListener
+{
+public:
+    static const int kRenderedRows = 20;
+
+    bool historyLoaded = false;
+    int msgCount = 0;
+    size_t contentSize = 0;
+
+    virtual void onMessageLoaded(megachat::MegaChatApi* megaChatApi, megachat::MegaChatMessage *msg);
+};
+
+// Measures the latency of the karere event loop, as seen by the app: the time
+// between issuing a request that is completed locally and receiving its result
+class LoopLatencyProbe : public megachat::MegaChatRequestListener
+{
+public:
+    // Issues \c count requests, one at a time, and returns their latencies
+    // in microseconds, sorted in ascending order
+    std::vector<long long> measure(megachat::MegaChatApi *api, int count);
+    virtual void onRequestFinish(megachat::MegaChatApi* api, megachat::MegaChatRequest *request, megachat::MegaChatError* e);
 
+private:
+    std::mutex mMutex;
+    std::condition_variable mCondVar;
+    bool mFinished = false;
+};
 
 class MegaChatApiUnitaryTest
 {